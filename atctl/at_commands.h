@@ -0,0 +1,335 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Timeout argument meaning "the command's own, from the table below".
+static constexpr size_t AT_TIMEOUT_AUTO = 0;
+
+static constexpr size_t AT_DEFAULT_TIMEOUT_MS = 30000;
+
+
+
+enum at_command_flags : uint8_t
+{
+    AT_CMD_IDEMPOTENT   = 0x01,     // setting it again changes nothing
+    AT_CMD_UNPREFIXED   = 0x02,     // information lines carry no "+XXX:" prefix
+    AT_CMD_MULTILINE    = 0x04,     // prefixed lines may be followed by unprefixed data
+    AT_CMD_PROMPT       = 0x08,     // answered with "> ", then takes a payload
+    AT_CMD_DATA         = 0x10,     // may leave command mode (CONNECT, multiplexer)
+    AT_CMD_RAW          = 0x20,     // an information line announces raw data that follows
+    AT_CMD_SETTING      = 0x40,     // sets a mode that holds until reset
+    AT_CMD_RESET        = 0x80,     // restores defaults or restarts: settings are unknown after
+};
+
+struct at_command_info
+{
+    std::string_view    stem;       // "+CREG", or "D", "&F" for basic commands
+    std::string_view    prefix;     // of the information lines
+    uint8_t             flags;
+    uint32_t            timeout_ms; // for the final result code
+};
+
+
+
+// Maximum response times are taken from the 27.007/27.005 notes and the
+// larger of the Quectel, SIMCom and u-blox manuals. inline: one table for
+// the whole program, so entries can be compared by address.
+inline constexpr at_command_info AT_COMMANDS [] = {
+    // V.250 basic commands
+    {"A",           "",             AT_CMD_DATA,                            90000},
+    {"D",           "",             AT_CMD_DATA,                            180000},
+    {"E",           "",             AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"H",           "",             AT_CMD_IDEMPOTENT,                      90000},
+    {"I",           "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"O",           "",             AT_CMD_DATA,                            90000},
+    {"Q",           "",             AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"S",           "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"V",           "",             AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"Z",           "",             AT_CMD_IDEMPOTENT | AT_CMD_RESET,       5000},
+    {"&F",          "",             AT_CMD_IDEMPOTENT | AT_CMD_RESET,       5000},
+    {"&W",          "",             AT_CMD_IDEMPOTENT,                      5000},
+
+    // Identification, answered without a prefix
+    {"+CGMI",       "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+CGMM",       "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+CGMR",       "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+CGSN",       "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+CIMI",       "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+GMI",        "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+GMM",        "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+GMR",        "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+GSN",        "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  5000},
+    {"+CLAC",       "",             AT_CMD_IDEMPOTENT | AT_CMD_UNPREFIXED,  10000},
+    {"+CCID",       "+CCID",        AT_CMD_IDEMPOTENT,                      5000},
+    {"+CICCID",     "+ICCID",       AT_CMD_IDEMPOTENT,                      5000},
+    {"+QCCID",      "+QCCID",       AT_CMD_IDEMPOTENT,                      5000},
+    {"+CNUM",       "+CNUM",        AT_CMD_IDEMPOTENT,                      5000},
+
+    // Control and status
+    {"+CMEE",       "+CMEE",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CFUN",       "+CFUN",        AT_CMD_RESET,                           15000},
+    {"+CPIN",       "+CPIN",        0,                                      5000},
+    {"+CLCK",       "+CLCK",        0,                                      15000},
+    {"+CPAS",       "+CPAS",        AT_CMD_IDEMPOTENT,                      5000},
+    {"+CCLK",       "+CCLK",        AT_CMD_IDEMPOTENT,                      5000},
+    {"+CSQ",        "+CSQ",         AT_CMD_IDEMPOTENT,                      5000},
+    {"+CESQ",       "+CESQ",        AT_CMD_IDEMPOTENT,                      5000},
+    {"+CSIM",       "+CSIM",        0,                                      5000},
+    {"+CRSM",       "+CRSM",        0,                                      5000},
+    {"+CSCS",       "+CSCS",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+IPR",        "+IPR",         AT_CMD_IDEMPOTENT,                      5000},
+    {"+CMUX",       "+CMUX",        AT_CMD_DATA,                            5000},
+
+    // Network
+    {"+COPS",       "+COPS",        0,                                      180000},
+    {"+COPN",       "+COPN",        AT_CMD_IDEMPOTENT,                      10000},
+    {"+CREG",       "+CREG",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CGREG",      "+CGREG",       AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CEREG",      "+CEREG",       AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+C5GREG",     "+C5GREG",      AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CUSD",       "+CUSD",        0,                                      120000},
+
+    // Packet domain
+    {"+CGDCONT",    "+CGDCONT",     AT_CMD_IDEMPOTENT,                      5000},
+    {"+CGATT",      "+CGATT",       AT_CMD_IDEMPOTENT,                      140000},
+    {"+CGACT",      "+CGACT",       AT_CMD_IDEMPOTENT,                      150000},
+    {"+CGPADDR",    "+CGPADDR",     AT_CMD_IDEMPOTENT,                      5000},
+    {"+CGDATA",     "",             AT_CMD_DATA,                            180000},
+
+    // SMS
+    {"+CMGF",       "+CMGF",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CPMS",       "+CPMS",        AT_CMD_IDEMPOTENT,                      5000},
+    {"+CNMI",       "+CNMI",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CSCA",       "+CSCA",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CSMP",       "+CSMP",        AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+CMGL",       "+CMGL",        AT_CMD_IDEMPOTENT | AT_CMD_MULTILINE,   20000},
+    {"+CMGR",       "+CMGR",        AT_CMD_IDEMPOTENT | AT_CMD_MULTILINE,   5000},
+    {"+CMGD",       "+CMGD",        0,                                      25000},
+    {"+CMGS",       "+CMGS",        AT_CMD_PROMPT,                          120000},
+    {"+CMGW",       "+CMGW",        AT_CMD_PROMPT,                          5000},
+    {"+CMGC",       "+CMGC",        AT_CMD_PROMPT,                          120000},
+    {"+CMSS",       "+CMSS",        0,                                      120000},
+
+    // Quectel TCP/IP stack
+    {"+QIACT",      "+QIACT",       AT_CMD_IDEMPOTENT,                      150000},
+    {"+QIOPEN",     "+QIOPEN",      0,                                      150000},
+    {"+QICLOSE",    "+QICLOSE",     AT_CMD_IDEMPOTENT,                      10000},
+    {"+QISTATE",    "+QISTATE",     AT_CMD_IDEMPOTENT,                      5000},
+    {"+QISDE",      "+QISDE",       AT_CMD_IDEMPOTENT | AT_CMD_SETTING,     5000},
+    {"+QISEND",     "+QISEND",      AT_CMD_PROMPT,                          10000},
+    {"+QIRD",       "+QIRD",        AT_CMD_RAW,                             5000},
+};
+
+
+
+// The key of a command line: "+CREG?" -> "+CREG", "D*99#" -> "D", "&F0" -> "&F".
+constexpr std::string_view at_command_key (std::string_view command)
+{
+    if (command.empty())
+    {
+        return command;
+    }
+
+    switch (command[0])
+    {
+        case '+': case '$': case '%': case '^': case '#': case '*':
+            return command.substr(0, command.find_first_of("=?;"));
+
+        case '&':
+            return command.substr(0, 2);
+
+        default:
+            return command.substr(0, 1);
+    }
+}
+
+// FNV-1a over the upper-cased key.
+constexpr uint32_t at_command_hash (std::string_view key, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (const char c : key)
+    {
+        hash ^= static_cast<uint8_t>(c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+namespace at_commands_detail
+{
+    static constexpr size_t N_COMMANDS = std::size(AT_COMMANDS);
+
+    // Hash and displace: the first hash picks a bucket, whose seed for the
+    // second hash was chosen so that no two stems share a slot.
+    static constexpr size_t N_BUCKETS = N_COMMANDS / 2 + 1;
+
+    static constexpr size_t N_SLOTS = [] {
+        size_t n = 1;
+        while (n < 2 * N_COMMANDS)
+        {
+            n *= 2;
+        }
+        return n;
+    }();
+
+    static constexpr uint8_t EMPTY = 0xFF;
+    static_assert(N_COMMANDS < EMPTY, "Slot indices are bytes");
+
+    struct hash_tables
+    {
+        std::array<uint32_t, N_BUCKETS>     seeds   {};
+        std::array<uint8_t, N_SLOTS>        slots   {};
+    };
+
+    constexpr size_t bucket_of (std::string_view key)
+    {
+        return at_command_hash(key, 0) % N_BUCKETS;
+    }
+
+    constexpr size_t slot_of (std::string_view key, uint32_t seed)
+    {
+        return at_command_hash(key, seed) & (N_SLOTS - 1);
+    }
+
+    // Evaluated once, by the compiler. Fills the largest buckets first,
+    // while most slots are still free.
+    inline constexpr hash_tables TABLES = [] {
+        hash_tables tables;
+        tables.slots.fill(EMPTY);
+
+        std::array<size_t, N_BUCKETS> sizes {};
+        for (const auto &command : AT_COMMANDS)
+        {
+            sizes[bucket_of(command.stem)]++;
+        }
+
+        for (size_t size = N_COMMANDS; size > 0; size--)
+        {
+            for (size_t bucket = 0; bucket < N_BUCKETS; bucket++)
+            {
+                if (sizes[bucket] != size)
+                {
+                    continue;
+                }
+
+                std::array<size_t, N_COMMANDS> members {};
+                size_t n_members = 0;
+                for (size_t i = 0; i < N_COMMANDS; i++)
+                {
+                    if (bucket_of(AT_COMMANDS[i].stem) == bucket)
+                    {
+                        members[n_members++] = i;
+                    }
+                }
+
+                for (uint32_t seed = 1; ; seed++)
+                {
+                    std::array<bool, N_SLOTS> taken {};
+                    bool fits = true;
+
+                    for (size_t m = 0; m < n_members && fits; m++)
+                    {
+                        const size_t slot = slot_of(AT_COMMANDS[members[m]].stem, seed);
+                        fits = EMPTY == tables.slots[slot] && !taken[slot];
+                        taken[slot] = true;
+                    }
+
+                    if (fits)
+                    {
+                        for (size_t m = 0; m < n_members; m++)
+                        {
+                            tables.slots[slot_of(AT_COMMANDS[members[m]].stem, seed)] = static_cast<uint8_t>(members[m]);
+                        }
+                        tables.seeds[bucket] = seed;
+                        break;
+                    }
+                }
+            }
+        }
+
+        return tables;
+    }();
+
+    constexpr bool same_key (std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            const char ca = a[i] >= 'a' && a[i] <= 'z' ? a[i] - ('a' - 'A') : a[i];
+            if (ca != b[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+
+
+// Two hashes and one comparison; nullptr for commands not in the table.
+constexpr const at_command_info* at_command_lookup (std::string_view command)
+{
+    using namespace at_commands_detail;
+
+    const std::string_view key = at_command_key(command);
+    const uint8_t slot = TABLES.slots[slot_of(key, TABLES.seeds[bucket_of(key)])];
+
+    if (EMPTY == slot || !same_key(key, AT_COMMANDS[slot].stem))
+    {
+        return nullptr;
+    }
+
+    return &AT_COMMANDS[slot];
+}
+
+constexpr size_t at_command_timeout (std::string_view command)
+{
+    const at_command_info *info = at_command_lookup(command);
+    return info ? info->timeout_ms : AT_DEFAULT_TIMEOUT_MS;
+}
+
+// Whether the command may be sent twice: queries and tests never change
+// anything, and the table knows which commands only set what they set.
+constexpr bool at_command_is_idempotent (std::string_view command)
+{
+    const at_command_info *info = at_command_lookup(command);
+    return (info && (info->flags & AT_CMD_IDEMPOTENT)) || command.ends_with('?');
+}
+
+// The prefix of the command's information lines, or its stem if unknown.
+constexpr std::string_view at_command_prefix (std::string_view command)
+{
+    const at_command_info *info = at_command_lookup(command);
+    return info ? info->prefix : at_command_key(command);
+}
+
+
+
+static_assert(at_command_lookup("+cmgs=\"123\"")->flags & AT_CMD_PROMPT);
+static_assert(at_command_lookup("D*99#")->flags & AT_CMD_DATA);
+static_assert(at_command_prefix("+CICCID") == "+ICCID");
+static_assert(!at_command_is_idempotent("+CFUN=1,1") && at_command_is_idempotent("+CFUN?"));
+static_assert(at_command_lookup("+XYZZY") == nullptr);
+static_assert([] {
+    for (const auto &command : AT_COMMANDS)
+    {
+        if (at_command_lookup(command.stem) != &command)
+        {
+            return false;
+        }
+    }
+    return true;
+}(), "Every stem must find its own entry");
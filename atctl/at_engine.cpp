@@ -0,0 +1,45 @@
+#include "at_engine.h"
+
+#include <cctype>
+#include <string_view>
+
+
+
+bool at_same_stem (std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (std::toupper(static_cast<unsigned char>(a[i])) != std::toupper(static_cast<unsigned char>(b[i])))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool at_is_mergeable (std::string_view command)
+{
+    if (command.size() < 2 || command[0] != '+' || std::string_view::npos != command.find(';'))
+    {
+        return false;
+    }
+
+    // A rejected line is retried command by command, so each must be safe
+    // to run twice. Unknown commands are not: neither how they answer nor
+    // whether they change anything is known.
+    const at_command_info *info = at_command_lookup(command);
+    if (!info || !at_command_is_idempotent(command))
+    {
+        return false;
+    }
+
+    // Answered without a "+XXX:" prefix, with free text that may look like
+    // one, with a "> " prompt or raw data, or leaving command mode.
+    return !(info->flags & (AT_CMD_UNPREFIXED | AT_CMD_MULTILINE | AT_CMD_PROMPT | AT_CMD_RAW | AT_CMD_DATA));
+}
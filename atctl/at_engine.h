@@ -0,0 +1,809 @@
+#pragma once
+
+#include "../serial/serial.h"
+#include "../serial/serial_device_type.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+#include "at_commands.h"
+#include "at_parser.h"
+#include "metrics.h"
+#include "modem_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// V.250 only guarantees 40 characters; modems in the field take far more.
+static constexpr size_t AT_DEFAULT_MAX_LINE = 128;
+
+static constexpr size_t AT_DEFAULT_PROMPT_TIMEOUT_MS = 5000;
+
+// Ends the payload of a prompt command; ESC cancels it instead.
+static constexpr char AT_CTRL_Z = '\x1a';
+static constexpr char AT_ESC    = '\x1b';
+
+// After a command timed out, its late output is discarded until the line
+// has been quiet this long, but for no more than AT_DRAIN_MAX_MS.
+static constexpr size_t AT_QUIET_MS     = 100;
+static constexpr size_t AT_DRAIN_MAX_MS = 2000;
+
+
+
+
+// Writes "AT<command>\r" in full, or throws.
+template<serial_device_type DEVICE>
+void at_write_command (DEVICE &device, const std::string &command)
+{
+    const std::string message = "AT" + command + "\r";
+    const ssize_t n_written = device.write(message.c_str(), message.size());
+
+    if (-1 == n_written)
+    {
+        throw source_exception("Failed to write to device");
+    }
+    else if (n_written < static_cast<ssize_t>(message.size()))
+    {
+        throw source_exception("Failed to write full command");
+    }
+
+    metrics_add(metrics->command_lines);
+    metrics_add(metrics->bytes_tx, n_written);
+}
+
+
+
+// For a command that timed out: aborts it if it is still running (any
+// character does, V.250 5.6.1), then reads and drops whatever it still
+// sends until the line is quiet, so that it is not taken for the answer to
+// the next command.
+template<serial_device_type DEVICE>
+void at_abandon (DEVICE &device)
+{
+    const char abort = AT_ESC;
+    if (1 != device.write(&abort, 1))
+    {
+        throw source_exception("Failed to write to device");
+    }
+    metrics_add(metrics->bytes_tx, 1);
+
+    char buffer [1024];
+    const auto give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(AT_DRAIN_MAX_MS);
+
+    while (std::chrono::steady_clock::now() < give_up && 0 < device.wait_for_data(AT_QUIET_MS))
+    {
+        const ssize_t n_read = device.read(buffer, sizeof(buffer));
+        if (n_read <= 0)
+        {
+            break;
+        }
+        metrics_add(metrics->bytes_rx, n_read);
+    }
+}
+
+
+
+// Case-insensitive.
+bool at_same_stem (std::string_view a, std::string_view b);
+
+// Only known extended commands that are safe to repeat and whose output
+// can be attributed by prefix are merged.
+bool at_is_mergeable (std::string_view command);
+
+
+
+struct at_response
+{
+    std::vector<std::string>    lines;                      // without the echo, with the final result code
+    at_final                    result = at_final::none;    // none: timed out
+};
+
+
+
+// Runs commands on an open device and collects each response up to its
+// final result code. Partial lines are kept between commands, except after
+// a timeout: the command is then abandoned (see at_abandon()) and what was
+// buffered is dropped. If the modem echoes commands, lines that still
+// arrive before the next command's echo are dropped too.
+//
+// Settings the modem has confirmed are tracked (modem_state) for as long as
+// the engine lives: transact(), transact_stream() and transact_batch()
+// answer a setting that is already in effect with a plain "OK" instead of
+// sending it again.
+//
+// Templated on the device so the I/O calls bind statically: for the final
+// serial_device classes no virtual dispatch is left on the read path, and
+// a mock_serial_device can stand in for a modem.
+template<serial_device_type DEVICE>
+class basic_at_engine
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    explicit basic_at_engine (DEVICE &device)
+        : m_device (device)
+    {}
+
+    // Response lines (without the echo, with the final result code) are
+    // stored in lines_dest. Returns at_final::none on timeout. Timeouts
+    // default to the command's entry in AT_COMMANDS.
+    at_final transact (const std::string &command, std::vector<std::string> &lines_dest, size_t timeout_ms = AT_TIMEOUT_AUTO);
+
+    // For commands answered with a "> " prompt (+CMGS, +CMGW, ...): waits
+    // for the prompt, writes payload followed by Ctrl-Z and collects the
+    // response. If no prompt arrives in time the command is cancelled.
+    // With terminate false the command has announced the payload's length
+    // (+QISEND=0,<n>): it is sent as is, binary-safe, without Ctrl-Z.
+    at_final transact_prompt (const std::string &command, std::string_view payload, std::vector<std::string> &lines_dest,
+                              size_t timeout_ms = AT_TIMEOUT_AUTO, size_t prompt_timeout_ms = AT_DEFAULT_PROMPT_TIMEOUT_MS,
+                              bool terminate = true);
+
+    // For commands whose information line "<prefix> <n>[,...]" is followed
+    // by n bytes of raw data (+QIRD): the data is appended to data_dest,
+    // the lines around it go to lines_dest.
+    at_final transact_read (const std::string &command, std::string_view prefix, std::string &data_dest, std::vector<std::string> &lines_dest,
+                            size_t timeout_ms = AT_TIMEOUT_AUTO);
+
+    // The next line while no command is running, e.g. an unsolicited
+    // result code. timeout_ms 0 only looks at what is already buffered.
+    bool wait_line (std::string &line_dest, size_t timeout_ms);
+
+    // Hands each response line (without the echo) to on_line as soon as it
+    // is complete, so memory is bounded by the longest line. on_idle runs
+    // before blocking for more data. timeout_ms applies to the gap between
+    // reads rather than the whole response.
+    template<typename LineHandler, typename IdleHandler>
+    at_final transact_stream (const std::string &command, LineHandler &&on_line, IdleHandler &&on_idle, size_t timeout_ms = AT_TIMEOUT_AUTO)
+    {
+        if (this->is_skippable(command))
+        {
+            const at_final result = this->skip(command, m_merged_lines);
+            on_line(m_merged_lines.front());
+            return result;
+        }
+
+        at_write_command(m_device, command);
+        m_round_trips++;
+        metrics_add(metrics->commands);
+
+        if (AT_TIMEOUT_AUTO == timeout_ms)
+        {
+            timeout_ms = at_command_timeout(command);
+        }
+
+        const clock::time_point start = clock::now();
+        m_echo.assign("AT").append(command);
+        m_echoed = false;
+        bool first = true;
+
+        while (1)
+        {
+            while (m_lines.next_line(m_line))
+            {
+                if (this->is_stale(m_echo))
+                {
+                    continue;
+                }
+
+                if (first && m_line == m_echo)
+                {
+                    first = false;
+                    m_echoed = true;
+                    continue;
+                }
+                first = false;
+
+                const at_final result = classify_final(m_line);
+                on_line(m_line);
+
+                if (result != at_final::none)
+                {
+                    // Lines are not kept, so only settings and resets are learnt.
+                    m_merged_lines.clear();
+                    this->note_echo(m_merged_lines);
+                    m_state.update(command, result, m_merged_lines);
+                    this->record(result, m_line, start);
+                    return result;
+                }
+            }
+
+            on_idle();
+
+            if (!this->fill(clock::now() + std::chrono::milliseconds(timeout_ms)))
+            {
+                this->abandon();
+                this->record(at_final::none, {}, start);
+                return at_final::none;
+            }
+        }
+    }
+
+    // Runs commands in order; responses_dest[i] belongs to commands[i].
+    // Consecutive extended commands are sent as one "AT+A;+B;..." line of at
+    // most max_line characters and the response is split back by
+    // information-response prefix. If the modem rejects a combined line,
+    // its commands are sent one by one.
+    void transact_batch (const std::vector<std::string> &commands, std::vector<at_response> &responses_dest, size_t timeout_ms = AT_TIMEOUT_AUTO);
+
+    // Forgets buffered partial output and the modem's settings, e.g. after
+    // the device was reopened.
+    void reset (void)
+    {
+        m_lines.clear();
+        m_state.clear();
+        m_resync = false;
+    }
+
+    // false sends every setting, even if it is already in effect.
+    void set_skip_settings (bool skip)
+    {
+        m_skip_settings = skip;
+    }
+
+    // 0 disables merging.
+    void set_max_line (size_t max_line)
+    {
+        m_max_line = max_line;
+    }
+
+    // Command lines written so far.
+    size_t get_round_trips (void) const
+    {
+        return m_round_trips;
+    }
+
+    // Settings answered without a round trip because they were in effect.
+    size_t get_skipped (void) const
+    {
+        return m_skipped;
+    }
+
+    // Command lines that timed out and were abandoned.
+    size_t get_abandoned (void) const
+    {
+        return m_abandoned;
+    }
+
+    DEVICE& get_device (void)
+    {
+        return m_device;
+    }
+
+private:
+    // Reads whatever is available into the line reader, waiting until
+    // deadline. false: timed out.
+    bool fill (clock::time_point deadline);
+
+    // Collects lines until a final result code (returned), the deadline,
+    // or, if prompt_dest is given, a "> " prompt (sets *prompt_dest).
+    at_final read_response (std::string_view echo, std::vector<std::string> &lines_dest, clock::time_point deadline, bool *prompt_dest = nullptr);
+
+    // After a timeout: see at_abandon(). Buffered output is dropped, and
+    // with echo on, so is what arrives before the next command's echo.
+    void abandon (void)
+    {
+        at_abandon(m_device);
+        m_lines.clear();
+        m_resync = m_modem_echoes || m_echoed;
+        m_abandoned++;
+    }
+
+    // Whether m_line is late output of an abandoned command, which is
+    // everything up to this command's echo.
+    bool is_stale (std::string_view echo)
+    {
+        if (!m_resync || echo.empty())
+        {
+            return false;
+        }
+
+        if (m_line == echo)
+        {
+            m_resync = false;
+            m_echoed = true;
+        }
+        return true;
+    }
+
+    // transact() without counting a command, for merged and retried lines.
+    at_final transact_line (const std::string &line, std::vector<std::string> &lines_dest, size_t timeout_ms);
+
+    void record (at_final result, std::string_view final_line, clock::time_point start)
+    {
+        metrics_record_result(result, final_line, std::chrono::duration<double, std::milli>(clock::now() - start).count());
+    }
+
+    void write_all (const char *data, size_t size);
+
+    // Answers a redundant setting as the modem would have.
+    at_final skip ([[maybe_unused]] const std::string &command, std::vector<std::string> &lines_dest)
+    {
+        DBG("Skipping AT%s, already in effect\n", command.c_str());
+        lines_dest.assign(1, "OK");
+        m_skipped++;
+        metrics_add(metrics->skipped);
+        return at_final::ok;
+    }
+
+    bool is_skippable (const std::string &command) const
+    {
+        return m_skip_settings && m_state.is_redundant(command);
+    }
+
+    // After a command line got its final result code.
+    void note_echo (const std::vector<std::string> &lines)
+    {
+        m_modem_echoes = m_echoed || lines.end() != std::find(lines.begin(), lines.end(), m_echo);
+        m_state.set_echo(m_modem_echoes);
+    }
+
+    // Hands the lines of a merged response, up to its final result code,
+    // to commands [first, last). Returns one past the last command that
+    // answered with a line of its own.
+    size_t split_response (const std::vector<std::string> &commands, size_t first, size_t last, std::vector<at_response> &responses_dest);
+
+    DEVICE                     &m_device;
+    at_line_reader              m_lines;
+    std::string                 m_line;
+    std::string                 m_echo;
+    std::string                 m_merged;
+    std::vector<std::string>    m_merged_lines;
+    size_t                      m_max_line      = AT_DEFAULT_MAX_LINE;
+    size_t                      m_round_trips   = 0;
+    modem_state                 m_state;
+    bool                        m_skip_settings = true;
+    bool                        m_echoed        = false;    // by the current command line
+    bool                        m_modem_echoes  = false;    // as far as the last command line showed
+    bool                        m_resync        = false;    // dropping lines up to the next echo
+    size_t                      m_skipped       = 0;
+    size_t                      m_abandoned     = 0;
+};
+
+
+
+template<serial_device_type DEVICE>
+at_final basic_at_engine<DEVICE>::transact (const std::string &command, std::vector<std::string> &lines_dest, size_t timeout_ms)
+{
+    if (this->is_skippable(command))
+    {
+        return this->skip(command, lines_dest);
+    }
+
+    metrics_add(metrics->commands);
+    const at_final result = this->transact_line(command, lines_dest, timeout_ms);
+    m_state.update(command, result, lines_dest);
+
+    return result;
+}
+
+template<serial_device_type DEVICE>
+at_final basic_at_engine<DEVICE>::transact_line (const std::string &line, std::vector<std::string> &lines_dest, size_t timeout_ms)
+{
+    at_write_command(m_device, line);
+    m_round_trips++;
+
+    if (AT_TIMEOUT_AUTO == timeout_ms)
+    {
+        timeout_ms = at_command_timeout(line);
+    }
+
+    const clock::time_point start = clock::now();
+    m_echo.assign("AT").append(line);
+    m_echoed = false;
+    lines_dest.clear();
+
+    const at_final result = this->read_response(m_echo, lines_dest, start + std::chrono::milliseconds(timeout_ms));
+    this->record(result, lines_dest.empty() ? std::string_view() : lines_dest.back(), start);
+
+    if (result != at_final::none)
+    {
+        this->note_echo(lines_dest);
+    }
+    else
+    {
+        this->abandon();
+    }
+
+    return result;
+}
+
+template<serial_device_type DEVICE>
+at_final basic_at_engine<DEVICE>::transact_prompt (const std::string &command, std::string_view payload, std::vector<std::string> &lines_dest,
+                                                    size_t timeout_ms, size_t prompt_timeout_ms, bool terminate)
+{
+    at_write_command(m_device, command);
+    m_round_trips++;
+    metrics_add(metrics->commands);
+
+    if (AT_TIMEOUT_AUTO == timeout_ms)
+    {
+        timeout_ms = at_command_timeout(command);
+    }
+
+    const clock::time_point start = clock::now();
+    m_echo.assign("AT").append(command);
+    lines_dest.clear();
+
+
+
+    bool prompt = false;
+    const at_final early = this->read_response(m_echo, lines_dest, start + std::chrono::milliseconds(prompt_timeout_ms), &prompt);
+
+    if (!prompt)
+    {
+        if (early == at_final::none)
+        {
+            this->abandon();
+        }
+
+        this->record(early, lines_dest.empty() ? std::string_view() : lines_dest.back(), start);
+        return early;
+    }
+
+    // Send the payload and its terminator in one write.
+    if (terminate)
+    {
+        m_echo.assign(payload).push_back(AT_CTRL_Z);
+        this->write_all(m_echo.data(), m_echo.size());
+    }
+    else
+    {
+        this->write_all(payload.data(), payload.size());
+    }
+
+
+
+    const at_final result = this->read_response({}, lines_dest, clock::now() + std::chrono::milliseconds(timeout_ms));
+    if (result == at_final::none)
+    {
+        this->abandon();
+    }
+
+    // Drop the echoed payload, which precedes the first "+..." or result line.
+    size_t first = 0;
+    while (first + 1 < lines_dest.size() && lines_dest[first][0] != '+')
+    {
+        first++;
+    }
+    lines_dest.erase(lines_dest.begin(), lines_dest.begin() + first);
+
+    this->record(result, lines_dest.empty() ? std::string_view() : lines_dest.back(), start);
+    return result;
+}
+
+template<serial_device_type DEVICE>
+at_final basic_at_engine<DEVICE>::transact_read (const std::string &command, std::string_view prefix, std::string &data_dest,
+                                                  std::vector<std::string> &lines_dest, size_t timeout_ms)
+{
+    at_write_command(m_device, command);
+    m_round_trips++;
+    metrics_add(metrics->commands);
+
+    if (AT_TIMEOUT_AUTO == timeout_ms)
+    {
+        timeout_ms = at_command_timeout(command);
+    }
+
+    const clock::time_point start = clock::now();
+    const clock::time_point deadline = start + std::chrono::milliseconds(timeout_ms);
+    m_echo.assign("AT").append(command);
+    lines_dest.clear();
+
+    while (1)
+    {
+        while (m_lines.next_line(m_line))
+        {
+            if (this->is_stale(m_echo) || (lines_dest.empty() && m_line == m_echo))
+            {
+                continue;
+            }
+
+            const at_final result = classify_final(m_line);
+            lines_dest.push_back(m_line);
+
+            if (result != at_final::none)
+            {
+                this->record(result, m_line, start);
+                return result;
+            }
+
+            if (!m_line.starts_with(prefix))
+            {
+                continue;
+            }
+
+            // The announced data may contain anything, line breaks included.
+            size_t remaining = strtoul(m_line.c_str() + prefix.size() + strspn(m_line.c_str() + prefix.size(), ": "), nullptr, 10);
+            while (0 < (remaining -= m_lines.take_raw(data_dest, remaining)))
+            {
+                if (!this->fill(deadline))
+                {
+                    this->abandon();
+                    this->record(at_final::none, {}, start);
+                    return at_final::none;
+                }
+            }
+        }
+
+        if (!this->fill(deadline))
+        {
+            this->abandon();
+            this->record(at_final::none, {}, start);
+            return at_final::none;
+        }
+    }
+}
+
+template<serial_device_type DEVICE>
+bool basic_at_engine<DEVICE>::wait_line (std::string &line_dest, size_t timeout_ms)
+{
+    const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (!m_lines.next_line(line_dest))
+    {
+        if (!this->fill(deadline))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<serial_device_type DEVICE>
+void basic_at_engine<DEVICE>::write_all (const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t n_written = m_device.write(data, size);
+        if (n_written <= 0)
+        {
+            throw source_exception("Failed to write to device");
+        }
+
+        metrics_add(metrics->bytes_tx, n_written);
+        data += n_written;
+        size -= n_written;
+    }
+}
+
+template<serial_device_type DEVICE>
+at_final basic_at_engine<DEVICE>::read_response (std::string_view echo, std::vector<std::string> &lines_dest, clock::time_point deadline, bool *prompt_dest)
+{
+    while (1)
+    {
+        while (m_lines.next_line(m_line))
+        {
+            if (this->is_stale(echo))
+            {
+                continue;
+            }
+
+            if (lines_dest.empty() && m_line == echo)
+            {
+                m_echoed = true;
+                continue;
+            }
+
+            // An unsolicited result code right behind the prompt turns it into a line.
+            if (prompt_dest && m_line == ">")
+            {
+                *prompt_dest = true;
+                return at_final::none;
+            }
+
+            const at_final result = classify_final(m_line);
+            lines_dest.push_back(m_line);
+
+            if (result != at_final::none)
+            {
+                return result;
+            }
+        }
+
+        if (prompt_dest && m_lines.take_prompt())
+        {
+            *prompt_dest = true;
+            return at_final::none;
+        }
+
+        if (!this->fill(deadline))
+        {
+            return at_final::none;
+        }
+    }
+}
+
+template<serial_device_type DEVICE>
+bool basic_at_engine<DEVICE>::fill (clock::time_point deadline)
+{
+    char buffer [1024];
+
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - clock::now()).count();
+    if (remaining <= 0)
+    {
+        return false;
+    }
+
+    const int rv = m_device.wait_for_data(remaining);
+    if (rv < 0)
+    {
+        throw source_exception("Failed to wait for data");
+    }
+    else if (rv == 0)
+    {
+        return false;
+    }
+
+    const ssize_t n_read = m_device.read(buffer, sizeof(buffer));
+    if (n_read < 0)
+    {
+        throw source_exception("Failed to read from device");
+    }
+    else if (n_read == 0)
+    {
+        throw source_exception("Device disconnected");
+    }
+
+    metrics_add(metrics->bytes_rx, n_read);
+    m_lines.append(buffer, n_read);
+    return true;
+}
+
+template<serial_device_type DEVICE>
+void basic_at_engine<DEVICE>::transact_batch (const std::vector<std::string> &commands, std::vector<at_response> &responses_dest, size_t timeout_ms)
+{
+    responses_dest.resize(commands.size());
+
+    size_t i = 0;
+    while (i < commands.size())
+    {
+        if (this->is_skippable(commands[i]))
+        {
+            responses_dest[i].result = this->skip(commands[i], responses_dest[i].lines);
+            i++;
+            continue;
+        }
+
+        // Grow a group of mergeable commands that fits on one line. A
+        // setting already in effect ends it: it may be skipped on its turn.
+        size_t end = i + 1;
+
+        if (at_is_mergeable(commands[i]))
+        {
+            m_merged.assign(commands[i]);
+
+            while (end < commands.size()
+                && at_is_mergeable(commands[end])
+                && !this->is_skippable(commands[end])
+                && 2 + m_merged.size() + 1 + commands[end].size() <= m_max_line)
+            {
+                // Responses are split by prefix, so a prefix may only appear once per line.
+                bool duplicate = false;
+                for (size_t j = i; j < end && !duplicate; j++)
+                {
+                    duplicate = at_same_stem(at_command_prefix(commands[j]), at_command_prefix(commands[end]));
+                }
+
+                if (duplicate)
+                {
+                    break;
+                }
+
+                m_merged.append(";").append(commands[end]);
+                end++;
+            }
+        }
+
+        if (end - i == 1)
+        {
+            responses_dest[i].result = this->transact_line(commands[i], responses_dest[i].lines, timeout_ms);
+        }
+        else
+        {
+            DBG("Merged %zu commands: AT%s\n", end - i, m_merged.c_str());
+
+            // The combined line may take as long as its commands together.
+            size_t merged_timeout_ms = timeout_ms;
+            if (AT_TIMEOUT_AUTO == timeout_ms)
+            {
+                for (size_t j = i; j < end; j++)
+                {
+                    merged_timeout_ms += at_command_timeout(commands[j]);
+                }
+            }
+
+            const at_final result = this->transact_line(m_merged, m_merged_lines, merged_timeout_ms);
+
+            if (result == at_final::ok)
+            {
+                this->split_response(commands, i, end, responses_dest);
+                for (size_t j = i; j < end; j++)
+                {
+                    responses_dest[j].lines.push_back(m_merged_lines.back());
+                    responses_dest[j].result = at_final::ok;
+                }
+            }
+            else if (result == at_final::none)
+            {
+                for (size_t j = i; j < end; j++)
+                {
+                    responses_dest[j].lines.clear();
+                    responses_dest[j].result = at_final::none;
+                }
+            }
+            else
+            {
+                // The modem stops at the failing command, and some reject
+                // combined lines outright. Commands up to the last one that
+                // answered did run; the rest are sent singly. Of those, any
+                // that ran silently run again, which at_is_mergeable() allows.
+                const size_t answered = this->split_response(commands, i, end, responses_dest);
+                DBG("Combined line rejected, sending %zu of %zu one by one\n", end - answered, end - i);
+
+                for (size_t j = i; j < end; j++)
+                {
+                    if (j < answered)
+                    {
+                        responses_dest[j].lines.push_back("OK");
+                        responses_dest[j].result = at_final::ok;
+                    }
+                    else
+                    {
+                        responses_dest[j].result = this->transact_line(commands[j], responses_dest[j].lines, timeout_ms);
+                    }
+                }
+            }
+        }
+
+        metrics_add(metrics->commands, end - i);
+        for (; i < end; i++)
+        {
+            m_state.update(commands[i], responses_dest[i].result, responses_dest[i].lines);
+        }
+    }
+}
+
+template<serial_device_type DEVICE>
+size_t basic_at_engine<DEVICE>::split_response (const std::vector<std::string> &commands, size_t first, size_t last, std::vector<at_response> &responses_dest)
+{
+    for (size_t j = first; j < last; j++)
+    {
+        responses_dest[j].lines.clear();
+    }
+
+    // Prefixed lines go to the command with that stem; unprefixed lines
+    // continue the previous one.
+    size_t owner = first;
+    size_t answered = first;
+    for (size_t k = 0; k + 1 < m_merged_lines.size(); k++)
+    {
+        const std::string &line = m_merged_lines[k];
+        const size_t colon = line.find(':');
+
+        if (!line.empty() && line[0] == '+' && colon != std::string::npos)
+        {
+            const std::string_view prefix(line.data(), colon);
+            for (size_t j = first; j < last; j++)
+            {
+                if (at_same_stem(at_command_prefix(commands[j]), prefix))
+                {
+                    owner = j;
+                    answered = std::max(answered, j + 1);
+                    break;
+                }
+            }
+        }
+
+        responses_dest[owner].lines.push_back(line);
+    }
+
+    return answered;
+}
+
+
+
+using at_engine = basic_at_engine<serial_device>;
@@ -0,0 +1,134 @@
+#include "at_io_thread.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+
+
+using load_clock = std::chrono::steady_clock;
+
+// Latency (us) at quantile p of sorted.
+static double _percentile (const std::vector<float> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    const size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[rank];
+}
+
+// false if a prefixed information line belongs to another command. Lines
+// of unprefixed commands cannot be told apart.
+static bool _is_own_response (const std::string &command, const at_response &response)
+{
+    const std::string_view prefix = at_command_prefix(command);
+
+    for (size_t i = 0; i + 1 < response.lines.size(); i++)
+    {
+        const std::string &line = response.lines[i];
+        const size_t colon = line.find(':');
+
+        if (!prefix.empty() && !line.empty() && line[0] == '+' && colon != std::string::npos
+            && !at_same_stem(prefix, std::string_view(line.data(), colon)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t run_load (at_engine &engine, const std::vector<std::string> &commands, size_t n_threads, size_t rounds)
+{
+    const size_t per_thread = rounds * commands.size();
+    const size_t start_round_trips = engine.get_round_trips();
+
+    std::vector<std::vector<float>> latencies (n_threads);
+    std::vector<uint64_t> failed (n_threads, 0);
+    std::vector<uint64_t> foreign (n_threads, 0);
+    std::atomic<size_t> ready {0};
+    double elapsed;
+    uint64_t batches, requests;
+
+    {
+        at_io_thread io (engine);
+        std::vector<std::thread> threads;
+        threads.reserve(n_threads);
+
+        for (size_t t = 0; t < n_threads; t++)
+        {
+            latencies[t].reserve(per_thread);
+            threads.emplace_back([&, t] (void)
+            {
+                at_request request;
+
+                // All start at once, so the first ones do not run alone.
+                ready.fetch_add(1);
+                while (ready.load() < n_threads)
+                {
+                    std::this_thread::yield();
+                }
+
+                for (size_t r = 0; r < rounds; r++)
+                {
+                    for (const std::string &command : commands)
+                    {
+                        const auto start = load_clock::now();
+                        request.command = command;
+                        io.submit(request);
+                        request.wait();
+                        const std::chrono::duration<float, std::micro> latency = load_clock::now() - start;
+
+                        latencies[t].push_back(latency.count());
+                        failed[t] += (at_final::ok != request.response.result);
+                        foreign[t] += !_is_own_response(command, request.response);
+                    }
+                }
+            });
+        }
+
+        const auto start = load_clock::now();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        elapsed = std::chrono::duration<double>(load_clock::now() - start).count();
+
+        batches = io.get_batches();
+        requests = io.get_requests();
+        if (const std::exception_ptr error = io.get_error())
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+
+
+    std::vector<float> all;
+    all.reserve(n_threads * per_thread);
+    uint64_t total_failed = 0;
+    uint64_t total_foreign = 0;
+    for (size_t t = 0; t < n_threads; t++)
+    {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        total_failed += failed[t];
+        total_foreign += foreign[t];
+    }
+    std::sort(all.begin(), all.end());
+
+    const size_t lines = engine.get_round_trips() - start_round_trips;
+
+    fprintf(stderr, "%zu threads: %llu commands in %.2f s, %.0f commands/s, %llu not OK, %llu with another's answer\n",
+            n_threads, static_cast<unsigned long long>(requests), elapsed,
+            elapsed > 0 ? requests / elapsed : 0.0, static_cast<unsigned long long>(total_failed),
+            static_cast<unsigned long long>(total_foreign));
+    fprintf(stderr, "Latency: p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n",
+            _percentile(all, 0.5), _percentile(all, 0.99), _percentile(all, 0.999), all.empty() ? 0.0 : all.back());
+    fprintf(stderr, "%llu batches (%.1f commands each), %zu command lines (%.1f commands each)\n",
+            static_cast<unsigned long long>(batches), batches ? static_cast<double>(requests) / batches : 0.0,
+            lines, lines ? static_cast<double>(requests) / lines : 0.0);
+
+    return total_failed + total_foreign;
+}
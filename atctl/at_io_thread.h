@@ -0,0 +1,432 @@
+#pragma once
+
+#include "at_engine.h"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Requests taken off the queue at a time.
+static constexpr size_t AT_IO_MAX_BATCH = 64;
+
+// Whether identical requests queued at the same time may share one
+// execution: queries, tests and commands that only report something.
+static inline bool at_io_is_shareable (std::string_view command)
+{
+    const at_command_info *info = at_command_lookup(command);
+    return command.ends_with('?')
+        || (info && (info->flags & AT_CMD_IDEMPOTENT) && !(info->flags & (AT_CMD_SETTING | AT_CMD_RESET)) && command.find('=') == std::string_view::npos);
+}
+
+
+
+
+// A command for an at_io_thread and, once complete, its response. Owned by
+// the submitting thread; reusable after completion.
+class at_request
+{
+public:
+    std::string     command;
+    at_response     response;       // valid once complete
+
+    at_request (void) = default;
+
+    explicit at_request (std::string command_)
+        : command (std::move(command_))
+    {}
+
+    at_request (const at_request&) = delete;
+    at_request& operator= (const at_request&) = delete;
+
+    bool is_complete (void) const
+    {
+        return COMPLETE == m_state.load(std::memory_order_acquire);
+    }
+
+    // Blocks (futex) until the I/O thread has filled in response, then
+    // spins out the short WAKING window in which it is still notifying.
+    void wait (void) const
+    {
+        uint32_t state;
+        while (COMPLETE != (state = m_state.load(std::memory_order_acquire)))
+        {
+            if (PENDING == state)
+            {
+                m_state.wait(state, std::memory_order_acquire);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    friend class at_request_queue;
+    template<serial_device_type> friend class basic_at_io_thread;
+
+    static constexpr uint32_t PENDING   = 0;
+    static constexpr uint32_t WAKING    = 1;    // response filled in, waiter being woken
+    static constexpr uint32_t COMPLETE  = 2;    // the I/O thread is done with the request
+
+    std::atomic<at_request*>    m_next      {nullptr};
+    std::atomic<uint32_t>       m_state     {COMPLETE};
+};
+
+
+
+// Intrusive multi-producer, single-consumer queue (Vyukov): push() is one
+// exchange and one store from any thread, pop() only runs on the consumer.
+// No locks, no allocation.
+class at_request_queue
+{
+public:
+    at_request_queue (void)
+        : m_head (&m_stub)
+        , m_tail (&m_stub)
+    {}
+
+    at_request_queue (const at_request_queue&) = delete;
+    at_request_queue& operator= (const at_request_queue&) = delete;
+
+    void push (at_request *request)
+    {
+        request->m_next.store(nullptr, std::memory_order_relaxed);
+        at_request *prev = m_head.exchange(request, std::memory_order_acq_rel);
+        prev->m_next.store(request, std::memory_order_release);
+    }
+
+    // Oldest request, or nullptr if empty. Also nullptr while the producer
+    // of the next request is between its two steps; it signals once done.
+    at_request* pop (void)
+    {
+        at_request *tail = m_tail;
+        at_request *next = tail->m_next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub)
+        {
+            if (!next)
+            {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->m_next.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        if (tail != m_head.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        // tail is the last one: put the stub behind it so it can be taken.
+        this->push(&m_stub);
+        next = tail->m_next.load(std::memory_order_acquire);
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        return nullptr;
+    }
+
+private:
+    at_request                  m_stub;
+    std::atomic<at_request*>    m_head;     // producers
+    at_request                 *m_tail;     // consumer
+};
+
+
+
+
+// Gives one thread sole use of an engine (and its device) so that any
+// number of others can issue commands without locking: they submit()
+// requests to a lock-free queue and wait on each request's completion.
+// The I/O thread takes whatever has queued up and runs it in queue order.
+// Consecutive shareable commands (see at_io_is_shareable()) go through
+// transact_batch() together, so queries from different threads share AT
+// lines and round trips with the modem; identical ones run once, unless
+// another command between them could change their answer. Every other
+// command is a transaction of its own, so that when it fails no other
+// thread's command is retried with it. It sleeps on a futex while there is
+// nothing to do.
+//
+// The engine must not be used by anyone else while this lives. If it
+// throws (the device failed), the request being run and all later ones
+// complete with at_final::none.
+template<serial_device_type DEVICE>
+class basic_at_io_thread
+{
+public:
+    explicit basic_at_io_thread (basic_at_engine<DEVICE> &engine)
+        : m_engine  (engine)
+        , m_thread  (&basic_at_io_thread::run, this)
+    {}
+
+    // Completes what was submitted before, then stops.
+    ~basic_at_io_thread (void)
+    {
+        m_stop.store(true, std::memory_order_seq_cst);
+        this->signal();
+        m_thread.join();
+    }
+
+    basic_at_io_thread (const basic_at_io_thread&) = delete;
+    basic_at_io_thread& operator= (const basic_at_io_thread&) = delete;
+
+    // From any thread. request must stay alive until it is complete.
+    void submit (at_request &request)
+    {
+        request.m_state.store(at_request::PENDING, std::memory_order_relaxed);
+        m_queue.push(&request);
+        this->signal();
+    }
+
+    // Batches run so far and the requests in them.
+    uint64_t get_batches (void) const
+    {
+        return m_batches.load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_requests (void) const
+    {
+        return m_requests.load(std::memory_order_relaxed);
+    }
+
+    // Whatever the engine threw, if anything.
+    std::exception_ptr get_error (void) const
+    {
+        return m_failed.load(std::memory_order_acquire) ? m_error : nullptr;
+    }
+
+private:
+    // Both sides are seq_cst: either the I/O thread sees the new count
+    // before it sleeps, or the submitter sees it waiting.
+    void signal (void)
+    {
+        m_signal.fetch_add(1, std::memory_order_seq_cst);
+        if (m_waiting.load(std::memory_order_seq_cst))
+        {
+            m_signal.notify_one();
+        }
+    }
+
+    void run (void);
+    void share (void);
+    void transact (void);
+    void complete (at_request &request, at_response &response, bool last);
+
+    basic_at_engine<DEVICE>        &m_engine;
+    at_request_queue                m_queue;
+    std::atomic<uint32_t>           m_signal        {0};
+    std::atomic<bool>               m_waiting       {false};
+    std::atomic<bool>               m_stop          {false};
+    std::atomic<bool>               m_failed        {false};
+    std::exception_ptr              m_error;
+    std::atomic<uint64_t>           m_batches       {0};
+    std::atomic<uint64_t>           m_requests      {0};
+
+    // I/O thread only, kept between batches. Request i is answered by
+    // m_responses[m_slots[i]], which m_refs[...] requests share.
+    std::vector<at_request*>        m_batch;
+    std::vector<std::string>        m_commands;
+    std::vector<at_response>        m_responses;
+    std::vector<size_t>             m_slots;
+    std::vector<size_t>             m_refs;
+    std::vector<std::string>        m_run;
+    std::vector<at_response>        m_run_responses;
+
+    // Last: starts once everything above is initialised.
+    std::thread                     m_thread;
+};
+
+template<serial_device_type DEVICE>
+void basic_at_io_thread<DEVICE>::run (void)
+{
+    while (1)
+    {
+        const uint32_t seen = m_signal.load(std::memory_order_seq_cst);
+
+        m_batch.clear();
+        while (m_batch.size() < AT_IO_MAX_BATCH)
+        {
+            at_request *request = m_queue.pop();
+            if (!request)
+            {
+                break;
+            }
+            m_batch.push_back(request);
+        }
+
+        if (m_batch.empty())
+        {
+            if (m_stop.load(std::memory_order_seq_cst))
+            {
+                break;
+            }
+
+            // A submit after seen was read changes m_signal, and wait()
+            // returns at once.
+            m_waiting.store(true, std::memory_order_seq_cst);
+            m_signal.wait(seen, std::memory_order_seq_cst);
+            m_waiting.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        metrics_set(metrics->queue_depth, m_batch.size());
+        this->share();
+
+        if (!m_failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                this->transact();
+            }
+            catch (...)
+            {
+                m_error = std::current_exception();
+                m_failed.store(true, std::memory_order_release);
+            }
+        }
+
+        if (m_failed.load(std::memory_order_relaxed))
+        {
+            m_responses.resize(m_commands.size());
+            for (auto &response : m_responses)
+            {
+                response.lines.clear();
+                response.result = at_final::none;
+            }
+        }
+
+        for (size_t i = 0; i < m_batch.size(); i++)
+        {
+            this->complete(*m_batch[i], m_responses[m_slots[i]], 0 == --m_refs[m_slots[i]]);
+        }
+
+        m_batches.fetch_add(1, std::memory_order_relaxed);
+        m_requests.fetch_add(m_batch.size(), std::memory_order_relaxed);
+        metrics_set(metrics->queue_depth, 0);
+    }
+}
+
+template<serial_device_type DEVICE>
+void basic_at_io_thread<DEVICE>::share (void)
+{
+    m_commands.clear();
+    m_refs.clear();
+    m_slots.resize(m_batch.size());
+
+    // Commands from scope on may answer later requests.
+    size_t scope = 0;
+
+    for (size_t i = 0; i < m_batch.size(); i++)
+    {
+        const std::string &command = m_batch[i]->command;
+        size_t slot = m_commands.size();
+
+        if (at_io_is_shareable(command))
+        {
+            for (size_t j = scope; j < m_commands.size(); j++)
+            {
+                if (m_commands[j] == command)
+                {
+                    slot = j;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            scope = m_commands.size() + 1;
+        }
+
+        if (slot == m_commands.size())
+        {
+            m_commands.push_back(command);
+            m_refs.push_back(0);
+        }
+
+        m_slots[i] = slot;
+        m_refs[slot]++;
+    }
+}
+
+template<serial_device_type DEVICE>
+void basic_at_io_thread<DEVICE>::transact (void)
+{
+    m_responses.resize(m_commands.size());
+
+    size_t i = 0;
+    while (i < m_commands.size())
+    {
+        if (!at_io_is_shareable(m_commands[i]))
+        {
+            m_responses[i].result = m_engine.transact(m_commands[i], m_responses[i].lines);
+            i++;
+            continue;
+        }
+
+        size_t end = i + 1;
+        while (end < m_commands.size() && at_io_is_shareable(m_commands[end]))
+        {
+            end++;
+        }
+
+        m_run.assign(m_commands.begin() + i, m_commands.begin() + end);
+        m_engine.transact_batch(m_run, m_run_responses);
+
+        for (size_t j = i; j < end; j++)
+        {
+            m_responses[j].lines.swap(m_run_responses[j - i].lines);
+            m_responses[j].result = m_run_responses[j - i].result;
+        }
+        i = end;
+    }
+}
+
+template<serial_device_type DEVICE>
+void basic_at_io_thread<DEVICE>::complete (at_request &request, at_response &response, bool last)
+{
+    // The last request sharing a response gets it swapped in: both keep
+    // their capacity for the next round.
+    if (last)
+    {
+        request.response.lines.swap(response.lines);
+    }
+    else
+    {
+        request.response.lines = response.lines;
+    }
+    request.response.result = response.result;
+
+    // The submitter may free the request as soon as it sees COMPLETE, so
+    // that is the last store; notify_one() goes before it, while the
+    // request is still alive.
+    request.m_state.store(at_request::WAKING, std::memory_order_release);
+    request.m_state.notify_one();
+    request.m_state.store(at_request::COMPLETE, std::memory_order_release);
+}
+
+
+
+using at_io_thread = basic_at_io_thread<serial_device>;
+
+// Issues commands in order rounds times from each of n_threads threads at
+// once through an at_io_thread, then prints throughput, latency
+// percentiles and how many commands shared an AT line to stderr. Each
+// response must carry only its own command's information lines. Returns
+// the number of commands that did not end in OK or got another's lines.
+uint64_t run_load (at_engine &engine, const std::vector<std::string> &commands, size_t n_threads, size_t rounds);
@@ -0,0 +1,136 @@
+#include "at_parser.h"
+#include "../common.h"
+
+#include <algorithm>
+#include <cctype>
+
+
+
+at_final classify_final (std::string_view line)
+{
+    static constexpr struct {
+        std::string_view    text;
+        bool                is_prefix;
+        at_final            result;
+    } FINAL_RESULTS [] = {
+        {"OK",              false,  at_final::ok},
+        {"ERROR",           false,  at_final::error},
+        {"+CME ERROR:",     true,   at_final::error},
+        {"+CMS ERROR:",     true,   at_final::error},
+        {"CONNECT",         true,   at_final::connect},
+        {"NO CARRIER",      false,  at_final::no_carrier},
+        {"BUSY",            false,  at_final::busy},
+        {"NO ANSWER",       false,  at_final::no_answer},
+        {"NO DIALTONE",     false,  at_final::no_dialtone},
+
+        // Ends sized sends (+QISEND, +CIPSEND).
+        {"SEND OK",         false,  at_final::ok},
+        {"SEND FAIL",       false,  at_final::error},
+    };
+
+    for (const auto &final : FINAL_RESULTS)
+    {
+        if (final.is_prefix ? line.starts_with(final.text) : line == final.text)
+        {
+            return final.result;
+        }
+    }
+
+    return at_final::none;
+}
+
+
+
+void at_line_reader::append (const char *data, size_t size)
+{
+    // Drop consumed lines before growing, so memory is bounded by the longest line.
+    if (m_pos > 0 && m_pos == m_buffer.size())
+    {
+        m_buffer.clear();
+        m_pos = 0;
+    }
+    else if (m_pos > m_buffer.size() / 2)
+    {
+        m_buffer.erase(0, m_pos);
+        m_pos = 0;
+    }
+
+    m_buffer.append(data, size);
+}
+
+bool at_line_reader::next_line (std::string &line)
+{
+    while (m_pos < m_buffer.size())
+    {
+        const size_t end = m_buffer.find_first_of("\r\n", m_pos);
+        if (end == std::string::npos)
+        {
+            break;
+        }
+
+        size_t beg = m_pos;
+        size_t last = end;
+        m_pos = end + 1;
+        m_after_cr = m_buffer[end] == '\r';
+
+        while (beg < last && std::isspace(static_cast<unsigned char>(m_buffer[beg])))
+        {
+            beg++;
+        }
+
+        while (last > beg && std::isspace(static_cast<unsigned char>(m_buffer[last - 1])))
+        {
+            last--;
+        }
+
+        if (beg < last)
+        {
+            line.assign(m_buffer, beg, last - beg);
+            DBG("Line: %s\n", line.c_str());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool at_line_reader::take_prompt (void)
+{
+    const size_t beg = m_buffer.find_first_not_of(" \r\n", m_pos);
+    const size_t last = m_buffer.find_last_not_of(" \r\n");
+
+    if (beg != std::string::npos && beg == last && m_buffer[beg] == '>')
+    {
+        m_buffer.clear();
+        m_pos = 0;
+        return true;
+    }
+
+    return false;
+}
+
+size_t at_line_reader::take_raw (std::string &dest, size_t size)
+{
+    // The "\n" of the preceding line's "\r\n" is not data.
+    if (m_after_cr && m_pos < m_buffer.size())
+    {
+        m_after_cr = false;
+        if (m_buffer[m_pos] == '\n')
+        {
+            m_pos++;
+        }
+    }
+
+    const size_t n = std::min(size, m_buffer.size() - m_pos);
+    dest.append(m_buffer, m_pos, n);
+    m_pos += n;
+
+    return n;
+}
+
+void at_line_reader::clear (void)
+{
+    m_buffer.clear();
+    m_pos = 0;
+    m_after_cr = false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+
+
+// Final result codes (V.250 / 27.007) that terminate a command's response.
+enum class at_final
+{
+    none,           // not a final result code
+    ok,
+    error,          // ERROR, +CME ERROR: <n>, +CMS ERROR: <n>
+    connect,
+    no_carrier,
+    busy,
+    no_answer,
+    no_dialtone,
+};
+
+at_final classify_final (std::string_view line);
+
+
+
+
+// Accumulates raw modem output and hands back complete lines with
+// surrounding whitespace removed. Empty lines are dropped.
+class at_line_reader
+{
+public:
+    void append (const char *data, size_t size);
+
+    // false: no complete line buffered yet
+    bool next_line (std::string &line);
+
+    // Consumes a pending "> " prompt (which has no line terminator), if
+    // that is all that is left in the buffer.
+    bool take_prompt (void);
+
+    // Moves up to size bytes of raw data following the last line into
+    // dest, e.g. a +QIRD payload. Returns the number moved.
+    size_t take_raw (std::string &dest, size_t size);
+
+    void clear (void);
+
+private:
+    std::string m_buffer;
+    size_t      m_pos       = 0;
+    bool        m_after_cr  = false;
+};
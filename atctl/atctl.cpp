@@ -2,223 +2,848 @@
 #include "../source_exception/source_exception.h"
 #include "../common.h"
 #include "string_manip.h"
-
-#include <iostream>
+#include "discovery.h"
+#include "at_parser.h"
+#include "output.h"
+#include "at_engine.h"
+#include "monitor.h"
+#include "sigint_fd.h"
+#include "sms.h"
+#include "sms_pdu.h"
+#include "cmux.h"
+#include "metrics.h"
+#include "reattach.h"
+#include "chat_script.h"
+#include "multi_device.h"
+#include "modem_socket.h"
+#include "telemetry.h"
+#include "realtime.h"
+#include "baud.h"
+#include "at_io_thread.h"
+
+#include <cctype>
 #include <cstdio>
 #include <fcntl.h>
 #include <cerrno>
 #include <string>
 #include <cstring>
-#include <filesystem>
 #include <vector>
-#ifndef _WIN32
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <map>
+#ifdef _WIN32
+    #include <iostream>     // interactive mode only; no std::cin/std::cout set-up otherwise
+#else
     #include <csignal>
-    #include <csetjmp>
     #include <unistd.h>
+    #include <poll.h>
     #include <sys/select.h>
+    #include <sys/signalfd.h>
 #endif
 
 
 
-#define RED             "\x1b[31m"
-#define GREEN           "\x1b[32m"
-#define YELLOW          "\x1b[33m"
-#define BRIGHT_YELLOW   "\x1b[93m"
-#define DEFAULT         "\x1b[39m"
+static bool interactive = false;
+static bool discover = false;
+static bool monitor = false;
+static monitor_options monitor_opts;
+static realtime_options rt_opts;
+static size_t max_line = AT_DEFAULT_MAX_LINE;
+static const char *sms_source = nullptr;
+static bool stream = false;
+static bool resend = false;
+static unsigned int cmux_channels = 0;
+static bool stats = false;
+static bool timing = false;
+static const char *script_path = nullptr;
+static serial_io_backend io_backend = serial_io_backend::io_uring;
+static std::string tcp_host;
+static uint16_t tcp_port = 0;
+static int tcp_out_fd = -1;
+static const char *record_path = nullptr;
+static const char *import_source = nullptr;
+static const char *scan_path = nullptr;
+static const char *scan_column = nullptr;
+static std::string scan_range;
+static telemetry_writer *recorder = nullptr;
+static bool decode_pdu = false;
+static sms_pdu_reader *pdu_reader = nullptr;
+static const char *decode_sms_source = nullptr;
+static size_t load_threads = 0;
+static size_t load_rounds = 100;
+
+// --baud: without it, a rate saved by --baud=auto or --baud=max is used.
+enum class baud_mode
+{
+    saved,
+    fixed,
+    detect,
+    negotiate,
+};
+static baud_mode baud = baud_mode::saved;
+static unsigned int baud_rate = 0;      // fixed: the rate, negotiate: the limit (0: none)
 
+static output_writer output(fileno(stdout));
 
 
 
-static bool interactive = false;
-static bool raw = false;
+static void _report_timeout (void)
+{
+    output.notice("Timed out.\n");
+}
 
+// CPU time used so far; at the top of main() that is fork/exec, loading
+// and static initialisation, as there was nothing to wait for yet.
+static double _process_cpu_us (void)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
 
-#ifndef _WIN32
-template <typename _CharT, typename _Traits, typename _Alloc>
-bool interruptable_getline (std::basic_istream<_CharT, _Traits> &__is, std::basic_string<_CharT, _Traits, _Alloc> &__str)
+static void _print_timing (double cpu_before_main_us, std::chrono::steady_clock::time_point main_start,
+                           std::chrono::steady_clock::time_point opened, std::chrono::steady_clock::time_point sending)
 {
-    static thread_local std::jmp_buf ctx_before_getline;
+    const auto since_main = [main_start](std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration<double, std::micro>(t - main_start).count();
+    };
 
-    bool was_interrupted;
-    auto prev_signal_handler = signal(SIGINT,
-        [](int signum) {
-            DBG("Calling std::longjmp()");
-            std::longjmp(ctx_before_getline, 1);
-        });
+    fprintf(stderr, "startup: %.0f us before main (cpu)", cpu_before_main_us);
+    if (opened != std::chrono::steady_clock::time_point())
+    {
+        fprintf(stderr, ", device open at +%.0f us, sending at +%.0f us", since_main(opened), since_main(sending));
+    }
+    fprintf(stderr, ", done at +%.0f us\n", since_main(std::chrono::steady_clock::now()));
+}
+
+// For --record, with the time the response arrived.
+static void _record (const std::string &line)
+{
+    if (recorder)
+    {
+        recorder->add(std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count(), line);
+    }
+}
+
+// A response line of a plain command: printed, or for --pdu taken into a
+// decoded SMS record.
+static void _print_line (const std::string &command, const std::string &line)
+{
+    if (!pdu_reader || !pdu_reader->line(command, line))
+    {
+        output.line(command, line);
+    }
+    _record(line);
+}
+
+// Copies the response through as it arrives; lines are only parsed to spot the final result code.
+// false: timed out.
+static bool _send_at_command_raw (serial_device &conn, const std::string &command)
+{
+    at_write_command(conn, command);
+    metrics_add(metrics->commands);
 
 
 
-    if (setjmp(ctx_before_getline))
+    at_line_reader lines;
+    std::string line;
+    bool terminator_found = false;
+    char buffer [256];
+
+    while (!terminator_found)
     {
-        signal(SIGINT, prev_signal_handler); // restore previous handler
-        was_interrupted = true;
+        // Async wait (if possible) for data to arrive.
+        const int rv = conn.wait_for_data(at_command_timeout(command));
+        if (rv < 0)
+        {
+            throw source_exception("Failed to wait for data");
+        }
+        else if (rv == 0)
+        {
+            _report_timeout();
+            at_abandon(conn);
+            break;
+        }
+
+        const ssize_t n_read = conn.read(buffer, sizeof(buffer));
+        if (n_read < 0)
+        {
+            throw source_exception("Failed to read from device");
+        }
+
+        metrics_add(metrics->bytes_rx, n_read);
+        output.text(std::string_view(buffer, n_read));
+        output.flush();
+
+        lines.append(buffer, n_read);
+        while (lines.next_line(line))
+        {
+            terminator_found = terminator_found || at_final::none != classify_final(line);
+        }
+    }
+
+    output.text("\n");
+    output.flush();
+    return terminator_found;
+}
+
+// false if any command timed out.
+static bool send_at_commands (serial_device &device, const std::vector<std::string> &commands)
+{
+    bool answered = true;
+
+    if (output.get_format() == output_format::raw)
+    {
+        for (const auto &command : commands)
+        {
+            answered = _send_at_command_raw(device, command) && answered;
+        }
+        return answered;
+    }
+
+    at_engine engine(device);
+    engine.set_max_line(max_line);
+    engine.set_skip_settings(!resend);
+
+    // Nothing to merge: print each line as soon as it is complete.
+    if (stream || commands.size() == 1)
+    {
+        for (const auto &command : commands)
+        {
+            const at_final result = engine.transact_stream(command,
+                [&command](const std::string &line) { _print_line(command, line); },
+                []() { output.flush(); });
+
+            if (result == at_final::none)
+            {
+                _report_timeout();
+                answered = false;
+            }
+        }
+
+        if (pdu_reader)
+        {
+            pdu_reader->finish();
+        }
+        output.flush();
+        return answered;
+    }
+
+    std::vector<at_response> responses;
+    engine.transact_batch(commands, responses);
+
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        for (const auto &line : responses[i].lines)
+        {
+            _print_line(commands[i], line);
+        }
+
+        if (responses[i].result == at_final::none)
+        {
+            _report_timeout();
+            answered = false;
+        }
+    }
+
+    if (pdu_reader)
+    {
+        pdu_reader->finish();
+    }
+    output.flush();
+    return answered;
+}
+
+#ifdef _WIN32
+static void send_at_command_interactive (serial_device &device, std::vector<std::string> &first_commands, device_watch *watch)
+{
+    output.notice("%s >>> Interactive mode. Enter q to quit. <<<%s\n", output.color(BRIGHT_YELLOW), output.color(DEFAULT));
+
+
+    for (auto &first_command : first_commands)
+    {
+        output.notice("\n%s > AT%s%s%s\n", output.color(YELLOW), output.color(BRIGHT_YELLOW), strip(first_command).c_str(), output.color(DEFAULT));
+        send_at_commands(device, {first_command});
+    }
+
+
+    std::string command;
+    while (1)
+    {
+        output.notice("\n%s > AT%s", output.color(YELLOW), output.color(BRIGHT_YELLOW));
+        output.flush();
+        std::getline(std::cin, command);
+        output.text(output.color(DEFAULT));
+
+        if (command == "q" || command == "Q")
+        {
+            break;
+        }
+
+        send_at_commands(device, {command});
+    }
+}
+#else
+static constexpr int ABORT_GRACE_MS     = 1000;
+
+// Any character received while a command executes makes the modem abort it (V.250 5.6.1).
+static constexpr char ABORT_CHAR = '\x1b';
+
+
+
+struct interactive_state
+{
+    using clock = std::chrono::steady_clock;
+
+    struct queued_command
+    {
+        std::string         text;
+        bool                echo;       // not already on screen from the terminal
+        clock::time_point   queued_at;
+    };
+
+    std::deque<queued_command> queued;      // commands entered while another is in flight
+    std::string             command;        // the in-flight command
+    std::string             echo;           // its echo
+    bool                    busy            = false;
+    bool                    aborting        = false;
+    bool                    prompt_shown    = false;
+    bool                    echo_input      = false;
+    clock::time_point       started;
+    clock::time_point       deadline;
+
+    int poll_timeout (void) const
+    {
+        if (!busy && !aborting)
+        {
+            return -1;
+        }
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        return remaining > 0 ? static_cast<int>(remaining) : 0;
+    }
+};
+
+static void _show_prompt (interactive_state &state)
+{
+    if (!state.prompt_shown)
+    {
+        output.notice("\n%s > AT%s", output.color(YELLOW), output.color(BRIGHT_YELLOW));
+        output.flush();
+        state.prompt_shown = true;
+    }
+}
+
+static void _start_command (serial_device &device, interactive_state &state, const std::string &command, bool echo)
+{
+    if (echo)
+    {
+        _show_prompt(state);
+        output.notice("%s%s\n", command.c_str(), output.color(DEFAULT));
     }
     else
     {
-        DBG("Calling std::getline()", 0);
-        std::getline(__is, __str);
-        was_interrupted = false;
+        output.text(output.color(DEFAULT));
     }
+    output.flush();
+
+    at_write_command(device, command);
+    metrics_add(metrics->commands);
 
+    state.command = command;
+    state.echo = "AT" + command;
+    state.busy = true;
+    state.prompt_shown = false;
+    state.started = interactive_state::clock::now();
+    state.deadline = state.started + std::chrono::milliseconds(at_command_timeout(command));
+}
+
+// The in-flight command is not retried: it may well be what reset the modem.
+static void _lose_device (serial_device &device, interactive_state &state, device_watch &watch)
+{
+    if (state.prompt_shown)
+    {
+        output.text(output.color("\r\x1b[K" DEFAULT));
+        state.prompt_shown = false;
+    }
 
+    if (state.busy)
+    {
+        output.notice("   %sDevice lost.%s\n", output.color(RED), output.color(DEFAULT));
+    }
 
-    return !was_interrupted;
+    state.busy = false;
+    state.aborting = false;
+    watch.lose(device);
 }
-#endif
 
+// Commands typed while the modem is away wait for it, but not forever.
+static void _drop_stale_commands (interactive_state &state)
+{
+    const auto oldest = interactive_state::clock::now() - std::chrono::milliseconds(REATTACH_QUEUE_MS);
+    size_t dropped = 0;
 
+    while (!state.queued.empty() && state.queued.front().queued_at < oldest)
+    {
+        state.queued.pop_front();
+        dropped++;
+    }
+
+    if (dropped)
+    {
+        output.notice("   %sDropped %zu commands queued while the device was away.%s\n", output.color(RED), dropped, output.color(DEFAULT));
+    }
+}
 
-static void _send_at_command (serial_device &conn, const std::string &command)
+static void _handle_device_line (interactive_state &state, std::string &line)
 {
-    // Write full command.
-    const std::string message = "AT" + command + "\r";
-    const ssize_t n_written = conn.write(message.c_str(), message.size());
+    if (state.busy)
+    {
+        if (line == state.echo)
+        {
+            return;
+        }
 
-    if (-1 == n_written)
+        const at_final result = classify_final(line);
+        output.line(state.command, line);
+
+        if (result != at_final::none)
+        {
+            metrics_record_result(result, line, std::chrono::duration<double, std::milli>(interactive_state::clock::now() - state.started).count());
+            state.busy = false;
+        }
+    }
+    else
     {
-        throw source_exception("Failed to write to device");
+        // Unsolicited output, or the tail of an aborted command: print it above the prompt.
+        if (state.prompt_shown)
+        {
+            output.text(output.color("\r\x1b[K" DEFAULT));
+            state.prompt_shown = false;
+        }
+
+        if (state.aborting && at_final::none != classify_final(line))
+        {
+            state.aborting = false;
+        }
+
+        output.line("", line);
     }
-    else if (n_written < message.size())
+}
+
+static void send_at_command_interactive (serial_device &device, std::vector<std::string> &first_commands, device_watch *watch)
+{
+    output.notice("%s >>> Interactive mode. Ctrl+c or q to quit. <<<%s\n", output.color(BRIGHT_YELLOW), output.color(DEFAULT));
+    output.flush();
+
+
+
+    sigint_fd sigint;
+    interactive_state state;
+    at_line_reader device_lines;
+    std::string input;
+    std::string line;
+    char buffer [512];
+
+    // When commands are piped in, echo them after the prompt like a terminal would.
+    state.echo_input = !isatty(STDIN_FILENO);
+
+    // Commands from the command line run first.
+    for (auto &first_command : first_commands)
     {
-        throw source_exception("Failed to write full command");
+        state.queued.push_back({strip(first_command), true, interactive_state::clock::now()});
     }
 
+    enum { FD_STDIN, FD_DEVICE, FD_SIGNAL, N_FDS };
+    pollfd fds [N_FDS] = {
+        {STDIN_FILENO,          POLLIN, 0},
+        {device.get_handle(),   POLLIN, 0},
+        {sigint.get_fd(),       POLLIN, 0},
+    };
 
 
-    // Read response.
-    std::string response;
-    bool terminator_found = false;
-    char buffer [128];
-    ssize_t n_read;
-    bool data_available;
 
-    while (!terminator_found)
+    bool running = true;
+    while (running)
     {
-        // Async wait (if possible) for data to arrive.
-        const int rv = conn.wait_for_data(30000);
-        if (rv < 0)
+        const bool lost = watch && watch->is_lost();
+        if (lost)
         {
-            throw source_exception("Failed to wait for data");
+            _drop_stale_commands(state);
         }
-        else if (rv == 0)
+
+        // Dispatch the next command once the modem is idle.
+        while (!state.busy && !state.aborting && !lost && !state.queued.empty() && running)
+        {
+            const auto command = std::move(state.queued.front());
+            state.queued.pop_front();
+
+            if (command.text == "q" || command.text == "Q")
+            {
+                running = false;
+                break;
+            }
+
+            try
+            {
+                _start_command(device, state, command.text, command.echo);
+            }
+            catch (const source_exception &e)
+            {
+                if (!watch || !watch->is_gone(device))
+                {
+                    throw;
+                }
+
+                // Never reached the modem, so it is safe to send again.
+                state.queued.push_front(command);
+                _lose_device(device, state, *watch);
+                fds[FD_DEVICE].fd = watch->get_fd();
+                break;
+            }
+        }
+
+        if (!running)
         {
-            printf("Timed out.\n");
             break;
         }
-        else
+
+        if (!state.busy)
+        {
+            if (fds[FD_STDIN].fd >= 0)
+            {
+                _show_prompt(state);
+            }
+            else if (!state.aborting && state.queued.empty())
+            {
+                // Nothing left to read commands from.
+                break;
+            }
+        }
+
+
+
+        output.flush();
+        metrics_set(metrics->queue_depth, state.queued.size());
+
+        const int rv = poll(fds, N_FDS, (watch && watch->is_lost()) ? watch->poll_timeout() : state.poll_timeout());
+        if (rv == -1)
         {
-            // Read all available data.
-            data_available = true;
-            while (!terminator_found && data_available)
+            if (EINTR == errno)
             {
-                n_read = conn.read(buffer, sizeof(buffer));
-                if (n_read < 0)
+                continue;
+            }
+
+            perror("poll");
+            break;
+        }
+        else if (watch && watch->is_lost())
+        {
+            // While lost, FD_DEVICE is the watch: look again on its events and on every probe interval.
+            if (rv == 0 || fds[FD_DEVICE].revents)
+            {
+                if (watch->try_reattach(device))
                 {
-                    throw source_exception("Failed to read from device");
+                    device_lines.clear();
+                    fds[FD_DEVICE].fd = device.get_handle();
                 }
-                else
+                else if (watch->get_outage_ms() > REATTACH_DEFAULT_TIMEOUT_MS)
                 {
-                    if (n_read > 0)
-                    {
-                        response.append(buffer, n_read);
+                    throw source_exception("Device did not come back");
+                }
+            }
 
-                        for (const auto &term : {"OK\r\n", "ERROR\r\n"})
-                        {
-                            if (response.ends_with(term))
-                            {
-                                terminator_found = true;
-                                break;
-                            }
-                        }
-                    }
+            fds[FD_DEVICE].revents = 0;
+        }
+        else if (rv == 0)
+        {
+            if (state.busy)
+            {
+                output.notice("   Timed out.\n");
+                metrics_record_result(at_final::none, {}, std::chrono::duration<double, std::milli>(interactive_state::clock::now() - state.started).count());
+
+                // It may still answer: abort it, and hold the next command
+                // back until its tail is through, as after Ctrl+C.
+                (void)device.write(&ABORT_CHAR, 1);
+                state.busy = false;
+                state.aborting = true;
+                state.deadline = interactive_state::clock::now() + std::chrono::milliseconds(ABORT_GRACE_MS);
+            }
+            else
+            {
+                state.aborting = false;
+            }
+            continue;
+        }
 
-                    if (n_read < sizeof(buffer))
-                    {
-                        data_available = false;
-                    }
+
+
+        // Ctrl+C cancels the in-flight command, or quits at the prompt.
+        if (fds[FD_SIGNAL].revents & POLLIN)
+        {
+            if (SIGINT == sigint.consume() && state.busy)
+            {
+                (void)device.write(&ABORT_CHAR, 1);
+                output.notice("%s   %sCancelled.%s\n", output.color(DEFAULT), output.color(RED), output.color(DEFAULT));
+
+                state.busy = false;
+                state.aborting = true;
+                state.deadline = interactive_state::clock::now() + std::chrono::milliseconds(ABORT_GRACE_MS);
+                state.queued.clear();
+            }
+            else
+            {
+                output.notice("%s\nUser requested stop.\n", output.color(DEFAULT));
+                running = false;
+            }
+        }
+
+        // Modem output is shown as soon as it arrives, whether or not a command is pending.
+        if (fds[FD_DEVICE].revents & (POLLIN | POLLERR | POLLHUP))
+        {
+            const ssize_t n_read = device.read(buffer, sizeof(buffer));
+            if (n_read <= 0 && watch && watch->is_gone(device))
+            {
+                _lose_device(device, state, *watch);
+                fds[FD_DEVICE].fd = watch->get_fd();
+            }
+            else if (n_read < 0)
+            {
+                throw source_exception("Failed to read from device");
+            }
+            else if (n_read == 0)
+            {
+                throw source_exception("Device disconnected");
+            }
+            else
+            {
+                metrics_add(metrics->bytes_rx, n_read);
+                device_lines.append(buffer, n_read);
+                while (device_lines.next_line(line))
+                {
+                    _handle_device_line(state, line);
+                }
+            }
+        }
+
+        if (fds[FD_STDIN].revents & (POLLIN | POLLHUP))
+        {
+            const ssize_t n_read = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (n_read <= 0)
+            {
+                // EOF: finish what was queued, then quit.
+                fds[FD_STDIN].fd = -1;
+                if (state.prompt_shown)
+                {
+                    output.notice("%s\n", output.color(DEFAULT));
                 }
             }
+            else
+            {
+                input.append(buffer, n_read);
+            }
+
+            size_t end;
+            while (std::string::npos != (end = input.find('\n')))
+            {
+                state.queued.push_back({input.substr(0, end), state.echo_input, interactive_state::clock::now()});
+                strip(state.queued.back().text);
+                input.erase(0, end + 1);
+            }
+
+            // A command typed at the terminal has been echoed and followed by a newline already.
+            if (!state.echo_input)
+            {
+                state.prompt_shown = false;
+            }
+        }
+    }
+
+    output.text(output.color(DEFAULT));
+    output.flush();
+}
+#endif
+
+static int send_sms (serial_device &device)
+{
+    const bool from_stdin = (0 == strcmp(sms_source, "-"));
+    FILE *input = from_stdin ? stdin : fopen(sms_source, "r");
+
+    if (!input)
+    {
+        perror(sms_source);
+        return EXIT_FAILURE;
+    }
+
+    at_engine engine(device);
+    engine.set_skip_settings(!resend);
+    const size_t failed = run_sms_send(engine, input, output);
+
+    if (!from_stdin)
+    {
+        fclose(input);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int run_script (serial_device &device, const std::vector<std::string> &assignments)
+{
+    std::map<std::string, std::string> vars;
+    for (const auto &assignment : assignments)
+    {
+        const size_t eq = assignment.find('=');
+        if (eq == std::string::npos || eq == 0)
+        {
+            fprintf(stderr, "Expected name=value, got: %s\n", assignment.c_str());
+            return EXIT_FAILURE;
         }
+        vars[assignment.substr(0, eq)] = assignment.substr(eq + 1);
     }
 
+    FILE *f = fopen(script_path, "r");
+    if (!f)
+    {
+        perror(script_path);
+        return EXIT_FAILURE;
+    }
 
+    chat_script script;
+    const bool loaded = script.load(f, script_path);
+    fclose(f);
 
-    // Print response.
-    if (raw)
+    if (!loaded)
     {
-        printf("%s\n", response.c_str());
+        return EXIT_FAILURE;
     }
-    else
+
+    at_engine engine(device);
+    engine.set_skip_settings(!resend);
+    return script.run(engine, vars, output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void run_cmux (serial_device &device)
+{
+#ifdef _WIN32
+    throw source_exception("--cmux is not supported on Windows");
+#else
+    std::vector<std::string> lines;
+    at_engine engine(device);
+    engine.set_skip_settings(!resend);
+
+    if (at_final::ok != engine.transact("+CMUX=0", lines))
+    {
+        throw source_exception("Modem did not enter CMUX mode");
+    }
+
+    sigint_fd sigint;
+    const auto start = std::chrono::steady_clock::now();
+
+    cmux mux(device);
+    mux.open(cmux_channels);
+
+    fprintf(stderr, "Multiplexing %u channels, Ctrl+c to stop.\n", cmux_channels);
+    cmux_relay_ptys(mux, sigint.get_fd());
+    mux.close();
+
+    cmux_print_stats(mux, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+#endif
+}
+
+static void run_tcp (serial_device &device)
+{
+#ifdef _WIN32
+    throw source_exception("--tcp is not supported on Windows");
+#else
+    at_engine engine(device);
+    engine.set_skip_settings(!resend);
+    sigint_fd sigint;
+
+    modem_socket_bridge(engine, tcp_host, tcp_port, STDIN_FILENO, tcp_out_fd, sigint.get_fd());
+#endif
+}
+
+// Right after opening: the modem must be reachable at the device's rate.
+static void set_up_baud (serial_device &device, const char *device_path)
+{
+    unsigned int rate;
+
+    switch (baud)
     {
-        // omit first line b/c it echoes the input
-        for (auto &line : split(response, 1))
+        case baud_mode::saved:
+            rate = load_baud_rate(device_path);
+            if (rate && !device.set_baud_rate(rate))
+            {
+                fprintf(stderr, "Cannot set the saved rate of %u baud\n", rate);
+            }
+            break;
+
+        case baud_mode::fixed:
+            if (!device.set_baud_rate(baud_rate))
+            {
+                throw source_exception("Baud rate not supported by the device");
+            }
+            break;
+
+        case baud_mode::detect:
+        case baud_mode::negotiate:
         {
-            // remove leading/trailing whitespace
-            strip(line);
+            at_engine engine(device);
+            rate = baud_detect(engine, load_baud_rate(device_path));
+            if (!rate)
+            {
+                throw source_exception("The modem does not answer at any baud rate");
+            }
+            fprintf(stderr, "Modem answers at %u baud\n", rate);
 
-            // omit empty lines
-            if (!line.empty())
+            if (baud == baud_mode::negotiate)
             {
-                if (line == "OK")
+                rate = baud_negotiate(engine, baud_rate);
+                if (!rate)
                 {
-                    line.insert(0, GREEN).append(DEFAULT);
-                }
-                else if (line == "ERROR")
-                {
-                    line.insert(0, RED).append(DEFAULT);
+                    throw source_exception("Lost the modem while changing the baud rate");
                 }
+            }
 
-                printf("   %s\n", line.c_str());
+            if (save_baud_rate(device_path, rate))
+            {
+                fprintf(stderr, "Saved %u baud for %s to %s\n", rate, device_path, baud_map_path());
             }
+            break;
         }
     }
 }
 
-static void send_at_command (serial_device &device, const std::string &command)
+static void discover_ports (void)
 {
-    _send_at_command(device, command);
-}
+    const auto start = std::chrono::steady_clock::now();
 
-static void send_at_command_interactive (serial_device &device, std::string &first_command)
-{
-#ifdef _WIN32
-    printf(BRIGHT_YELLOW " >>> Interactive mode. Enter q to quit. <<<" DEFAULT "\n");
-#else
-    printf(BRIGHT_YELLOW " >>> Interactive mode. Ctrl+c or q to quit. <<<" DEFAULT "\n");
-#endif
+    auto ports = enumerate_ports();
+    probe_ports(ports);
 
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
 
-    strip(first_command);
-    if (!first_command.empty())
-    {
-        printf("\n" YELLOW " > AT" BRIGHT_YELLOW "%s" DEFAULT "\n", first_command.c_str());
-        _send_at_command(device, first_command);
-    }
 
 
-    std::string command;
-    while (1)
+    printf("modem  device              vid:pid    if  AT\n");
+    for (const auto &port : ports)
     {
-        printf("\n" YELLOW " > AT" BRIGHT_YELLOW);
-
-#ifdef _WIN32
-        std::getline(std::cin, command);
-#else
-        if (!interruptable_getline(std::cin, command))
-        {
-            printf(DEFAULT "\nUser requested stop.\n");
-            break;
-        }
-#endif
-
-        printf(DEFAULT);
+        printf("%-5u  %-18s  %04x:%04x  %2d  %s%s%s\n",
+               port.modem, port.device.c_str(), port.vid, port.pid, port.interface,
+               port.answers_at ? output.color(GREEN) : "", port.answers_at ? "yes" : "", output.color(DEFAULT));
+    }
 
-        if (command == "q" || command == "Q")
-        {
-            break;
-        }
+    printf("\nProbed %zu ports in %lld ms.\n", ports.size(), static_cast<long long>(elapsed.count()));
 
-        _send_at_command(device, command);
+    if (save_port_map(ports))
+    {
+        printf("Saved port map to %s\n", port_map_path());
     }
 }
 
@@ -227,19 +852,111 @@ static void send_at_command_interactive (serial_device &device, std::string &fir
 static std::false_type usage (const char *detail = nullptr)
 {
     static const char USAGE_MESSAGE [] =
-        "Usage: atctl [options] <device> [command]\n"
-        "  device       A serial device with which to send AT-Commands.\n"
-        "  command      An AT-Command to issue (without AT prefix). If\n"
-        "               omitted, interactive mode will be used.\n"
+        "Usage: atctl [options] <device> [command...]\n"
+        "       atctl --discover\n"
+        "       atctl --stats\n"
+        "       atctl --sms <file|-> <device>\n"
+        "       atctl --cmux <n> <device>\n"
+        "       atctl --tcp <host:port> <device>\n"
+        "       atctl --script <file> <device> [name=value...]\n"
+        "       atctl --import <file|-> --record <file>\n"
+        "       atctl --scan <file> [<table>.<column> [<min>..<max>]]\n"
+        "       atctl --decode-sms <file|->\n"
+        "  device       A serial device with which to send AT-Commands, or\n"
+        "               @N for the AT port of modem N (see --discover).\n"
+        "               Several, separated by commas, run the commands on\n"
+        "               all of them at once.\n"
+        "  command      AT-Commands to issue (without AT prefix), in order.\n"
+        "               If omitted, interactive mode will be used.\n"
         "\n"
         "  options:\n"
-        "    -r         Print the raw unfiltered response.\n"
+        "    -r         Print the raw unfiltered response. Same as --format=raw.\n"
+        "    --format=<text|raw|jsonl|csv>\n"
+        "               Output format. Colors are only used for text on a\n"
+        "               terminal.\n"
         "    -i         Interactive mode.\n"
+        "    -s, --stream\n"
+        "               Print each response line as soon as it arrives instead\n"
+        "               of merging commands (always the case for one command).\n"
+        "    --discover Find USB modems and their AT ports, and save the\n"
+        "               mapping for use with @N.\n"
+        "    --baud=<rate|auto|max[:<limit>]>\n"
+        "               Serial line rate. auto finds the rate the modem\n"
+        "               answers at; max then raises it with AT+IPR to the\n"
+        "               highest rate (up to limit) that passes a check. Both\n"
+        "               save the rate for the device, which is used from then\n"
+        "               on; commands are optional.\n"
+        "    --stats    Print the counters of running atctl monitor,\n"
+        "               interactive, SMS and CMUX sessions.\n"
+        "    --monitor <interval>\n"
+        "               Keep the device open and issue the commands every\n"
+        "               interval (e.g. 100ms, 2s) until interrupted.\n"
+        "    --changes  With --monitor, only print responses that changed.\n"
+        "    --rt[=<priority>]\n"
+        "               With --monitor, poll from a SCHED_FIFO thread\n"
+        "               (priority 1-99, default 50) with locked, pre-faulted\n"
+        "               memory. Needs CAP_SYS_NICE and CAP_IPC_LOCK or the\n"
+        "               matching rtprio and memlock limits.\n"
+        "    --cpu=<n[,n...]>\n"
+        "               With --monitor, poll from a thread bound to these CPUs.\n"
+        "    --sms <file|->\n"
+        "               Send text-mode SMS, one \"<number> <text>\" per line\n"
+        "               (\\n for a line break), read from a file or stdin.\n"
+        "    --pdu      Decode the SMS PDUs in +CMGL and +CMGR responses (PDU\n"
+        "               mode, AT+CMGF=0) into records: index, status, smsc,\n"
+        "               number, time, parts, text. Concatenated messages are\n"
+        "               joined.\n"
+        "    --decode-sms <file|->\n"
+        "               The same for a saved +CMGL listing (-r or text output).\n"
+        "    --cmux <n> Start a 27.010 multiplexer on the device and expose n\n"
+        "               channels as ptys, so several atctl instances can share\n"
+        "               one serial port, until interrupted.\n"
+        "    --tcp <host:port>\n"
+        "               Connect through the modem's TCP/IP stack (Quectel\n"
+        "               +QIOPEN) and bridge stdin and stdout to it.\n"
+        "    --script <file>\n"
+        "               Run a chat script (send/expect/if/capture/retry, see\n"
+        "               chat_script.h) in-process. Arguments after the device\n"
+        "               set script variables.\n"
+        "    --record <file>\n"
+        "               Append the numbers in +CSQ, +CREG, +CEREG and LTE\n"
+        "               +QENG responses to a columnar telemetry file, with\n"
+        "               --monitor or plain commands.\n"
+        "    --import <file|->\n"
+        "               Convert sample output of --monitor (raw, text or\n"
+        "               jsonl) into the --record file.\n"
+        "    --scan <file>\n"
+        "               List the tables and columns of a telemetry file, or\n"
+        "               the statistics of one column, optionally counting the\n"
+        "               values within a range.\n"
+        "    --io=<io_uring|epoll>\n"
+        "               I/O backend for several devices (default io_uring,\n"
+        "               falling back to epoll where it is unavailable).\n"
+        "    --resend   Send settings (E0, +CMEE=2, ...) even if the modem\n"
+        "               has already confirmed them on this connection.\n"
+        "    --timing   Print to stderr how long startup, opening the device\n"
+        "               and the commands took.\n"
+        "    --load <threads>[x<rounds>]\n"
+        "               Issue the commands rounds times (default 100) from\n"
+        "               this many threads at once through one I/O thread,\n"
+        "               and print throughput and latency to stderr. Fails\n"
+        "               if a command is not OK or gets another's answer.\n"
+        "    --max-line=<n>\n"
+        "               Merge consecutive extended commands into command\n"
+        "               lines of at most n characters (default 128, 0: off).\n"
         "    -h, --help\n"
         "\n"
         "  Examples:\n"
         "    atctl /dev/ttyUSB0 GSTATUS?\n"
         "    atctl -i /dev/ttyUSB0\n"
+        "    atctl @3 CSQ\n"
+        "    atctl /dev/ttyUSB2,/dev/ttyUSB6,@3 +CSQ +CREG?\n"
+        "    atctl --monitor 100ms --format=jsonl @3 +CSQ +CREG?\n"
+        "    atctl --baud=max:921600 /dev/ttyS1\n"
+        "    atctl --monitor 10s --record cov.atct @3 +CSQ +QENG=\\\"servingcell\\\"\n"
+        "    atctl --scan cov.atct serving.rsrp -140..-110\n"
+        "    atctl --pdu --format=jsonl @3 +CMGF=0 +CMGL=4\n"
+        "    atctl --load 8x1000 @3 +CSQ +CREG? +COPS?\n"
         ;
 
     if (detail)
@@ -251,16 +968,12 @@ static std::false_type usage (const char *detail = nullptr)
     return std::false_type();
 }
 
-static bool parse (int argc, char *argv[], const char *&device_dest, std::string &command_dest)
+static bool parse (int argc, char *argv[], const char *&device_dest, std::vector<std::string> &commands_dest)
 {
     constexpr size_t N_REQ = 1;
     char *req_positional [N_REQ];
     size_t req_count = 0;
 
-    constexpr size_t N_OP_MAX = 1;
-    char *op_positional [N_OP_MAX];
-    size_t op_count = 0;
-
 
 
     // check if requesting help
@@ -285,17 +998,228 @@ static bool parse (int argc, char *argv[], const char *&device_dest, std::string
         char *arg = argv[i];
 
 
-        // optional flags
-        if (arg[0] == '-')
+        // optional flags (not negative numbers, e.g. a --scan range)
+        if (arg[0] == '-' && !isdigit(static_cast<unsigned char>(arg[1])))
         {
             if (0 == strncmp("-r", arg, 3))
             {
-                raw = true;
+                output.set_format(output_format::raw);
+            }
+            else if (0 == strncmp("--format=", arg, 9))
+            {
+                output_format format;
+                if (!parse_output_format(arg + 9, format))
+                {
+                    const auto str = std::string("Unrecognized format: ").append(arg + 9);
+                    return usage(str.c_str());
+                }
+                output.set_format(format);
+            }
+            else if (0 == strncmp("-s", arg, 3) || 0 == strncmp("--stream", arg, 9))
+            {
+                stream = true;
             }
             else if (0 == strncmp("-i", arg, 3))
             {
                 interactive = true;
             }
+            else if (0 == strncmp("--resend", arg, 9))
+            {
+                resend = true;
+            }
+            else if (0 == strncmp("--discover", arg, 11))
+            {
+                discover = true;
+            }
+            else if (0 == strncmp("--stats", arg, 8))
+            {
+                stats = true;
+            }
+            else if (0 == strncmp("--pdu", arg, 6))
+            {
+                decode_pdu = true;
+            }
+            else if (0 == strncmp("--decode-sms", arg, 13))
+            {
+                if (i + 1 >= argc)
+                {
+                    return usage("--decode-sms needs a file, or - for stdin");
+                }
+
+                decode_sms_source = argv[++i];
+            }
+            else if (0 == strncmp("--timing", arg, 9))
+            {
+                timing = true;
+            }
+            else if (0 == strncmp("--load", arg, 7))
+            {
+                char *end = nullptr;
+                if (i + 1 < argc)
+                {
+                    load_threads = strtoul(argv[i + 1], &end, 10);
+                    if ('x' == *end)
+                    {
+                        load_rounds = strtoul(end + 1, &end, 10);
+                    }
+                }
+                if (!end || *end || load_threads < 1 || load_threads > 1024 || load_rounds < 1)
+                {
+                    return usage("--load needs a thread count, optionally with rounds (8x1000)");
+                }
+
+                i++;
+            }
+            else if (0 == strncmp("--monitor", arg, 10))
+            {
+                if (i + 1 >= argc || !parse_interval(argv[i + 1], monitor_opts.interval))
+                {
+                    return usage("--monitor needs a valid interval");
+                }
+
+                monitor = true;
+                i++;
+            }
+            else if (0 == strncmp("--sms", arg, 6))
+            {
+                if (i + 1 >= argc)
+                {
+                    return usage("--sms needs a file, or - for stdin");
+                }
+
+                sms_source = argv[++i];
+            }
+            else if (0 == strncmp("--cmux", arg, 7))
+            {
+                char *end = nullptr;
+                if (i + 1 < argc)
+                {
+                    cmux_channels = strtoul(argv[++i], &end, 10);
+                }
+
+                if (!end || *end || cmux_channels < 1 || cmux_channels > CMUX_MAX_CHANNELS)
+                {
+                    return usage("--cmux needs a channel count between 1 and 8");
+                }
+            }
+            else if (0 == strncmp("--tcp", arg, 6))
+            {
+                if (i + 1 >= argc || !parse_host_port(argv[++i], tcp_host, tcp_port))
+                {
+                    return usage("--tcp needs host:port");
+                }
+            }
+            else if (0 == strncmp("--script", arg, 9))
+            {
+                if (i + 1 >= argc)
+                {
+                    return usage("--script needs a file");
+                }
+
+                script_path = argv[++i];
+            }
+            else if (0 == strncmp("--record", arg, 9))
+            {
+                if (i + 1 >= argc)
+                {
+                    return usage("--record needs a file");
+                }
+
+                record_path = argv[++i];
+            }
+            else if (0 == strncmp("--import", arg, 9))
+            {
+                if (i + 1 >= argc)
+                {
+                    return usage("--import needs a file, or - for stdin");
+                }
+
+                import_source = argv[++i];
+            }
+            else if (0 == strncmp("--scan", arg, 7))
+            {
+                if (i + 1 >= argc)
+                {
+                    return usage("--scan needs a file");
+                }
+
+                scan_path = argv[++i];
+            }
+            else if (0 == strncmp("--rt", arg, 5) || 0 == strncmp("--rt=", arg, 5))
+            {
+                char *end = nullptr;
+                rt_opts.priority = arg[4] ? strtol(arg + 5, &end, 10) : 50;
+                rt_opts.lock_memory = true;
+
+                if ((end && (end == arg + 5 || *end)) || rt_opts.priority < 1 || rt_opts.priority > 99)
+                {
+                    return usage("--rt needs a priority between 1 and 99");
+                }
+            }
+            else if (0 == strncmp("--cpu=", arg, 6))
+            {
+                if (!parse_cpu_list(arg + 6, rt_opts.cpus))
+                {
+                    return usage("--cpu needs a CPU number or a list like 2,3");
+                }
+            }
+            else if (0 == strncmp("--baud=", arg, 7))
+            {
+                const char *rate = nullptr;
+
+                if (0 == strcmp(arg + 7, "auto"))
+                {
+                    baud = baud_mode::detect;
+                }
+                else if (0 == strcmp(arg + 7, "max"))
+                {
+                    baud = baud_mode::negotiate;
+                }
+                else if (0 == strncmp(arg + 7, "max:", 4))
+                {
+                    baud = baud_mode::negotiate;
+                    rate = arg + 11;
+                }
+                else
+                {
+                    baud = baud_mode::fixed;
+                    rate = arg + 7;
+                }
+
+                char *end = nullptr;
+                if (rate && ((baud_rate = strtoul(rate, &end, 10)) == 0 || *end))
+                {
+                    return usage("--baud needs a rate, auto, or max with an optional limit (max:921600)");
+                }
+            }
+            else if (0 == strncmp("--changes", arg, 10))
+            {
+                monitor_opts.changes_only = true;
+            }
+            else if (0 == strncmp("--io=", arg, 5))
+            {
+                if (0 == strcmp(arg + 5, "io_uring"))
+                {
+                    io_backend = serial_io_backend::io_uring;
+                }
+                else if (0 == strcmp(arg + 5, "epoll"))
+                {
+                    io_backend = serial_io_backend::epoll;
+                }
+                else
+                {
+                    return usage("--io needs io_uring or epoll");
+                }
+            }
+            else if (0 == strncmp("--max-line=", arg, 11))
+            {
+                char *end;
+                max_line = strtoul(arg + 11, &end, 10);
+                if (end == arg + 11 || *end)
+                {
+                    return usage("--max-line needs a number");
+                }
+            }
             else
             {
                 const auto str = std::string("Unrecognized option: ").append(arg);
@@ -309,18 +1233,48 @@ static bool parse (int argc, char *argv[], const char *&device_dest, std::string
             req_positional[req_count++] = arg;
         }
 
-        // optional positional args
-        else if (op_count < N_OP_MAX)
+        // commands
+        else
         {
-            op_positional[op_count++] = arg;
+            commands_dest.emplace_back(arg);
         }
+    }
 
-        // unknown arg (all positional args have been supplied)
-        else
+    // Neither talks to a particular device.
+    if (discover || stats)
+    {
+        return true;
+    }
+
+    // Telemetry files only.
+    if (scan_path)
+    {
+        if (commands_dest.size() > 1)
+        {
+            return usage("--scan takes a column and a range");
+        }
+
+        scan_column = req_count ? req_positional[0] : nullptr;
+        scan_range = commands_dest.empty() ? "" : commands_dest[0];
+        return true;
+    }
+
+    if (decode_sms_source)
+    {
+        if (output.get_format() == output_format::raw)
+        {
+            return usage("--decode-sms prints records: text, jsonl or csv");
+        }
+        return true;
+    }
+
+    if (import_source)
+    {
+        if (!record_path)
         {
-            const auto str = std::string("Unrecognized argument: ").append(arg);
-            return usage(str.c_str());
+            return usage("--import needs --record");
         }
+        return true;
     }
 
     // Make sure all required args were supplied.
@@ -336,48 +1290,230 @@ static bool parse (int argc, char *argv[], const char *&device_dest, std::string
         device_dest = req_positional[0];
     }
 
-    // Handle any extra args.
-    if (op_count > 0)
+    // Several devices only take plain commands.
+    if (strchr(device_dest, ',') && (commands_dest.empty() || interactive || monitor || sms_source || cmux_channels || script_path || tcp_port))
     {
-        command_dest = op_positional[0];
+        return usage("Several devices need commands and work without -i, --monitor, --sms, --cmux, --tcp and --script");
     }
-    else
+
+    if (strchr(device_dest, ',') && baud != baud_mode::saved)
+    {
+        return usage("--baud works with one device");
+    }
+
+    // Handle any extra args.
+    if (commands_dest.empty() && !sms_source && !cmux_channels && !script_path && !tcp_port
+        && baud != baud_mode::detect && baud != baud_mode::negotiate)
     {
+        if (monitor)
+        {
+            return usage("--monitor needs at least one command");
+        }
+
         interactive = true;
     }
 
+    if (rt_opts.enabled() && !monitor)
+    {
+        return usage("--rt and --cpu work with --monitor");
+    }
+
+    if (record_path && (interactive || sms_source || cmux_channels || tcp_port || script_path || strchr(device_dest, ',')
+                        || (!monitor && output.get_format() == output_format::raw)))
+    {
+        return usage("--record works with --monitor and plain commands");
+    }
+
+    if (decode_pdu && (interactive || monitor || sms_source || cmux_channels || tcp_port || script_path || strchr(device_dest, ',')
+                       || output.get_format() == output_format::raw))
+    {
+        return usage("--pdu works with plain commands, without -r");
+    }
+
+    if (load_threads && (interactive || monitor || sms_source || cmux_channels || tcp_port || script_path || strchr(device_dest, ',')
+                         || decode_pdu || record_path))
+    {
+        return usage("--load works with plain commands on one device");
+    }
+
 
     return true;
 }
 
 int main (int argc, char *argv[])
 {
-    const char *device_path;
-    std::string command;
+    // First, for --timing: what exec, the loader and static initialisation cost.
+    const double cpu_before_main_us = _process_cpu_us();
+    const auto main_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point opened, sending;
+
+    const char *device_path = nullptr;
+    std::vector<std::string> commands;
     int rc = EXIT_FAILURE;
 
 
 
     // Parse command line args.
-    if (parse(argc, argv, device_path, command))
+    if (parse(argc, argv, device_path, commands))
     {
+#ifndef _WIN32
+        // stdout carries the remote end's data; anything else printed goes to stderr.
+        if (tcp_port)
+        {
+            fflush(stdout);
+            tcp_out_fd = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+#endif
+
         try
         {
-            serial_device at_device;
-            if (at_device.open(device_path))
+            std::string resolved_path;
+            telemetry_writer record;
+            sms_pdu_reader pdu(output);
+
+            if (decode_pdu)
+            {
+                pdu_reader = &pdu;
+            }
+
+            if (record_path)
             {
-                if (interactive)
+                if (!record.open(record_path))
                 {
-                    send_at_command_interactive(at_device, command);
+                    throw source_exception("Failed to open the --record file");
                 }
-                else
+                recorder = &record;
+                monitor_opts.record = &record;
+            }
+
+            if (scan_path)
+            {
+                if (telemetry_scan(scan_path, scan_column, scan_range.empty() ? nullptr : scan_range.c_str()))
                 {
-                    send_at_command(at_device, command);
+                    rc = EXIT_SUCCESS;
+                }
+            }
+            else if (decode_sms_source)
+            {
+                if (sms_decode_file(decode_sms_source, output))
+                {
+                    rc = EXIT_SUCCESS;
+                }
+            }
+            else if (import_source)
+            {
+                if (telemetry_import(import_source, record))
+                {
+                    rc = EXIT_SUCCESS;
+                }
+            }
+            else if (discover)
+            {
+                discover_ports();
+                rc = EXIT_SUCCESS;
+            }
+            else if (stats)
+            {
+                if (0 == metrics_print_all(stdout))
+                {
+                    fprintf(stderr, "No running atctl processes found.\n");
                 }
-
-                at_device.close();
                 rc = EXIT_SUCCESS;
             }
+            else if (strchr(device_path, ','))
+            {
+                if (0 == send_at_commands_multi(split_device_list(device_path), commands, io_backend, output))
+                {
+                    rc = EXIT_SUCCESS;
+                }
+            }
+            else
+            {
+                if (resolve_at_port(device_path, resolved_path))
+                {
+                    device_path = resolved_path.c_str();
+                }
+
+                output.set_device(device_path);
+
+                serial_device at_device;
+                if (at_device.open(device_path))
+                {
+                    set_up_baud(at_device, device_path);
+                    opened = std::chrono::steady_clock::now();
+                    rc = EXIT_SUCCESS;
+
+                    // Long-running modes can be watched with atctl --stats.
+                    if (sms_source || cmux_channels || tcp_port || monitor || interactive)
+                    {
+                        metrics_publish(device_path);
+                    }
+
+                    sending = std::chrono::steady_clock::now();
+
+                    if (sms_source)
+                    {
+                        rc = send_sms(at_device);
+                    }
+                    else if (cmux_channels)
+                    {
+                        run_cmux(at_device);
+                    }
+                    else if (tcp_port)
+                    {
+                        run_tcp(at_device);
+                    }
+                    else if (script_path)
+                    {
+                        rc = run_script(at_device, commands);
+                    }
+                    else if (monitor)
+                    {
+                        device_watch watch(device_path);
+                        at_engine engine(at_device);
+                        engine.set_max_line(max_line);
+                        engine.set_skip_settings(!resend);
+                        if (rt_opts.enabled())
+                        {
+                            realtime_run(rt_opts, [&]() { run_monitor(engine, commands, monitor_opts, output, &watch); });
+                        }
+                        else
+                        {
+                            run_monitor(engine, commands, monitor_opts, output, &watch);
+                        }
+                    }
+                    else if (load_threads)
+                    {
+                        at_engine engine(at_device);
+                        engine.set_max_line(max_line);
+                        engine.set_skip_settings(!resend);
+                        if (run_load(engine, commands, load_threads, load_rounds))
+                        {
+                            rc = EXIT_FAILURE;
+                        }
+                    }
+                    else if (interactive)
+                    {
+                        device_watch watch(device_path);
+                        send_at_command_interactive(at_device, commands, &watch);
+                    }
+                    else if (!commands.empty())
+                    {
+                        if (!send_at_commands(at_device, commands))
+                        {
+                            rc = EXIT_FAILURE;
+                        }
+                    }
+
+                    at_device.close();
+                }
+            }
+
+            if (record_path && !record.close())
+            {
+                rc = EXIT_FAILURE;
+            }
         }
         catch (const source_exception &e)
         {
@@ -391,8 +1527,14 @@ int main (int argc, char *argv[])
 
 
 
-    printf(DEFAULT);
+    output.text(output.color(DEFAULT));
+    output.flush();
+
+    if (timing)
+    {
+        _print_timing(cpu_before_main_us, main_start, opened, sending);
+    }
+
     fflush(stderr);
-    fflush(stdout);
     return rc;
 }
@@ -0,0 +1,312 @@
+#include "baud.h"
+#include "state_file.h"
+#include "../common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+
+
+// In the order they are tried: what modems ship at, then the usual
+// upgrades, then the rest.
+static constexpr unsigned int BAUD_CANDIDATES [] = {
+    115200, 921600, 460800, 230400, 57600, 38400, 19200, 9600,
+    1000000, 1500000, 2000000, 3000000, 4000000,
+};
+
+// Modems switch once the OK of AT+IPR is out; some take a moment longer.
+static constexpr size_t BAUD_SWITCH_MS = 20;
+
+// AT+IPR sent at a rate that garbles it is repeated this often.
+static constexpr size_t BAUD_RESTORE_TRIES = 3;
+
+
+
+static bool _probe (at_engine &engine, unsigned int rate)
+{
+    if (!engine.get_device().set_baud_rate(rate))
+    {
+        return false;
+    }
+    engine.reset();
+
+    // The first "AT" may only end what was left in the modem's line buffer.
+    std::vector<std::string> lines;
+    for (int i = 0; i < 2; i++)
+    {
+        if (at_final::ok == engine.transact("", lines, BAUD_PROBE_TIMEOUT_MS))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned int baud_detect (at_engine &engine, unsigned int first)
+{
+    std::vector<unsigned int> rates;
+    for (const unsigned int rate : {first, engine.get_device().get_baud_rate()})
+    {
+        if (rate && rates.end() == std::find(rates.begin(), rates.end(), rate))
+        {
+            rates.push_back(rate);
+        }
+    }
+    for (const unsigned int rate : BAUD_CANDIDATES)
+    {
+        if (rates.end() == std::find(rates.begin(), rates.end(), rate))
+        {
+            rates.push_back(rate);
+        }
+    }
+
+    for (const unsigned int rate : rates)
+    {
+        if (_probe(engine, rate))
+        {
+            return rate;
+        }
+    }
+
+    return 0;
+}
+
+
+
+bool baud_verify (at_engine &engine, const std::vector<std::string> &reference, double &ms_per_round_dest)
+{
+    std::vector<std::string> lines;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < BAUD_VERIFY_ROUNDS; i++)
+    {
+        if (at_final::ok != engine.transact("I", lines, 1000) || lines != reference)
+        {
+            return false;
+        }
+    }
+
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    ms_per_round_dest = elapsed.count() / BAUD_VERIFY_ROUNDS;
+    return true;
+}
+
+// The numbers in the first list of "+IPR: (4800,9600,...),(...)".
+static std::vector<unsigned int> _modem_rates (at_engine &engine)
+{
+    std::vector<std::string> lines;
+    std::vector<unsigned int> rates;
+
+    if (at_final::ok != engine.transact("+IPR=?", lines, 1000))
+    {
+        return rates;
+    }
+
+    for (const std::string &line : lines)
+    {
+        if (!line.starts_with("+IPR:"))
+        {
+            continue;
+        }
+
+        const char *p = strchr(line.c_str(), '(');
+        while (p && *p && *p != ')')
+        {
+            char *end;
+            const unsigned long rate = strtoul(p + 1, &end, 10);
+            if (end != p + 1 && rate)
+            {
+                rates.push_back(static_cast<unsigned int>(rate));
+            }
+            p = end;
+        }
+    }
+
+    return rates;
+}
+
+// Sends AT+IPR=to at the current rate and follows the modem to the new one.
+static bool _switch (at_engine &engine, unsigned int from, unsigned int to)
+{
+    serial_device &device = engine.get_device();
+    std::vector<std::string> lines;
+
+    // Once the modem has moved, a rate the device refuses would strand it.
+    if (!device.set_baud_rate(to) || !device.set_baud_rate(from))
+    {
+        fprintf(stderr, "%u baud: not supported by the device\n", to);
+        device.set_baud_rate(from);
+        return false;
+    }
+
+    if (at_final::ok != engine.transact("+IPR=" + std::to_string(to), lines, 1000))
+    {
+        fprintf(stderr, "%u baud: refused by the modem\n", to);
+        return false;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(BAUD_SWITCH_MS));
+    device.set_baud_rate(to);
+    engine.reset();
+    return true;
+}
+
+// Back from a rate that does not work reliably. Returns the rate the modem
+// answers at, 0 if it is lost.
+static unsigned int _restore (at_engine &engine, unsigned int from, unsigned int to)
+{
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < BAUD_RESTORE_TRIES; i++)
+    {
+        if (at_final::ok == engine.transact("+IPR=" + std::to_string(to), lines, BAUD_PROBE_TIMEOUT_MS * 2))
+        {
+            break;
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(BAUD_SWITCH_MS));
+    if (_probe(engine, to))
+    {
+        return to;
+    }
+
+    fprintf(stderr, "Lost the modem at %u baud, detecting its rate...\n", from);
+    return baud_detect(engine, to);
+}
+
+unsigned int baud_negotiate (at_engine &engine, unsigned int max_rate)
+{
+    serial_device &device = engine.get_device();
+    unsigned int rate = device.get_baud_rate();
+    std::vector<std::string> reference;
+    double ms_before, ms_after;
+
+    if (!rate)
+    {
+        fprintf(stderr, "The device has no baud rate to change\n");
+        return 0;
+    }
+
+    if (at_final::ok != engine.transact("I", reference, 1000) || !baud_verify(engine, reference, ms_before))
+    {
+        fprintf(stderr, "%u baud: ATI does not answer reliably, keeping the rate\n", rate);
+        return rate;
+    }
+
+    std::vector<unsigned int> rates = _modem_rates(engine);
+    if (rates.empty())
+    {
+        fprintf(stderr, "No rates in AT+IPR=?, trying the standard ones\n");
+        rates.assign(std::begin(BAUD_CANDIDATES), std::end(BAUD_CANDIDATES));
+    }
+    std::sort(rates.begin(), rates.end(), std::greater<unsigned int>());
+
+    for (const unsigned int to : rates)
+    {
+        if (to <= rate)
+        {
+            break;
+        }
+        if (max_rate && to > max_rate)
+        {
+            continue;
+        }
+
+        if (!_switch(engine, rate, to))
+        {
+            continue;
+        }
+
+        if (baud_verify(engine, reference, ms_after))
+        {
+            fprintf(stderr, "Switched from %u to %u baud: %.2f ms per ATI, was %.2f ms\n", rate, to, ms_after, ms_before);
+            return to;
+        }
+
+        fprintf(stderr, "%u baud: responses garbled or lost, going back to %u\n", to, rate);
+        rate = _restore(engine, to, rate);
+        if (!rate)
+        {
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Staying at %u baud: %.2f ms per ATI\n", rate, ms_before);
+    return rate;
+}
+
+
+
+const char* baud_map_path (void)
+{
+    static const std::string path = state_file_path("atctl.bauds", "ATCTL_BAUD_MAP");
+    return path.c_str();
+}
+
+bool save_baud_rate (const char *device, unsigned int rate, const char *path)
+{
+    // Other devices' entries are kept.
+    std::vector<std::string> lines;
+    char line [512];
+    char entry_device [256];
+    unsigned int entry_rate;
+
+    if (FILE *f = fopen(path, "r"))
+    {
+        while (fgets(line, sizeof(line), f))
+        {
+            if (line[0] != '#' && 2 == sscanf(line, "%255s %u", entry_device, &entry_rate) && 0 != strcmp(entry_device, device))
+            {
+                lines.emplace_back(line);
+            }
+        }
+        fclose(f);
+    }
+
+    state_file_writer writer(path);
+    FILE *f = writer.begin();
+
+    if (!f)
+    {
+        return false;
+    }
+
+    fprintf(f, "# device baud\n");
+    for (const std::string &entry : lines)
+    {
+        fputs(entry.c_str(), f);
+    }
+    fprintf(f, "%s %u\n", device, rate);
+
+    return writer.commit();
+}
+
+unsigned int load_baud_rate (const char *device, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return 0;
+    }
+
+    char line [512];
+    char entry_device [256];
+    unsigned int entry_rate;
+    unsigned int rate = 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (line[0] != '#' && 2 == sscanf(line, "%255s %u", entry_device, &entry_rate) && 0 == strcmp(entry_device, device))
+        {
+            rate = entry_rate;
+        }
+    }
+
+    fclose(f);
+    return rate;
+}
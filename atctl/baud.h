@@ -0,0 +1,48 @@
+#pragma once
+
+#include "at_engine.h"
+
+#include <string>
+#include <vector>
+
+// What UART modems ship at.
+static constexpr unsigned int BAUD_DEFAULT = 115200;
+
+// Per "AT" at a candidate rate; a modem answers within a few ms.
+static constexpr size_t BAUD_PROBE_TIMEOUT_MS = 150;
+
+// "ATI" exchanges a new rate has to get through unchanged.
+static constexpr size_t BAUD_VERIFY_ROUNDS = 20;
+
+
+
+
+// Finds the rate the modem answers "AT" at by trying the standard rates,
+// first (e.g. a saved rate) and the device's current one before the rest.
+// Leaves the device at that rate. 0: no answer at any rate.
+unsigned int baud_detect (at_engine &engine, unsigned int first = 0);
+
+// Moves the modem and the device from the rate they both use now to the
+// highest rate up to max_rate (0: no limit) that the modem offers in
+// "AT+IPR=?", the device accepts and baud_verify() passes at. A rate that
+// fails is undone with AT+IPR at that rate, or by baud_detect() if the
+// modem no longer answers, and the next lower one tried. Prints each step
+// and the exchange time at the old and new rate to stderr. Returns the
+// rate in use at the end, 0 if the modem was lost.
+unsigned int baud_negotiate (at_engine &engine, unsigned int max_rate = 0);
+
+// Runs "ATI" BAUD_VERIFY_ROUNDS times; every response must equal reference
+// (taken at a rate known to work), which with echo on also covers what
+// the modem received. ms_per_round_dest: average exchange time.
+bool baud_verify (at_engine &engine, const std::vector<std::string> &reference, double &ms_per_round_dest);
+
+
+
+// "<device> <rate>" per line, in atctl.bauds in the state directory (see
+// state_file_path()) or $ATCTL_BAUD_MAP.
+const char* baud_map_path (void);
+
+bool save_baud_rate (const char *device, unsigned int rate, const char *path = baud_map_path());
+
+// 0 if the device has no saved rate.
+unsigned int load_baud_rate (const char *device, const char *path = baud_map_path());
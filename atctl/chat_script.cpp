@@ -0,0 +1,476 @@
+#include "chat_script.h"
+#include "../common.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <string_view>
+
+
+
+static constexpr struct {
+    const char *name;
+    at_final    result;
+} RESULT_NAMES [] = {
+    {"OK",          at_final::ok},
+    {"ERROR",       at_final::error},
+    {"CONNECT",     at_final::connect},
+    {"NO CARRIER",  at_final::no_carrier},
+    {"BUSY",        at_final::busy},
+    {"NO ANSWER",   at_final::no_answer},
+    {"NO DIALTONE", at_final::no_dialtone},
+    {"TIMEOUT",     at_final::none},
+};
+
+
+
+static std::string_view _trim (std::string_view text)
+{
+    while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Splits off the next word, or quoted string (\" and \\ are unescaped,
+// other backslashes are kept for the regex). false: nothing left or an
+// unterminated quote.
+static bool _next_token (std::string_view &rest, std::string &token_dest, bool *quoted_dest = nullptr)
+{
+    rest = _trim(rest);
+    token_dest.clear();
+
+    if (rest.empty())
+    {
+        return false;
+    }
+
+    if (rest[0] != '"')
+    {
+        const size_t end = std::min(rest.size(), rest.find_first_of(" \t"));
+        token_dest.assign(rest.substr(0, end));
+        rest.remove_prefix(end);
+
+        if (quoted_dest)
+        {
+            *quoted_dest = false;
+        }
+        return true;
+    }
+
+    for (size_t i = 1; i < rest.size(); i++)
+    {
+        if (rest[i] == '\\' && i + 1 < rest.size() && (rest[i + 1] == '"' || rest[i + 1] == '\\'))
+        {
+            token_dest.push_back(rest[++i]);
+        }
+        else if (rest[i] == '"')
+        {
+            rest.remove_prefix(i + 1);
+
+            if (quoted_dest)
+            {
+                *quoted_dest = true;
+            }
+            return true;
+        }
+        else
+        {
+            token_dest.push_back(rest[i]);
+        }
+    }
+
+    return false;
+}
+
+static bool _parse_ms (const std::string &token, size_t &ms_dest)
+{
+    char *end;
+    ms_dest = strtoul(token.c_str(), &end, 10);
+    return !token.empty() && !*end;
+}
+
+static bool _is_identifier (const std::string &name)
+{
+    if (name.empty() || isdigit(static_cast<unsigned char>(name[0])))
+    {
+        return false;
+    }
+
+    for (const char c : name)
+    {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string chat_script::expand (const std::string &text, const std::map<std::string, std::string> &vars)
+{
+    std::string result;
+    result.reserve(text.size());
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] != '$' || i + 1 == text.size())
+        {
+            result.push_back(text[i]);
+            continue;
+        }
+
+        size_t start = i + 1;
+        size_t end;
+        if (text[start] == '{')
+        {
+            start++;
+            end = text.find('}', start);
+            if (end == std::string::npos)
+            {
+                result.push_back(text[i]);
+                continue;
+            }
+            i = end;
+        }
+        else
+        {
+            end = start;
+            while (end < text.size() && (isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_'))
+            {
+                end++;
+            }
+            if (end == start)
+            {
+                result.push_back(text[i]);
+                continue;
+            }
+            i = end - 1;
+        }
+
+        const auto var = vars.find(text.substr(start, end - start));
+        if (var != vars.end())
+        {
+            result.append(var->second);
+        }
+    }
+
+    return result;
+}
+
+
+
+bool chat_script::load (FILE *f, const char *name)
+{
+    label_map labels;
+    jump_list jumps;
+    char buffer [1024];
+    std::string text;
+    size_t line_number = 0;
+    bool ok = true;
+
+    m_name = name;
+    m_steps.clear();
+    m_timeout_ms = AT_TIMEOUT_AUTO;
+
+    while (fgets(buffer, sizeof(buffer), f))
+    {
+        line_number++;
+
+        std::string_view line(buffer);
+        if (line.empty() || line.back() != '\n')
+        {
+            if (!feof(f))
+            {
+                fprintf(stderr, "%s:%zu: line too long\n", m_name, line_number);
+                return false;
+            }
+        }
+
+        // Comments run to the end of the line, except inside quotes; \#
+        // outside quotes is a literal '#', as in "send D*99\#".
+        bool quoted = false;
+        text.clear();
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            if (line[i] == '\\' && i + 1 < line.size() && (quoted || line[i + 1] == '#'))
+            {
+                if (quoted)
+                {
+                    text.push_back(line[i]);
+                }
+                text.push_back(line[++i]);
+                continue;
+            }
+
+            if (line[i] == '"')
+            {
+                quoted = !quoted;
+            }
+            else if (line[i] == '#' && !quoted)
+            {
+                break;
+            }
+            text.push_back(line[i]);
+        }
+
+        const std::string_view statement = _trim(text);
+        if (!statement.empty())
+        {
+            ok = this->parse_line(statement, line_number, labels, jumps) && ok;
+        }
+    }
+
+
+
+    for (const auto &[label, index] : jumps)
+    {
+        const auto target = labels.find(label);
+        if (target == labels.end())
+        {
+            fprintf(stderr, "%s:%zu: unknown label '%s'\n", m_name, m_steps[index].line, label.c_str());
+            ok = false;
+        }
+        else
+        {
+            m_steps[index].target = target->second;
+        }
+    }
+
+    return ok;
+}
+
+bool chat_script::parse_line (std::string_view line, size_t line_number, label_map &labels, jump_list &jumps)
+{
+    // "label:"
+    if (line.back() == ':')
+    {
+        const std::string label(_trim(line.substr(0, line.size() - 1)));
+        if (!_is_identifier(label) || !labels.emplace(label, m_steps.size()).second)
+        {
+            fprintf(stderr, "%s:%zu: invalid or duplicate label '%s'\n", m_name, line_number, label.c_str());
+            return false;
+        }
+        return true;
+    }
+
+
+
+    std::string_view rest = line;
+    std::string keyword;
+    std::string token;
+    _next_token(rest, keyword);
+
+    step s;
+    s.line = line_number;
+    std::string jump;
+
+    const auto error = [&](const char *message) {
+        fprintf(stderr, "%s:%zu: %s\n", m_name, line_number, message);
+        return false;
+    };
+
+    // Reads a result code name or quoted regex into s.match.
+    const auto parse_pattern = [&]() {
+        bool quoted;
+        if (!_next_token(rest, token, &quoted))
+        {
+            return error("missing pattern");
+        }
+
+        if (quoted)
+        {
+            try
+            {
+                s.match.regex = std::regex(token, std::regex::ECMAScript | std::regex::optimize);
+            }
+            catch (const std::regex_error &e)
+            {
+                return error("invalid regex");
+            }
+            return true;
+        }
+
+        // Two-word result codes.
+        std::string_view lookahead = rest;
+        std::string second;
+        if (_next_token(lookahead, second) && (token == "NO") && second != "else" && second != "goto")
+        {
+            token.append(" ").append(second);
+            rest = lookahead;
+        }
+
+        for (const auto &result : RESULT_NAMES)
+        {
+            if (token == result.name)
+            {
+                s.match.is_result = true;
+                s.match.result = result.result;
+                return true;
+            }
+        }
+
+        return error("pattern must be a result code or a quoted regex");
+    };
+
+    // "<keyword> <label>", optionally required.
+    const auto parse_jump = [&](const char *keyword, bool required) {
+        std::string_view lookahead = rest;
+        if (!_next_token(lookahead, token) || token != keyword)
+        {
+            return !required || error("missing jump");
+        }
+
+        rest = lookahead;
+        if (!_next_token(rest, jump))
+        {
+            return error("missing label");
+        }
+        return true;
+    };
+
+
+
+    if (keyword == "send")
+    {
+        s.code = op::send;
+        s.count = m_timeout_ms;
+        s.text.assign(_trim(rest));
+        rest = {};
+        if (s.text.empty())
+        {
+            return error("send needs a command");
+        }
+    }
+    else if (keyword == "timeout")
+    {
+        // Applied to later sends at load time; keeps no step of its own.
+        if (!_next_token(rest, token) || !_parse_ms(token, m_timeout_ms) || 0 == m_timeout_ms)
+        {
+            return error("timeout needs milliseconds");
+        }
+
+        return _trim(rest).empty() || error("unexpected text after statement");
+    }
+    else if (keyword == "expect")
+    {
+        s.code = op::expect;
+        if (!parse_pattern() || !parse_jump("else", false))
+        {
+            return false;
+        }
+    }
+    else if (keyword == "if")
+    {
+        s.code = op::branch;
+        if (!parse_pattern() || !parse_jump("goto", true))
+        {
+            return false;
+        }
+    }
+    else if (keyword == "capture")
+    {
+        s.code = op::capture;
+        if (!_next_token(rest, s.var) || !_is_identifier(s.var))
+        {
+            return error("capture needs a variable name");
+        }
+
+        bool quoted;
+        if (!_next_token(rest, token, &quoted) || !quoted)
+        {
+            return error("capture needs a quoted regex");
+        }
+
+        try
+        {
+            s.match.regex = std::regex(token, std::regex::ECMAScript | std::regex::optimize);
+        }
+        catch (const std::regex_error &e)
+        {
+            return error("invalid regex");
+        }
+
+        if (!parse_jump("else", false))
+        {
+            return false;
+        }
+    }
+    else if (keyword == "retry")
+    {
+        s.code = op::retry;
+        if (!_next_token(rest, jump))
+        {
+            return error("retry needs a label");
+        }
+
+        if (!_next_token(rest, token) || !_parse_ms(token, s.count) || 0 == s.count)
+        {
+            return error("retry needs a count");
+        }
+        if (_next_token(rest, token) && !_parse_ms(token, s.delay_ms))
+        {
+            return error("retry delay must be in milliseconds");
+        }
+    }
+    else if (keyword == "goto")
+    {
+        s.code = op::jump;
+        if (!_next_token(rest, jump))
+        {
+            return error("goto needs a label");
+        }
+    }
+    else if (keyword == "set")
+    {
+        s.code = op::set;
+        if (!_next_token(rest, s.var) || !_is_identifier(s.var))
+        {
+            return error("set needs a variable name");
+        }
+        s.text.assign(_trim(rest));
+        rest = {};
+    }
+    else if (keyword == "sleep")
+    {
+        s.code = op::sleep;
+        if (!_next_token(rest, token) || !_parse_ms(token, s.count))
+        {
+            return error("sleep needs milliseconds");
+        }
+    }
+    else if (keyword == "print" || keyword == "fail")
+    {
+        s.code = (keyword == "print") ? op::print : op::fail;
+        s.text.assign(_trim(rest));
+        rest = {};
+    }
+    else if (keyword == "done")
+    {
+        s.code = op::done;
+    }
+    else
+    {
+        return error("unknown statement");
+    }
+
+    if (!_trim(rest).empty())
+    {
+        return error("unexpected text after statement");
+    }
+
+    if (!jump.empty())
+    {
+        jumps.emplace_back(jump, m_steps.size());
+    }
+
+    m_steps.push_back(std::move(s));
+    return true;
+}
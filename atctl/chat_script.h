@@ -0,0 +1,242 @@
+#pragma once
+
+#include "at_engine.h"
+#include "output.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+// A small provisioning language, one statement per line:
+//
+//   label:
+//   send <command>                  run AT<command>, e.g. send +CPIN?
+//   expect <pattern> [else <label>] fail (or jump) unless the response matches
+//   if <pattern> goto <label>       jump if the response matches
+//   capture <var> "<regex>" [else <label>]
+//                                   store group 1 (or the match) in var
+//   retry <label> <count> [<ms>]    jump back up to count times, doubling
+//                                   the delay before each attempt
+//   goto <label>
+//   set <var> <text>
+//   timeout <ms>                    for the sends that follow, instead of
+//                                   each command's own
+//   sleep <ms>
+//   print <text>
+//   fail <text>
+//   done
+//
+// A pattern is a result code (OK, ERROR, CONNECT, BUSY, NO CARRIER,
+// NO ANSWER, NO DIALTONE, TIMEOUT) or a quoted regex searched for in the
+// response lines. $var and ${var} are replaced in send, set, print and
+// fail. '#' starts a comment outside quotes; write \# for a literal one,
+// e.g. send D*99\#. print goes to stderr in jsonl and csv output.
+class chat_script
+{
+public:
+    // Parses and checks the whole script, reporting errors with line numbers.
+    bool load (FILE *f, const char *name);
+
+    // Runs the script to its end, "done" or "fail". vars holds the initial
+    // variables and receives the captured ones.
+    template<serial_device_type DEVICE>
+    bool run (basic_at_engine<DEVICE> &engine, std::map<std::string, std::string> &vars, output_writer &output);
+
+private:
+    enum class op { send, expect, branch, capture, retry, jump, set, sleep, print, fail, done };
+
+    struct pattern
+    {
+        bool            is_result   = false;
+        at_final        result      = at_final::none;   // none with is_result: TIMEOUT
+        std::regex      regex;
+    };
+
+    struct step
+    {
+        op              code;
+        size_t          line;
+        std::string     text;                   // command, message or value
+        std::string     var;
+        pattern         match;
+        size_t          target      = SIZE_MAX; // jump destination
+        size_t          count       = 0;        // retry limit, or timeout/sleep ms
+        size_t          delay_ms    = 0;
+    };
+
+    // Label -> index of the step that follows it.
+    using label_map = std::map<std::string, size_t, std::less<>>;
+
+    // Jumps are resolved once all labels are known: (label, step).
+    using jump_list = std::vector<std::pair<std::string, size_t>>;
+
+    bool parse_line (std::string_view line, size_t line_number, label_map &labels, jump_list &jumps);
+
+    // Replaces $var and ${var}; unknown variables expand to nothing.
+    static std::string expand (const std::string &text, const std::map<std::string, std::string> &vars);
+
+    std::vector<step>   m_steps;
+    const char         *m_name          = "";
+    size_t              m_timeout_ms    = AT_TIMEOUT_AUTO;          // while loading
+};
+
+
+
+template<serial_device_type DEVICE>
+bool chat_script::run (basic_at_engine<DEVICE> &engine, std::map<std::string, std::string> &vars, output_writer &output)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::string> lines;
+    std::vector<size_t> attempts(m_steps.size(), 0);
+    at_final result = at_final::none;
+    bool sent = false;
+    std::smatch match;
+    size_t n_sent = 0;
+    size_t n_retries = 0;
+
+    const auto start = clock::now();
+    const size_t start_round_trips = engine.get_round_trips();
+    const size_t start_skipped = engine.get_skipped();
+    const auto matches = [&](const pattern &p) {
+        if (p.is_result)
+        {
+            return sent && p.result == result;
+        }
+
+        for (const auto &line : lines)
+        {
+            if (std::regex_search(line, p.regex))
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    const auto finish = [&](bool ok) {
+        output.flush();
+        fprintf(stderr, "%s: %s after %.0f ms, %zu commands in %zu round trips (%zu already in effect), %zu retries\n",
+                m_name, ok ? "done" : "failed",
+                std::chrono::duration<double, std::milli>(clock::now() - start).count(),
+                n_sent, engine.get_round_trips() - start_round_trips, engine.get_skipped() - start_skipped, n_retries);
+        return ok;
+    };
+
+
+
+    size_t pc = 0;
+    while (pc < m_steps.size())
+    {
+        const step &s = m_steps[pc++];
+
+        switch (s.code)
+        {
+            case op::send:
+            {
+                const std::string command = expand(s.text, vars);
+                result = engine.transact(command, lines, s.count);
+                sent = true;
+                n_sent++;
+                DBG("%s:%zu: AT%s -> %zu lines\n", m_name, s.line, command.c_str(), lines.size());
+                break;
+            }
+
+            case op::expect:
+                if (!matches(s.match))
+                {
+                    if (s.target == SIZE_MAX)
+                    {
+                        fprintf(stderr, "%s:%zu: response did not match%s%s\n", m_name, s.line,
+                                lines.empty() ? "" : ", last line: ", lines.empty() ? "" : lines.back().c_str());
+                        return finish(false);
+                    }
+                    pc = s.target;
+                }
+                break;
+
+            case op::branch:
+                if (matches(s.match))
+                {
+                    pc = s.target;
+                }
+                break;
+
+            case op::capture:
+            {
+                bool captured = false;
+                for (const auto &line : lines)
+                {
+                    if (std::regex_search(line, match, s.match.regex))
+                    {
+                        vars[s.var] = match.size() > 1 ? match[1].str() : match[0].str();
+                        captured = true;
+                        break;
+                    }
+                }
+
+                if (!captured)
+                {
+                    if (s.target == SIZE_MAX)
+                    {
+                        fprintf(stderr, "%s:%zu: nothing to capture into %s\n", m_name, s.line, s.var.c_str());
+                        return finish(false);
+                    }
+                    pc = s.target;
+                }
+                break;
+            }
+
+            case op::retry:
+            {
+                size_t &n = attempts[pc - 1];
+                if (n < s.count)
+                {
+                    // Back off exponentially: delay, 2 * delay, 4 * delay, ...
+                    std::this_thread::sleep_for(std::chrono::milliseconds(s.delay_ms << std::min<size_t>(n, 16)));
+                    n++;
+                    n_retries++;
+                    pc = s.target;
+                }
+                else
+                {
+                    n = 0;
+                }
+                break;
+            }
+
+            case op::jump:
+                pc = s.target;
+                break;
+
+            case op::set:
+                vars[s.var] = expand(s.text, vars);
+                break;
+
+            case op::sleep:
+                std::this_thread::sleep_for(std::chrono::milliseconds(s.count));
+                break;
+
+            case op::print:
+                output.notice("%s\n", expand(s.text, vars).c_str());
+                break;
+
+            case op::fail:
+                fprintf(stderr, "%s:%zu: %s\n", m_name, s.line, expand(s.text, vars).c_str());
+                return finish(false);
+
+            case op::done:
+                return finish(true);
+        }
+    }
+
+    return finish(true);
+}
@@ -0,0 +1,676 @@
+#include "cmux.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+#include "metrics.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <termios.h>
+#endif
+
+
+
+// Control channel message types (27.010 5.4.6.3), with EA set.
+static constexpr uint8_t CMUX_MSG_CLD = 0xC1;
+static constexpr uint8_t CMUX_MSG_MSC = 0xE1;
+static constexpr uint8_t CMUX_MSG_CR  = 0x02;
+
+// V.24 signals for MSC: EA, RTC, RTR, DV.
+static constexpr uint8_t CMUX_V24_READY = 0x8D;
+
+// The receiver's FCS over a good frame, FCS byte included.
+static constexpr uint8_t CMUX_FCS_GOOD = 0xCF;
+
+static constexpr size_t CMUX_MAX_FRAME_DATA = 32768;
+
+
+
+// CRC-8, reversed polynomial x^8 + x^2 + x + 1 (27.010 annex B).
+static constexpr std::array<uint8_t, 256> _make_fcs_table (void)
+{
+    std::array<uint8_t, 256> table {};
+
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        uint8_t crc = static_cast<uint8_t>(i);
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? static_cast<uint8_t>((crc >> 1) ^ 0xE0) : static_cast<uint8_t>(crc >> 1);
+        }
+        table[i] = crc;
+    }
+
+    return table;
+}
+
+static constexpr std::array<uint8_t, 256> FCS_TABLE = _make_fcs_table();
+
+static_assert(FCS_TABLE[1] == 0x91 && FCS_TABLE[255] == 0xCF);
+
+static inline uint8_t _fcs_update (uint8_t fcs, uint8_t byte)
+{
+    return FCS_TABLE[fcs ^ byte];
+}
+
+
+
+void cmux_encode_frame (uint8_t dlci, uint8_t control, const void *data, size_t size, std::string &dest, bool command)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    uint8_t header [4];
+    size_t header_size = 0;
+
+    header[header_size++] = static_cast<uint8_t>((dlci << 2) | (command ? 0x02 : 0x00) | 0x01);
+    header[header_size++] = control;
+    if (size < 128)
+    {
+        header[header_size++] = static_cast<uint8_t>((size << 1) | 0x01);
+    }
+    else
+    {
+        header[header_size++] = static_cast<uint8_t>(size << 1);
+        header[header_size++] = static_cast<uint8_t>(size >> 7);
+    }
+
+    // UIH frames only protect the header; UI frames include the data.
+    uint8_t fcs = 0xFF;
+    for (size_t i = 0; i < header_size; i++)
+    {
+        fcs = _fcs_update(fcs, header[i]);
+    }
+    if ((control & ~CMUX_PF) == CMUX_UI)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            fcs = _fcs_update(fcs, bytes[i]);
+        }
+    }
+
+    dest.push_back(static_cast<char>(CMUX_FLAG));
+    dest.append(reinterpret_cast<const char*>(header), header_size);
+    dest.append(reinterpret_cast<const char*>(bytes), size);
+    dest.push_back(static_cast<char>(0xFF - fcs));
+    dest.push_back(static_cast<char>(CMUX_FLAG));
+}
+
+
+
+bool cmux_decoder::feed (uint8_t byte, cmux_frame &frame_dest)
+{
+    switch (m_state)
+    {
+        case state::flag:
+            if (byte == CMUX_FLAG)
+            {
+                m_state = state::address;
+            }
+            break;
+
+        case state::address:
+            // Repeated flags between frames.
+            if (byte != CMUX_FLAG)
+            {
+                frame_dest.dlci = byte >> 2;
+                frame_dest.data.clear();
+                m_fcs = _fcs_update(0xFF, byte);
+                m_state = state::control;
+            }
+            break;
+
+        case state::control:
+            frame_dest.control = byte & ~CMUX_PF;
+            m_fcs = _fcs_update(m_fcs, byte);
+            m_state = state::length;
+            break;
+
+        case state::length:
+        case state::length2:
+            m_fcs = _fcs_update(m_fcs, byte);
+            if (m_state == state::length)
+            {
+                m_length = byte >> 1;
+                if (!(byte & 0x01))
+                {
+                    m_state = state::length2;
+                    break;
+                }
+            }
+            else
+            {
+                m_length |= static_cast<size_t>(byte) << 7;
+            }
+
+            if (m_length > CMUX_MAX_FRAME_DATA)
+            {
+                m_state = state::flag;
+            }
+            else
+            {
+                m_state = m_length ? state::data : state::fcs;
+            }
+            break;
+
+        case state::data:
+            frame_dest.data.push_back(static_cast<char>(byte));
+            if (frame_dest.control == CMUX_UI)
+            {
+                m_fcs = _fcs_update(m_fcs, byte);
+            }
+            if (frame_dest.data.size() == m_length)
+            {
+                m_state = state::fcs;
+            }
+            break;
+
+        case state::fcs:
+            if (CMUX_FCS_GOOD == _fcs_update(m_fcs, byte))
+            {
+                m_state = state::end;
+            }
+            else
+            {
+                DBG("CMUX FCS error on DLCI %u\n", frame_dest.dlci);
+                m_fcs_errors++;
+                m_state = state::flag;
+            }
+            break;
+
+        case state::end:
+            if (byte == CMUX_FLAG)
+            {
+                // The closing flag may open the next frame.
+                m_state = state::address;
+                return true;
+            }
+            m_state = state::flag;
+            break;
+    }
+
+    return false;
+}
+
+
+
+cmux::cmux (serial_device &device, size_t frame_size)
+    : m_device (device), m_frame_size (frame_size)
+{}
+
+cmux::~cmux (void)
+{
+    if (m_channels[0].open)
+    {
+        try
+        {
+            this->close();
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stderr, "Failed to close multiplexer: %s\n", e.what());
+        }
+    }
+}
+
+void cmux::open (unsigned int n_channels, size_t timeout_ms)
+{
+    if (n_channels < 1 || n_channels > CMUX_MAX_CHANNELS)
+    {
+        throw source_exception("Invalid number of CMUX channels");
+    }
+
+    m_n_channels = n_channels;
+
+    for (unsigned int dlci = 0; dlci <= n_channels; dlci++)
+    {
+        this->establish(static_cast<uint8_t>(dlci), timeout_ms);
+    }
+
+    // Some modems hold back data until the channel's V.24 signals are set.
+    for (unsigned int dlci = 1; dlci <= n_channels; dlci++)
+    {
+        const uint8_t msc [] = {
+            CMUX_MSG_MSC | CMUX_MSG_CR, 0x05,
+            static_cast<uint8_t>((dlci << 2) | 0x03), CMUX_V24_READY,
+        };
+        this->send_frame(0, CMUX_UIH, msc, sizeof(msc));
+    }
+}
+
+void cmux::close (size_t timeout_ms)
+{
+    const uint8_t cld [] = {CMUX_MSG_CLD | CMUX_MSG_CR, 0x01};
+
+    m_closing = true;
+    this->send_frame(0, CMUX_UIH, cld, sizeof(cld));
+
+    // The modem is back in AT mode once it confirms; don't wait forever for a dead one.
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (m_channels[0].open)
+    {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (remaining <= 0 || !this->pump(remaining))
+        {
+            DBG("No answer to CMUX close-down\n");
+            break;
+        }
+    }
+
+    for (auto &ch : m_channels)
+    {
+        ch.open = false;
+    }
+    m_closing = false;
+}
+
+void cmux::write (uint8_t dlci, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char*>(data);
+    channel &ch = m_channels[dlci];
+
+    m_tx.clear();
+    for (size_t offset = 0; offset < size; offset += m_frame_size)
+    {
+        const size_t n = std::min(m_frame_size, size - offset);
+        cmux_encode_frame(dlci, CMUX_UIH, bytes + offset, n, m_tx);
+
+        ch.stats.frames_tx++;
+        ch.stats.bytes_tx += n;
+    }
+
+    if (!ch.awaiting_reply)
+    {
+        ch.awaiting_reply = true;
+        ch.last_write = clock::now();
+    }
+
+    this->write_all(m_tx);
+}
+
+bool cmux::pump (size_t timeout_ms)
+{
+    char buffer [4096];
+
+    const int rv = m_device.wait_for_data(timeout_ms);
+    if (rv < 0)
+    {
+        throw source_exception("Failed to wait for data");
+    }
+    else if (rv == 0)
+    {
+        return false;
+    }
+
+    const ssize_t n_read = m_device.read(buffer, sizeof(buffer));
+    if (n_read < 0)
+    {
+        throw source_exception("Failed to read from device");
+    }
+    else if (n_read == 0)
+    {
+        throw source_exception("Device disconnected");
+    }
+
+    metrics_add(metrics->bytes_rx, n_read);
+    this->receive(buffer, n_read);
+    return true;
+}
+
+void cmux::receive (const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (m_decoder.feed(bytes[i], m_frame))
+        {
+            this->handle_frame(m_frame);
+        }
+    }
+}
+
+void cmux::send_frame (uint8_t dlci, uint8_t control, const void *data, size_t size, bool command)
+{
+    m_tx.clear();
+    cmux_encode_frame(dlci, control, data, size, m_tx, command);
+    this->write_all(m_tx);
+}
+
+void cmux::write_all (const std::string &data)
+{
+    const char *p = data.data();
+    size_t size = data.size();
+
+    while (size > 0)
+    {
+        const ssize_t n_written = m_device.write(p, size);
+        if (n_written <= 0)
+        {
+            throw source_exception("Failed to write to device");
+        }
+
+        metrics_add(metrics->bytes_tx, n_written);
+        p += n_written;
+        size -= n_written;
+    }
+}
+
+void cmux::establish (uint8_t dlci, size_t timeout_ms)
+{
+    channel &ch = m_channels[dlci];
+    ch.open = false;
+    ch.refused = false;
+
+    this->send_frame(dlci, CMUX_SABM | CMUX_PF, nullptr, 0);
+
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!ch.open)
+    {
+        if (ch.refused)
+        {
+            throw source_exception("Modem refused CMUX channel");
+        }
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (remaining <= 0 || !this->pump(remaining))
+        {
+            throw source_exception("No answer to CMUX channel request");
+        }
+    }
+
+    DBG("DLCI %u established\n", dlci);
+}
+
+void cmux::handle_frame (const cmux_frame &frame)
+{
+    if (frame.dlci > CMUX_MAX_CHANNELS)
+    {
+        DBG("Frame for unknown DLCI %u\n", frame.dlci);
+        return;
+    }
+
+    channel &ch = m_channels[frame.dlci];
+
+    switch (frame.control)
+    {
+        case CMUX_UA:
+            ch.open = !m_closing;
+            break;
+
+        case CMUX_DM:
+            ch.open = false;
+            ch.refused = true;
+            break;
+
+        case CMUX_DISC:
+            this->send_frame(frame.dlci, CMUX_UA | CMUX_PF, nullptr, 0, false);
+            ch.open = false;
+            break;
+
+        case CMUX_UIH:
+        case CMUX_UI:
+            if (frame.dlci == 0)
+            {
+                if (frame.data.empty())
+                {
+                    break;
+                }
+
+                const uint8_t type = static_cast<uint8_t>(frame.data[0]);
+                if ((type & ~CMUX_MSG_CR) == CMUX_MSG_CLD)
+                {
+                    ch.open = false;
+                }
+                else if (type == (CMUX_MSG_MSC | CMUX_MSG_CR))
+                {
+                    // Acknowledge the modem's status by echoing it as a response.
+                    std::string reply = frame.data;
+                    reply[0] = static_cast<char>(CMUX_MSG_MSC);
+                    this->send_frame(0, CMUX_UIH, reply.data(), reply.size());
+                }
+                break;
+            }
+
+            ch.stats.frames_rx++;
+            ch.stats.bytes_rx += frame.data.size();
+
+            if (ch.awaiting_reply)
+            {
+                const double ms = std::chrono::duration<double, std::milli>(clock::now() - ch.last_write).count();
+
+                ch.stats.latency_min_ms = ch.stats.latency_samples ? std::min(ch.stats.latency_min_ms, ms) : ms;
+                ch.stats.latency_max_ms = std::max(ch.stats.latency_max_ms, ms);
+                ch.stats.latency_sum_ms += ms;
+                ch.stats.latency_samples++;
+                ch.awaiting_reply = false;
+            }
+
+            ch.rx.append(frame.data);
+            if (ch.rx.size() > CMUX_MAX_BUFFERED)
+            {
+                // Nobody is reading this channel; keep the newest data.
+                const size_t excess = ch.rx.size() - CMUX_MAX_BUFFERED;
+                ch.rx.erase(0, excess);
+                ch.stats.bytes_dropped += excess;
+            }
+            break;
+
+        default:
+            DBG("Ignoring CMUX frame 0x%02x on DLCI %u\n", frame.control, frame.dlci);
+            break;
+    }
+}
+
+
+
+ssize_t cmux_channel::read (void *buffer, size_t size)
+{
+    std::string &rx = m_mux.buffer(m_dlci);
+    const size_t n = std::min(size, rx.size());
+
+    memcpy(buffer, rx.data(), n);
+    rx.erase(0, n);
+
+    return static_cast<ssize_t>(n);
+}
+
+int cmux_channel::wait_for_data (size_t timeout_ms)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (m_mux.buffer(m_dlci).empty())
+    {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0 || !m_mux.pump(remaining))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
+#ifndef _WIN32
+// A pty for one DLCI; closes both ends when it goes.
+class _relay_pty
+{
+public:
+    _relay_pty (void)
+    {
+        m_master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (-1 == m_master || 0 != grantpt(m_master) || 0 != unlockpt(m_master))
+        {
+            perror("posix_openpt");
+            this->close();
+            throw source_exception("Failed to create pty");
+        }
+
+        // Holding the slave open keeps the master readable while no client is
+        // attached, and keeps the raw settings for the next client.
+        m_slave = ::open(ptsname(m_master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (-1 == m_slave)
+        {
+            perror("open");
+            this->close();
+            throw source_exception("Failed to open pty");
+        }
+
+        termios tio;
+        if (0 == tcgetattr(m_slave, &tio))
+        {
+            cfmakeraw(&tio);
+            tcsetattr(m_slave, TCSANOW, &tio);
+        }
+
+        fcntl(m_master, F_SETFL, fcntl(m_master, F_GETFL) | O_NONBLOCK);
+    }
+
+    ~_relay_pty (void)
+    {
+        this->close();
+    }
+
+    _relay_pty (const _relay_pty&) = delete;
+    _relay_pty& operator= (const _relay_pty&) = delete;
+
+    int get_master (void) const
+    {
+        return m_master;
+    }
+
+private:
+    void close (void)
+    {
+        if (-1 != m_slave)
+        {
+            ::close(m_slave);
+        }
+        if (-1 != m_master)
+        {
+            ::close(m_master);
+        }
+        m_slave = m_master = -1;
+    }
+
+    int         m_master    = -1;
+    int         m_slave     = -1;
+};
+
+void cmux_relay_ptys (cmux &mux, int stop_fd)
+{
+    const unsigned int n_channels = mux.get_channel_count();
+    std::vector<std::unique_ptr<_relay_pty>> ptys;
+    std::vector<pollfd> fds(2 + n_channels);
+    char buffer [4096];
+
+    enum { FD_DEVICE, FD_STOP, FD_FIRST_PTY };
+    fds[FD_DEVICE]  = {mux.get_device().get_handle(), POLLIN, 0};
+    fds[FD_STOP]    = {stop_fd, POLLIN, 0};
+
+    for (unsigned int dlci = 1; dlci <= n_channels; dlci++)
+    {
+        ptys.push_back(std::make_unique<_relay_pty>());
+        fds[FD_FIRST_PTY + dlci - 1] = {ptys.back()->get_master(), POLLIN, 0};
+        printf("DLCI %u: %s\n", dlci, ptsname(ptys.back()->get_master()));
+    }
+    fflush(stdout);
+
+
+
+    while (1)
+    {
+        // Push received data to clients; what doesn't fit waits for POLLOUT.
+        for (unsigned int dlci = 1; dlci <= n_channels; dlci++)
+        {
+            std::string &rx = mux.buffer(dlci);
+            pollfd &pfd = fds[FD_FIRST_PTY + dlci - 1];
+
+            if (!rx.empty())
+            {
+                const ssize_t n_written = ::write(pfd.fd, rx.data(), rx.size());
+                if (n_written > 0)
+                {
+                    rx.erase(0, n_written);
+                }
+            }
+
+            pfd.events = POLLIN | (rx.empty() ? 0 : POLLOUT);
+        }
+
+        const int rv = poll(fds.data(), fds.size(), -1);
+        if (rv == -1)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            perror("poll");
+            break;
+        }
+
+        if (fds[FD_STOP].revents & POLLIN)
+        {
+            break;
+        }
+
+        if (fds[FD_DEVICE].revents & (POLLIN | POLLERR | POLLHUP))
+        {
+            mux.pump(0);
+        }
+
+        for (unsigned int dlci = 1; dlci <= n_channels; dlci++)
+        {
+            const pollfd &pfd = fds[FD_FIRST_PTY + dlci - 1];
+            if (pfd.revents & POLLIN)
+            {
+                const ssize_t n_read = ::read(pfd.fd, buffer, sizeof(buffer));
+                if (n_read > 0)
+                {
+                    mux.write(static_cast<uint8_t>(dlci), buffer, n_read);
+                }
+            }
+        }
+    }
+}
+#else
+void cmux_relay_ptys (cmux &mux, int stop_fd)
+{
+    throw source_exception("CMUX ptys are not supported on Windows");
+}
+#endif
+
+void cmux_print_stats (const cmux &mux, double elapsed_s)
+{
+    if (elapsed_s <= 0)
+    {
+        elapsed_s = 1e-9;
+    }
+
+    fprintf(stderr, "CMUX: %.1f s, %zu FCS errors\n", elapsed_s, mux.get_fcs_errors());
+
+    for (unsigned int dlci = 1; dlci <= mux.get_channel_count(); dlci++)
+    {
+        const cmux_channel_stats &stats = mux.get_stats(dlci);
+
+        fprintf(stderr, "  DLCI %u: tx %zu frames, %zu bytes (%.0f B/s); rx %zu frames, %zu bytes (%.0f B/s); %zu dropped\n",
+                dlci,
+                stats.frames_tx, stats.bytes_tx, stats.bytes_tx / elapsed_s,
+                stats.frames_rx, stats.bytes_rx, stats.bytes_rx / elapsed_s,
+                stats.bytes_dropped);
+
+        if (stats.latency_samples)
+        {
+            fprintf(stderr, "          latency: mean %.2f ms, min %.2f ms, max %.2f ms over %zu replies\n",
+                    stats.latency_sum_ms / stats.latency_samples,
+                    stats.latency_min_ms, stats.latency_max_ms, stats.latency_samples);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "../serial/serial.h"
+#include "../serial/serial_device_type.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 3GPP TS 27.010 basic option, default N1 of AT+CMUX=0.
+static constexpr size_t CMUX_DEFAULT_FRAME_SIZE = 31;
+
+// DLCI 0 is the control channel, AT channels start at 1.
+static constexpr unsigned int CMUX_MAX_CHANNELS = 8;
+
+static constexpr size_t CMUX_DEFAULT_TIMEOUT_MS = 3000;
+
+// Unread data kept per channel before the oldest is dropped.
+static constexpr size_t CMUX_MAX_BUFFERED = 64 * 1024;
+
+static constexpr uint8_t CMUX_FLAG = 0xF9;
+
+// Control field, without the P/F bit.
+static constexpr uint8_t CMUX_SABM  = 0x2F;
+static constexpr uint8_t CMUX_UA    = 0x63;
+static constexpr uint8_t CMUX_DM    = 0x0F;
+static constexpr uint8_t CMUX_DISC  = 0x43;
+static constexpr uint8_t CMUX_UIH   = 0xEF;
+static constexpr uint8_t CMUX_UI    = 0x03;
+static constexpr uint8_t CMUX_PF    = 0x10;
+
+
+
+
+// Appends one basic-mode frame to dest. command sets the C/R bit as the
+// initiating station does for commands and data.
+void cmux_encode_frame (uint8_t dlci, uint8_t control, const void *data, size_t size, std::string &dest, bool command = true);
+
+
+
+struct cmux_frame
+{
+    uint8_t         dlci;
+    uint8_t         control;        // without the P/F bit
+    std::string     data;
+};
+
+// Reassembles frames from a byte stream. Bytes outside a frame and frames
+// failing the FCS are skipped.
+class cmux_decoder
+{
+public:
+    // Returns true when a frame is complete; it stays in frame_dest until
+    // the next call.
+    bool feed (uint8_t byte, cmux_frame &frame_dest);
+
+    size_t get_fcs_errors (void) const
+    {
+        return m_fcs_errors;
+    }
+
+private:
+    enum class state { flag, address, control, length, length2, data, fcs, end };
+
+    state       m_state         = state::flag;
+    uint8_t     m_fcs           = 0;
+    size_t      m_length        = 0;
+    size_t      m_fcs_errors    = 0;
+};
+
+
+
+struct cmux_channel_stats
+{
+    size_t      frames_tx       = 0;
+    size_t      frames_rx       = 0;
+    size_t      bytes_tx        = 0;
+    size_t      bytes_rx        = 0;
+    size_t      bytes_dropped   = 0;
+
+    // Time from a write to the first frame coming back on the channel.
+    size_t      latency_samples = 0;
+    double      latency_sum_ms  = 0;
+    double      latency_min_ms  = 0;
+    double      latency_max_ms  = 0;
+};
+
+
+
+// Multiplexes DLCIs 1..n over one serial device that has already been
+// switched to CMUX mode with AT+CMUX=0.
+class cmux
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    explicit cmux (serial_device &device, size_t frame_size = CMUX_DEFAULT_FRAME_SIZE);
+    ~cmux (void);
+
+    // Establishes the control channel and n_channels AT channels.
+    void open (unsigned int n_channels, size_t timeout_ms = CMUX_DEFAULT_TIMEOUT_MS);
+
+    // Sends the close-down command, returning the modem to AT mode.
+    void close (size_t timeout_ms = CMUX_DEFAULT_TIMEOUT_MS);
+
+    // Sends data on dlci as UIH frames of at most frame_size bytes.
+    void write (uint8_t dlci, const void *data, size_t size);
+
+    // Reads whatever the device has, waiting up to timeout_ms, and sorts
+    // it into channel buffers. false: timed out.
+    bool pump (size_t timeout_ms);
+
+    // Feeds raw bytes received from the device.
+    void receive (const void *data, size_t size);
+
+    // Received, not yet consumed data of a channel.
+    std::string& buffer (uint8_t dlci)
+    {
+        return m_channels[dlci].rx;
+    }
+
+    const cmux_channel_stats& get_stats (uint8_t dlci) const
+    {
+        return m_channels[dlci].stats;
+    }
+
+    unsigned int get_channel_count (void) const
+    {
+        return m_n_channels;
+    }
+
+    size_t get_fcs_errors (void) const
+    {
+        return m_decoder.get_fcs_errors();
+    }
+
+    serial_device& get_device (void)
+    {
+        return m_device;
+    }
+
+private:
+    struct channel
+    {
+        std::string         rx;
+        bool                open            = false;
+        bool                refused         = false;
+        bool                awaiting_reply  = false;
+        clock::time_point   last_write;
+        cmux_channel_stats  stats;
+    };
+
+    void send_frame (uint8_t dlci, uint8_t control, const void *data, size_t size, bool command = true);
+
+    void write_all (const std::string &data);
+
+    // Sends SABM and waits for UA.
+    void establish (uint8_t dlci, size_t timeout_ms);
+
+    void handle_frame (const cmux_frame &frame);
+
+    serial_device      &m_device;
+    size_t              m_frame_size;
+    unsigned int        m_n_channels    = 0;
+    bool                m_closing       = false;
+    channel             m_channels [CMUX_MAX_CHANNELS + 1];
+    cmux_decoder        m_decoder;
+    cmux_frame          m_frame;
+    std::string         m_tx;
+};
+
+
+
+// One DLCI seen as a serial device, so an at_engine can run on it:
+// basic_at_engine<cmux_channel>.
+class cmux_channel
+{
+public:
+    cmux_channel (cmux &mux, uint8_t dlci)
+        : m_mux (mux), m_dlci (dlci)
+    {}
+
+    bool is_open (void) const
+    {
+        return true;
+    }
+
+    ssize_t read (void *buffer, size_t size);
+
+    ssize_t write (const void *buffer, size_t size)
+    {
+        m_mux.write(m_dlci, buffer, size);
+        return static_cast<ssize_t>(size);
+    }
+
+    // Pumps the mux until this channel has data; other channels' data is
+    // buffered meanwhile.
+    int wait_for_data (size_t timeout_ms);
+
+private:
+    cmux       &m_mux;
+    uint8_t     m_dlci;
+};
+
+static_assert(serial_device_type<cmux_channel>);
+
+
+
+// Exposes each channel as a pty and relays between them and the mux until
+// stop_fd becomes readable. Prints the pty paths to stdout.
+void cmux_relay_ptys (cmux &mux, int stop_fd);
+
+// Prints per-channel counters, throughput and latency to stderr.
+void cmux_print_stats (const cmux &mux, double elapsed_s);
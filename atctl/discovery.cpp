@@ -0,0 +1,399 @@
+#include "discovery.h"
+#include "state_file.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <filesystem>
+#ifndef _WIN32
+    #include <chrono>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <termios.h>
+#endif
+
+
+
+#ifndef _WIN32
+static const char SYSFS_TTY [] = "/sys/class/tty";
+static const char LOCK_DIR  [] = "/var/lock";
+
+
+
+static bool _read_sysfs (const std::filesystem::path &path, std::string &dest)
+{
+    char buffer [64];
+    bool ok = false;
+
+    if (FILE *f = fopen(path.c_str(), "r"))
+    {
+        if (fgets(buffer, sizeof(buffer), f))
+        {
+            buffer[strcspn(buffer, "\r\n")] = '\0';
+            dest = buffer;
+            ok = true;
+        }
+        fclose(f);
+    }
+
+    return ok;
+}
+
+static unsigned long _read_sysfs_hex (const std::filesystem::path &path)
+{
+    std::string value;
+    return _read_sysfs(path, value) ? strtoul(value.c_str(), nullptr, 16) : 0;
+}
+
+// Orders digit runs numerically so that 1-1.2 sorts before 1-1.10.
+static bool _natural_less (const std::string &a, const std::string &b)
+{
+    const char *pa = a.c_str();
+    const char *pb = b.c_str();
+
+    while (*pa && *pb)
+    {
+        if (isdigit(*pa) && isdigit(*pb))
+        {
+            char *end_a;
+            char *end_b;
+            const unsigned long na = strtoul(pa, &end_a, 10);
+            const unsigned long nb = strtoul(pb, &end_b, 10);
+
+            if (na != nb)
+            {
+                return na < nb;
+            }
+
+            pa = end_a;
+            pb = end_b;
+        }
+        else
+        {
+            if (*pa != *pb)
+            {
+                return *pa < *pb;
+            }
+
+            pa++;
+            pb++;
+        }
+    }
+
+    return !*pa && *pb;
+}
+
+// Ports held by pppd, ModemManager, etc. advertise a UUCP lock file; leave them alone.
+static bool _is_locked (const std::string &device)
+{
+    const std::string name = std::filesystem::path(device).filename().string();
+    const std::string lock = std::string(LOCK_DIR).append("/LCK..").append(name);
+
+    return 0 == access(lock.c_str(), F_OK);
+}
+
+// Check that a port still hangs off the USB device recorded in the map.
+static bool _port_matches (const tty_port &port)
+{
+    std::error_code ec;
+    const std::string name = std::filesystem::path(port.device).filename().string();
+    const auto dir = std::filesystem::canonical(std::filesystem::path(SYSFS_TTY) / name / "device", ec);
+
+    return !ec && std::string::npos != dir.string().find("/" + port.usb_path + "/");
+}
+
+
+
+std::vector<tty_port> enumerate_ports (void)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<tty_port> ports;
+    std::error_code ec;
+
+    for (const auto &entry : fs::directory_iterator(SYSFS_TTY, ec))
+    {
+        // Virtual ttys have no backing device.
+        fs::path dir = fs::canonical(entry.path() / "device", ec);
+        if (ec)
+        {
+            ec.clear();
+            continue;
+        }
+
+        // Walk up to the USB interface the tty belongs to.
+        while (dir.has_relative_path() && !fs::exists(dir / "bInterfaceNumber", ec))
+        {
+            dir = dir.parent_path();
+        }
+
+        if (!dir.has_relative_path())
+        {
+            DBG("Skipping non-USB tty %s\n", entry.path().c_str());
+            continue;
+        }
+
+        tty_port port;
+        port.device     = "/dev/" + entry.path().filename().string();
+        port.usb_path   = dir.parent_path().filename().string();
+        port.vid        = _read_sysfs_hex(dir.parent_path() / "idVendor");
+        port.pid        = _read_sysfs_hex(dir.parent_path() / "idProduct");
+        port.interface  = static_cast<int>(_read_sysfs_hex(dir / "bInterfaceNumber"));
+        port.modem      = 0;
+        port.answers_at = false;
+
+        ports.push_back(std::move(port));
+    }
+
+    std::sort(ports.begin(), ports.end(),
+        [](const tty_port &a, const tty_port &b) {
+            if (a.usb_path != b.usb_path)
+            {
+                return _natural_less(a.usb_path, b.usb_path);
+            }
+            return a.interface < b.interface;
+        });
+
+    // Number modems in USB topology order.
+    for (size_t i = 1; i < ports.size(); i++)
+    {
+        ports[i].modem = ports[i - 1].modem + (ports[i].usb_path != ports[i - 1].usb_path);
+    }
+
+    return ports;
+}
+
+void probe_ports (std::vector<tty_port> &ports, size_t timeout_ms)
+{
+    static const char PROBE [] = "AT\r";
+
+    std::vector<pollfd> fds(ports.size());
+    std::vector<std::string> replies(ports.size());
+    size_t pending = 0;
+
+
+
+    // Send the probe to every candidate up front...
+    for (size_t i = 0; i < ports.size(); i++)
+    {
+        int fd = -1;
+        ports[i].answers_at = false;
+
+        if (_is_locked(ports[i].device))
+        {
+            DBG("Skipping locked port %s\n", ports[i].device.c_str());
+        }
+        else if (-1 != (fd = ::open(ports[i].device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)))
+        {
+            // A port left in canonical mode would hold back or mangle the reply.
+            termios tio;
+            if (0 == tcgetattr(fd, &tio))
+            {
+                cfmakeraw(&tio);
+                tio.c_cflag |= CLOCAL | CREAD;
+                tcsetattr(fd, TCSANOW, &tio);
+            }
+            tcflush(fd, TCIOFLUSH);
+
+            if (static_cast<ssize_t>(sizeof(PROBE) - 1) != ::write(fd, PROBE, sizeof(PROBE) - 1))
+            {
+                ::close(fd);
+                fd = -1;
+            }
+            else
+            {
+                pending++;
+            }
+        }
+
+        // poll() ignores negative descriptors.
+        fds[i] = {fd, POLLIN, 0};
+    }
+
+
+
+    // ...then collect replies until all have answered or the deadline passes.
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (pending > 0)
+    {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+        {
+            break;
+        }
+
+        const int rv = poll(fds.data(), fds.size(), static_cast<int>(remaining));
+        if (rv == -1)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            perror("poll");
+            break;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (fds[i].fd < 0 || !fds[i].revents)
+            {
+                continue;
+            }
+
+            bool done = true;
+
+            if (fds[i].revents & POLLIN)
+            {
+                char buffer [128];
+                const ssize_t n_read = ::read(fds[i].fd, buffer, sizeof(buffer));
+
+                if (n_read > 0)
+                {
+                    replies[i].append(buffer, n_read);
+                    ports[i].answers_at = std::string::npos != replies[i].find("OK");
+                    done = ports[i].answers_at;
+                }
+                else if (n_read == -1 && EAGAIN == errno)
+                {
+                    done = false;
+                }
+            }
+
+            if (done)
+            {
+                ::close(fds[i].fd);
+                fds[i].fd = -1;
+                pending--;
+            }
+        }
+    }
+
+    for (const auto &pfd : fds)
+    {
+        if (pfd.fd >= 0)
+        {
+            ::close(pfd.fd);
+        }
+    }
+}
+#else
+std::vector<tty_port> enumerate_ports (void)
+{
+    return {};
+}
+
+void probe_ports (std::vector<tty_port> &ports, size_t timeout_ms)
+{
+}
+
+static bool _port_matches (const tty_port &port)
+{
+    return true;
+}
+#endif
+
+const char* port_map_path (void)
+{
+    static const std::string path = state_file_path("atctl.ports", "ATCTL_PORT_MAP");
+    return path.c_str();
+}
+
+
+
+bool save_port_map (const std::vector<tty_port> &ports, const char *path)
+{
+    state_file_writer writer(path);
+    FILE *f = writer.begin();
+
+    if (!f)
+    {
+        return false;
+    }
+
+    fprintf(f, "# modem device usb_path vid pid interface at\n");
+    for (const auto &port : ports)
+    {
+        fprintf(f, "%u %s %s %04x %04x %d %d\n",
+                port.modem, port.device.c_str(), port.usb_path.c_str(),
+                port.vid, port.pid, port.interface, port.answers_at);
+    }
+
+    return writer.commit();
+}
+
+bool load_port_map (std::vector<tty_port> &ports, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return false;
+    }
+
+    char line [512];
+    char device [256];
+    char usb_path [128];
+    int answers_at;
+
+    ports.clear();
+    while (fgets(line, sizeof(line), f))
+    {
+        tty_port port;
+
+        if (line[0] != '#' && 7 == sscanf(line, "%u %255s %127s %x %x %d %d",
+                                          &port.modem, device, usb_path,
+                                          &port.vid, &port.pid, &port.interface, &answers_at))
+        {
+            port.device     = device;
+            port.usb_path   = usb_path;
+            port.answers_at = answers_at;
+            ports.push_back(std::move(port));
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+bool resolve_at_port (const char *spec, std::string &device_dest)
+{
+    if (!spec || spec[0] != '@')
+    {
+        return false;
+    }
+
+    char *end;
+    const unsigned long modem = strtoul(spec + 1, &end, 10);
+    if (end == spec + 1 || *end)
+    {
+        throw source_exception("Invalid modem index");
+    }
+
+    std::vector<tty_port> ports;
+    if (!load_port_map(ports))
+    {
+        throw source_exception("No port map found, run atctl --discover");
+    }
+
+    for (const auto &port : ports)
+    {
+        if (port.modem == modem && port.answers_at)
+        {
+            if (!_port_matches(port))
+            {
+                throw source_exception("Port map is stale, run atctl --discover");
+            }
+
+            device_dest = port.device;
+            return true;
+        }
+    }
+
+    throw source_exception("No AT port known for modem");
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+static constexpr size_t DISCOVER_DEFAULT_TIMEOUT_MS = 500;
+
+
+
+
+// A serial tty exposed by a USB modem.
+struct tty_port
+{
+    std::string     device;         // e.g. /dev/ttyUSB2
+    std::string     usb_path;       // USB device the port belongs to, e.g. 1-1.3
+    unsigned int    vid;
+    unsigned int    pid;
+    int             interface;      // bInterfaceNumber
+    unsigned int    modem;          // index of the owning modem
+    bool            answers_at;
+};
+
+
+
+// Enumerate USB serial ttys from sysfs, grouped and indexed by modem.
+std::vector<tty_port> enumerate_ports (void);
+
+// Probe all ports at once with "AT", waiting at most timeout_ms in total.
+void probe_ports (std::vector<tty_port> &ports, size_t timeout_ms = DISCOVER_DEFAULT_TIMEOUT_MS);
+
+
+
+// atctl.ports in the state directory (see state_file_path()), or
+// $ATCTL_PORT_MAP.
+const char* port_map_path (void);
+
+bool save_port_map (const std::vector<tty_port> &ports, const char *path = port_map_path());
+
+bool load_port_map (std::vector<tty_port> &ports, const char *path = port_map_path());
+
+// Resolve "@<modem>" to the AT port of that modem using the saved map.
+// Returns false if spec is not of that form.
+bool resolve_at_port (const char *spec, std::string &device_dest);
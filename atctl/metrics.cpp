@@ -0,0 +1,310 @@
+#include "metrics.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#ifndef _WIN32
+    #include <csignal>
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+
+
+// Segments are named per process: /dev/shm/atctl.<pid>
+static const char SHM_PREFIX [] = "atctl.";
+
+static at_metrics local_metrics;
+
+at_metrics *metrics = &local_metrics;
+
+// The scalar counters, by exposition name.
+static constexpr struct
+{
+    const char                     *name;
+    at_metrics::counter at_metrics::*member;
+} COUNTERS [] = {
+    {"commands_total",          &at_metrics::commands},
+    {"command_lines_total",     &at_metrics::command_lines},
+    {"commands_skipped_total",  &at_metrics::skipped},
+    {"ok_total",                &at_metrics::ok},
+    {"errors_total",            &at_metrics::errors},
+    {"cme_errors_total",        &at_metrics::cme_errors},
+    {"cms_errors_total",        &at_metrics::cms_errors},
+    {"timeouts_total",          &at_metrics::timeouts},
+    {"bytes_tx_total",          &at_metrics::bytes_tx},
+    {"bytes_rx_total",          &at_metrics::bytes_rx},
+    {"reconnects_total",        &at_metrics::reconnects},
+    {"queue_depth",             &at_metrics::queue_depth},
+};
+
+
+
+void metrics_record_result (at_final result, std::string_view final_line, double latency_ms)
+{
+    switch (result)
+    {
+        case at_final::none:
+            metrics_add(metrics->timeouts);
+            return;
+
+        case at_final::ok:
+        case at_final::connect:
+            metrics_add(metrics->ok);
+            break;
+
+        default:
+            if (final_line.starts_with("+CME ERROR:"))
+            {
+                metrics_add(metrics->cme_errors);
+            }
+            else if (final_line.starts_with("+CMS ERROR:"))
+            {
+                metrics_add(metrics->cms_errors);
+            }
+            else
+            {
+                metrics_add(metrics->errors);
+            }
+            break;
+    }
+
+    size_t bucket = 0;
+    while (bucket < METRICS_N_BUCKETS - 1 && latency_ms > METRICS_LATENCY_BOUNDS_MS[bucket])
+    {
+        bucket++;
+    }
+
+    metrics_add(metrics->latency_buckets[bucket]);
+    metrics_add(metrics->latency_sum_us, static_cast<uint64_t>(latency_ms * 1000));
+}
+
+
+
+#ifndef _WIN32
+static std::string published_name;
+
+static void _unpublish (void)
+{
+    shm_unlink(published_name.c_str());
+}
+
+static void _copy_counter (const at_metrics::counter &from, at_metrics::counter &to)
+{
+    to.store(from.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+static void _copy_counters (const at_metrics &from, at_metrics &to)
+{
+    for (const auto &counter : COUNTERS)
+    {
+        _copy_counter(from.*counter.member, to.*counter.member);
+    }
+
+    _copy_counter(from.latency_sum_us, to.latency_sum_us);
+    for (size_t i = 0; i < METRICS_N_BUCKETS; i++)
+    {
+        _copy_counter(from.latency_buckets[i], to.latency_buckets[i]);
+    }
+}
+
+bool metrics_publish (const char *device)
+{
+    if (metrics != &local_metrics)
+    {
+        return true;
+    }
+
+    const std::string name = std::string("/").append(SHM_PREFIX).append(std::to_string(getpid()));
+
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (-1 == fd)
+    {
+        perror("shm_open");
+        return false;
+    }
+
+    void *mem = MAP_FAILED;
+    if (0 == ftruncate(fd, sizeof(at_metrics)))
+    {
+        mem = mmap(nullptr, sizeof(at_metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (MAP_FAILED == mem)
+    {
+        perror("metrics");
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+
+
+    // The segment is zero-filled, which is a valid state for the atomics.
+    at_metrics *shared = static_cast<at_metrics*>(mem);
+    shared->version     = METRICS_VERSION;
+    shared->pid         = getpid();
+    shared->start_time  = static_cast<uint64_t>(time(nullptr));
+    snprintf(shared->device, sizeof(shared->device), "%s", device ? device : "");
+
+    _copy_counters(local_metrics, *shared);
+    shared->magic.store(METRICS_MAGIC, std::memory_order_release);
+
+    metrics = shared;
+    published_name = name;
+    atexit(_unpublish);
+
+    DBG("Publishing metrics in %s\n", name.c_str());
+    return true;
+}
+
+
+
+// Label values escape backslash, double quote and line feed. The device
+// name comes from another process and need not be terminated.
+static std::string _labels (const at_metrics &m)
+{
+    std::string labels = std::string("pid=\"").append(std::to_string(m.pid)).append("\",device=\"");
+
+    for (size_t i = 0; i < sizeof(m.device) && m.device[i]; i++)
+    {
+        switch (m.device[i])
+        {
+            case '\\':
+                labels.append("\\\\");
+                break;
+
+            case '"':
+                labels.append("\\\"");
+                break;
+
+            case '\n':
+                labels.append("\\n");
+                break;
+
+            default:
+                labels.push_back(m.device[i]);
+                break;
+        }
+    }
+
+    return labels.append("\"");
+}
+
+static void _print_metrics (FILE *f, const at_metrics &m)
+{
+    const std::string label_string = _labels(m);
+    const char *labels = label_string.c_str();
+
+    fprintf(f, "atctl_start_time_seconds{%s} %llu\n", labels, static_cast<unsigned long long>(m.start_time));
+    for (const auto &counter : COUNTERS)
+    {
+        fprintf(f, "atctl_%s{%s} %llu\n", counter.name, labels, static_cast<unsigned long long>((m.*counter.member).load(std::memory_order_relaxed)));
+    }
+
+    // Histogram buckets are cumulative in the exposition format.
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < METRICS_N_BUCKETS; i++)
+    {
+        cumulative += m.latency_buckets[i].load(std::memory_order_relaxed);
+
+        if (i < METRICS_N_BUCKETS - 1)
+        {
+            fprintf(f, "atctl_latency_ms_bucket{%s,le=\"%g\"} %llu\n", labels, METRICS_LATENCY_BOUNDS_MS[i], static_cast<unsigned long long>(cumulative));
+        }
+        else
+        {
+            fprintf(f, "atctl_latency_ms_bucket{%s,le=\"+Inf\"} %llu\n", labels, static_cast<unsigned long long>(cumulative));
+        }
+    }
+    fprintf(f, "atctl_latency_ms_sum{%s} %.3f\n", labels, m.latency_sum_us.load(std::memory_order_relaxed) / 1000.0);
+    fprintf(f, "atctl_latency_ms_count{%s} %llu\n", labels, static_cast<unsigned long long>(cumulative));
+}
+
+size_t metrics_print_all (FILE *f)
+{
+    DIR *dir = opendir("/dev/shm");
+    if (!dir)
+    {
+        perror("/dev/shm");
+        return 0;
+    }
+
+    size_t found = 0;
+    while (const dirent *entry = readdir(dir))
+    {
+        if (0 != strncmp(entry->d_name, SHM_PREFIX, sizeof(SHM_PREFIX) - 1))
+        {
+            continue;
+        }
+
+        const std::string name = std::string("/").append(entry->d_name);
+
+        // Left behind by a process that crashed: remove it, or /dev/shm
+        // fills up with them.
+        char *end;
+        const long owner = strtol(entry->d_name + sizeof(SHM_PREFIX) - 1, &end, 10);
+        if (owner > 0 && '\0' == *end && -1 == kill(static_cast<pid_t>(owner), 0) && ESRCH == errno)
+        {
+            DBG("Removing stale metrics segment %s\n", name.c_str());
+            shm_unlink(name.c_str());
+            continue;
+        }
+        const int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (-1 == fd)
+        {
+            continue;
+        }
+
+        // A short segment (being created, or from another version) would fault when read.
+        struct stat st;
+        void *mem = MAP_FAILED;
+        if (0 == fstat(fd, &st) && st.st_size >= static_cast<off_t>(sizeof(at_metrics)))
+        {
+            mem = mmap(nullptr, sizeof(at_metrics), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+
+        if (MAP_FAILED == mem)
+        {
+            continue;
+        }
+
+        const at_metrics &m = *static_cast<const at_metrics*>(mem);
+
+        // Skip segments still being set up, or from other versions.
+        if (METRICS_MAGIC == m.magic.load(std::memory_order_acquire)
+            && METRICS_VERSION == m.version)
+        {
+            _print_metrics(f, m);
+            found++;
+        }
+        else
+        {
+            DBG("Skipping metrics segment %s\n", name.c_str());
+        }
+
+        munmap(mem, sizeof(at_metrics));
+    }
+
+    closedir(dir);
+    return found;
+}
+#else
+bool metrics_publish (const char *device)
+{
+    return false;
+}
+
+size_t metrics_print_all (FILE *f)
+{
+    throw source_exception("--stats is not supported on Windows");
+}
+#endif
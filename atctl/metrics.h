@@ -0,0 +1,81 @@
+#pragma once
+
+#include "at_parser.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <string_view>
+
+static constexpr uint32_t METRICS_MAGIC     = 0x6d746361;   // "actm"
+static constexpr uint32_t METRICS_VERSION   = 2;
+
+// Upper bounds of the command latency histogram; one more bucket catches the rest.
+static constexpr double METRICS_LATENCY_BOUNDS_MS [] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000,
+};
+static constexpr size_t METRICS_N_BUCKETS = std::size(METRICS_LATENCY_BOUNDS_MS) + 1;
+
+
+
+
+// Counters of one atctl process. Written with relaxed atomics from the I/O
+// path and read by other processes without any locking; a scrape may see
+// counters from slightly different instants.
+struct at_metrics
+{
+    using counter = std::atomic<uint64_t>;
+
+    std::atomic<uint32_t>   magic;          // set last when published
+    uint32_t                version;
+    int32_t                 pid;
+    char                    device [116];
+    uint64_t                start_time;     // unix seconds
+
+    counter                 commands;       // commands sent
+    counter                 command_lines;  // AT lines written (merged commands count once)
+    counter                 skipped;        // settings already in effect, not sent
+    counter                 ok;
+    counter                 errors;         // ERROR and other failing final results
+    counter                 cme_errors;
+    counter                 cms_errors;
+    counter                 timeouts;
+    counter                 bytes_tx;
+    counter                 bytes_rx;
+    counter                 reconnects;
+    counter                 queue_depth;    // gauge: commands waiting to be sent
+
+    counter                 latency_sum_us;
+    counter                 latency_buckets [METRICS_N_BUCKETS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "metrics need lock-free 64-bit atomics");
+
+
+
+// Always valid: process-local until metrics_publish() moves it to shared memory.
+extern at_metrics *metrics;
+
+static inline void metrics_add (at_metrics::counter &counter, uint64_t n = 1)
+{
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+static inline void metrics_set (at_metrics::counter &counter, uint64_t value)
+{
+    counter.store(value, std::memory_order_relaxed);
+}
+
+// Counts a finished command line and its latency from write to final result.
+void metrics_record_result (at_final result, std::string_view final_line, double latency_ms);
+
+
+
+// Makes this process's counters readable by atctl --stats until exit.
+// Failure only costs visibility, so it is reported and otherwise ignored.
+bool metrics_publish (const char *device);
+
+// Prints the counters of all running atctl processes in text exposition
+// format. Returns the number of processes found.
+size_t metrics_print_all (FILE *f);
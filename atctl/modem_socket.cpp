@@ -0,0 +1,430 @@
+#include "modem_socket.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+
+
+modem_socket::modem_socket (at_engine &engine, int context_id, int connect_id)
+    : m_engine (engine)
+    , m_context_id (context_id)
+    , m_connect_id (connect_id)
+{}
+
+modem_socket::~modem_socket (void)
+{
+    try
+    {
+        this->close();
+    }
+    catch (const source_exception &e)
+    {
+        DBG("Closing socket: %s\n", e.what());
+    }
+}
+
+void modem_socket::connect (const std::string &host, uint16_t port, size_t timeout_ms)
+{
+    // The host goes into a quoted string parameter of a command line.
+    if (host.empty() || host.end() != std::find_if(host.begin(), host.end(), [] (char c) { return c == '"' || static_cast<unsigned char>(c) < ' '; }))
+    {
+        throw source_exception("Invalid host name");
+    }
+
+    // Sent data must not be echoed back into the response.
+    m_engine.transact("+QISDE=0", m_lines);
+    this->handle_lines(m_lines);
+
+    const std::string active = "+QIACT: " + std::to_string(m_context_id) + ",1";
+    bool is_active = false;
+
+    if (at_final::ok == m_engine.transact("+QIACT?", m_lines))
+    {
+        for (const auto &line : m_lines)
+        {
+            is_active = is_active || line.starts_with(active);
+        }
+    }
+
+    if (!is_active && at_final::ok != m_engine.transact("+QIACT=" + std::to_string(m_context_id), m_lines))
+    {
+        throw source_exception("Failed to activate the PDP context");
+    }
+
+
+
+    const std::string open = "+QIOPEN=" + std::to_string(m_context_id) + "," + std::to_string(m_connect_id)
+                           + ",\"TCP\",\"" + host + "\"," + std::to_string(port) + ",0,0";
+
+    if (at_final::ok != m_engine.transact(open, m_lines))
+    {
+        throw source_exception("Modem refused to open a connection");
+    }
+    this->handle_lines(m_lines);
+
+    // The outcome follows as "+QIOPEN: <id>,<err>".
+    if (AT_TIMEOUT_AUTO == timeout_ms)
+    {
+        timeout_ms = at_command_timeout("+QIOPEN");
+    }
+
+    const std::string opened = "+QIOPEN: " + std::to_string(m_connect_id) + ",";
+    const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (!m_connected)
+    {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (remaining <= 0 || !m_engine.wait_line(m_line, remaining))
+        {
+            throw source_exception("Timed out connecting");
+        }
+
+        if (m_line.starts_with(opened))
+        {
+            const int err = atoi(m_line.c_str() + opened.size());
+            if (err)
+            {
+                fprintf(stderr, "Connecting to %s:%u failed with error %d\n", host.c_str(), port, err);
+                throw source_exception("Failed to connect");
+            }
+
+            m_connected = true;
+        }
+        else
+        {
+            this->handle_urc(m_line);
+        }
+    }
+}
+
+void modem_socket::close (void)
+{
+    if (!m_connected)
+    {
+        return;
+    }
+
+    this->flush();
+    m_connected = false;
+    m_engine.transact("+QICLOSE=" + std::to_string(m_connect_id), m_lines);
+}
+
+
+
+void modem_socket::write (const char *data, size_t size)
+{
+    if (m_tx.empty())
+    {
+        m_tx_since = clock::now();
+    }
+    m_tx.append(data, size);
+
+    while (m_connected && m_tx.size() >= QI_MAX_SEND)
+    {
+        this->send_chunk(QI_MAX_SEND);
+    }
+}
+
+void modem_socket::flush (void)
+{
+    while (m_connected && !m_tx.empty())
+    {
+        this->send_chunk(std::min(m_tx.size(), QI_MAX_SEND));
+    }
+}
+
+void modem_socket::send_chunk (size_t size)
+{
+    const std::string command = "+QISEND=" + std::to_string(m_connect_id) + "," + std::to_string(size);
+    const at_final result = m_engine.transact_prompt(command, std::string_view(m_tx.data(), size), m_lines,
+                                                     AT_TIMEOUT_AUTO, AT_DEFAULT_PROMPT_TIMEOUT_MS, false);
+    this->handle_lines(m_lines);
+
+    if (result != at_final::ok)
+    {
+        // SEND FAIL: the modem's send buffer is full or the connection is gone.
+        throw source_exception("Failed to send");
+    }
+
+    const double latency = std::chrono::duration<double, std::milli>(clock::now() - m_tx_since).count();
+    m_latency_sum += latency;
+    m_latency_max = std::max(m_latency_max, latency);
+    m_n_sends++;
+    m_bytes_tx += size;
+
+    m_tx.erase(0, size);
+    m_tx_since = clock::now();
+}
+
+
+
+void modem_socket::poll (size_t timeout_ms)
+{
+    if (m_engine.wait_line(m_line, timeout_ms))
+    {
+        this->handle_urc(m_line);
+
+        while (m_engine.wait_line(m_line, 0))
+        {
+            this->handle_urc(m_line);
+        }
+    }
+
+    this->read_available();
+}
+
+void modem_socket::read_available (void)
+{
+    const std::string command = "+QIRD=" + std::to_string(m_connect_id) + "," + std::to_string(QI_MAX_READ);
+
+    // Announced once per arrival, so read until the modem has nothing left.
+    while (m_readable)
+    {
+        const size_t before = m_rx.size();
+        if (at_final::ok != m_engine.transact_read(command, "+QIRD", m_rx, m_lines))
+        {
+            throw source_exception("Failed to read");
+        }
+
+        m_n_reads++;
+        m_bytes_rx += m_rx.size() - before;
+        m_readable = m_rx.size() > before;
+
+        this->handle_lines(m_lines);
+    }
+}
+
+void modem_socket::handle_lines (const std::vector<std::string> &lines)
+{
+    for (const auto &line : lines)
+    {
+        if (line.starts_with("+QIURC:"))
+        {
+            this->handle_urc(line);
+        }
+    }
+}
+
+bool modem_socket::handle_urc (std::string_view line)
+{
+    static constexpr std::string_view URC = "+QIURC: \"";
+    if (!line.starts_with(URC))
+    {
+        DBG("Ignoring %.*s\n", static_cast<int>(line.size()), line.data());
+        return false;
+    }
+
+    line.remove_prefix(URC.size());
+    const size_t quote = line.find('"');
+    const std::string_view event = line.substr(0, quote);
+    // ",<id>" may be missing from a garbled line.
+    const int id = (std::string_view::npos == quote || quote + 2 >= line.size()) ? -1 : atoi(std::string(line.substr(quote + 2)).c_str());
+
+    if (event == "recv" && id == m_connect_id)
+    {
+        m_readable = true;
+    }
+    else if (event == "closed" && id == m_connect_id)
+    {
+        // Whatever arrived before the close can still be read.
+        m_readable = true;
+        this->read_available();
+        m_connected = false;
+        m_engine.transact("+QICLOSE=" + std::to_string(m_connect_id), m_lines);
+    }
+    else if (event == "pdpdeact" && id == m_context_id)
+    {
+        m_connected = false;
+    }
+
+    return true;
+}
+
+void modem_socket::print_stats (FILE *f, double elapsed) const
+{
+    fprintf(f, "Sent %llu bytes in %llu +QISEND (%.0f bytes each), received %llu bytes in %llu +QIRD\n",
+            static_cast<unsigned long long>(m_bytes_tx), static_cast<unsigned long long>(m_n_sends),
+            m_n_sends ? static_cast<double>(m_bytes_tx) / m_n_sends : 0,
+            static_cast<unsigned long long>(m_bytes_rx), static_cast<unsigned long long>(m_n_reads));
+    fprintf(f, "Throughput: %.1f kB/s out, %.1f kB/s in over %.1f s\n",
+            elapsed > 0 ? m_bytes_tx / elapsed / 1e3 : 0, elapsed > 0 ? m_bytes_rx / elapsed / 1e3 : 0, elapsed);
+    fprintf(f, "Send latency (buffered to SEND OK): mean %.1f ms, max %.1f ms\n",
+            m_n_sends ? m_latency_sum / m_n_sends : 0, m_latency_max);
+}
+
+
+
+#ifndef _WIN32
+static void _write_out (int fd, std::string &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        const ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            perror("write");
+            throw source_exception("Failed to write received data");
+        }
+        written += n;
+    }
+
+    data.clear();
+}
+
+void modem_socket_bridge (at_engine &engine, const std::string &host, uint16_t port, int in_fd, int out_fd, int stop_fd,
+                          size_t coalesce_ms, size_t linger_ms)
+{
+    using clock = std::chrono::steady_clock;
+
+    modem_socket socket(engine);
+    socket.connect(host, port);
+    fprintf(stderr, "Connected to %s:%u\n", host.c_str(), port);
+
+    const clock::time_point start = clock::now();
+    clock::time_point last_activity = start;
+    bool in_open = true;
+    char buffer [16 * 1024];
+
+    while (socket.is_connected())
+    {
+        // Lines that arrived during the last command are already buffered.
+        socket.poll(0);
+        if (!socket.received().empty())
+        {
+            _write_out(out_fd, socket.received());
+            last_activity = clock::now();
+        }
+
+        if (!socket.is_connected())
+        {
+            break;
+        }
+
+        int timeout_ms = -1;
+        if (socket.get_pending())
+        {
+            const auto due = socket.get_pending_since() + std::chrono::milliseconds(coalesce_ms);
+            timeout_ms = std::max<int>(0, std::chrono::ceil<std::chrono::milliseconds>(due - clock::now()).count());
+        }
+        else if (!in_open)
+        {
+            const auto due = last_activity + std::chrono::milliseconds(linger_ms);
+            if (clock::now() >= due)
+            {
+                break;
+            }
+            timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(due - clock::now()).count();
+        }
+
+        pollfd fds [] = {
+            {in_open ? in_fd : -1,                      POLLIN, 0},
+            {engine.get_device().get_handle(),          POLLIN, 0},
+            {stop_fd,                                   POLLIN, 0},
+        };
+
+        if (-1 == ::poll(fds, 3, timeout_ms))
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        if (fds[2].revents & POLLIN)
+        {
+            break;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP))
+        {
+            const ssize_t n = ::read(in_fd, buffer, sizeof(buffer));
+            if (n > 0)
+            {
+                socket.write(buffer, n);
+            }
+            else
+            {
+                in_open = false;
+                socket.flush();
+            }
+            last_activity = clock::now();
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            socket.poll(1);
+        }
+
+        if (socket.get_pending() && clock::now() >= socket.get_pending_since() + std::chrono::milliseconds(coalesce_ms))
+        {
+            socket.flush();
+        }
+    }
+
+    if (!socket.received().empty())
+    {
+        _write_out(out_fd, socket.received());
+    }
+
+    const bool remote_closed = !socket.is_connected();
+    socket.close();
+
+    if (remote_closed)
+    {
+        fprintf(stderr, "Connection closed by remote end\n");
+    }
+    socket.print_stats(stderr, std::chrono::duration<double>(clock::now() - start).count());
+}
+#else
+void modem_socket_bridge (at_engine &engine, const std::string &host, uint16_t port, int in_fd, int out_fd, int stop_fd,
+                          size_t coalesce_ms, size_t linger_ms)
+{
+    throw source_exception("The TCP bridge is not supported on Windows");
+}
+#endif
+
+
+
+bool parse_host_port (const char *str, std::string &host_dest, uint16_t &port_dest)
+{
+    const std::string_view s(str);
+    const size_t colon = s.rfind(':');
+
+    if (std::string_view::npos == colon || 0 == colon)
+    {
+        return false;
+    }
+
+    std::string_view host = s.substr(0, colon);
+    if (host.front() == '[' && host.back() == ']')
+    {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    char *end;
+    const unsigned long port = strtoul(str + colon + 1, &end, 10);
+    if (end == str + colon + 1 || *end || port == 0 || port > 65535 || host.empty())
+    {
+        return false;
+    }
+
+    host_dest.assign(host);
+    port_dest = static_cast<uint16_t>(port);
+    return true;
+}
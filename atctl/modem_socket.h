@@ -0,0 +1,115 @@
+#pragma once
+
+#include "at_engine.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Largest payload of one +QISEND, and of one +QIRD.
+static constexpr size_t QI_MAX_SEND = 1460;
+static constexpr size_t QI_MAX_READ = 1500;
+
+// How long a partial chunk waits for more data before it is sent.
+static constexpr size_t TCP_DEFAULT_COALESCE_MS = 20;
+
+// After stdin ends, how long to wait for the remote end to answer.
+static constexpr size_t TCP_DEFAULT_LINGER_MS = 2000;
+
+
+
+// A TCP connection through the modem's own TCP/IP stack (Quectel
+// +QIOPEN/+QISEND/+QIRD, buffer access mode). Writes are collected and
+// sent in as few +QISEND chunks as possible; incoming data is fetched with
+// +QIRD when the modem reports it with +QIURC: "recv".
+class modem_socket
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    explicit modem_socket (at_engine &engine, int context_id = 1, int connect_id = 0);
+    ~modem_socket (void);
+
+    modem_socket (const modem_socket&) = delete;
+    modem_socket& operator= (const modem_socket&) = delete;
+
+    // Activates the PDP context if needed and connects; throws on failure.
+    void connect (const std::string &host, uint16_t port, size_t timeout_ms = AT_TIMEOUT_AUTO);
+
+    // Buffers data, sending every full chunk at once.
+    void write (const char *data, size_t size);
+
+    // Sends whatever is buffered.
+    void flush (void);
+
+    // Handles unsolicited result codes, waiting up to timeout_ms for the
+    // first (0: only those already received), and fetches announced data.
+    void poll (size_t timeout_ms);
+
+    // Data received so far; the caller consumes it.
+    std::string& received (void)
+    {
+        return m_rx;
+    }
+
+    void close (void);
+
+    bool is_connected (void) const
+    {
+        return m_connected;
+    }
+
+    size_t get_pending (void) const
+    {
+        return m_tx.size();
+    }
+
+    // When the oldest buffered byte was written.
+    clock::time_point get_pending_since (void) const
+    {
+        return m_tx_since;
+    }
+
+    void print_stats (FILE *f, double elapsed) const;
+
+private:
+    void send_chunk (size_t size);
+    void read_available (void);
+
+    // Handles the +QIURC lines among a command's response.
+    void handle_lines (const std::vector<std::string> &lines);
+    bool handle_urc (std::string_view line);
+
+    at_engine                  &m_engine;
+    int                         m_context_id;
+    int                         m_connect_id;
+    bool                        m_connected     = false;
+    bool                        m_readable      = false;
+
+    std::string                 m_tx;
+    clock::time_point           m_tx_since;
+    std::string                 m_rx;
+    std::string                 m_line;
+    std::vector<std::string>    m_lines;
+
+    // Statistics
+    uint64_t                    m_n_sends       = 0;
+    uint64_t                    m_n_reads       = 0;
+    uint64_t                    m_bytes_tx      = 0;
+    uint64_t                    m_bytes_rx      = 0;
+    double                      m_latency_sum   = 0;    // first byte buffered -> SEND OK, ms
+    double                      m_latency_max   = 0;
+};
+
+
+
+// Bridges in_fd and out_fd to host:port until the remote end closes, stop_fd
+// becomes readable, or in_fd ends and the remote end has been quiet for
+// linger_ms. Prints statistics to stderr.
+void modem_socket_bridge (at_engine &engine, const std::string &host, uint16_t port, int in_fd, int out_fd, int stop_fd,
+                          size_t coalesce_ms = TCP_DEFAULT_COALESCE_MS, size_t linger_ms = TCP_DEFAULT_LINGER_MS);
+
+// "host:port", "[v6addr]:port"
+bool parse_host_port (const char *str, std::string &host_dest, uint16_t &port_dest);
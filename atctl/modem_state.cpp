@@ -0,0 +1,155 @@
+#include "modem_state.h"
+
+#include <algorithm>
+
+
+
+static constexpr const at_command_info *ECHO = at_command_lookup("E");
+static_assert(ECHO->flags & AT_CMD_SETTING);
+
+// What a setting command sets: "E" -> "0", "E1" -> "1", "+CMEE=2" -> "2".
+// false for anything else, e.g. "+CMEE?", "+CMEE=?" or "E0V1".
+static bool _setting_value (std::string_view command, const at_command_info *info, std::string_view &value_dest)
+{
+    const std::string_view rest = command.substr(info->stem.size());
+
+    if (info->stem[0] != '+')
+    {
+        if (std::string_view::npos != rest.find_first_not_of("0123456789"))
+        {
+            return false;
+        }
+
+        value_dest = rest.empty() ? "0" : rest;
+        return true;
+    }
+
+    if (!rest.starts_with('=') || rest.ends_with('?'))
+    {
+        return false;
+    }
+
+    value_dest = rest.substr(1);
+    return true;
+}
+
+// "+CMEE: 2" -> "2"
+static bool _reported_value (const std::vector<std::string> &lines, std::string_view prefix, std::string_view &value_dest)
+{
+    for (const std::string_view line : lines)
+    {
+        if (line.size() > prefix.size() && line.starts_with(prefix) && line[prefix.size()] == ':')
+        {
+            value_dest = line.substr(prefix.size() + 1);
+            value_dest.remove_prefix(std::min(value_dest.find_first_not_of(' '), value_dest.size()));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+bool modem_state::is_redundant (std::string_view command) const
+{
+    // Only single commands: the rest of a combined line may change anything.
+    if (std::string_view::npos != command.find(';'))
+    {
+        return false;
+    }
+
+    const at_command_info *info = at_command_lookup(command);
+    std::string_view value;
+
+    if (!info || !(info->flags & AT_CMD_SETTING) || !_setting_value(command, info, value))
+    {
+        return false;
+    }
+
+    const std::string *current = this->find(info);
+    return current && *current == value;
+}
+
+void modem_state::update (std::string_view command, at_final result, const std::vector<std::string> &lines)
+{
+    const at_command_info *info = at_command_lookup(command);
+
+    // Even a reset that reported an error may have happened.
+    if (std::string_view::npos != command.find(';') || (info && (info->flags & AT_CMD_RESET) && !command.ends_with('?')))
+    {
+        this->clear();
+        return;
+    }
+
+    if (!info || !(info->flags & AT_CMD_SETTING) || command.ends_with("=?"))
+    {
+        return;
+    }
+
+    std::string_view value;
+
+    if (_setting_value(command, info, value))
+    {
+        // Rejected or timed out: the old value may or may not still hold.
+        if (result == at_final::ok)
+        {
+            this->set(info, value);
+        }
+        else
+        {
+            this->forget(info);
+        }
+    }
+    else if (command.ends_with('?'))
+    {
+        if (result == at_final::ok && !info->prefix.empty() && _reported_value(lines, info->prefix, value))
+        {
+            this->set(info, value);
+        }
+    }
+    else
+    {
+        // Several basic commands on one line ("E0V1"): nothing is known any more.
+        this->clear();
+    }
+}
+
+void modem_state::set_echo (bool echo)
+{
+    this->set(ECHO, echo ? "1" : "0");
+}
+
+
+
+const std::string* modem_state::find (const at_command_info *info) const
+{
+    for (const auto &setting : m_settings)
+    {
+        if (setting.first == info)
+        {
+            return &setting.second;
+        }
+    }
+
+    return nullptr;
+}
+
+void modem_state::set (const at_command_info *info, std::string_view value)
+{
+    for (auto &setting : m_settings)
+    {
+        if (setting.first == info)
+        {
+            setting.second.assign(value);
+            return;
+        }
+    }
+
+    m_settings.emplace_back(info, value);
+}
+
+void modem_state::forget (const at_command_info *info)
+{
+    std::erase_if(m_settings, [info](const auto &setting) { return setting.first == info; });
+}
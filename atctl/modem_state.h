@@ -0,0 +1,48 @@
+#pragma once
+
+#include "at_commands.h"
+#include "at_parser.h"
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+
+// The settings the modem has confirmed on this connection, so that setting
+// one again can be skipped. Only commands flagged AT_CMD_SETTING in
+// AT_COMMANDS are tracked. Values are learnt from a setting's OK, from the
+// answer to its query, and for E from whether commands are echoed;
+// AT_CMD_RESET commands forget everything, a failed setting its own value.
+// Whoever notices the modem went away (reattach) must clear() it.
+class modem_state
+{
+public:
+    // True if command only sets what is already in effect.
+    bool is_redundant (std::string_view command) const;
+
+    // Learns from a finished command; lines as collected by at_engine.
+    void update (std::string_view command, at_final result, const std::vector<std::string> &lines);
+
+    // Whether the modem echoed the last command line.
+    void set_echo (bool echo);
+
+    void clear (void)
+    {
+        m_settings.clear();
+    }
+
+    size_t size (void) const
+    {
+        return m_settings.size();
+    }
+
+private:
+    const std::string* find (const at_command_info *info) const;
+    void set (const at_command_info *info, std::string_view value);
+    void forget (const at_command_info *info);
+
+    // Few enough for a linear search; keyed by the table entry.
+    std::vector<std::pair<const at_command_info*, std::string>> m_settings;
+};
@@ -0,0 +1,378 @@
+#include "monitor.h"
+#include "realtime.h"
+#include "sigint_fd.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#ifndef _WIN32
+    #include <ctime>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/timerfd.h>
+    #include <sys/resource.h>
+#endif
+
+
+
+bool parse_interval (const char *str, std::chrono::nanoseconds &interval_dest)
+{
+    static constexpr struct {
+        const char *suffix;
+        double      ns;
+    } UNITS [] = {
+        {"",    1e9},
+        {"s",   1e9},
+        {"ms",  1e6},
+        {"us",  1e3},
+    };
+
+    char *end;
+    const double value = strtod(str, &end);
+
+    if (end == str || !(value > 0))
+    {
+        return false;
+    }
+
+    for (const auto &unit : UNITS)
+    {
+        if (0 == strcmp(end, unit.suffix))
+        {
+            interval_dest = std::chrono::nanoseconds(static_cast<int64_t>(value * unit.ns));
+            return interval_dest.count() > 0;
+        }
+    }
+
+    return false;
+}
+
+
+
+#ifndef _WIN32
+static constexpr int64_t NSEC_PER_SEC = 1000000000;
+
+// How long recorded telemetry may sit in memory before it is written out
+// as a short block.
+static constexpr int64_t RECORD_FLUSH_NS = 60 * NSEC_PER_SEC;
+
+static int64_t _now_ns (clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static timespec _to_timespec (int64_t ns)
+{
+    return {static_cast<time_t>(ns / NSEC_PER_SEC), static_cast<long>(ns % NSEC_PER_SEC)};
+}
+
+static double _cpu_seconds (void)
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+         + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// A CLOCK_MONOTONIC timerfd, closed when it goes.
+class monitor_timer
+{
+public:
+    monitor_timer (void)
+        : m_fd (timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC))
+    {
+        if (-1 == m_fd)
+        {
+            throw source_exception("Failed to create timer");
+        }
+    }
+
+    ~monitor_timer (void)
+    {
+        ::close(m_fd);
+    }
+
+    monitor_timer (const monitor_timer&) = delete;
+    monitor_timer& operator= (const monitor_timer&) = delete;
+
+    int get_fd (void) const
+    {
+        return m_fd;
+    }
+
+    // Fires at start_ns and every interval_ns after it.
+    void arm (int64_t start_ns, int64_t interval_ns)
+    {
+        itimerspec spec;
+        spec.it_value = _to_timespec(start_ns);
+        spec.it_interval = _to_timespec(interval_ns);
+
+        if (-1 == timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &spec, nullptr))
+        {
+            throw source_exception("Failed to arm timer");
+        }
+    }
+
+private:
+    int     m_fd;
+};
+
+// Lateness histogram: bucket b holds [LATENESS_STEP^b, LATENESS_STEP^(b+1)) us,
+// so percentiles are within 5%, up to about 13 s.
+static constexpr double LATENESS_STEP = 1.05;
+static constexpr size_t LATENESS_BUCKETS = 336;
+
+// Running mean/variance (Welford) of how late each tick was serviced, and
+// a fixed histogram for percentiles: nothing allocated per tick.
+struct lateness_stats
+{
+    uint64_t    n       = 0;
+    double      mean    = 0;
+    double      m2      = 0;
+    double      min     = 0;
+    double      max     = 0;
+    uint64_t    buckets [LATENESS_BUCKETS] = {};
+
+    void add (double x)
+    {
+        n++;
+        const double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+        min = (n == 1) ? x : std::min(min, x);
+        max = (n == 1) ? x : std::max(max, x);
+
+        const double b = x > 1 ? std::log(x) / std::log(LATENESS_STEP) : 0;
+        buckets[std::min(static_cast<size_t>(b), LATENESS_BUCKETS - 1)]++;
+    }
+
+    double stddev (void) const
+    {
+        return n > 1 ? std::sqrt(m2 / (n - 1)) : 0;
+    }
+
+    // Upper bound of the bucket holding the p-quantile, at most max.
+    double percentile (double p) const
+    {
+        const uint64_t rank = static_cast<uint64_t>(std::ceil(p * n));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < LATENESS_BUCKETS; b++)
+        {
+            seen += buckets[b];
+            if (seen >= rank && seen)
+            {
+                return std::min(max, std::pow(LATENESS_STEP, b + 1));
+            }
+        }
+        return max;
+    }
+};
+
+
+
+void run_monitor (at_engine &engine, const std::vector<std::string> &commands, const monitor_options &options, output_writer &output,
+                  device_watch *watch)
+{
+    sigint_fd sigint;
+
+    monitor_timer timer;
+
+    // Ticks are start + k * interval, so scheduling error never accumulates.
+    const int64_t interval_ns = options.interval.count();
+    const int64_t start_ns = _now_ns(CLOCK_MONOTONIC);
+    const double start_cpu = _cpu_seconds();
+    timer.arm(start_ns, interval_ns);
+
+
+
+    std::vector<at_response> responses;
+    std::vector<std::string> last(commands.size());
+    std::string joined;
+    lateness_stats lateness;
+    uint64_t tick = 0;
+    uint64_t samples = 0;
+    uint64_t overruns = 0;
+    uint64_t timeouts = 0;
+    const size_t start_round_trips = engine.get_round_trips();
+    const size_t start_skipped = engine.get_skipped();
+    const uint64_t start_recorded = options.record ? options.record->get_rows() : 0;
+    thread_sched_stats warm {};
+    int64_t last_record_flush_ns = start_ns;
+
+    pollfd fds [] = {
+        {timer.get_fd(),    POLLIN, 0},
+        {sigint.get_fd(),   POLLIN, 0},
+    };
+
+    while (1)
+    {
+        output.flush();
+
+        if (-1 == poll(fds, 2, -1))
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            perror("poll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            sigint.consume();
+            break;
+        }
+
+        uint64_t expirations;
+        if (!(fds[0].revents & POLLIN) || sizeof(expirations) != ::read(timer.get_fd(), &expirations, sizeof(expirations)))
+        {
+            continue;
+        }
+
+        // Ticks that passed while the previous sample was still running are skipped, not queued.
+        overruns += expirations - 1;
+        tick += expirations;
+
+        const int64_t scheduled_ns = start_ns + static_cast<int64_t>(tick - 1) * interval_ns;
+        lateness.add((_now_ns(CLOCK_MONOTONIC) - scheduled_ns) / 1e3);
+
+        const double time = _now_ns(CLOCK_REALTIME) / 1e9;
+
+
+
+        try
+        {
+            engine.transact_batch(commands, responses);
+        }
+        catch (const source_exception &e)
+        {
+            if (!watch || !watch->is_gone(engine.get_device()))
+            {
+                throw;
+            }
+
+            // Ticks missed meanwhile show up as overruns.
+            watch->lose(engine.get_device());
+            if (!reattach(engine.get_device(), *watch, sigint.get_fd()))
+            {
+                break;
+            }
+
+            engine.reset();
+            continue;
+        }
+
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            const auto &lines = responses[i].lines;
+
+            if (at_final::none == responses[i].result)
+            {
+                timeouts++;
+                continue;
+            }
+
+            if (options.record)
+            {
+                for (const auto &line : lines)
+                {
+                    options.record->add(time, line);
+                }
+            }
+
+            if (options.changes_only)
+            {
+                joined.clear();
+                for (const auto &line : lines)
+                {
+                    joined.append(line).push_back('\n');
+                }
+
+                if (joined == last[i])
+                {
+                    continue;
+                }
+
+                last[i].swap(joined);
+            }
+
+            for (const auto &line : lines)
+            {
+                output.sample(time, commands[i], line);
+            }
+        }
+
+        // Whatever the first sample faults in is there from now on.
+        if (0 == samples++)
+        {
+            warm = get_thread_sched_stats();
+        }
+
+        if (options.record && _now_ns(CLOCK_MONOTONIC) - last_record_flush_ns >= RECORD_FLUSH_NS)
+        {
+            options.record->flush();
+            last_record_flush_ns = _now_ns(CLOCK_MONOTONIC);
+        }
+    }
+
+    output.flush();
+
+
+
+    const double elapsed = (_now_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+    const double cpu = _cpu_seconds() - start_cpu;
+    const thread_sched_stats end = get_thread_sched_stats();
+
+    fprintf(stderr, "\n%llu samples, %llu overruns skipped, %llu timeouts in %.1f s\n",
+            static_cast<unsigned long long>(samples), static_cast<unsigned long long>(overruns),
+            static_cast<unsigned long long>(timeouts), elapsed);
+    fprintf(stderr, "%zu command lines for %llu commands, %zu settings already in effect\n",
+            engine.get_round_trips() - start_round_trips,
+            static_cast<unsigned long long>(samples * commands.size()),
+            engine.get_skipped() - start_skipped);
+    fprintf(stderr, "Wake-up lateness: mean %.1f us, stddev %.1f us, min %.1f us, max %.1f us\n",
+            lateness.mean, lateness.stddev(), lateness.min, lateness.max);
+    fprintf(stderr, "                  p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+            lateness.percentile(0.5), lateness.percentile(0.99), lateness.percentile(0.999));
+    if (samples)
+    {
+        fprintf(stderr, "After the first sample: %llu preemptions, %llu waits, %llu page faults (%llu major)\n",
+                static_cast<unsigned long long>(end.involuntary_switches - warm.involuntary_switches),
+                static_cast<unsigned long long>(end.voluntary_switches - warm.voluntary_switches),
+                static_cast<unsigned long long>(end.minor_faults - warm.minor_faults + end.major_faults - warm.major_faults),
+                static_cast<unsigned long long>(end.major_faults - warm.major_faults));
+    }
+    fprintf(stderr, "CPU: %.1f ms (%.3f%% of one core, %.1f us per sample)\n",
+            cpu * 1e3, elapsed > 0 ? 100 * cpu / elapsed : 0, samples ? 1e6 * cpu / samples : 0);
+
+    if (options.record)
+    {
+        options.record->flush();
+        fprintf(stderr, "Recorded %llu telemetry rows, %.1f KB written\n",
+                static_cast<unsigned long long>(options.record->get_rows() - start_recorded), options.record->get_bytes_written() / 1e3);
+    }
+
+    if (watch && watch->get_reattach_count())
+    {
+        fprintf(stderr, "Reattached %zu times, recovery last %.0f ms, max %.0f ms\n",
+                watch->get_reattach_count(), watch->get_last_recovery_ms(), watch->get_max_recovery_ms());
+    }
+}
+#else
+void run_monitor (at_engine &engine, const std::vector<std::string> &commands, const monitor_options &options, output_writer &output,
+                  device_watch *watch)
+{
+    throw source_exception("Monitor mode is not supported on Windows");
+}
+#endif
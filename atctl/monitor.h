@@ -0,0 +1,28 @@
+#pragma once
+
+#include "at_engine.h"
+#include "output.h"
+#include "reattach.h"
+#include "telemetry.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+
+struct monitor_options
+{
+    std::chrono::nanoseconds    interval        = std::chrono::seconds(1);
+    bool                        changes_only    = false;
+    telemetry_writer           *record          = nullptr;  // every sample, also with changes_only
+};
+
+// Accepts e.g. "100ms", "2s", "0.5" (seconds).
+bool parse_interval (const char *str, std::chrono::nanoseconds &interval_dest);
+
+// Runs the commands once per interval on absolute deadlines until SIGINT or
+// SIGTERM, then prints timing statistics to stderr. With a watch, a modem
+// that resets is waited for and sampling resumes once it answers again.
+void run_monitor (at_engine &engine, const std::vector<std::string> &commands, const monitor_options &options, output_writer &output,
+                  device_watch *watch = nullptr);
@@ -0,0 +1,277 @@
+#include "multi_device.h"
+#include "at_commands.h"
+#include "at_parser.h"
+#include "discovery.h"
+#include "metrics.h"
+#include "../serial/serial.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#ifndef _WIN32
+    #include <sys/resource.h>
+#endif
+
+
+
+std::vector<std::string> split_device_list (const char *list)
+{
+    std::vector<std::string> devices;
+    std::string_view rest(list);
+
+    while (!rest.empty())
+    {
+        const size_t comma = rest.find(',');
+        if (comma != 0)
+        {
+            devices.emplace_back(rest.substr(0, comma));
+        }
+        rest.remove_prefix(std::string_view::npos == comma ? rest.size() : comma + 1);
+    }
+
+    return devices;
+}
+
+
+
+#ifndef _WIN32
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    struct target
+    {
+        std::string                 path;
+        serial_device               device;
+        size_t                      index;          // in the io ring
+        at_line_reader              lines;
+        std::string                 line;
+        size_t                      next        = 0;
+        std::string                 echo;
+        std::vector<std::string>    response;
+        clock::time_point           started;
+        clock::time_point           deadline;
+        bool                        busy        = false;
+        bool                        failed      = false;
+    };
+}
+
+static double _cpu_seconds (void)
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+         + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void _send_next (serial_io_ring &ring, target &t, const std::vector<std::string> &commands)
+{
+    if (t.next >= commands.size() || t.failed)
+    {
+        t.busy = false;
+        return;
+    }
+
+    const std::string &command = commands[t.next];
+    t.echo.assign("AT").append(command);
+
+    const std::string message = t.echo + "\r";
+    ring.write(t.index, message.data(), message.size());
+
+    metrics_add(metrics->commands);
+    metrics_add(metrics->command_lines);
+    metrics_add(metrics->bytes_tx, message.size());
+
+    t.response.clear();
+    t.started = clock::now();
+    t.deadline = t.started + std::chrono::milliseconds(at_command_timeout(command));
+    t.busy = true;
+}
+
+static void _print_response (output_writer &output, const target &t, const std::string &command, bool timed_out)
+{
+    output.set_device(t.path.c_str());
+
+    // jsonl and csv carry the device on every line.
+    const bool plain = output.get_format() == output_format::text || output.get_format() == output_format::raw;
+    if (plain)
+    {
+        output.text(t.path);
+        output.text(" AT");
+        output.text(command);
+        output.text("\n");
+    }
+
+    for (const auto &line : t.response)
+    {
+        output.line(command, line);
+    }
+
+    if (timed_out)
+    {
+        if (plain)
+        {
+            output.text("   Timed out.\n");
+        }
+        else
+        {
+            fprintf(stderr, "%s: timed out.\n", t.path.c_str());
+        }
+    }
+}
+
+
+
+size_t send_at_commands_multi (const std::vector<std::string> &devices, const std::vector<std::string> &commands, serial_io_backend backend,
+                               output_writer &output, multi_device_stats *stats_dest)
+{
+    serial_io_ring ring(devices.size(), backend);
+    std::vector<std::unique_ptr<target>> targets;
+    size_t n_failed = 0;
+
+    for (const auto &spec : devices)
+    {
+        auto t = std::make_unique<target>();
+        if (!resolve_at_port(spec.c_str(), t->path))
+        {
+            t->path = spec;
+        }
+
+        try
+        {
+            if (!t->device.open(t->path.c_str()))
+            {
+                throw source_exception("Failed to open");
+            }
+        }
+        catch (const source_exception &e)
+        {
+            fprintf(stderr, "%s: %s\n", t->path.c_str(), e.what());
+            n_failed++;
+            continue;
+        }
+
+        t->index = ring.add(t->device.get_handle());
+        targets.push_back(std::move(t));
+    }
+
+
+
+    const double cpu_start = _cpu_seconds();
+    const clock::time_point start = clock::now();
+    const uint64_t syscalls_start = ring.get_syscalls();
+    size_t n_commands = 0;
+
+    for (auto &t : targets)
+    {
+        _send_next(ring, *t, commands);
+    }
+
+    std::vector<serial_io_event> events;
+    while (1)
+    {
+        clock::time_point deadline = clock::time_point::max();
+        for (const auto &t : targets)
+        {
+            if (t->busy)
+            {
+                deadline = std::min(deadline, t->deadline);
+            }
+        }
+
+        if (deadline == clock::time_point::max())
+        {
+            break;
+        }
+
+        const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - clock::now()).count();
+        events.clear();
+        ring.wait(std::max<int>(0, remaining), events);
+
+
+
+        for (const auto &event : events)
+        {
+            target &t = *targets[event.index];
+
+            if (event.size <= 0)
+            {
+                fprintf(stderr, "%s: %s\n", t.path.c_str(), event.size ? "read failed" : "disconnected");
+                ring.remove(t.index);
+                t.failed = true;
+                t.busy = false;
+                n_failed++;
+                continue;
+            }
+
+            metrics_add(metrics->bytes_rx, event.size);
+            t.lines.append(event.data, event.size);
+
+            while (t.busy && t.lines.next_line(t.line))
+            {
+                if (t.response.empty() && t.line == t.echo)
+                {
+                    continue;
+                }
+
+                const at_final result = classify_final(t.line);
+                t.response.push_back(t.line);
+
+                if (result != at_final::none)
+                {
+                    metrics_record_result(result, t.line, std::chrono::duration<double, std::milli>(clock::now() - t.started).count());
+                    _print_response(output, t, commands[t.next], false);
+                    n_commands++;
+
+                    t.next++;
+                    _send_next(ring, t, commands);
+                }
+            }
+        }
+
+        // The rest of a timed-out device's commands are skipped: it may have stopped answering.
+        const clock::time_point now = clock::now();
+        for (auto &t : targets)
+        {
+            if (t->busy && now >= t->deadline)
+            {
+                metrics_record_result(at_final::none, {}, std::chrono::duration<double, std::milli>(now - t->started).count());
+                _print_response(output, *t, commands[t->next], true);
+                ring.remove(t->index);
+                t->failed = true;
+                t->busy = false;
+                n_failed++;
+            }
+        }
+
+        output.flush();
+    }
+
+
+
+    const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    const double cpu = _cpu_seconds() - cpu_start;
+    const uint64_t syscalls = ring.get_syscalls() - syscalls_start;
+
+    fprintf(stderr, "%zu commands on %zu devices in %.1f ms via %s\n", n_commands, targets.size(), elapsed * 1e3, ring.get_backend_name());
+    fprintf(stderr, "I/O system calls: %llu (%.2f per command), CPU: %.1f ms (%.1f ms per 1000 commands)\n",
+            static_cast<unsigned long long>(syscalls), n_commands ? static_cast<double>(syscalls) / n_commands : 0,
+            cpu * 1e3, n_commands ? 1e6 * cpu / n_commands : 0);
+
+    if (stats_dest)
+    {
+        *stats_dest = {n_commands, syscalls, cpu, ring.get_backend()};
+    }
+    return n_failed;
+}
+#else
+size_t send_at_commands_multi (const std::vector<std::string> &devices, const std::vector<std::string> &commands, serial_io_backend backend,
+                               output_writer &output, multi_device_stats *stats_dest)
+{
+    throw source_exception("Multiple devices are not supported on Windows");
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "output.h"
+#include "../serial/serial_io_ring.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+
+// "/dev/ttyUSB2,@3" -> {"/dev/ttyUSB2", "@3"}
+std::vector<std::string> split_device_list (const char *list);
+
+// What a run of send_at_commands_multi() took, from the first command on.
+struct multi_device_stats
+{
+    size_t              commands    = 0;    // answered
+    uint64_t            syscalls    = 0;    // I/O system calls
+    double              cpu_seconds = 0;
+    serial_io_backend   backend     = serial_io_backend::epoll;
+};
+
+// Runs the commands on all devices at once from a single thread, each
+// device working through the list at its own pace. Responses are printed
+// per command as they complete; in text format under the device's name.
+// I/O statistics are printed to stderr, and stored in stats_dest if given.
+// Returns the number of devices that failed to open, disconnected or timed
+// out.
+size_t send_at_commands_multi (const std::vector<std::string> &devices, const std::vector<std::string> &commands, serial_io_backend backend,
+                               output_writer &output, multi_device_stats *stats_dest = nullptr);
@@ -0,0 +1,475 @@
+#include "output.h"
+#include "../common.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+    #include <poll.h>
+#endif
+
+
+
+bool parse_output_format (const char *name, output_format &format_dest)
+{
+    static constexpr struct {
+        const char     *name;
+        output_format   format;
+    } FORMATS [] = {
+        {"text",    output_format::text},
+        {"raw",     output_format::raw},
+        {"jsonl",   output_format::jsonl},
+        {"csv",     output_format::csv},
+    };
+
+    for (const auto &f : FORMATS)
+    {
+        if (0 == strcmp(f.name, name))
+        {
+            format_dest = f.format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+output_writer::output_writer (int fd)
+    : m_format          (output_format::text)
+    , m_fd              (fd)
+#ifdef _WIN32
+    , m_is_tty          (_isatty(fd))
+#else
+    , m_is_tty          (isatty(fd))
+#endif
+    , m_header_written  (false)
+{
+    m_buffer.reserve(FLUSH_THRESHOLD + 4096);
+    m_colors = m_is_tty;
+}
+
+output_writer::~output_writer (void)
+{
+    this->flush();
+}
+
+void output_writer::set_format (output_format format)
+{
+    m_format = format;
+    m_colors = m_is_tty && format == output_format::text;
+}
+
+
+
+void output_writer::record (const double *time, std::string_view command, std::string_view line)
+{
+    char time_str [32] = "";
+    if (time)
+    {
+        snprintf(time_str, sizeof(time_str), "%.3f", *time);
+    }
+
+    switch (m_format)
+    {
+        case output_format::text:
+        {
+            const char *color = nullptr;
+            if (m_colors)
+            {
+                if (line == "OK")
+                {
+                    color = GREEN;
+                }
+                else if (line == "ERROR")
+                {
+                    color = RED;
+                }
+            }
+
+            m_buffer.append("   ");
+            if (time)
+            {
+                m_buffer.append(time_str).append("  ");
+            }
+            if (color)
+            {
+                m_buffer.append(color).append(line).append(DEFAULT);
+            }
+            else
+            {
+                m_buffer.append(line);
+            }
+            m_buffer.push_back('\n');
+            break;
+        }
+
+        case output_format::raw:
+            if (time)
+            {
+                m_buffer.append(time_str).push_back(' ');
+            }
+            m_buffer.append(line).push_back('\n');
+            break;
+
+        case output_format::jsonl:
+            m_buffer.push_back('{');
+            if (time)
+            {
+                m_buffer.append("\"time\":").append(time_str).push_back(',');
+            }
+            m_buffer.append("\"device\":");
+            this->append_json_string(m_device);
+            m_buffer.append(",\"command\":");
+            this->append_json_string(command);
+            m_buffer.append(",\"line\":");
+            this->append_json_string(line);
+            m_buffer.append("}\n");
+            break;
+
+        case output_format::csv:
+            if (!m_header_written)
+            {
+                m_buffer.append(time ? "time,device,command,line\n" : "device,command,line\n");
+                m_header_written = true;
+            }
+            if (time)
+            {
+                m_buffer.append(time_str).push_back(',');
+            }
+            this->append_csv_field(m_device);
+            m_buffer.push_back(',');
+            this->append_csv_field(command);
+            m_buffer.push_back(',');
+            this->append_csv_field(line);
+            m_buffer.push_back('\n');
+            break;
+    }
+
+    this->maybe_flush();
+}
+
+void output_writer::fields (std::initializer_list<output_field> fields)
+{
+    switch (m_format)
+    {
+        case output_format::text:
+        case output_format::raw:
+            for (const auto &field : fields)
+            {
+                if (m_format == output_format::text)
+                {
+                    m_buffer.append("   ");
+                }
+                m_buffer.append(field.name).append(": ").append(field.value).push_back('\n');
+            }
+            m_buffer.push_back('\n');
+            break;
+
+        case output_format::jsonl:
+        {
+            char sep = '{';
+            for (const auto &field : fields)
+            {
+                m_buffer.push_back(sep);
+                this->append_json_string(field.name);
+                m_buffer.push_back(':');
+                this->append_json_string(field.value);
+                sep = ',';
+            }
+            m_buffer.append("}\n");
+            break;
+        }
+
+        case output_format::csv:
+            if (!m_header_written)
+            {
+                const char *sep = "";
+                for (const auto &field : fields)
+                {
+                    m_buffer.append(sep).append(field.name);
+                    sep = ",";
+                }
+                m_buffer.push_back('\n');
+                m_header_written = true;
+            }
+
+            for (const auto &field : fields)
+            {
+                if (&field != fields.begin())
+                {
+                    m_buffer.push_back(',');
+                }
+                this->append_csv_field(field.value);
+            }
+            m_buffer.push_back('\n');
+            break;
+    }
+
+    this->maybe_flush();
+}
+
+void output_writer::text (std::string_view text)
+{
+    m_buffer.append(text);
+    this->maybe_flush();
+}
+
+void output_writer::textf (const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    this->append_formatted(fmt, args);
+    va_end(args);
+}
+
+void output_writer::notice (const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    if (m_format == output_format::text || m_format == output_format::raw)
+    {
+        this->append_formatted(fmt, args);
+    }
+    else
+    {
+        vfprintf(stderr, fmt, args);
+    }
+
+    va_end(args);
+}
+
+void output_writer::append_formatted (const char *fmt, va_list args)
+{
+    char small [256];
+    va_list retry;
+
+    va_copy(retry, args);
+    const int n = vsnprintf(small, sizeof(small), fmt, args);
+
+    if (n < 0)
+    {
+        va_end(retry);
+        return;
+    }
+    else if (static_cast<size_t>(n) < sizeof(small))
+    {
+        m_buffer.append(small, n);
+    }
+    else
+    {
+        const size_t offset = m_buffer.size();
+        m_buffer.resize(offset + n + 1);
+        vsnprintf(&m_buffer[offset], n + 1, fmt, retry);
+        m_buffer.pop_back();
+    }
+
+    va_end(retry);
+    this->maybe_flush();
+}
+
+bool output_writer::flush (void)
+{
+    // Anything printed with stdio must go out first to keep the order.
+    fflush(stdout);
+
+    const char *data = m_buffer.data();
+    size_t remaining = m_buffer.size();
+
+    while (remaining > 0)
+    {
+#ifdef _WIN32
+        const int n_written = _write(m_fd, data, static_cast<unsigned int>(remaining));
+#else
+        const ssize_t n_written = ::write(m_fd, data, remaining);
+#endif
+        if (n_written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+#ifndef _WIN32
+            // A slow, non-blocking consumer: wait until it drains rather than dropping output.
+            else if (EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                pollfd pfd = {m_fd, POLLOUT, 0};
+                (void)poll(&pfd, 1, -1);
+                continue;
+            }
+#endif
+
+            perror("write");
+            m_buffer.clear();
+            return false;
+        }
+
+        data += n_written;
+        remaining -= n_written;
+    }
+
+    m_buffer.clear();
+    return true;
+}
+
+
+
+// The length of the well-formed UTF-8 sequence str starts with (RFC 3629:
+// no overlong forms, surrogates or code points past U+10FFFF), 0 if none.
+static size_t _utf8_length (std::string_view str)
+{
+    const unsigned char c = str[0];
+    size_t n;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+
+    if (c < 0x80)
+    {
+        return 1;
+    }
+    else if (c >= 0xC2 && c <= 0xDF)
+    {
+        n = 2;
+    }
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+        n = 3;
+        low = (c == 0xE0) ? 0xA0 : 0x80;
+        high = (c == 0xED) ? 0x9F : 0xBF;
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+        n = 4;
+        low = (c == 0xF0) ? 0x90 : 0x80;
+        high = (c == 0xF4) ? 0x8F : 0xBF;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (str.size() < n)
+    {
+        return 0;
+    }
+    for (size_t i = 1; i < n; i++)
+    {
+        const unsigned char next = str[i];
+        if (next < low || next > high)
+        {
+            return 0;
+        }
+        low = 0x80;
+        high = 0xBF;
+    }
+    return n;
+}
+
+// Bytes that are not UTF-8, e.g. line noise, come out as the Latin-1
+// character of the same value, so the line stays valid JSON and the byte
+// can still be told.
+void output_writer::append_json_string (std::string_view str)
+{
+    static const char HEX [] = "0123456789abcdef";
+
+    m_buffer.push_back('"');
+    size_t run = 0;
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        const char c = str[i];
+        if (static_cast<unsigned char>(c) >= 0x80)
+        {
+            const size_t n = _utf8_length(str.substr(i));
+            if (n)
+            {
+                i += n - 1;
+                continue;
+            }
+        }
+        else if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20)
+        {
+            continue;
+        }
+
+        // Characters that need no escaping are appended in runs.
+        m_buffer.append(str.data() + run, i - run);
+        run = i + 1;
+
+        switch (c)
+        {
+            case '"':   m_buffer.append("\\\"");    break;
+            case '\\':  m_buffer.append("\\\\");    break;
+            case '\n':  m_buffer.append("\\n");     break;
+            case '\r':  m_buffer.append("\\r");     break;
+            case '\t':  m_buffer.append("\\t");     break;
+            default:
+                m_buffer.append("\\u00");
+                m_buffer.push_back(HEX[(c >> 4) & 0xf]);
+                m_buffer.push_back(HEX[c & 0xf]);
+                break;
+        }
+    }
+    m_buffer.append(str.data() + run, str.size() - run);
+    m_buffer.push_back('"');
+}
+
+// CSV has no escapes: bytes that are not UTF-8 become U+FFFD.
+void output_writer::append_csv_field (std::string_view str)
+{
+    const bool quoted = std::string_view::npos != str.find_first_of(",\"\r\n");
+    const bool ascii = str.end() == std::find_if(str.begin(), str.end(), [] (char c) { return static_cast<unsigned char>(c) >= 0x80; });
+
+    if (!quoted && ascii)
+    {
+        m_buffer.append(str);
+        return;
+    }
+
+    if (quoted)
+    {
+        m_buffer.push_back('"');
+    }
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        const char c = str[i];
+        if (static_cast<unsigned char>(c) >= 0x80)
+        {
+            const size_t n = _utf8_length(str.substr(i));
+            if (n)
+            {
+                m_buffer.append(str.data() + i, n);
+                i += n - 1;
+            }
+            else
+            {
+                m_buffer.append("\xEF\xBF\xBD");
+            }
+            continue;
+        }
+
+        if (c == '"')
+        {
+            m_buffer.push_back('"');
+        }
+        m_buffer.push_back(c);
+    }
+    if (quoted)
+    {
+        m_buffer.push_back('"');
+    }
+}
+
+void output_writer::maybe_flush (void)
+{
+    if (m_buffer.size() >= FLUSH_THRESHOLD)
+    {
+        this->flush();
+    }
+}
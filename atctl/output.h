@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdarg>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+
+
+#define RED             "\x1b[31m"
+#define GREEN           "\x1b[32m"
+#define YELLOW          "\x1b[33m"
+#define BRIGHT_YELLOW   "\x1b[93m"
+#define DEFAULT         "\x1b[39m"
+
+
+
+enum class output_format
+{
+    text,       // indented lines, colored result codes on a terminal
+    raw,        // the unfiltered response
+    jsonl,      // {"device":...,"command":...,"line":...} per line
+    csv,        // device,command,line
+
+    // Samples (see output_writer::sample) are prefixed with a "time" field.
+};
+
+// false: unknown format name
+bool parse_output_format (const char *name, output_format &format_dest);
+
+// A named value of a structured record, see output_writer::fields().
+struct output_field
+{
+    std::string_view    name;
+    std::string_view    value;
+};
+
+
+
+
+// Formats response lines into a reusable buffer and emits them with few,
+// large writes. Colors are only used in text format on a terminal.
+class output_writer
+{
+public:
+    static constexpr size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    explicit output_writer (int fd);
+    ~output_writer (void);
+
+    output_writer (const output_writer&) = delete;
+    output_writer& operator= (const output_writer&) = delete;
+
+
+
+    void set_format (output_format format);
+
+    output_format get_format (void) const
+    {
+        return m_format;
+    }
+
+    void set_device (const char *device)
+    {
+        m_device = device ? device : "";
+    }
+
+    // The escape sequence, or "" when colors are off.
+    const char* color (const char *code) const
+    {
+        return m_colors ? code : "";
+    }
+
+
+
+    // One line of a command's response.
+    void line (std::string_view command, std::string_view line)
+    {
+        this->record(nullptr, command, line);
+    }
+
+    // A response line taken at a point in time (seconds since the epoch).
+    void sample (double time, std::string_view command, std::string_view line)
+    {
+        this->record(&time, command, line);
+    }
+
+    // A record of named values (e.g. a decoded SMS) instead of a response
+    // line: an object in jsonl, a row under a header of the first record's
+    // names in csv, and "name: value" lines followed by a blank line in
+    // text and raw.
+    void fields (std::initializer_list<output_field> fields);
+
+    // Unformatted text, e.g. a raw response or interactive prompts.
+    void text (std::string_view text);
+
+    // printf-style unformatted text.
+    void textf (const char *fmt, ...);
+
+    // printf-style text for a person: prompts, "Timed out.", and so on.
+    // Inline in text and raw; on stderr in jsonl and csv, so the output
+    // stays machine-readable.
+    void notice (const char *fmt, ...);
+
+    bool flush (void);
+
+
+
+private:
+    void record (const double *time, std::string_view command, std::string_view line);
+    void append_json_string (std::string_view str);
+    void append_csv_field (std::string_view str);
+    void append_formatted (const char *fmt, va_list args);
+    void maybe_flush (void);
+
+    std::string     m_buffer;
+    std::string     m_device;
+    output_format   m_format;
+    int             m_fd;
+    bool            m_colors;
+    bool            m_is_tty;
+    bool            m_header_written;
+};
@@ -0,0 +1,218 @@
+#include "realtime.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#ifndef _WIN32
+    #include <csignal>
+    #include <malloc.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/mman.h>
+    #include <sys/prctl.h>
+    #include <sys/resource.h>
+#endif
+
+
+
+bool parse_cpu_list (const char *str, std::vector<int> &cpus_dest)
+{
+    cpus_dest.clear();
+
+    while (*str)
+    {
+        char *end;
+        const long cpu = strtol(str, &end, 10);
+        if (end == str || cpu < 0 || cpu >= 1024 || (*end && *end != ','))
+        {
+            return false;
+        }
+
+        cpus_dest.push_back(static_cast<int>(cpu));
+        str = *end ? end + 1 : end;
+    }
+
+    return !cpus_dest.empty();
+}
+
+
+
+#ifndef _WIN32
+// Stack of the real-time thread, all of it touched before the loop starts.
+static constexpr size_t RT_STACK_SIZE = 512 * 1024;
+
+// Heap touched and kept: what the loop allocates comes from pages that are
+// already there.
+static constexpr size_t RT_HEAP_PREFAULT = 8 * 1024 * 1024;
+
+struct realtime_thread
+{
+    const realtime_options                 &options;
+    const std::function<void (void)>       &body;
+    std::exception_ptr                      error;
+};
+
+static void _prefault_stack (void)
+{
+    // Leaves room for what the thread itself already uses.
+    volatile char stack [RT_STACK_SIZE - 64 * 1024];
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+    {
+        stack[i] = 0;
+    }
+}
+
+static void _prefault_heap (void)
+{
+#ifdef __GLIBC__
+    // No returning memory to the kernel, and no mmap() for large blocks.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+
+    char *heap = static_cast<char*>(malloc(RT_HEAP_PREFAULT));
+    if (heap)
+    {
+        for (size_t i = 0; i < RT_HEAP_PREFAULT; i += 4096)
+        {
+            heap[i] = 1;
+        }
+        free(heap);
+    }
+}
+
+static void* _realtime_main (void *arg)
+{
+    realtime_thread &thread = *static_cast<realtime_thread*>(arg);
+
+    // Everything the loop needs is mapped by now. Not MCL_FUTURE: under a
+    // memlock limit that would make any later growth of the heap fail.
+    if (thread.options.lock_memory)
+    {
+        _prefault_stack();
+        if (-1 == mlockall(MCL_CURRENT))
+        {
+            perror("mlockall (needs CAP_IPC_LOCK or a higher memlock limit)");
+        }
+    }
+
+    // Timers wake the thread when asked to, not up to 50 us later.
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    try
+    {
+        thread.body();
+    }
+    catch (...)
+    {
+        thread.error = std::current_exception();
+    }
+
+    return nullptr;
+}
+
+static int _create_thread (pthread_t &thread_dest, realtime_thread &thread, bool with_priority)
+{
+    const realtime_options &options = thread.options;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+
+    if (!options.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const int cpu : options.cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+
+    if (with_priority)
+    {
+        sched_param param = {};
+        param.sched_priority = options.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    const int status = pthread_create(&thread_dest, &attr, _realtime_main, &thread);
+    pthread_attr_destroy(&attr);
+    return status;
+}
+
+void realtime_run (const realtime_options &options, const std::function<void (void)> &body)
+{
+    if (options.lock_memory)
+    {
+        _prefault_heap();
+    }
+
+    // The new thread inherits the mask; its sigint_fd then gets the signals.
+    sigset_t mask, prev_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &prev_mask);
+
+    realtime_thread thread = {options, body, nullptr};
+    pthread_t id;
+    int status = _create_thread(id, thread, options.priority > 0);
+
+    if (EPERM == status && options.priority > 0)
+    {
+        fprintf(stderr, "SCHED_FIFO not permitted (needs CAP_SYS_NICE or an rtprio limit), running with the normal policy\n");
+        status = _create_thread(id, thread, false);
+    }
+
+    if (status)
+    {
+        pthread_sigmask(SIG_SETMASK, &prev_mask, nullptr);
+        errno = status;
+        perror("pthread_create");
+        throw source_exception("Failed to start the real-time thread");
+    }
+
+    pthread_join(id, nullptr);
+    pthread_sigmask(SIG_SETMASK, &prev_mask, nullptr);
+
+    if (options.lock_memory)
+    {
+        munlockall();
+    }
+
+    if (thread.error)
+    {
+        std::rethrow_exception(thread.error);
+    }
+}
+
+thread_sched_stats get_thread_sched_stats (void)
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+
+    return {
+        static_cast<uint64_t>(usage.ru_nvcsw),
+        static_cast<uint64_t>(usage.ru_nivcsw),
+        static_cast<uint64_t>(usage.ru_minflt),
+        static_cast<uint64_t>(usage.ru_majflt),
+    };
+}
+#else
+void realtime_run (const realtime_options &options, const std::function<void (void)> &body)
+{
+    throw source_exception("Real-time mode is not supported on Windows");
+}
+
+thread_sched_stats get_thread_sched_stats (void)
+{
+    return {};
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+
+struct realtime_options
+{
+    int                 priority        = 0;        // SCHED_FIFO priority, 0: keep the normal policy
+    std::vector<int>    cpus;                       // affinity, empty: any
+    bool                lock_memory     = false;    // pre-faulted, locked stack and heap
+
+    bool enabled (void) const
+    {
+        return priority || !cpus.empty() || lock_memory;
+    }
+};
+
+// "2" or "0,2,3"
+bool parse_cpu_list (const char *str, std::vector<int> &cpus_dest);
+
+// Runs body to completion on a new thread set up as options ask, with
+// SIGINT and SIGTERM blocked everywhere else so that only it sees them
+// (through sigint_fd). Whatever cannot be set up (e.g. SCHED_FIFO without
+// CAP_SYS_NICE or an rtprio limit) is reported and done without. Rethrows
+// what body throws.
+void realtime_run (const realtime_options &options, const std::function<void (void)> &body);
+
+
+
+// Scheduling counters of the calling thread.
+struct thread_sched_stats
+{
+    uint64_t    voluntary_switches;     // blocked, e.g. in poll()
+    uint64_t    involuntary_switches;   // preempted
+    uint64_t    minor_faults;
+    uint64_t    major_faults;
+};
+
+thread_sched_stats get_thread_sched_stats (void);
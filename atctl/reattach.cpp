@@ -0,0 +1,252 @@
+#include "reattach.h"
+#include "at_engine.h"
+#include "discovery.h"
+#include "metrics.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <filesystem>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/inotify.h>
+    #include <sys/stat.h>
+#endif
+
+
+
+#ifndef _WIN32
+device_watch::device_watch (const char *device)
+    : m_path (device)
+{
+    // Remember where the tty hangs off USB, in case it comes back renumbered.
+    std::error_code ec;
+    const auto canonical = std::filesystem::canonical(device, ec);
+
+    if (!ec)
+    {
+        for (const auto &port : enumerate_ports())
+        {
+            if (port.device == canonical.string())
+            {
+                m_usb_path  = port.usb_path;
+                m_interface = port.interface;
+                break;
+            }
+        }
+    }
+}
+
+device_watch::~device_watch (void)
+{
+    this->stop_watching();
+}
+
+bool device_watch::is_gone (serial_device &device) const
+{
+    if (!device.is_open())
+    {
+        return true;
+    }
+
+    // A hung-up tty reports POLLHUP; a removed one has no node left.
+    pollfd pfd = {device.get_handle(), POLLIN, 0};
+    struct stat st;
+
+    return (1 == poll(&pfd, 1, 0) && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)))
+        || -1 == fstat(device.get_handle(), &st) || 0 == st.st_nlink
+        || !std::filesystem::exists(m_path);
+}
+
+void device_watch::lose (serial_device &device)
+{
+    device.close();
+
+    if (!m_lost)
+    {
+        m_lost = true;
+        m_lost_at = clock::now();
+        fprintf(stderr, "%s lost, waiting for it to return...\n", m_path.c_str());
+    }
+
+    if (-1 == m_inotify_fd)
+    {
+        m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (-1 == m_inotify_fd)
+        {
+            perror("inotify_init1");
+            return;
+        }
+
+        // Without a watch (e.g. /dev/serial/by-id went away too) the probe interval still applies.
+        const uint32_t mask = IN_CREATE | IN_ATTRIB | IN_MOVED_TO;
+        const std::string dir = std::filesystem::path(m_path).parent_path().string();
+
+        if (-1 == inotify_add_watch(m_inotify_fd, dir.c_str(), mask))
+        {
+            DBG("Cannot watch %s\n", dir.c_str());
+        }
+        if (!m_usb_path.empty() && dir != "/dev")
+        {
+            inotify_add_watch(m_inotify_fd, "/dev", mask);
+        }
+    }
+}
+
+bool device_watch::try_reattach (serial_device &device)
+{
+    if (!m_lost)
+    {
+        return true;
+    }
+
+    // The events only say when to look again.
+    char events [4096];
+    while (m_inotify_fd >= 0 && 0 < ::read(m_inotify_fd, events, sizeof(events)))
+    {}
+
+
+
+    if (!device.is_open())
+    {
+        if (!std::filesystem::exists(m_path) && !m_usb_path.empty())
+        {
+            for (const auto &port : enumerate_ports())
+            {
+                if (port.usb_path == m_usb_path && port.interface == m_interface)
+                {
+                    DBG("%s is now %s\n", m_path.c_str(), port.device.c_str());
+                    m_path = port.device;
+                    break;
+                }
+            }
+        }
+
+        try
+        {
+            if (!std::filesystem::exists(m_path) || !device.open(m_path.c_str()))
+            {
+                return false;
+            }
+        }
+        catch (const source_exception &e)
+        {
+            DBG("Reopening %s: %s\n", m_path.c_str(), e.what());
+            return false;
+        }
+    }
+
+    // The tty usually appears before the modem firmware listens on it.
+    std::vector<std::string> lines;
+    at_engine engine(device);
+
+    try
+    {
+        if (at_final::ok != engine.transact("", lines, REATTACH_PROBE_MS))
+        {
+            return false;
+        }
+    }
+    catch (const source_exception &e)
+    {
+        device.close();
+        return false;
+    }
+
+
+
+    m_last_recovery_ms = this->get_outage_ms();
+    m_lost = false;
+    m_max_recovery_ms = std::max(m_max_recovery_ms, m_last_recovery_ms);
+    m_n_reattached++;
+    metrics_add(metrics->reconnects);
+    this->stop_watching();
+
+    fprintf(stderr, "Reattached %s after %.0f ms.\n", m_path.c_str(), m_last_recovery_ms);
+    return true;
+}
+
+double device_watch::get_outage_ms (void) const
+{
+    return m_lost ? std::chrono::duration<double, std::milli>(clock::now() - m_lost_at).count() : 0;
+}
+
+void device_watch::stop_watching (void)
+{
+    if (m_inotify_fd >= 0)
+    {
+        ::close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
+}
+
+
+
+bool reattach (serial_device &device, device_watch &watch, int stop_fd, size_t timeout_ms)
+{
+    while (!watch.try_reattach(device))
+    {
+        if (watch.get_outage_ms() > timeout_ms)
+        {
+            throw source_exception("Device did not come back");
+        }
+
+        pollfd fds [] = {
+            {watch.get_fd(),    POLLIN, 0},
+            {stop_fd,           POLLIN, 0},
+        };
+
+        if (-1 == poll(fds, 2, watch.poll_timeout()) && EINTR != errno)
+        {
+            perror("poll");
+            return false;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+#else
+device_watch::device_watch (const char *device)
+    : m_path (device)
+{}
+
+device_watch::~device_watch (void)
+{}
+
+bool device_watch::is_gone (serial_device &device) const
+{
+    return false;
+}
+
+void device_watch::lose (serial_device &device)
+{
+    throw source_exception("Reattaching is not supported on Windows");
+}
+
+bool device_watch::try_reattach (serial_device &device)
+{
+    return !m_lost;
+}
+
+double device_watch::get_outage_ms (void) const
+{
+    return 0;
+}
+
+void device_watch::stop_watching (void)
+{}
+
+bool reattach (serial_device &device, device_watch &watch, int stop_fd, size_t timeout_ms)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "../serial/serial.h"
+
+#include <chrono>
+#include <string>
+
+// Give up (and let a supervisor take over) if the modem stays away this long.
+static constexpr size_t REATTACH_DEFAULT_TIMEOUT_MS = 120000;
+
+// Retry interval while the tty exists but the modem is still booting.
+static constexpr size_t REATTACH_PROBE_MS = 250;
+
+// Commands queued during an outage are dropped once they are this old.
+static constexpr size_t REATTACH_QUEUE_MS = 30000;
+
+
+
+
+// Follows a modem across resets and USB re-enumeration. When its tty goes
+// away, watches the device directory with inotify and reopens the tty as
+// soon as it is back and the modem answers "AT". USB ttys are found again
+// by USB path and interface, as they may come back under another name.
+class device_watch
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    explicit device_watch (const char *device);
+    ~device_watch (void);
+
+    device_watch (const device_watch&) = delete;
+    device_watch& operator= (const device_watch&) = delete;
+
+    // Whether a failure on device means the tty went away, as opposed to an
+    // error worth giving up over.
+    bool is_gone (serial_device &device) const;
+
+    // Closes device and starts watching for it to come back.
+    void lose (serial_device &device);
+
+    // Reopens and probes the device. true once it answers.
+    bool try_reattach (serial_device &device);
+
+    bool is_lost (void) const
+    {
+        return m_lost;
+    }
+
+    // Readable when the device directory changes; -1 when not watching.
+    int get_fd (void) const
+    {
+        return m_inotify_fd;
+    }
+
+    // Poll timeout while lost, so booting modems are probed again.
+    int poll_timeout (void) const
+    {
+        return static_cast<int>(REATTACH_PROBE_MS);
+    }
+
+    // How long the device has been away.
+    double get_outage_ms (void) const;
+
+    const std::string& get_path (void) const
+    {
+        return m_path;
+    }
+
+    size_t get_reattach_count (void) const
+    {
+        return m_n_reattached;
+    }
+
+    // Time from losing the device to its first successful command.
+    double get_last_recovery_ms (void) const
+    {
+        return m_last_recovery_ms;
+    }
+
+    double get_max_recovery_ms (void) const
+    {
+        return m_max_recovery_ms;
+    }
+
+private:
+    void stop_watching (void);
+
+    std::string         m_path;
+    std::string         m_usb_path;         // empty if not a USB tty
+    int                 m_interface         = -1;
+    int                 m_inotify_fd        = -1;
+    bool                m_lost              = false;
+    clock::time_point   m_lost_at;
+    size_t              m_n_reattached      = 0;
+    double              m_last_recovery_ms  = 0;
+    double              m_max_recovery_ms   = 0;
+};
+
+// Waits for a lost device to return. false: stop_fd became readable first.
+// Throws if the device stays away longer than timeout_ms.
+bool reattach (serial_device &device, device_watch &watch, int stop_fd, size_t timeout_ms = REATTACH_DEFAULT_TIMEOUT_MS);
@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef _WIN32
+#include "../source_exception/source_exception.h"
+
+#include <csignal>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+
+
+// Routes SIGINT (and SIGTERM) to a descriptor for as long as it lives.
+class sigint_fd
+{
+public:
+    sigint_fd (void)
+    {
+        sigemptyset(&m_mask);
+        sigaddset(&m_mask, SIGINT);
+        sigaddset(&m_mask, SIGTERM);
+        sigprocmask(SIG_BLOCK, &m_mask, &m_prev_mask);
+
+        m_fd = signalfd(-1, &m_mask, SFD_CLOEXEC);
+        if (-1 == m_fd)
+        {
+            sigprocmask(SIG_SETMASK, &m_prev_mask, nullptr);
+            throw source_exception("Failed to create signal fd");
+        }
+    }
+
+    ~sigint_fd (void)
+    {
+        ::close(m_fd);
+        sigprocmask(SIG_SETMASK, &m_prev_mask, nullptr);
+    }
+
+    sigint_fd (const sigint_fd&) = delete;
+    sigint_fd& operator= (const sigint_fd&) = delete;
+
+    int get_fd (void) const
+    {
+        return m_fd;
+    }
+
+    // Returns the signal number that was received.
+    int consume (void) const
+    {
+        signalfd_siginfo info;
+        return sizeof(info) == ::read(m_fd, &info, sizeof(info)) ? static_cast<int>(info.ssi_signo) : 0;
+    }
+
+private:
+    sigset_t    m_mask;
+    sigset_t    m_prev_mask;
+    int         m_fd;
+};
+#endif
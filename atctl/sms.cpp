@@ -0,0 +1,142 @@
+#include "sms.h"
+#include "../common.h"
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// Submitting to the SMSC regularly takes tens of seconds on a weak network.
+static constexpr size_t SMS_SUBMIT_TIMEOUT_MS = 120000;
+
+
+
+bool parse_sms_line (const std::string &line, sms_message &message_dest)
+{
+    const size_t number_end = line.find_first_of(" \t");
+    if (number_end == 0 || number_end == std::string::npos)
+    {
+        return false;
+    }
+
+    const size_t text_beg = line.find_first_not_of(" \t", number_end);
+    if (text_beg == std::string::npos)
+    {
+        return false;
+    }
+
+    message_dest.number.assign(line, 0, number_end);
+    message_dest.text.clear();
+
+    for (size_t i = text_beg; i < line.size(); i++)
+    {
+        if (line[i] == '\\' && i + 1 < line.size() && line[i + 1] == 'n')
+        {
+            message_dest.text.push_back('\n');
+            i++;
+        }
+        else if (line[i] == AT_CTRL_Z || line[i] == AT_ESC)
+        {
+            // Would end or cancel the message early.
+            return false;
+        }
+        else if (line[i] != '\r' && line[i] != '\n')
+        {
+            message_dest.text.push_back(line[i]);
+        }
+    }
+
+    return true;
+}
+
+
+
+size_t run_sms_send (at_engine &engine, FILE *input, output_writer &output)
+{
+    std::vector<std::string> lines;
+    std::string command;
+    std::string line;
+    sms_message message;
+    size_t sent = 0;
+    size_t failed = 0;
+    char buffer [512];
+
+
+
+    // Text mode, and keep the SMSC relay link open between messages (+CMMS=2)
+    // so consecutive submits do not each pay for link setup. Not every modem
+    // has +CMMS, so its result is ignored.
+    if (at_final::ok != engine.transact("+CMGF=1", lines))
+    {
+        output.line("+CMGF=1", lines.empty() ? "Timed out" : lines.back());
+        return 0;
+    }
+    (void)engine.transact("+CMMS=2", lines);
+
+    const auto start = std::chrono::steady_clock::now();
+
+
+
+    line.reserve(sizeof(buffer));
+    while (fgets(buffer, sizeof(buffer), input))
+    {
+        line.append(buffer);
+        if (line.back() != '\n' && !feof(input))
+        {
+            continue;
+        }
+
+        if (line.find_first_not_of(" \t\r\n") == std::string::npos || line[0] == '#')
+        {
+            line.clear();
+            continue;
+        }
+
+        if (!parse_sms_line(line, message))
+        {
+            line.erase(line.find_last_not_of("\r\n") + 1);
+            output.line(line, "Malformed message");
+            failed++;
+            line.clear();
+            continue;
+        }
+        line.clear();
+
+        command.assign("+CMGS=\"").append(message.number).append("\"");
+        const at_final result = engine.transact_prompt(command, message.text, lines, SMS_SUBMIT_TIMEOUT_MS);
+
+        if (result == at_final::ok)
+        {
+            sent++;
+        }
+        else
+        {
+            failed++;
+        }
+
+        if (lines.empty())
+        {
+            output.line(message.number, "Timed out");
+        }
+
+        // "+CMGS: <mr>" on success, the error otherwise.
+        for (const auto &response : lines)
+        {
+            if (result != at_final::ok || response != "OK")
+            {
+                output.line(message.number, response);
+            }
+        }
+    }
+
+    (void)engine.transact("+CMMS=0", lines);
+    output.flush();
+
+
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fprintf(stderr, "%zu sent, %zu failed in %.1f s (%.1f messages/min)\n",
+            sent, failed, elapsed, elapsed > 0 ? 60 * sent / elapsed : 0);
+
+    return failed;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "at_engine.h"
+#include "output.h"
+
+#include <cstdio>
+#include <string>
+
+
+
+struct sms_message
+{
+    std::string number;
+    std::string text;
+};
+
+// "<number> <text>" (tab or space separated); "\n" in text is a line break.
+// false: malformed line
+bool parse_sms_line (const std::string &line, sms_message &message_dest);
+
+// Sends every message read from input in text mode, back to back. Each
+// result (+CMGS: <mr> or the error) is reported through output with the
+// number as the command; totals and throughput go to stderr.
+// Returns the number of messages that failed.
+size_t run_sms_send (at_engine &engine, FILE *input, output_writer &output);
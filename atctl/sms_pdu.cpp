@@ -0,0 +1,724 @@
+#include "sms_pdu.h"
+#include "../common.h"
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define SMS_PDU_SSE2 1
+#endif
+
+
+
+// Hex digit values, -1 for anything else.
+static constexpr std::array<int8_t, 256> HEX_VALUES = []()
+{
+    std::array<int8_t, 256> values = {};
+    for (int c = 0; c < 256; c++)
+    {
+        values[c] = (c >= '0' && c <= '9') ? c - '0'
+                  : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                  : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                  : -1;
+    }
+    return values;
+}();
+
+#ifdef SMS_PDU_SSE2
+// 16 hex digits to 8 bytes. false if any is not a hex digit.
+static inline bool _hex_decode_16 (const char *hex, uint8_t *dest)
+{
+    const __m128i c         = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex));
+    const __m128i bias      = _mm_set1_epi8(static_cast<char>(0x80));
+
+    // c - '0' below 10, or (c | 0x20) - 'a' below 6; unsigned compares
+    // done as signed ones on values offset by 0x80.
+    const __m128i digit     = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    const __m128i letter    = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_digit  = _mm_cmplt_epi8(_mm_xor_si128(digit, bias), _mm_set1_epi8(static_cast<char>(0x80 + 10)));
+    const __m128i is_letter = _mm_cmplt_epi8(_mm_xor_si128(letter, bias), _mm_set1_epi8(static_cast<char>(0x80 + 6)));
+
+    if (0xffff != _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)))
+    {
+        return false;
+    }
+
+    const __m128i value = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                                       _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+
+    // Per 16-bit lane: the first digit in the low byte is the high nibble.
+    const __m128i byte  = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(value, 4), _mm_set1_epi16(0x00f0)),
+                                       _mm_srli_epi16(value, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest), _mm_packus_epi16(byte, byte));
+    return true;
+}
+#endif
+
+bool sms_hex_decode_table (const char *hex, size_t n_bytes, uint8_t *dest)
+{
+    int bad = 0;
+    for (size_t i = 0; i < n_bytes; i++)
+    {
+        const int hi = HEX_VALUES[static_cast<uint8_t>(hex[2 * i])];
+        const int lo = HEX_VALUES[static_cast<uint8_t>(hex[2 * i + 1])];
+        bad |= hi | lo;
+        dest[i] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+
+    return bad >= 0;
+}
+
+bool sms_hex_decode (const char *hex, size_t n_bytes, uint8_t *dest)
+{
+    size_t i = 0;
+
+#ifdef SMS_PDU_SSE2
+    for (; i + 8 <= n_bytes; i += 8)
+    {
+        if (!_hex_decode_16(hex + 2 * i, dest + i))
+        {
+            return false;
+        }
+    }
+#endif
+
+    return sms_hex_decode_table(hex + 2 * i, n_bytes - i, dest + i);
+}
+
+
+
+// The 3GPP 23.038 default alphabet as code points; 0x1b escapes to the
+// extension table.
+static constexpr uint16_t GSM7_CODE_POINTS [128] = {
+    0x0040, 0x00a3, 0x0024, 0x00a5, 0x00e8, 0x00e9, 0x00f9, 0x00ec, 0x00f2, 0x00c7, 0x000a, 0x00d8, 0x00f8, 0x000d, 0x00c5, 0x00e5,
+    0x0394, 0x005f, 0x03a6, 0x0393, 0x039b, 0x03a9, 0x03a0, 0x03a8, 0x03a3, 0x0398, 0x039e, 0x00a0, 0x00c6, 0x00e6, 0x00df, 0x00c9,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x00a4, 0x0025, 0x0026, 0x0027, 0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+    0x00a1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047, 0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057, 0x0058, 0x0059, 0x005a, 0x00c4, 0x00d6, 0x00d1, 0x00dc, 0x00a7,
+    0x00bf, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067, 0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077, 0x0078, 0x0079, 0x007a, 0x00e4, 0x00f6, 0x00f1, 0x00fc, 0x00e0,
+};
+
+static constexpr uint8_t GSM7_ESCAPE = 0x1b;
+
+static constexpr struct
+{
+    uint8_t     septet;
+    uint16_t    code_point;
+} GSM7_EXTENSION [] = {
+    {0x0a, 0x000c}, {0x14, 0x005e}, {0x28, 0x007b}, {0x29, 0x007d}, {0x2f, 0x005c},
+    {0x3c, 0x005b}, {0x3d, 0x007e}, {0x3e, 0x005d}, {0x40, 0x007c}, {0x65, 0x20ac},
+};
+
+// A character as UTF-8: all bytes are written, len of them kept.
+struct utf8_char
+{
+    char        bytes [3];
+    uint8_t     len;
+};
+
+static constexpr utf8_char _utf8 (uint16_t cp)
+{
+    if (cp < 0x80)
+    {
+        return {{static_cast<char>(cp), 0, 0}, 1};
+    }
+    else if (cp < 0x800)
+    {
+        return {{static_cast<char>(0xc0 | (cp >> 6)), static_cast<char>(0x80 | (cp & 0x3f)), 0}, 2};
+    }
+    return {{static_cast<char>(0xe0 | (cp >> 12)), static_cast<char>(0x80 | ((cp >> 6) & 0x3f)), static_cast<char>(0x80 | (cp & 0x3f))}, 3};
+}
+
+// [0, 128): default alphabet, [128, 256): after an escape.
+static constexpr std::array<utf8_char, 256> GSM7_UTF8 = []()
+{
+    std::array<utf8_char, 256> table = {};
+    for (int i = 0; i < 128; i++)
+    {
+        table[i] = _utf8(GSM7_CODE_POINTS[i]);
+        table[128 + i] = table[i];
+    }
+    for (const auto &ext : GSM7_EXTENSION)
+    {
+        table[128 + ext.septet] = _utf8(ext.code_point);
+    }
+    return table;
+}();
+
+
+
+// Unpacks n septets, eight from every seven octets. data must be readable
+// up to a multiple of seven octets past the last septet.
+static void _unpack_septets (const uint8_t *data, size_t n, uint8_t *dest)
+{
+    for (size_t i = 0; i < n; i += 8, data += 7, dest += 8)
+    {
+        const uint64_t v = static_cast<uint64_t>(data[0])       | static_cast<uint64_t>(data[1]) << 8
+                         | static_cast<uint64_t>(data[2]) << 16 | static_cast<uint64_t>(data[3]) << 24
+                         | static_cast<uint64_t>(data[4]) << 32 | static_cast<uint64_t>(data[5]) << 40
+                         | static_cast<uint64_t>(data[6]) << 48;
+
+        for (int j = 0; j < 8; j++)
+        {
+            dest[j] = (v >> (7 * j)) & 0x7f;
+        }
+    }
+}
+
+static void _gsm7_to_utf8 (const uint8_t *septets, size_t n, std::string &dest)
+{
+    dest.resize(3 * n);
+    char *out = dest.data();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t index = septets[i];
+        if (GSM7_ESCAPE == index)
+        {
+            if (++i == n)
+            {
+                break;
+            }
+            index = 128 + septets[i];
+        }
+
+        const utf8_char &c = GSM7_UTF8[index];
+        memcpy(out, c.bytes, 3);
+        out += c.len;
+    }
+
+    dest.resize(out - dest.data());
+}
+
+static void _ucs2_to_utf8 (const uint8_t *data, size_t n, std::string &dest)
+{
+    // Three bytes per code unit at most; four per surrogate pair.
+    dest.resize(n / 2 * 3);
+    char *out = dest.data();
+
+    for (size_t i = 0; i + 1 < n; i += 2)
+    {
+        uint32_t cp = (data[i] << 8) | data[i + 1];
+
+        // A high surrogate followed by a low one.
+        if (cp >= 0xd800 && cp < 0xdc00 && i + 3 < n)
+        {
+            const uint32_t low = (data[i + 2] << 8) | data[i + 3];
+            if (low >= 0xdc00 && low < 0xe000)
+            {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                i += 2;
+            }
+        }
+
+        if (cp < 0x80)
+        {
+            *out++ = static_cast<char>(cp);
+        }
+        else if (cp < 0x800)
+        {
+            *out++ = static_cast<char>(0xc0 | (cp >> 6));
+            *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000)
+        {
+            *out++ = static_cast<char>(0xe0 | (cp >> 12));
+            *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else
+        {
+            *out++ = static_cast<char>(0xf0 | (cp >> 18));
+            *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    dest.resize(out - dest.data());
+}
+
+static void _hex_encode (const uint8_t *data, size_t n, std::string &dest)
+{
+    static const char HEX [] = "0123456789ABCDEF";
+
+    dest.resize(2 * n);
+    for (size_t i = 0; i < n; i++)
+    {
+        dest[2 * i]     = HEX[data[i] >> 4];
+        dest[2 * i + 1] = HEX[data[i] & 0xf];
+    }
+}
+
+
+
+// Semi-octets, low nibble first; 0xf pads an odd count.
+static void _decode_digits (const uint8_t *data, size_t n_digits, std::string &dest)
+{
+    static const char DIGITS [] = "0123456789*#abc";
+
+    for (size_t i = 0; i < n_digits; i++)
+    {
+        const uint8_t nibble = (i & 1) ? data[i / 2] >> 4 : data[i / 2] & 0xf;
+        if (nibble != 0xf)
+        {
+            dest.push_back(DIGITS[nibble]);
+        }
+    }
+}
+
+// An address after its type octet: digits, or GSM 7-bit text for an
+// alphanumeric sender (type of number 101).
+static void _decode_address (const uint8_t *data, size_t n_digits, uint8_t type, std::string &dest)
+{
+    dest.clear();
+
+    if (0x50 == (type & 0x70))
+    {
+        uint8_t padded [16] = {};
+        uint8_t septets [16];
+        memcpy(padded, data, (n_digits + 1) / 2);
+
+        const size_t n = n_digits * 4 / 7;
+        _unpack_septets(padded, n, septets);
+        _gsm7_to_utf8(septets, n, dest);
+        return;
+    }
+
+    if (0x10 == (type & 0x70))
+    {
+        dest.push_back('+');
+    }
+    _decode_digits(data, n_digits, dest);
+}
+
+// YYMMDDhhmmss and the zone in quarters of an hour, as swapped semi-octets.
+static void _decode_time (const uint8_t *data, std::string &dest)
+{
+    auto two_digits = [](uint8_t octet, char *out)
+    {
+        out[0] = '0' + (octet & 0xf) % 10;
+        out[1] = '0' + (octet >> 4) % 10;
+    };
+
+    char time [] = "20YY-MM-DDThh:mm:ss+hh:mm";
+    two_digits(data[0], time + 2);
+    two_digits(data[1], time + 5);
+    two_digits(data[2], time + 8);
+    two_digits(data[3], time + 11);
+    two_digits(data[4], time + 14);
+    two_digits(data[5], time + 17);
+
+    // The sign is bit 3 of the first (tens) semi-octet.
+    const unsigned int quarters = (data[6] & 0x7) * 10 + (data[6] >> 4) % 10;
+    time[19] = (data[6] & 0x8) ? '-' : '+';
+    time[20] = '0' + quarters / 4 / 10;
+    time[21] = '0' + quarters / 4 % 10;
+    time[23] = '0' + quarters % 4 * 15 / 10;
+    time[24] = '0' + quarters % 4 * 15 % 10;
+
+    dest.assign(time, sizeof(time) - 1);
+}
+
+// From the data coding scheme; compressed text is passed on as data.
+static sms_alphabet _alphabet (uint8_t dcs)
+{
+    // General data coding (also when marked for deletion).
+    if (0 == (dcs & 0x80))
+    {
+        if (dcs & 0x20)
+        {
+            return sms_alphabet::data8;
+        }
+
+        switch ((dcs >> 2) & 0x3)
+        {
+            case 1:     return sms_alphabet::data8;
+            case 2:     return sms_alphabet::ucs2;
+            default:    return sms_alphabet::gsm7;
+        }
+    }
+
+    switch (dcs & 0xf0)
+    {
+        case 0xe0:
+            return sms_alphabet::ucs2;
+
+        case 0xf0:
+            return (dcs & 0x04) ? sms_alphabet::data8 : sms_alphabet::gsm7;
+
+        default:
+            return sms_alphabet::gsm7;
+    }
+}
+
+bool sms_decode_pdu (std::string_view hex, sms_pdu &pdu_dest)
+{
+    // Room for _unpack_septets() to read past the end.
+    uint8_t pdu [SMS_PDU_MAX + 8];
+
+    if (hex.size() % 2 || hex.size() / 2 > SMS_PDU_MAX || hex.size() < 2)
+    {
+        return false;
+    }
+
+    const size_t n = hex.size() / 2;
+    if (!sms_hex_decode(hex.data(), n, pdu))
+    {
+        return false;
+    }
+    memset(pdu + n, 0, 8);
+
+    size_t pos = 0;
+    auto have = [&](size_t bytes) { return pos + bytes <= n; };
+
+    // SMSC: octets that follow, type included.
+    const size_t smsc_len = pdu[pos++];
+    pdu_dest.smsc.clear();
+    if (smsc_len)
+    {
+        if (!have(smsc_len) || smsc_len > 12)
+        {
+            return false;
+        }
+        if (0x10 == (pdu[pos] & 0x70))
+        {
+            pdu_dest.smsc.push_back('+');
+        }
+        _decode_digits(pdu + pos + 1, 2 * (smsc_len - 1), pdu_dest.smsc);
+        pos += smsc_len;
+    }
+
+    if (!have(1))
+    {
+        return false;
+    }
+    const uint8_t first = pdu[pos++];
+    const bool has_header = first & 0x40;
+
+    switch (first & 0x3)
+    {
+        case 0: pdu_dest.submit = false;    break;
+        case 1: pdu_dest.submit = true;     break;
+        default:
+            return false;   // status reports and commands
+    }
+
+    // Message reference
+    if (pdu_dest.submit && !have(1))
+    {
+        return false;
+    }
+    pos += pdu_dest.submit;
+
+    // Address: its length in digits, type, digits.
+    if (!have(2))
+    {
+        return false;
+    }
+    const size_t n_digits = pdu[pos];
+    const uint8_t type = pdu[pos + 1];
+    pos += 2;
+    if (n_digits > 20 || !have((n_digits + 1) / 2))
+    {
+        return false;
+    }
+    _decode_address(pdu + pos, n_digits, type, pdu_dest.number);
+    pos += (n_digits + 1) / 2;
+
+    // Protocol identifier, data coding scheme
+    if (!have(2))
+    {
+        return false;
+    }
+    pdu_dest.alphabet = _alphabet(pdu[pos + 1]);
+    pos += 2;
+
+    if (pdu_dest.submit)
+    {
+        // Validity period: none, relative (1 octet), enhanced or absolute (7).
+        static constexpr size_t VP_LENGTHS [] = {0, 7, 1, 7};
+        pos += VP_LENGTHS[(first >> 3) & 0x3];
+        pdu_dest.time.clear();
+    }
+    else
+    {
+        if (!have(7))
+        {
+            return false;
+        }
+        _decode_time(pdu + pos, pdu_dest.time);
+        pos += 7;
+    }
+
+    // User data: its length in septets or octets, then an optional header.
+    if (!have(1))
+    {
+        return false;
+    }
+    const size_t udl = pdu[pos++];
+    const uint8_t *ud = pdu + pos;
+    const size_t ud_octets = (pdu_dest.alphabet == sms_alphabet::gsm7) ? (udl * 7 + 7) / 8 : udl;
+    if (!have(ud_octets))
+    {
+        return false;
+    }
+
+    size_t header_octets = 0;
+    pdu_dest.ref = 0;
+    pdu_dest.part = 0;
+    pdu_dest.parts = 0;
+
+    if (has_header)
+    {
+        header_octets = 1 + ud[0];
+        if (header_octets > ud_octets)
+        {
+            return false;
+        }
+
+        // Information elements: id, length, data.
+        for (size_t i = 1; i + 2 <= header_octets; i += 2 + ud[i + 1])
+        {
+            const uint8_t id = ud[i];
+            const uint8_t len = ud[i + 1];
+            if (i + 2 + len > header_octets)
+            {
+                return false;
+            }
+
+            // Concatenated message, 8- and 16-bit reference.
+            if (0x00 == id && 3 == len)
+            {
+                pdu_dest.ref    = ud[i + 2];
+                pdu_dest.parts  = ud[i + 3];
+                pdu_dest.part   = ud[i + 4];
+            }
+            else if (0x08 == id && 4 == len)
+            {
+                pdu_dest.ref    = (ud[i + 2] << 8) | ud[i + 3];
+                pdu_dest.parts  = ud[i + 4];
+                pdu_dest.part   = ud[i + 5];
+            }
+        }
+    }
+
+    if (pdu_dest.alphabet == sms_alphabet::gsm7)
+    {
+        // Septets start after the header and the fill bits that align them.
+        uint8_t septets [256];
+        const size_t skip = (header_octets * 8 + 6) / 7;
+        if (skip > udl)
+        {
+            return false;
+        }
+
+        _unpack_septets(ud, udl, septets);
+        _gsm7_to_utf8(septets + skip, udl - skip, pdu_dest.text);
+    }
+    else if (pdu_dest.alphabet == sms_alphabet::ucs2)
+    {
+        _ucs2_to_utf8(ud + header_octets, udl - header_octets, pdu_dest.text);
+    }
+    else
+    {
+        _hex_encode(ud + header_octets, udl - header_octets, pdu_dest.text);
+    }
+
+    return true;
+}
+
+
+
+// <stat> of +CMGL and +CMGR in PDU mode.
+static constexpr const char *SMS_STATUS [] = {"unread", "read", "unsent", "sent"};
+
+bool sms_pdu_reader::line (std::string_view command, std::string_view line)
+{
+    if (m_expect_pdu)
+    {
+        m_expect_pdu = false;
+
+        if (sms_decode_pdu(line, m_pdu))
+        {
+            m_pdus++;
+            this->add_part();
+        }
+        else
+        {
+            m_failed++;
+            m_output.line(command, line);
+        }
+        return true;
+    }
+
+    // +CMGL: <index>,<stat>,... or +CMGR: <stat>,...; text mode has
+    // "REC READ" and the like for <stat>.
+    const bool list = line.starts_with("+CMGL: ");
+    if (!list && !line.starts_with("+CMGR: "))
+    {
+        return false;
+    }
+
+    size_t pos = 7;
+    m_index.clear();
+    if (list)
+    {
+        while (pos < line.size() && line[pos] >= '0' && line[pos] <= '9')
+        {
+            m_index.push_back(line[pos++]);
+        }
+        if (m_index.empty() || pos >= line.size() || line[pos++] != ',')
+        {
+            return false;
+        }
+    }
+
+    if (pos >= line.size() || line[pos] < '0' || line[pos] > '3')
+    {
+        return false;
+    }
+
+    m_status = line[pos] - '0';
+    m_expect_pdu = true;
+    return true;
+}
+
+void sms_pdu_reader::add_part (void)
+{
+    if (m_pdu.parts <= 1 || m_pdu.part < 1 || m_pdu.part > m_pdu.parts)
+    {
+        this->print(m_pdu, m_status, m_index, m_pdu.text, 1);
+        return;
+    }
+
+    m_key.assign(m_pdu.number).push_back('/');
+    m_key.append(std::to_string(m_pdu.ref)).push_back('/');
+    m_key.append(std::to_string(m_pdu.parts));
+
+    partial &p = m_partial[m_key];
+    if (p.texts.empty())
+    {
+        p.texts.resize(m_pdu.parts);
+        p.have.assign(m_pdu.parts, false);
+        p.first = m_pdu;
+        p.status = m_status;
+    }
+    else
+    {
+        p.index.push_back(',');
+        if (1 == m_pdu.part)
+        {
+            p.first = m_pdu;
+        }
+    }
+    p.index.append(m_index);
+
+    if (!p.have[m_pdu.part - 1])
+    {
+        p.have[m_pdu.part - 1] = true;
+        p.seen++;
+    }
+    p.texts[m_pdu.part - 1].swap(m_pdu.text);
+
+    if (p.seen == p.texts.size())
+    {
+        m_joined.clear();
+        for (const auto &text : p.texts)
+        {
+            m_joined.append(text);
+        }
+
+        this->print(p.first, p.status, p.index, m_joined, p.texts.size());
+        m_partial.erase(m_key);
+    }
+}
+
+void sms_pdu_reader::finish (void)
+{
+    for (const auto &[key, p] : m_partial)
+    {
+        m_joined.clear();
+        for (size_t i = 0; i < p.texts.size(); i++)
+        {
+            m_joined.append(p.have[i] ? std::string_view(p.texts[i]) : std::string_view("..."));
+        }
+
+        this->print(p.first, p.status, p.index, m_joined, p.texts.size());
+    }
+
+    m_partial.clear();
+}
+
+void sms_pdu_reader::print (const sms_pdu &pdu, uint8_t status, std::string_view index, std::string_view text, size_t parts)
+{
+    char parts_str [8];
+    snprintf(parts_str, sizeof(parts_str), "%zu", parts);
+
+    m_output.fields({
+        {"index",   index},
+        {"status",  SMS_STATUS[status]},
+        {"smsc",    pdu.smsc},
+        {"number",  pdu.number},
+        {"time",    pdu.time},
+        {"parts",   parts_str},
+        {"text",    text},
+    });
+    m_messages++;
+}
+
+
+
+bool sms_decode_file (const char *source, output_writer &output)
+{
+    FILE *f = strcmp(source, "-") ? fopen(source, "r") : stdin;
+    if (!f)
+    {
+        perror(source);
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    sms_pdu_reader reader(output);
+
+    char *buffer = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    uint64_t bytes = 0;
+
+    while (-1 != (length = getline(&buffer, &capacity, f)))
+    {
+        bytes += length;
+
+        // Raw output as is, or text output with its indentation.
+        std::string_view line(buffer, length);
+        line.remove_prefix(std::min(line.find_first_not_of(' '), line.size()));
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        {
+            line.remove_suffix(1);
+        }
+
+        reader.line("+CMGL", line);
+    }
+
+    free(buffer);
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+
+    reader.finish();
+    const bool ok = output.flush();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fprintf(stderr, "%" PRIu64 " PDUs (%.1f MB) -> %" PRIu64 " messages, %" PRIu64 " not decodable, in %.2f s: %.2f M PDUs/s\n",
+            reader.get_pdus(), bytes / 1e6, reader.get_messages(), reader.get_failed(),
+            elapsed, elapsed > 0 ? reader.get_pdus() / elapsed / 1e6 : 0);
+    return ok;
+}
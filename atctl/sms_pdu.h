@@ -0,0 +1,125 @@
+#pragma once
+
+#include "output.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// SMSC address (12) and the longest TPDU (164), in octets.
+static constexpr size_t SMS_PDU_MAX = 176;
+
+
+
+
+enum class sms_alphabet : uint8_t
+{
+    gsm7,       // 3GPP 23.038 default alphabet and its extension table
+    data8,      // given as hex
+    ucs2,       // UTF-16 really, surrogate pairs included
+};
+
+// One SMS-DELIVER or SMS-SUBMIT TPDU (3GPP 23.040) as stored on the SIM or
+// in the ME. Strings are UTF-8. Decoding into the same object again reuses
+// its buffers.
+struct sms_pdu
+{
+    std::string     smsc;
+    std::string     number;         // originator of a DELIVER, destination of a SUBMIT
+    std::string     time;           // service centre time stamp (DELIVER only), ISO 8601
+    std::string     text;
+    bool            submit;
+    sms_alphabet    alphabet;
+
+    // From the concatenation header, if any (parts 0 otherwise).
+    uint16_t        ref;
+    uint8_t         part;           // 1-based
+    uint8_t         parts;
+};
+
+// Converts 2 * n_bytes hex digits to n_bytes bytes. false if any is not a
+// hex digit. Uses SSE2 where the target has it; sms_hex_decode_table() is
+// the portable path, which must give the same result.
+bool sms_hex_decode (const char *hex, size_t n_bytes, uint8_t *dest);
+bool sms_hex_decode_table (const char *hex, size_t n_bytes, uint8_t *dest);
+
+// hex as in a +CMGL/+CMGR response, including the SMSC address. false if
+// it is not valid hex or not a well-formed DELIVER or SUBMIT.
+bool sms_decode_pdu (std::string_view hex, sms_pdu &pdu_dest);
+
+
+
+
+// Decodes the PDUs in the response lines of AT+CMGL and AT+CMGR in PDU mode
+// (AT+CMGF=0):
+//
+//   +CMGL: <index>,<stat>,[<alpha>],<length>
+//   <pdu>
+//
+// and prints one record per message through output: index, status, smsc,
+// number, time, parts, text. The parts of a concatenated message are
+// joined into one record once all of them were seen; their indices are
+// listed as "3,4,5".
+class sms_pdu_reader
+{
+public:
+    explicit sms_pdu_reader (output_writer &output)
+        : m_output (output)
+    {}
+
+    // false: the line is not part of a PDU listing and is left to the
+    // caller. A PDU that cannot be decoded is printed as a plain line.
+    bool line (std::string_view command, std::string_view line);
+
+    // Prints the messages some parts of which are missing, with "..." in
+    // their place.
+    void finish (void);
+
+    uint64_t get_pdus (void) const
+    {
+        return m_pdus;
+    }
+
+    uint64_t get_messages (void) const
+    {
+        return m_messages;
+    }
+
+    uint64_t get_failed (void) const
+    {
+        return m_failed;
+    }
+
+private:
+    struct partial
+    {
+        sms_pdu                     first;      // metadata of the first part seen
+        std::string                 index;
+        std::vector<std::string>    texts;      // by part
+        std::vector<bool>           have;
+        size_t                      seen        = 0;
+        uint8_t                     status;
+    };
+
+    void print (const sms_pdu &pdu, uint8_t status, std::string_view index, std::string_view text, size_t parts);
+    void add_part (void);
+
+    output_writer                              &m_output;
+    std::unordered_map<std::string, partial>    m_partial;      // by number, reference and part count
+    sms_pdu                                     m_pdu;
+    std::string                                 m_index;        // of the header line before the PDU
+    std::string                                 m_key;
+    std::string                                 m_joined;
+    uint8_t                                     m_status        = 0;
+    bool                                        m_expect_pdu    = false;
+    uint64_t                                    m_pdus          = 0;
+    uint64_t                                    m_messages      = 0;
+    uint64_t                                    m_failed        = 0;
+};
+
+// Decodes a saved +CMGL/+CMGR listing (atctl -r or text output) from a
+// file or "-" for stdin. Prints what it did to stderr.
+bool sms_decode_file (const char *source, output_writer &output);
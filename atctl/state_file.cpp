@@ -0,0 +1,132 @@
+#include "state_file.h"
+
+#include <cstdlib>
+#ifndef _WIN32
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+
+#ifndef _WIN32
+// "" if there is neither a runtime directory nor a home.
+static std::string _state_dir (void)
+{
+    if (const char *runtime = getenv("XDG_RUNTIME_DIR"); runtime && *runtime)
+    {
+        return runtime;
+    }
+
+    const char *home = getenv("HOME");
+    if (!home || !*home)
+    {
+        return "";
+    }
+
+    const std::string cache = std::string(home).append("/.cache");
+    const std::string dir = cache + "/atctl";
+
+    mkdir(cache.c_str(), 0700);
+    if (-1 == mkdir(dir.c_str(), 0700) && EEXIST != errno)
+    {
+        perror("mkdir");
+    }
+
+    return dir;
+}
+
+std::string state_file_path (const char *name, const char *env)
+{
+    if (const char *path = getenv(env); path && *path)
+    {
+        return path;
+    }
+
+    const std::string dir = _state_dir();
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+#else
+std::string state_file_path (const char *name, const char *env)
+{
+    const char *path = getenv(env);
+    return (path && *path) ? path : name;
+}
+#endif
+
+
+
+state_file_writer::~state_file_writer (void)
+{
+    if (m_file)
+    {
+        fclose(m_file);
+        remove(m_tmp_path.c_str());
+    }
+}
+
+#ifndef _WIN32
+FILE* state_file_writer::begin (void)
+{
+    m_tmp_path = m_path + ".XXXXXX";
+
+    const int fd = mkstemp(m_tmp_path.data());
+    if (-1 == fd)
+    {
+        perror("mkstemp");
+        return nullptr;
+    }
+
+    m_file = fdopen(fd, "w");
+    if (!m_file)
+    {
+        perror("fdopen");
+        close(fd);
+        remove(m_tmp_path.c_str());
+    }
+
+    return m_file;
+}
+#else
+FILE* state_file_writer::begin (void)
+{
+    m_tmp_path = m_path + ".tmp";
+
+    m_file = fopen(m_tmp_path.c_str(), "wx");
+    if (!m_file)
+    {
+        perror("fopen");
+    }
+
+    return m_file;
+}
+#endif
+
+bool state_file_writer::commit (void)
+{
+    FILE *f = m_file;
+    m_file = nullptr;
+
+    if (!f)
+    {
+        return false;
+    }
+
+    const bool written = !ferror(f);
+    if (0 != fclose(f) || !written)
+    {
+        perror("write");
+        remove(m_tmp_path.c_str());
+        return false;
+    }
+
+    if (0 != rename(m_tmp_path.c_str(), m_path.c_str()))
+    {
+        perror("rename");
+        remove(m_tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+
+
+// Where atctl keeps what it remembers between runs (port map, baud rates):
+// $XDG_RUNTIME_DIR, else ~/.cache/atctl (created 0700). Both belong to the
+// user alone, unlike /tmp. The environment variable env, if set, names the
+// file instead.
+std::string state_file_path (const char *name, const char *env);
+
+// Replacing a state file: begin creates an unpredictable temporary next to
+// path (O_EXCL, 0600, so no symlink is followed), commit closes it and
+// renames it over path, so readers never see a partial file. commit also
+// cleans up if writing failed. Both report errors to stderr.
+class state_file_writer
+{
+public:
+    explicit state_file_writer (const char *path)
+        : m_path (path)
+    {}
+
+    ~state_file_writer (void);
+
+    state_file_writer (const state_file_writer&) = delete;
+    state_file_writer& operator= (const state_file_writer&) = delete;
+
+    FILE* begin (void);
+    bool commit (void);
+
+private:
+    std::string     m_path;
+    std::string     m_tmp_path;
+    FILE           *m_file      = nullptr;
+};
@@ -0,0 +1,990 @@
+#include "telemetry.h"
+#include "../common.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <stdio.h>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+
+
+// Internal marker; never a parsed value (those are limited to +-2^62 so
+// that any delta between two of them fits in zigzag + 1).
+static constexpr int64_t TELEMETRY_NULL = INT64_MIN;
+static constexpr int64_t TELEMETRY_LIMIT = INT64_C(1) << 62;
+
+enum class field_kind
+{
+    time,       // the sample time, not a field
+    dec,
+    hex,
+    equals,     // 1 if the field is match, else 0
+};
+
+struct telemetry_column
+{
+    const char     *name;
+    int             field;      // index after "<prefix>: "
+    field_kind      kind;
+    const char     *match      = nullptr;
+};
+
+struct telemetry_table
+{
+    const char     *name;
+    const char     *prefix;
+    const char     *field0;     // required start of field 0, if any
+    int             rat_field;  // required "LTE" at this field, if >= 0
+    std::initializer_list<telemetry_column> columns;
+};
+
+static constexpr telemetry_column TIME = {"time", -1, field_kind::time};
+
+static const telemetry_table TABLES [] = {
+    {"csq", "+CSQ", nullptr, -1, {
+        TIME,
+        {"rssi",        0,  field_kind::dec},
+        {"ber",         1,  field_kind::dec},
+    }},
+    {"creg", "+CREG", nullptr, -1, {
+        TIME,
+        {"n",           0,  field_kind::dec},
+        {"stat",        1,  field_kind::dec},
+        {"lac",         2,  field_kind::hex},
+        {"ci",          3,  field_kind::hex},
+        {"act",         4,  field_kind::dec},
+    }},
+    {"cereg", "+CEREG", nullptr, -1, {
+        TIME,
+        {"n",           0,  field_kind::dec},
+        {"stat",        1,  field_kind::dec},
+        {"tac",         2,  field_kind::hex},
+        {"ci",          3,  field_kind::hex},
+        {"act",         4,  field_kind::dec},
+    }},
+    {"serving", "+QENG", "servingcell", 2, {
+        TIME,
+        {"connected",   1,  field_kind::equals, "CONNECT"},
+        {"tdd",         3,  field_kind::equals, "TDD"},
+        {"mcc",         4,  field_kind::dec},
+        {"mnc",         5,  field_kind::dec},
+        {"cellid",      6,  field_kind::hex},
+        {"pcid",        7,  field_kind::dec},
+        {"earfcn",      8,  field_kind::dec},
+        {"band",        9,  field_kind::dec},
+        {"ul_bw",       10, field_kind::dec},
+        {"dl_bw",       11, field_kind::dec},
+        {"tac",         12, field_kind::hex},
+        {"rsrp",        13, field_kind::dec},
+        {"rsrq",        14, field_kind::dec},
+        {"rssi",        15, field_kind::dec},
+        {"sinr",        16, field_kind::dec},
+        {"cqi",         17, field_kind::dec},
+        {"tx_power",    18, field_kind::dec},
+        {"srxlev",      19, field_kind::dec},
+    }},
+    {"neighbour", "+QENG", "neighbourcell", 1, {
+        TIME,
+        {"inter",       0,  field_kind::equals, "neighbourcell inter"},
+        {"earfcn",      2,  field_kind::dec},
+        {"pcid",        3,  field_kind::dec},
+        {"rsrq",        4,  field_kind::dec},
+        {"rsrp",        5,  field_kind::dec},
+        {"rssi",        6,  field_kind::dec},
+        {"sinr",        7,  field_kind::dec},
+        {"srxlev",      8,  field_kind::dec},
+    }},
+};
+
+static constexpr size_t N_TABLES = std::size(TABLES);
+static constexpr size_t MAX_FIELDS = 24;
+
+
+
+void telemetry_put_varint (std::vector<uint8_t> &dest, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        dest.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    dest.push_back(static_cast<uint8_t>(value));
+}
+
+bool telemetry_get_varint (const uint8_t *&p, const uint8_t *end, uint64_t &value_dest)
+{
+    value_dest = 0;
+    for (unsigned int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        const uint8_t byte = *p++;
+        value_dest |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t telemetry_zigzag (int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t telemetry_unzigzag (uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+
+
+// Splits "<prefix>: a,"b",c" into fields without quotes or spaces.
+static size_t _split_fields (std::string_view rest, std::string_view (&fields_dest)[MAX_FIELDS])
+{
+    size_t n = 0;
+    while (n < MAX_FIELDS)
+    {
+        const size_t comma = rest.find(',');
+        std::string_view field = rest.substr(0, comma);
+
+        field.remove_prefix(std::min(field.find_first_not_of(' '), field.size()));
+        while (!field.empty() && field.back() == ' ')
+        {
+            field.remove_suffix(1);
+        }
+        if (field.size() >= 2 && field.front() == '"' && field.back() == '"')
+        {
+            field = field.substr(1, field.size() - 2);
+        }
+
+        fields_dest[n++] = field;
+        if (std::string_view::npos == comma)
+        {
+            break;
+        }
+        rest.remove_prefix(comma + 1);
+    }
+    return n;
+}
+
+static int64_t _parse_field (std::string_view field, field_kind kind, const char *match)
+{
+    if (kind == field_kind::equals)
+    {
+        return field == match;
+    }
+
+    int64_t value;
+    const auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), value, kind == field_kind::hex ? 16 : 10);
+
+    // "-" and anything else unexpected.
+    if (field.empty() || ec != std::errc() || end != field.data() + field.size() || value <= -TELEMETRY_LIMIT || value >= TELEMETRY_LIMIT)
+    {
+        return TELEMETRY_NULL;
+    }
+    return value;
+}
+
+
+
+telemetry_writer::telemetry_writer (void)
+    : m_file            (nullptr)
+    , m_pending         (N_TABLES)
+    , m_rows            (0)
+    , m_bytes_written   (0)
+{
+    for (size_t t = 0; t < N_TABLES; t++)
+    {
+        m_pending[t].resize(TABLES[t].columns.size());
+    }
+}
+
+telemetry_writer::~telemetry_writer (void)
+{
+    this->close();
+}
+
+bool telemetry_writer::add (double time, std::string_view line)
+{
+    const size_t colon = line.find(':');
+    if (std::string_view::npos == colon || !line.starts_with('+'))
+    {
+        return false;
+    }
+
+    const std::string_view prefix = line.substr(0, colon);
+    std::string_view fields [MAX_FIELDS];
+    size_t n_fields = 0;
+
+    for (size_t t = 0; t < N_TABLES; t++)
+    {
+        const telemetry_table &table = TABLES[t];
+        if (prefix != table.prefix)
+        {
+            continue;
+        }
+
+        if (!n_fields)
+        {
+            n_fields = _split_fields(line.substr(colon + 1), fields);
+        }
+
+        if ((table.field0 && !fields[0].starts_with(table.field0))
+         || (table.rat_field >= 0 && (static_cast<size_t>(table.rat_field) >= n_fields || fields[table.rat_field] != "LTE")))
+        {
+            continue;
+        }
+
+        auto &columns = m_pending[t];
+        size_t c = 0;
+        for (const auto &column : table.columns)
+        {
+            int64_t value;
+            if (column.kind == field_kind::time)
+            {
+                value = std::llround(time * 1e3);
+            }
+            else if (static_cast<size_t>(column.field) < n_fields)
+            {
+                value = _parse_field(fields[column.field], column.kind, column.match);
+            }
+            else
+            {
+                value = TELEMETRY_NULL;
+            }
+            columns[c++].push_back(value);
+        }
+
+        m_rows++;
+        if (columns[0].size() >= TELEMETRY_BLOCK_ROWS)
+        {
+            this->write_block(t);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool telemetry_writer::write_block (size_t table)
+{
+    auto &columns = m_pending[table];
+    const size_t rows = columns[0].size();
+    bool ok = true;
+
+    if (rows && m_file)
+    {
+        // Values first, so the directory in front of them knows their sizes.
+        std::vector<uint8_t> &payload = m_payload;
+        payload.clear();
+        m_block.clear();
+        telemetry_put_varint(m_block, table);
+        telemetry_put_varint(m_block, rows);
+        telemetry_put_varint(m_block, columns.size());
+
+        for (const auto &values : columns)
+        {
+            const size_t start = payload.size();
+            int64_t prev = 0, min = 0, max = 0;
+            bool any = false;
+            uint64_t nulls = 0;
+
+            for (const int64_t value : values)
+            {
+                if (value == TELEMETRY_NULL)
+                {
+                    nulls++;
+                    payload.push_back(0);
+                    continue;
+                }
+
+                min = any ? std::min(min, value) : value;
+                max = any ? std::max(max, value) : value;
+                any = true;
+                telemetry_put_varint(payload, telemetry_zigzag(value - prev) + 1);
+                prev = value;
+            }
+
+            // The directory says it all: all null, or one value throughout.
+            if (nulls == values.size() || (!nulls && min == max))
+            {
+                payload.resize(start);
+            }
+
+            telemetry_put_varint(m_block, payload.size() - start);
+            telemetry_put_varint(m_block, nulls);
+            telemetry_put_varint(m_block, telemetry_zigzag(min));
+            telemetry_put_varint(m_block, telemetry_zigzag(max));
+        }
+
+        ok = 1 == fwrite(m_block.data(), m_block.size(), 1, m_file)
+          && (payload.empty() || 1 == fwrite(payload.data(), payload.size(), 1, m_file));
+        if (!ok)
+        {
+            perror("telemetry");
+        }
+        m_bytes_written += m_block.size() + payload.size();
+    }
+
+    for (auto &values : columns)
+    {
+        values.clear();
+    }
+    return ok;
+}
+
+bool telemetry_writer::flush (void)
+{
+    bool ok = true;
+    for (size_t t = 0; t < N_TABLES; t++)
+    {
+        ok = this->write_block(t) && ok;
+    }
+    return m_file && 0 == fflush(m_file) && ok;
+}
+
+bool telemetry_writer::close (void)
+{
+    if (!m_file)
+    {
+        return true;
+    }
+
+    bool ok = this->flush();
+    ok = 0 == fclose(m_file) && ok;
+    m_file = nullptr;
+    return ok;
+}
+
+
+
+// The whole file, read-only: mapped, so that scanning one column only
+// touches the pages holding it.
+struct telemetry_view
+{
+    const uint8_t          *data    = nullptr;
+    size_t                  size    = 0;
+#ifdef _WIN32
+    std::vector<uint8_t>    copy;
+#else
+    void                   *mapping = nullptr;
+#endif
+
+    bool open (const char *path);
+
+    ~telemetry_view (void)
+    {
+#ifndef _WIN32
+        if (mapping)
+        {
+            munmap(mapping, size);
+        }
+#endif
+    }
+};
+
+bool telemetry_view::open (const char *path)
+{
+#ifdef _WIN32
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    uint8_t buffer [64 * 1024];
+    size_t n;
+    while (0 < (n = fread(buffer, 1, sizeof(buffer), f)))
+    {
+        copy.insert(copy.end(), buffer, buffer + n);
+    }
+    fclose(f);
+
+    data = copy.data();
+    size = copy.size();
+    return true;
+#else
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+    {
+        perror(path);
+        return false;
+    }
+
+    struct stat st;
+    if (-1 == fstat(fd, &st))
+    {
+        perror(path);
+        ::close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    if (size)
+    {
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == mapping)
+        {
+            perror(path);
+            mapping = nullptr;
+            size = 0;
+        }
+        data = static_cast<const uint8_t*>(mapping);
+    }
+    ::close(fd);
+    return !size || mapping;
+#endif
+}
+
+static constexpr size_t TELEMETRY_HEADER_SIZE = sizeof(TELEMETRY_MAGIC) + 1;
+
+static bool _check_header (const telemetry_view &view, const char *path)
+{
+    if (view.size < TELEMETRY_HEADER_SIZE || 0 != memcmp(view.data, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC)))
+    {
+        fprintf(stderr, "%s: not a telemetry file\n", path);
+        return false;
+    }
+
+    if (view.data[sizeof(TELEMETRY_MAGIC)] != TELEMETRY_VERSION)
+    {
+        fprintf(stderr, "%s: unsupported telemetry version %u\n", path, view.data[sizeof(TELEMETRY_MAGIC)]);
+        return false;
+    }
+    return true;
+}
+
+
+
+bool telemetry_read_block (const uint8_t *&p, const uint8_t *end, telemetry_block &block_dest)
+{
+    uint64_t n_columns;
+    if (!telemetry_get_varint(p, end, block_dest.table) || !telemetry_get_varint(p, end, block_dest.rows) || !telemetry_get_varint(p, end, n_columns)
+     || block_dest.table >= N_TABLES || n_columns != TABLES[block_dest.table].columns.size() || !block_dest.rows)
+    {
+        return false;
+    }
+
+    block_dest.columns.resize(n_columns);
+    uint64_t total = 0;
+
+    for (auto &column : block_dest.columns)
+    {
+        uint64_t min, max;
+        if (!telemetry_get_varint(p, end, column.bytes) || !telemetry_get_varint(p, end, column.nulls)
+         || !telemetry_get_varint(p, end, min) || !telemetry_get_varint(p, end, max)
+         || column.nulls > block_dest.rows || column.bytes > 10 * block_dest.rows
+         || (column.bytes < block_dest.rows && !(0 == column.bytes && (column.nulls == block_dest.rows || (!column.nulls && min == max)))))
+        {
+            return false;
+        }
+
+        column.min = telemetry_unzigzag(min);
+        column.max = telemetry_unzigzag(max);
+        total += column.bytes;
+    }
+
+    if (total > static_cast<uint64_t>(end - p))
+    {
+        return false;
+    }
+
+    for (auto &column : block_dest.columns)
+    {
+        column.values = p;
+        p += column.bytes;
+    }
+    return true;
+}
+
+// Calls on_value for each non-null value. false: corrupt.
+template<typename ValueHandler>
+static bool _decode_column (const telemetry_block_column &column, uint64_t rows, ValueHandler &&on_value)
+{
+    if (!column.bytes)
+    {
+        for (uint64_t r = column.nulls; r < rows; r++)
+        {
+            on_value(column.min);
+        }
+        return true;
+    }
+
+    const uint8_t *p = column.values;
+    const uint8_t *end = p + column.bytes;
+    uint64_t value = 0;     // unsigned: corrupt deltas must not overflow
+
+    for (uint64_t r = 0; r < rows; r++)
+    {
+        uint64_t code;
+        if (!telemetry_get_varint(p, end, code))
+        {
+            return false;
+        }
+
+        if (code)
+        {
+            value += static_cast<uint64_t>(telemetry_unzigzag(code - 1));
+            on_value(static_cast<int64_t>(value));
+        }
+    }
+
+    return p == end;
+}
+
+
+
+bool telemetry_writer::open (const char *path)
+{
+    this->close();
+
+    m_file = fopen(path, "ab");
+    if (!m_file)
+    {
+        perror(path);
+        return false;
+    }
+
+    telemetry_view view;
+    if (!view.open(path))
+    {
+        this->close();
+        return false;
+    }
+
+    if (!view.size)
+    {
+        const uint8_t header [TELEMETRY_HEADER_SIZE] = {
+            TELEMETRY_MAGIC[0], TELEMETRY_MAGIC[1], TELEMETRY_MAGIC[2], TELEMETRY_MAGIC[3], TELEMETRY_VERSION,
+        };
+
+        if (1 != fwrite(header, sizeof(header), 1, m_file) || 0 != fflush(m_file))
+        {
+            perror(path);
+            this->close();
+            return false;
+        }
+        return true;
+    }
+
+    if (!_check_header(view, path))
+    {
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    // Appending after a torn block would hide everything written from now on.
+    const uint8_t *p = view.data + TELEMETRY_HEADER_SIZE;
+    const uint8_t *end = view.data + view.size;
+    telemetry_block block;
+
+    while (p < end)
+    {
+        const uint8_t *start = p;
+        if (!telemetry_read_block(p, end, block))
+        {
+            fprintf(stderr, "%s: dropping %zu bytes of a torn block at the end\n", path, static_cast<size_t>(end - start));
+#ifdef _WIN32
+            fclose(m_file);
+            m_file = nullptr;
+            return false;
+#else
+            if (-1 == ftruncate(fileno(m_file), start - view.data))
+            {
+                perror(path);
+                fclose(m_file);
+                m_file = nullptr;
+                return false;
+            }
+            break;
+#endif
+        }
+    }
+
+    return true;
+}
+
+
+
+// "<time> <line>" (raw), "   <time>  <line>" (text) or a jsonl object.
+static bool _parse_sample (std::string_view text, double &time_dest, std::string &line_dest)
+{
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+    {
+        text.remove_suffix(1);
+    }
+
+    if (text.starts_with('{'))
+    {
+        const size_t time = text.find("\"time\":");
+        const size_t line = text.find("\"line\":\"");
+        if (std::string_view::npos == time || std::string_view::npos == line)
+        {
+            return false;
+        }
+
+        const std::string_view value = text.substr(time + 7);
+        if (std::from_chars(value.data(), value.data() + value.size(), time_dest).ec != std::errc())
+        {
+            return false;
+        }
+
+        // Only \" and \\ can occur in the lines of interest.
+        line_dest.clear();
+        for (size_t i = line + 8; i < text.size() && text[i] != '"'; i++)
+        {
+            if (text[i] == '\\' && i + 1 < text.size())
+            {
+                i++;
+            }
+            line_dest.push_back(text[i]);
+        }
+        return true;
+    }
+
+    text.remove_prefix(std::min(text.find_first_not_of(' '), text.size()));
+    const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), time_dest);
+    if (ec != std::errc() || end == text.data() + text.size() || *end != ' ')
+    {
+        return false;
+    }
+
+    text.remove_prefix(end - text.data());
+    text.remove_prefix(std::min(text.find_first_not_of(' '), text.size()));
+    line_dest.assign(text);
+    return true;
+}
+
+bool telemetry_import (const char *source, telemetry_writer &writer)
+{
+    FILE *f = strcmp(source, "-") ? fopen(source, "r") : stdin;
+    if (!f)
+    {
+        perror(source);
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t start_rows = writer.get_rows();
+
+    char *buffer = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    uint64_t lines = 0;
+    uint64_t bytes = 0;
+    double time;
+    std::string line;
+
+    while (-1 != (length = getline(&buffer, &capacity, f)))
+    {
+        lines++;
+        bytes += length;
+
+        if (_parse_sample(std::string_view(buffer, length), time, line))
+        {
+            writer.add(time, line);
+        }
+    }
+
+    free(buffer);
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+
+    const bool ok = writer.flush();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const uint64_t rows = writer.get_rows() - start_rows;
+
+    fprintf(stderr, "%" PRIu64 " lines (%.1f MB) -> %" PRIu64 " rows in %.2f s, %.2f M lines/s\n",
+            lines, bytes / 1e6, rows, elapsed, elapsed > 0 ? lines / elapsed / 1e6 : 0);
+    fprintf(stderr, "Written so far: %.1f MB, %.2f bytes per row\n",
+            writer.get_bytes_written() / 1e6, writer.get_rows() ? static_cast<double>(writer.get_bytes_written()) / writer.get_rows() : 0);
+    return ok;
+}
+
+
+
+static bool _find_column (const char *name, size_t &table_dest, size_t &column_dest)
+{
+    const char *dot = strchr(name, '.');
+    if (!dot)
+    {
+        return false;
+    }
+
+    const std::string_view table_name(name, dot - name);
+    for (table_dest = 0; table_dest < N_TABLES; table_dest++)
+    {
+        if (table_name != TABLES[table_dest].name)
+        {
+            continue;
+        }
+
+        column_dest = 0;
+        for (const auto &column : TABLES[table_dest].columns)
+        {
+            if (0 == strcmp(dot + 1, column.name))
+            {
+                return true;
+            }
+            column_dest++;
+        }
+    }
+    return false;
+}
+
+// "<min>..<max>"
+static bool _parse_range (const char *str, int64_t &min_dest, int64_t &max_dest)
+{
+    const char *sep = strstr(str, "..");
+    if (!sep)
+    {
+        return false;
+    }
+
+    const auto a = std::from_chars(str, sep, min_dest);
+    const auto b = std::from_chars(sep + 2, str + strlen(str), max_dest);
+    return a.ec == std::errc() && a.ptr == sep && b.ec == std::errc() && !*b.ptr && min_dest <= max_dest;
+}
+
+// Per table: rows, blocks and per column bytes, nulls, min and max.
+static void _print_summary (const telemetry_view &view, const uint8_t *end)
+{
+    struct column_summary
+    {
+        uint64_t    bytes   = 0;
+        uint64_t    nulls   = 0;
+        int64_t     min     = 0;
+        int64_t     max     = 0;
+        bool        any     = false;
+    };
+
+    std::vector<std::vector<column_summary>> summary(N_TABLES);
+    std::vector<uint64_t> rows(N_TABLES), blocks(N_TABLES);
+    const uint8_t *p = view.data + TELEMETRY_HEADER_SIZE;
+    telemetry_block block;
+
+    while (p < end && telemetry_read_block(p, end, block))
+    {
+        auto &columns = summary[block.table];
+        columns.resize(block.columns.size());
+        rows[block.table] += block.rows;
+        blocks[block.table]++;
+
+        for (size_t c = 0; c < block.columns.size(); c++)
+        {
+            const auto &column = block.columns[c];
+            column_summary &s = columns[c];
+
+            s.bytes += column.bytes;
+            s.nulls += column.nulls;
+            if (column.nulls < block.rows)
+            {
+                s.min = s.any ? std::min(s.min, column.min) : column.min;
+                s.max = s.any ? std::max(s.max, column.max) : column.max;
+                s.any = true;
+            }
+        }
+    }
+
+    uint64_t total_rows = 0;
+    for (size_t t = 0; t < N_TABLES; t++)
+    {
+        if (!rows[t])
+        {
+            continue;
+        }
+        total_rows += rows[t];
+
+        printf("%s: %" PRIu64 " rows in %" PRIu64 " blocks\n", TABLES[t].name, rows[t], blocks[t]);
+
+        size_t c = 0;
+        for (const auto &column : TABLES[t].columns)
+        {
+            const column_summary &s = summary[t][c++];
+            printf("  %-10s %10" PRIu64 " bytes  %5.2f bits/value", column.name, s.bytes, 8.0 * s.bytes / rows[t]);
+            if (s.any)
+            {
+                printf("  min %" PRId64 "  max %" PRId64, s.min, s.max);
+            }
+            if (s.nulls)
+            {
+                printf("  %" PRIu64 " null", s.nulls);
+            }
+            printf("\n");
+        }
+    }
+
+    printf("%zu bytes, %" PRIu64 " rows, %.2f bytes per row\n", view.size, total_rows, total_rows ? static_cast<double>(view.size) / total_rows : 0);
+}
+
+// Maps path and finds where its intact blocks end.
+static bool _open_blocks (telemetry_view &view, const char *path, const uint8_t *&end_dest)
+{
+    if (!view.open(path) || !_check_header(view, path))
+    {
+        return false;
+    }
+
+    // Stop short of a torn last block (a writer may be appending right now).
+    const uint8_t *q = view.data + TELEMETRY_HEADER_SIZE;
+    const uint8_t *end = view.data + view.size;
+    const uint8_t *last = q;
+    telemetry_block block;
+    while (q < end && telemetry_read_block(q, end, block))
+    {
+        last = q;
+    }
+    if (last != end)
+    {
+        fprintf(stderr, "%s: ignoring %zu bytes of a torn block at the end\n", path, static_cast<size_t>(end - last));
+    }
+    end_dest = last;
+    return true;
+}
+
+bool telemetry_scan_column (const char *path, const char *column_name, int64_t lo, int64_t hi, bool skip_blocks, telemetry_scan_result &result_dest)
+{
+    size_t table, c;
+    if (!_find_column(column_name, table, c))
+    {
+        fprintf(stderr, "Unknown column %s, expected <table>.<column> (see atctl --scan %s)\n", column_name, path);
+        return false;
+    }
+
+    telemetry_view view;
+    const uint8_t *end;
+    if (!_open_blocks(view, path, end))
+    {
+        return false;
+    }
+
+    const uint8_t *p = view.data + TELEMETRY_HEADER_SIZE;
+    telemetry_block block;
+    telemetry_scan_result &r = result_dest;
+    r = telemetry_scan_result();
+    r.file_bytes = view.size;
+
+    while (p < end && telemetry_read_block(p, end, block))
+    {
+        if (block.table != table)
+        {
+            continue;
+        }
+
+        const telemetry_block_column &column = block.columns[c];
+        const uint64_t present = block.rows - column.nulls;
+
+        r.blocks++;
+        r.rows += block.rows;
+
+        if (present && r.values)
+        {
+            r.min = std::min(r.min, column.min);
+            r.max = std::max(r.max, column.max);
+        }
+        else if (present)
+        {
+            r.min = column.min;
+            r.max = column.max;
+        }
+        r.values += present;
+
+        // A range is answered from the directory where it can be.
+        if (skip_blocks)
+        {
+            if (!present || column.max < lo || column.min > hi)
+            {
+                r.skipped++;
+                continue;
+            }
+
+            if (column.min >= lo && column.max <= hi)
+            {
+                r.within += present;
+                r.whole++;
+                continue;
+            }
+        }
+
+        r.decoded++;
+        r.bytes_decoded += column.bytes;
+
+        const bool ok = _decode_column(column, block.rows, [&](int64_t value)
+        {
+            r.sum += value;
+            r.within += (value >= lo && value <= hi);
+        });
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: corrupt %s block\n", path, column_name);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool telemetry_scan (const char *path, const char *column_name, const char *range)
+{
+    if (!column_name)
+    {
+        telemetry_view view;
+        const uint8_t *end;
+        if (!_open_blocks(view, path, end))
+        {
+            return false;
+        }
+        _print_summary(view, end);
+        return true;
+    }
+
+    int64_t lo = INT64_MIN, hi = INT64_MAX;
+    if (range && !_parse_range(range, lo, hi))
+    {
+        fprintf(stderr, "Invalid range %s, expected <min>..<max>\n", range);
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    telemetry_scan_result r;
+    if (!telemetry_scan_column(path, column_name, lo, hi, range != nullptr, r))
+    {
+        return false;
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%s: %" PRIu64 " values, %" PRIu64 " null", column_name, r.values, r.rows - r.values);
+    if (r.values)
+    {
+        printf(", min %" PRId64 ", max %" PRId64, r.min, r.max);
+    }
+    if (!range && r.values)
+    {
+        printf(", mean %.2f", r.sum / r.values);
+    }
+    if (range)
+    {
+        printf(", %" PRIu64 " in %" PRId64 "..%" PRId64, r.within, lo, hi);
+    }
+    printf("\n");
+
+    fprintf(stderr, "%" PRIu64 " blocks: %" PRIu64 " decoded (%.1f KB of %.1f MB), %" PRIu64 " skipped, %" PRIu64 " taken whole by min/max; %.2f ms, %.0f M rows/s\n",
+            r.blocks, r.decoded, r.bytes_decoded / 1e3, r.file_bytes / 1e6, r.skipped, r.whole,
+            elapsed * 1e3, elapsed > 0 ? r.rows / elapsed / 1e6 : 0);
+    return true;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static constexpr char       TELEMETRY_MAGIC []      = {'A', 'T', 'C', 'T'};
+static constexpr uint8_t    TELEMETRY_VERSION       = 1;
+
+// Rows buffered per table before they are written out as one block.
+static constexpr size_t     TELEMETRY_BLOCK_ROWS    = 4096;
+
+
+
+
+// Appends the numbers in radio telemetry responses to a columnar file, one
+// table per kind of line:
+//
+//   csq        +CSQ: <rssi>,<ber>
+//   creg       +CREG: <n>,<stat>[,<lac>,<ci>[,<act>]]
+//   cereg      +CEREG: <n>,<stat>[,<tac>,<ci>[,<act>]]
+//   serving    +QENG: "servingcell",<state>,"LTE",... (Quectel, LTE only)
+//   neighbour  +QENG: "neighbourcell intra|inter","LTE",...
+//
+// Every table starts with a "time" column (ms since the epoch). Fields that
+// are missing or "-" are stored as null.
+//
+// The file is a header (TELEMETRY_MAGIC, TELEMETRY_VERSION) followed by
+// blocks, each holding up to TELEMETRY_BLOCK_ROWS rows of one table:
+//
+//   <table> <rows> <columns>
+//   per column: <bytes> <nulls> <min> <max>
+//   per column: <bytes> of values
+//
+// All numbers are LEB128 varints, signed ones zigzag encoded. A column's
+// values are deltas from the previous non-null value in the block, as
+// zigzag + 1, with 0 for null; a column that is all null or holds one value
+// throughout takes no bytes. The directory at the start of a block lets a
+// reader jump to one column, or skip the block by its min/max.
+//
+// Rows are kept in memory until a block is full or flush(); a crash loses
+// at most the unflushed rows, and a reader ignores a torn last block.
+class telemetry_writer
+{
+public:
+    telemetry_writer (void);
+    ~telemetry_writer (void);
+
+    telemetry_writer (const telemetry_writer&) = delete;
+    telemetry_writer& operator= (const telemetry_writer&) = delete;
+
+    // Creates the file or appends to an existing telemetry file.
+    bool open (const char *path);
+
+    // Adds a row if line is one of the tables above; time in seconds since
+    // the epoch. false: not telemetry.
+    bool add (double time, std::string_view line);
+
+    // Writes out the rows buffered so far as (short) blocks.
+    bool flush (void);
+
+    bool close (void);
+
+    uint64_t get_rows (void) const
+    {
+        return m_rows;
+    }
+
+    uint64_t get_bytes_written (void) const
+    {
+        return m_bytes_written;
+    }
+
+private:
+    bool write_block (size_t table);
+
+    FILE                                       *m_file;
+    std::vector<std::vector<std::vector<int64_t>>> m_pending;  // [table][column][row]
+    std::vector<uint8_t>                        m_block;
+    std::vector<uint8_t>                        m_payload;
+    uint64_t                                    m_rows;
+    uint64_t                                    m_bytes_written;
+};
+
+
+
+
+// Imports atctl sample output (--format=raw, text or jsonl, e.g. from
+// --monitor) from a file or "-" for stdin. Prints what it did to stderr.
+bool telemetry_import (const char *source, telemetry_writer &writer);
+
+// Without a column ("table.column"), lists the tables and the bytes used
+// by each column. With one, decodes only that column and prints its
+// statistics; with a range ("<min>..<max>") also counts the values within,
+// skipping blocks whose min/max lie outside it.
+bool telemetry_scan (const char *path, const char *column, const char *range);
+
+// What telemetry_scan() prints for one column.
+struct telemetry_scan_result
+{
+    uint64_t    rows            = 0;
+    uint64_t    values          = 0;    // non-null
+    uint64_t    within          = 0;    // values in lo..hi
+    uint64_t    blocks          = 0;
+    uint64_t    decoded         = 0;
+    uint64_t    skipped         = 0;    // by min/max, outside lo..hi
+    uint64_t    whole           = 0;    // by min/max, inside lo..hi
+    uint64_t    bytes_decoded   = 0;
+    uint64_t    file_bytes      = 0;
+    int64_t     min             = 0;
+    int64_t     max             = 0;
+    double      sum             = 0;
+};
+
+// Scans column ("table.column") of path, counting the values in lo..hi.
+// With skip_blocks, blocks are skipped or counted by their min/max where
+// that answers for them; otherwise every block is decoded.
+bool telemetry_scan_column (const char *path, const char *column, int64_t lo, int64_t hi, bool skip_blocks, telemetry_scan_result &result_dest);
+
+
+
+
+// The file format's building blocks, for tests and tools.
+
+void telemetry_put_varint (std::vector<uint8_t> &dest, uint64_t value);
+
+// Reads a varint and moves p past it. false: truncated or over 10 bytes.
+bool telemetry_get_varint (const uint8_t *&p, const uint8_t *end, uint64_t &value_dest);
+
+uint64_t telemetry_zigzag (int64_t value);
+int64_t telemetry_unzigzag (uint64_t value);
+
+struct telemetry_block_column
+{
+    uint64_t        bytes;
+    uint64_t        nulls;
+    int64_t         min;
+    int64_t         max;
+    const uint8_t  *values;
+};
+
+struct telemetry_block
+{
+    uint64_t                            table;
+    uint64_t                            rows;
+    std::vector<telemetry_block_column> columns;
+};
+
+// Reads a block's directory and moves p past the block. false: torn or
+// not a block.
+bool telemetry_read_block (const uint8_t *&p, const uint8_t *end, telemetry_block &block_dest);
@@ -0,0 +1,316 @@
+#include "geofence.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <stdio.h>
+
+// Longest side of the grid, in cells.
+static constexpr uint32_t GEOFENCE_MAX_GRID = 2048;
+
+// Cells per fence: enough that a cell lists only a few fences.
+static constexpr double GEOFENCE_CELLS_PER_FENCE = 2;
+
+
+
+void geo_box::extend (const geo_point &p)
+{
+    min_lat = std::min(min_lat, p.lat);
+    min_lon = std::min(min_lon, p.lon);
+    max_lat = std::max(max_lat, p.lat);
+    max_lon = std::max(max_lon, p.lon);
+}
+
+static bool _parse_double (std::string_view &str, double &value_dest)
+{
+    const auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value_dest);
+    if (ec != std::errc() || !std::isfinite(value_dest))
+    {
+        return false;
+    }
+
+    str.remove_prefix(end - str.data());
+    return true;
+}
+
+// "<lat>,<lon>"
+static bool _parse_point (std::string_view str, geo_point &point_dest)
+{
+    return _parse_double(str, point_dest.lat)
+        && str.starts_with(',')
+        && (str.remove_prefix(1), _parse_double(str, point_dest.lon))
+        && str.empty()
+        && std::fabs(point_dest.lat) <= 90 && std::fabs(point_dest.lon) <= 180;
+}
+
+
+
+bool geofence_set::load (FILE *f, const char *name)
+{
+    m_fences.clear();
+    m_points.clear();
+
+    char *buffer = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t line_number = 0;
+    bool ok = true;
+
+    // Polygons can be long: lines are read whole.
+    while (ok && -1 != (length = getline(&buffer, &capacity, f)))
+    {
+        line_number++;
+
+        std::string_view line(buffer, length);
+        line = line.substr(0, line.find('#'));
+
+        std::vector<std::string_view> tokens;
+        while (!line.empty())
+        {
+            const size_t start = line.find_first_not_of(" \t\r\n");
+            if (std::string_view::npos == start)
+            {
+                break;
+            }
+            line.remove_prefix(start);
+
+            const size_t end = std::min(line.find_first_of(" \t\r\n"), line.size());
+            tokens.push_back(line.substr(0, end));
+            line.remove_prefix(end);
+        }
+
+        if (tokens.empty())
+        {
+            continue;
+        }
+
+        // Ids are printed in JSON as they are.
+        if (std::string_view::npos != tokens[0].find_first_of("\"\\"))
+        {
+            fprintf(stderr, "%s:%zu: invalid fence id\n", name, line_number);
+            ok = false;
+            break;
+        }
+
+        if (tokens.size() < 4)
+        {
+            fprintf(stderr, "%s:%zu: a fence needs at least three points\n", name, line_number);
+            ok = false;
+            break;
+        }
+
+        fence &added = m_fences.emplace_back();
+        added.id.assign(tokens[0]);
+        added.first = static_cast<uint32_t>(m_points.size());
+        added.count = static_cast<uint32_t>(tokens.size() - 1);
+
+        for (size_t i = 1; i < tokens.size(); i++)
+        {
+            geo_point &point = m_points.emplace_back();
+            if (!_parse_point(tokens[i], point))
+            {
+                fprintf(stderr, "%s:%zu: expected <lat>,<lon>, got %.*s\n", name, line_number, static_cast<int>(tokens[i].size()), tokens[i].data());
+                ok = false;
+                break;
+            }
+            added.box.extend(point);
+        }
+    }
+
+    free(buffer);
+
+    if (!ok)
+    {
+        m_fences.clear();
+        m_points.clear();
+    }
+
+    this->build_index();
+    return ok;
+}
+
+
+
+void geofence_set::build_index (void)
+{
+    m_bounds = geo_box();
+    for (const auto &fence : m_fences)
+    {
+        m_bounds.extend({fence.box.min_lat, fence.box.min_lon});
+        m_bounds.extend({fence.box.max_lat, fence.box.max_lon});
+    }
+
+    m_cell_start.assign(1, 0);
+    m_cell_fences.clear();
+    m_cols = m_rows = 0;
+
+    if (m_fences.empty())
+    {
+        return;
+    }
+
+    // Square cells where possible, each side capped.
+    const double span_lat = std::max(m_bounds.max_lat - m_bounds.min_lat, 1e-9);
+    const double span_lon = std::max(m_bounds.max_lon - m_bounds.min_lon, 1e-9);
+    const double side = std::sqrt(span_lat * span_lon / (GEOFENCE_CELLS_PER_FENCE * m_fences.size()));
+
+    m_rows = static_cast<uint32_t>(std::clamp(std::ceil(span_lat / side), 1.0, static_cast<double>(GEOFENCE_MAX_GRID)));
+    m_cols = static_cast<uint32_t>(std::clamp(std::ceil(span_lon / side), 1.0, static_cast<double>(GEOFENCE_MAX_GRID)));
+    m_cell_lat = span_lat / m_rows;
+    m_cell_lon = span_lon / m_cols;
+
+
+
+    // Count, then fill: every cell's list in one array, fences in ascending order.
+    m_cell_start.assign(static_cast<size_t>(m_rows) * m_cols + 1, 0);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::vector<uint32_t> cursor;
+        if (pass == 1)
+        {
+            for (size_t c = 1; c < m_cell_start.size(); c++)
+            {
+                m_cell_start[c] += m_cell_start[c - 1];
+            }
+            m_cell_fences.resize(m_cell_start.back());
+            cursor.assign(m_cell_start.begin(), m_cell_start.end() - 1);
+        }
+
+        for (uint32_t i = 0; i < m_fences.size(); i++)
+        {
+            const geo_box &box = m_fences[i].box;
+
+            for (uint32_t row = this->row_of(box.min_lat); row <= this->row_of(box.max_lat); row++)
+            {
+                for (uint32_t col = this->col_of(box.min_lon); col <= this->col_of(box.max_lon); col++)
+                {
+                    const size_t cell = static_cast<size_t>(row) * m_cols + col;
+                    if (pass == 0)
+                    {
+                        m_cell_start[cell + 1]++;
+                    }
+                    else
+                    {
+                        m_cell_fences[cursor[cell]++] = i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Even-odd rule: count the edges a ray towards east crosses.
+bool geofence_set::contains (const fence &f, const geo_point &p) const
+{
+    const geo_point *v = &m_points[f.first];
+    bool inside = false;
+
+    for (uint32_t i = 0, j = f.count - 1; i < f.count; j = i++)
+    {
+        if ((v[i].lat > p.lat) != (v[j].lat > p.lat)
+         && p.lon < (v[j].lon - v[i].lon) * (p.lat - v[i].lat) / (v[j].lat - v[i].lat) + v[i].lon)
+        {
+            inside = !inside;
+        }
+    }
+
+    return inside;
+}
+
+void geofence_set::query (const geo_point &p, std::vector<uint32_t> &inside_dest) const
+{
+    inside_dest.clear();
+
+    if (m_fences.empty() || !m_bounds.contains(p))
+    {
+        return;
+    }
+
+    const size_t cell = static_cast<size_t>(this->row_of(p.lat)) * m_cols + this->col_of(p.lon);
+
+    for (uint32_t k = m_cell_start[cell]; k < m_cell_start[cell + 1]; k++)
+    {
+        const fence &f = m_fences[m_cell_fences[k]];
+        if (f.box.contains(p) && this->contains(f, p))
+        {
+            inside_dest.push_back(m_cell_fences[k]);
+        }
+    }
+}
+
+void geofence_set::query_linear (const geo_point &p, std::vector<uint32_t> &inside_dest) const
+{
+    inside_dest.clear();
+
+    for (uint32_t i = 0; i < m_fences.size(); i++)
+    {
+        if (m_fences[i].box.contains(p) && this->contains(m_fences[i], p))
+        {
+            inside_dest.push_back(i);
+        }
+    }
+}
+
+void geofence_set::get_grid_stats (uint32_t &cols_dest, uint32_t &rows_dest, double &per_cell_dest) const
+{
+    cols_dest = m_cols;
+    rows_dest = m_rows;
+    per_cell_dest = m_cols ? static_cast<double>(m_cell_fences.size()) / (static_cast<double>(m_cols) * m_rows) : 0;
+}
+
+
+
+// The value of "key": in a flat JSON object, without unescaping.
+static bool _json_value (std::string_view json, std::string_view key, std::string_view &value_dest)
+{
+    size_t at = 0;
+    while (std::string_view::npos != (at = json.find(key, at)))
+    {
+        at += key.size();
+        if (json[at - key.size() - 1] != '"' || at >= json.size() || json[at] != '"')
+        {
+            continue;
+        }
+
+        std::string_view rest = json.substr(at + 1);
+        rest.remove_prefix(std::min(rest.find_first_not_of(" :"), rest.size()));
+        value_dest = rest.substr(0, rest.find_first_of(",}"));
+        return true;
+    }
+
+    return false;
+}
+
+bool geofence_parse_fix (std::string_view line, geo_point &fix_dest, std::string &time_dest)
+{
+    time_dest.clear();
+
+    if (line.starts_with('{'))
+    {
+        std::string_view value;
+        if (!_json_value(line, "class", value) || value != "\"TPV\"")
+        {
+            return false;
+        }
+
+        if (!_json_value(line, "lat", value) || !_parse_double(value, fix_dest.lat)
+         || !_json_value(line, "lon", value) || !_parse_double(value, fix_dest.lon))
+        {
+            return false;
+        }
+
+        if (_json_value(line, "time", value) && value.size() >= 2 && value.front() == '"' && value.back() == '"')
+        {
+            time_dest.assign(value.substr(1, value.size() - 2));
+        }
+        return true;
+    }
+
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+    {
+        line.remove_suffix(1);
+    }
+    return _parse_point(line, fix_dest);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+
+struct geo_point
+{
+    double lat;
+    double lon;
+};
+
+struct geo_box
+{
+    double min_lat  =  90;
+    double min_lon  =  180;
+    double max_lat  = -90;
+    double max_lon  = -180;
+
+    void extend (const geo_point &p);
+
+    bool contains (const geo_point &p) const
+    {
+        return p.lat >= min_lat && p.lat <= max_lat && p.lon >= min_lon && p.lon <= max_lon;
+    }
+};
+
+
+
+// A set of polygon fences with a uniform grid over them: a fix is only
+// tested against the fences whose bounding box overlaps its cell.
+// Coordinates are taken as planar, so fences must not cross the 180th
+// meridian or contain a pole.
+//
+// File format, one fence per line, '#' starts a comment:
+//
+//   <id> <lat>,<lon> <lat>,<lon> <lat>,<lon> ...
+//
+// The ring is closed implicitly; at least three points are needed.
+class geofence_set
+{
+public:
+    // Parses the whole file, reporting errors with line numbers, and builds
+    // the index.
+    bool load (FILE *f, const char *name);
+
+    // Indices of the fences containing p, in ascending order.
+    void query (const geo_point &p, std::vector<uint32_t> &inside_dest) const;
+
+    // The same by testing every fence, for comparison.
+    void query_linear (const geo_point &p, std::vector<uint32_t> &inside_dest) const;
+
+    size_t size (void) const
+    {
+        return m_fences.size();
+    }
+
+    const std::string& get_id (uint32_t fence) const
+    {
+        return m_fences[fence].id;
+    }
+
+    // Grid dimensions and the average number of fences listed per cell.
+    void get_grid_stats (uint32_t &cols_dest, uint32_t &rows_dest, double &per_cell_dest) const;
+
+private:
+    struct fence
+    {
+        std::string     id;
+        geo_box         box;
+        uint32_t        first;      // in m_points
+        uint32_t        count;
+    };
+
+    void build_index (void);
+    bool contains (const fence &f, const geo_point &p) const;
+
+    // Within m_bounds.
+    uint32_t row_of (double lat) const
+    {
+        return std::min(m_rows - 1, static_cast<uint32_t>((lat - m_bounds.min_lat) / m_cell_lat));
+    }
+
+    uint32_t col_of (double lon) const
+    {
+        return std::min(m_cols - 1, static_cast<uint32_t>((lon - m_bounds.min_lon) / m_cell_lon));
+    }
+
+    std::vector<fence>          m_fences;
+    std::vector<geo_point>      m_points;
+
+    // Cell c lists m_cell_fences[m_cell_start[c] .. m_cell_start[c + 1]).
+    geo_box                     m_bounds;
+    uint32_t                    m_cols          = 0;
+    uint32_t                    m_rows          = 0;
+    double                      m_cell_lat      = 1;
+    double                      m_cell_lon      = 1;
+    std::vector<uint32_t>       m_cell_start;
+    std::vector<uint32_t>       m_cell_fences;
+};
+
+
+
+// Follows one position through a geofence_set and reports crossings.
+class geofence_tracker
+{
+public:
+    explicit geofence_tracker (const geofence_set &fences)
+        : m_fences (fences)
+    {}
+
+    // Calls on_event(fence, entered) for every fence entered or left since
+    // the previous fix.
+    template<typename EventHandler>
+    void update (const geo_point &p, EventHandler &&on_event)
+    {
+        m_fences.query(p, m_next);
+
+        // Both sorted: one merge pass finds the differences.
+        size_t i = 0, j = 0;
+        while (i < m_inside.size() || j < m_next.size())
+        {
+            if (j == m_next.size() || (i < m_inside.size() && m_inside[i] < m_next[j]))
+            {
+                on_event(m_inside[i++], false);
+            }
+            else if (i == m_inside.size() || m_next[j] < m_inside[i])
+            {
+                on_event(m_next[j++], true);
+            }
+            else
+            {
+                i++;
+                j++;
+            }
+        }
+
+        m_inside.swap(m_next);
+    }
+
+    const std::vector<uint32_t>& get_inside (void) const
+    {
+        return m_inside;
+    }
+
+private:
+    const geofence_set         &m_fences;
+    std::vector<uint32_t>       m_inside;
+    std::vector<uint32_t>       m_next;
+};
+
+
+
+// Reads a fix from one line of a recorded track: a gpsd TPV report (as
+// printed by gpspipe -w or gps --subscribe) or "<lat>,<lon>". time_dest
+// receives the TPV's "time", if any. Other lines are skipped (false).
+bool geofence_parse_fix (std::string_view line, geo_point &fix_dest, std::string &time_dest);
@@ -5,6 +5,17 @@
 #include <unistd.h>
 #include <gps.h>
 #include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "geofence.h"
+#include "gps_ring.h"
+#include "../source_exception/source_exception.h"
 
 
 // https://kickstartembedded.com/2022/07/23/a-beginners-guide-to-using-gpsd-in-linux/
@@ -126,10 +137,321 @@ int gpsd_main (void)
 
 
 
+// Relays gpsd's JSON reports into a shared memory ring, so any number of
+// local consumers can follow them without each keeping a gpsd session.
+static volatile sig_atomic_t g_stop = 0;
+
+static void _on_signal (int)
+{
+    g_stop = 1;
+}
+
+int publish_main (const char *ring_name)
+{
+    struct gps_data_t gps_data;
+
+    if (int r = gps_open(SERVER_NAME, SERVER_PORT, &gps_data)) {
+        const char *str = gps_errstr(r);
+        fprintf(stderr, "%s\n", str ? str : "Open error");
+        return 1;
+    }
+
+    signal(SIGINT, _on_signal);
+    signal(SIGTERM, _on_signal);
+
+    try
+    {
+        gps_ring_writer ring(ring_name);
+        size_t n_oversized = 0;
+
+        (void)gps_stream(&gps_data, WATCH_ENABLE | WATCH_JSON, NULL);
+
+        // gps_read() hands back the raw JSON, one report per line.
+        char message [GPS_JSON_RESPONSE_MAX];
+        while (!g_stop && gps_waiting(&gps_data, 5000000)) {
+            if (-1 == gps_read(&gps_data, message, sizeof(message))) {
+                fprintf(stderr, "Read error\n");
+                break;
+            }
+
+            std::string_view json(message, strnlen(message, sizeof(message)));
+            while (!json.empty()) {
+                const size_t eol = json.find('\n');
+                const std::string_view report = json.substr(0, eol);
+
+                if (!report.empty() && !ring.publish(report)) {
+                    n_oversized++;
+                }
+
+                json.remove_prefix(std::string_view::npos == eol ? json.size() : eol + 1);
+            }
+        }
+
+        fprintf(stderr, "Published %llu reports, %zu too large.\n", (unsigned long long) ring.get_published(), n_oversized);
+    }
+    catch (const source_exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+    }
+
+    (void)gps_stream(&gps_data, WATCH_DISABLE, NULL);
+    (void)gps_close(&gps_data);
+    return 0;
+}
+
+int subscribe_main (const char *ring_name)
+{
+    signal(SIGINT, _on_signal);
+    signal(SIGTERM, _on_signal);
+
+    uint64_t n_received = 0;
+    uint64_t n_dropped = 0;
+    std::string line;
+
+    while (!g_stop) {
+        try
+        {
+            gps_ring_reader ring(ring_name);
+
+            while (!g_stop && !ring.is_closed()) {
+                if (!ring.wait(500)) {
+                    continue;
+                }
+
+                std::string_view report;
+                while (ring.next(report)) {
+                    // Copied out first: the writer may overwrite the slot
+                    // at any time, and only an intact copy is printed.
+                    line.assign(report);
+                    if (!ring.valid()) {
+                        continue;
+                    }
+
+                    line += '\n';
+                    fwrite(line.data(), 1, line.size(), stdout);
+                    n_received++;
+                }
+                fflush(stdout);
+            }
+
+            n_dropped += ring.get_dropped();
+        }
+        catch (const source_exception &e)
+        {
+            // Not published yet, or restarting.
+        }
+
+        if (!g_stop) {
+            sleep(1);
+        }
+    }
+
+    fprintf(stderr, "Received %llu reports, dropped %llu.\n", (unsigned long long) n_received, (unsigned long long) n_dropped);
+    return 0;
+}
+
+
+
+
+// Checks every fix against a set of geofences and prints a FENCE report
+// for each crossing as it happens, live from gpsd or from a recorded track.
+static void _print_crossing (const geofence_set &fences, uint32_t fence, bool entered, const geo_point &fix, const std::string &time)
+{
+    printf("{\"class\":\"FENCE\",\"event\":\"%s\",\"id\":\"%s\",", entered ? "enter" : "exit", fences.get_id(fence).c_str());
+    if (!time.empty()) {
+        printf("\"time\":\"%s\",", time.c_str());
+    }
+    printf("\"lat\":%.7f,\"lon\":%.7f}\n", fix.lat, fix.lon);
+}
+
+// Sorts samples.
+static void _print_latency (const char *what, std::vector<double> &samples_us)
+{
+    if (samples_us.empty()) {
+        return;
+    }
+
+    std::sort(samples_us.begin(), samples_us.end());
+    double sum = 0;
+    for (const double sample : samples_us) {
+        sum += sample;
+    }
+
+    fprintf(stderr, "%s: mean %.2f us, p50 %.2f us, p99 %.2f us, max %.2f us\n", what, sum / samples_us.size(),
+            samples_us[samples_us.size() / 2], samples_us[samples_us.size() * 99 / 100], samples_us.back());
+}
+
+int fences_main (const char *fences_path, const char *track_path)
+{
+    using clock = std::chrono::steady_clock;
+
+    FILE *f = fopen(fences_path, "r");
+    if (!f) {
+        perror(fences_path);
+        return 1;
+    }
+
+    geofence_set fences;
+    const clock::time_point load_start = clock::now();
+    const bool loaded = fences.load(f, fences_path);
+    const double load_ms = std::chrono::duration<double, std::milli>(clock::now() - load_start).count();
+    fclose(f);
+
+    if (!loaded) {
+        return 1;
+    }
+
+    uint32_t cols, rows;
+    double per_cell;
+    fences.get_grid_stats(cols, rows, per_cell);
+    fprintf(stderr, "%zu fences loaded and indexed in %.1f ms (grid %ux%u, %.2f fences per cell)\n",
+            fences.size(), load_ms, cols, rows, per_cell);
+
+    signal(SIGINT, _on_signal);
+    signal(SIGTERM, _on_signal);
+
+    geofence_tracker tracker(fences);
+    std::vector<std::pair<uint32_t, bool>> crossings;
+    std::vector<double> latency_us;
+    std::string time;
+    geo_point fix;
+    size_t n_enter = 0;
+    size_t n_exit = 0;
+
+    // Crossings are printed after the clock stops.
+    const auto evaluate = [&]() {
+        crossings.clear();
+
+        const clock::time_point start = clock::now();
+        tracker.update(fix, [&crossings](uint32_t fence, bool entered) { crossings.emplace_back(fence, entered); });
+        latency_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+
+        for (const auto &[fence, entered] : crossings) {
+            _print_crossing(fences, fence, entered, fix, time);
+            (entered ? n_enter : n_exit)++;
+        }
+        if (!crossings.empty()) {
+            fflush(stdout);
+        }
+    };
+
+
+
+    if (track_path) {
+        FILE *track = strcmp(track_path, "-") ? fopen(track_path, "r") : stdin;
+        if (!track) {
+            perror(track_path);
+            return 1;
+        }
+
+        std::vector<double> linear_us;
+        std::vector<uint32_t> linear;
+        size_t n_mismatches = 0;
+        char *buffer = nullptr;
+        size_t capacity = 0;
+        ssize_t length;
+
+        while (!g_stop && -1 != (length = getline(&buffer, &capacity, track))) {
+            if (!geofence_parse_fix(std::string_view(buffer, length), fix, time)) {
+                continue;
+            }
+
+            evaluate();
+
+            // The baseline the index has to beat, and must agree with.
+            const clock::time_point start = clock::now();
+            fences.query_linear(fix, linear);
+            linear_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+
+            if (linear != tracker.get_inside()) {
+                n_mismatches++;
+            }
+        }
+
+        free(buffer);
+        if (track != stdin) {
+            fclose(track);
+        }
+
+        fprintf(stderr, "%zu fixes replayed: %zu enter, %zu exit\n", latency_us.size(), n_enter, n_exit);
+        _print_latency("Per fix (grid)", latency_us);
+        _print_latency("Per fix (linear scan)", linear_us);
+        if (n_mismatches) {
+            fprintf(stderr, "Grid and linear scan disagreed on %zu fixes\n", n_mismatches);
+            return 1;
+        }
+        return 0;
+    }
+
+
+
+    struct gps_data_t gps_data;
+
+    if (int r = gps_open(SERVER_NAME, SERVER_PORT, &gps_data)) {
+        const char *str = gps_errstr(r);
+        fprintf(stderr, "%s\n", str ? str : "Open error");
+        return 1;
+    }
+
+    (void)gps_stream(&gps_data, WATCH_ENABLE | WATCH_JSON, NULL);
+
+    while (!g_stop && gps_waiting(&gps_data, 5000000)) {
+        if (-1 == gps_read(&gps_data, NULL, 0)) {
+            fprintf(stderr, "Read error\n");
+            break;
+        }
+
+        if (!(gps_data.set & LATLON_SET) || gps_data.fix.mode < MODE_2D
+         || !isfinite(gps_data.fix.latitude) || !isfinite(gps_data.fix.longitude)) {
+            continue;
+        }
+
+        fix = {gps_data.fix.latitude, gps_data.fix.longitude};
+        time.clear();
+        if (TIME_SET == (TIME_SET & gps_data.set)) {
+            char buffer [32];
+            struct tm tm;
+            gmtime_r(&gps_data.fix.time.tv_sec, &tm);
+            const size_t n = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+            snprintf(buffer + n, sizeof(buffer) - n, ".%03ldZ", gps_data.fix.time.tv_nsec / 1000000);
+            time.assign(buffer);
+        }
+
+        evaluate();
+    }
+
+    (void)gps_stream(&gps_data, WATCH_DISABLE, NULL);
+    (void)gps_close(&gps_data);
+
+    fprintf(stderr, "%zu fixes: %zu enter, %zu exit\n", latency_us.size(), n_enter, n_exit);
+    _print_latency("Per fix", latency_us);
+    return 0;
+}
+
+
+
 
 
 
 int main (int argc, char *argv[]) {
+    // --publish [name] | --subscribe [name] | --fences <file> [--replay <track>]
+    if (argc >= 2) {
+        const char *ring_name = argc >= 3 ? argv[2] : GPS_RING_DEFAULT_NAME;
+
+        if (0 == strcmp(argv[1], "--publish")) {
+            return publish_main(ring_name);
+        }
+        if (0 == strcmp(argv[1], "--subscribe")) {
+            return subscribe_main(ring_name);
+        }
+        if (0 == strcmp(argv[1], "--fences") && (argc == 3 || (argc == 5 && 0 == strcmp(argv[3], "--replay")))) {
+            return fences_main(argv[2], argc == 5 ? argv[4] : nullptr);
+        }
+
+        fprintf(stderr, "Usage: %s [--publish [name] | --subscribe [name] | --fences <file> [--replay <track|->]]\n", argv[0]);
+        return 1;
+    }
+
     return kickstartembedded_main();
     return gpsd_main();
 }
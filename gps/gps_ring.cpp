@@ -0,0 +1,276 @@
+#ifndef _WIN32
+
+#include "gps_ring.h"
+#include "../source_exception/source_exception.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static constexpr uint32_t GPS_RING_MAGIC    = 0x72737067;   // "gpsr"
+static constexpr uint32_t GPS_RING_VERSION  = 2;
+
+
+
+// Not FUTEX_PRIVATE: the word lives in memory shared between processes.
+static void _futex_wake_all (std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static void _futex_wait (const std::atomic<uint32_t> *word, uint32_t expected, int timeout_ms)
+{
+    timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, reinterpret_cast<const uint32_t*>(word), FUTEX_WAIT, expected, timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+}
+
+
+// Whether the ring's writer is still running. A ring from another
+// version, or one that was never filled in, has no writer to wait for.
+static bool _writer_alive (const char *name)
+{
+    const int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+        return false;
+    }
+
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size >= static_cast<off_t>(sizeof(gps_ring_header)))
+    {
+        mem = mmap(nullptr, sizeof(gps_ring_header), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (MAP_FAILED == mem)
+    {
+        return false;
+    }
+
+    const gps_ring_header *header = static_cast<const gps_ring_header*>(mem);
+    const bool ours = GPS_RING_MAGIC == header->magic && GPS_RING_VERSION == header->version;
+    const pid_t pid = header->writer_pid;
+    munmap(mem, sizeof(gps_ring_header));
+
+    return ours && pid > 0 && !(-1 == kill(pid, 0) && ESRCH == errno);
+}
+
+
+
+gps_ring_writer::gps_ring_writer (const char *name, size_t n_slots, size_t slot_size)
+    : m_name (name)
+{
+    if (n_slots == 0 || slot_size <= sizeof(gps_ring_slot) || slot_size % alignof(gps_ring_slot))
+    {
+        throw source_exception("Invalid ring geometry");
+    }
+
+    m_size = sizeof(gps_ring_header) + n_slots * slot_size;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (-1 == fd && EEXIST == errno)
+    {
+        if (_writer_alive(name))
+        {
+            throw source_exception("The ring is in use by another publisher");
+        }
+
+        // Left behind by a writer that died.
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if (-1 == fd)
+    {
+        perror("shm_open");
+        throw source_exception("Failed to create ring");
+    }
+
+    void *mem = MAP_FAILED;
+    if (0 == ftruncate(fd, m_size))
+    {
+        mem = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (MAP_FAILED == mem)
+    {
+        perror("mmap");
+        shm_unlink(name);
+        throw source_exception("Failed to map ring");
+    }
+
+    // Zero-filled: head, futex, closed and every slot's seq start at 0.
+    m_header = static_cast<gps_ring_header*>(mem);
+    m_header->version   = GPS_RING_VERSION;
+    m_header->n_slots   = static_cast<uint32_t>(n_slots);
+    m_header->slot_size = static_cast<uint32_t>(slot_size);
+    m_header->writer_pid = getpid();
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic     = GPS_RING_MAGIC;
+}
+
+gps_ring_writer::~gps_ring_writer (void)
+{
+    m_header->closed.store(1, std::memory_order_release);
+    m_header->futex.fetch_add(1, std::memory_order_release);
+    _futex_wake_all(&m_header->futex);
+
+    munmap(m_header, m_size);
+    shm_unlink(m_name.c_str());
+}
+
+gps_ring_slot* gps_ring_writer::slot (uint64_t seq)
+{
+    char *base = reinterpret_cast<char*>(m_header + 1);
+    return reinterpret_cast<gps_ring_slot*>(base + (seq % m_header->n_slots) * m_header->slot_size);
+}
+
+bool gps_ring_writer::publish (std::string_view report)
+{
+    if (report.size() > m_header->slot_size - sizeof(gps_ring_slot))
+    {
+        return false;
+    }
+
+    const uint64_t seq = m_header->head.load(std::memory_order_relaxed);
+    gps_ring_slot *s = this->slot(seq);
+
+    // Readers still looking at the old report in this slot will see seq change.
+    s->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(s->data, report.data(), report.size());
+    s->length = static_cast<uint32_t>(report.size());
+
+    s->seq.store(seq + 1, std::memory_order_release);
+    m_header->head.store(seq + 1, std::memory_order_release);
+
+    // One wake-up for all readers, however many there are.
+    m_header->futex.fetch_add(1, std::memory_order_release);
+    _futex_wake_all(&m_header->futex);
+
+    return true;
+}
+
+
+
+gps_ring_reader::gps_ring_reader (const char *name)
+{
+    const int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+        throw source_exception("No ring found, is the publisher running?");
+    }
+
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size >= static_cast<off_t>(sizeof(gps_ring_header)))
+    {
+        mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (MAP_FAILED == mem)
+    {
+        throw source_exception("Failed to map ring");
+    }
+
+    m_header = static_cast<const gps_ring_header*>(mem);
+    m_size = st.st_size;
+
+    if (GPS_RING_MAGIC != m_header->magic || GPS_RING_VERSION != m_header->version
+        || m_size < sizeof(gps_ring_header) + static_cast<size_t>(m_header->n_slots) * m_header->slot_size)
+    {
+        munmap(const_cast<gps_ring_header*>(m_header), m_size);
+        throw source_exception("Not a gps ring, or another version");
+    }
+
+    m_next = m_header->head.load(std::memory_order_acquire);
+}
+
+gps_ring_reader::~gps_ring_reader (void)
+{
+    munmap(const_cast<gps_ring_header*>(m_header), m_size);
+}
+
+const gps_ring_slot* gps_ring_reader::slot (uint64_t seq) const
+{
+    const char *base = reinterpret_cast<const char*>(m_header + 1);
+    return reinterpret_cast<const gps_ring_slot*>(base + (seq % m_header->n_slots) * m_header->slot_size);
+}
+
+bool gps_ring_reader::next (std::string_view &report_dest)
+{
+    while (1)
+    {
+        const uint64_t head = m_header->head.load(std::memory_order_acquire);
+        if (m_next >= head)
+        {
+            return false;
+        }
+
+        // Lapped: the oldest reports are being overwritten, skip to what is still there.
+        if (head - m_next >= m_header->n_slots)
+        {
+            const uint64_t oldest = head - m_header->n_slots + 1;
+            m_dropped += oldest - m_next;
+            m_next = oldest;
+        }
+
+        const gps_ring_slot *s = this->slot(m_next);
+        const uint64_t seq = s->seq.load(std::memory_order_acquire);
+
+        if (seq != m_next + 1)
+        {
+            // Overwritten since head was read.
+            m_dropped++;
+            m_next++;
+            continue;
+        }
+
+        m_current = s;
+        m_current_seq = seq;
+        m_next++;
+
+        report_dest = std::string_view(s->data, std::min<size_t>(s->length, m_header->slot_size - sizeof(gps_ring_slot)));
+        return true;
+    }
+}
+
+bool gps_ring_reader::valid (void)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_current && m_current->seq.load(std::memory_order_relaxed) == m_current_seq)
+    {
+        return true;
+    }
+
+    m_dropped++;
+    return false;
+}
+
+bool gps_ring_reader::wait (int timeout_ms)
+{
+    const uint32_t futex = m_header->futex.load(std::memory_order_acquire);
+
+    if (m_next < m_header->head.load(std::memory_order_acquire) || this->is_closed())
+    {
+        return true;
+    }
+
+    _futex_wait(&m_header->futex, futex, timeout_ms);
+    return m_next < m_header->head.load(std::memory_order_acquire) || this->is_closed();
+}
+
+#endif
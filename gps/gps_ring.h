@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+static constexpr const char *GPS_RING_DEFAULT_NAME = "/gps.ring";
+
+static constexpr size_t GPS_RING_SLOTS      = 256;
+
+// SKY reports with many satellites run past 2 KiB.
+static constexpr size_t GPS_RING_SLOT_SIZE  = 4096;
+
+
+
+
+// A single-writer, many-reader ring of gpsd reports in shared memory.
+//
+// The writer copies each report into the ring once and wakes all waiting
+// readers with a single futex call, so its cost does not depend on the
+// number of readers. Readers look at the reports in place and never write
+// to the ring, so a slow reader cannot hold up the writer or other readers:
+// once lapped, it skips ahead and counts what it missed.
+struct gps_ring_header
+{
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                n_slots;
+    uint32_t                slot_size;
+    int32_t                 writer_pid;     // replaced only once this process is gone
+    std::atomic<uint64_t>   head;           // sequence number of the next report
+    std::atomic<uint32_t>   futex;          // bumped on every report
+    std::atomic<uint32_t>   closed;         // the writer went away
+};
+
+struct gps_ring_slot
+{
+    std::atomic<uint64_t>   seq;            // report sequence + 1; 0 while being written
+    uint32_t                length;
+    char                    data [];
+};
+
+
+
+class gps_ring_writer
+{
+public:
+    // Throws if another live writer owns the ring; one left behind by a
+    // writer that died is replaced.
+    explicit gps_ring_writer (const char *name = GPS_RING_DEFAULT_NAME, size_t n_slots = GPS_RING_SLOTS, size_t slot_size = GPS_RING_SLOT_SIZE);
+    ~gps_ring_writer (void);
+
+    gps_ring_writer (const gps_ring_writer&) = delete;
+    gps_ring_writer& operator= (const gps_ring_writer&) = delete;
+
+    // false: report too large for a slot, dropped.
+    bool publish (std::string_view report);
+
+    uint64_t get_published (void) const
+    {
+        return m_header->head.load(std::memory_order_relaxed);
+    }
+
+private:
+    gps_ring_slot* slot (uint64_t seq);
+
+    std::string         m_name;
+    gps_ring_header    *m_header;
+    size_t              m_size;
+};
+
+
+
+class gps_ring_reader
+{
+public:
+    // Starts at the newest report; throws if there is no ring.
+    explicit gps_ring_reader (const char *name = GPS_RING_DEFAULT_NAME);
+    ~gps_ring_reader (void);
+
+    gps_ring_reader (const gps_ring_reader&) = delete;
+    gps_ring_reader& operator= (const gps_ring_reader&) = delete;
+
+    // The next report, pointing into the ring. false: none available yet.
+    bool next (std::string_view &report_dest);
+
+    // Whether the report last returned by next() was left intact. Check it
+    // after using the view: the writer may have lapped this reader meanwhile.
+    bool valid (void);
+
+    // Waits up to timeout_ms for a report. false: timed out.
+    bool wait (int timeout_ms);
+
+    // The writer has closed the ring; reopen to follow a new one.
+    bool is_closed (void) const
+    {
+        return m_header->closed.load(std::memory_order_acquire);
+    }
+
+    // Reports skipped because this reader was lapped.
+    uint64_t get_dropped (void) const
+    {
+        return m_dropped;
+    }
+
+private:
+    const gps_ring_slot* slot (uint64_t seq) const;
+
+    const gps_ring_header  *m_header;
+    size_t                  m_size;
+    uint64_t                m_next;
+    const gps_ring_slot    *m_current       = nullptr;
+    uint64_t                m_current_seq   = 0;
+    uint64_t                m_dropped       = 0;
+};
@@ -6,6 +6,11 @@
     using ssize_t = long;
 #endif
 
+// Build with -DSERIAL_LOG=1 to trace opening and closing devices.
+#ifndef SERIAL_LOG
+    #define SERIAL_LOG 0
+#endif
+
 
 
 template<typename HANDLE_T, HANDLE_T _INVALID_HANDLE>
@@ -112,14 +117,19 @@ private:
 
     template<typename... Args>
     static void log (const char (&fmt)[], Args&& ...args) {
-        printf("[serial] ");
-        printf(fmt, args...);
-        printf("\n");
+        if constexpr (SERIAL_LOG) {
+            printf("[serial] ");
+            printf(fmt, args...);
+            printf("\n");
+        }
     }
 
     static void log (const char (&msg)[])
     {
-        printf("[serial] %s\n", msg);
+        if constexpr (SERIAL_LOG)
+        {
+            printf("[serial] %s\n", msg);
+        }
     }
 
     HANDLE_T m_handle;
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "serial_device_type.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+
+
+// An in-memory serial device. Bytes queued with feed() are returned by
+// read(). If a responder is set, it is called with every command line
+// written (up to and excluding "\r", or Ctrl-Z for prompt payloads) and
+// whatever it returns is queued for reading, so a scripted modem can
+// answer without a kernel, a pty or any timing involved.
+//
+// wait_for_data() never blocks: with nothing queued it reports a timeout.
+class mock_serial_device
+{
+public:
+    using responder = std::function<std::string (std::string_view line)>;
+
+    constexpr bool is_open (void) const
+    {
+        return true;
+    }
+
+    ssize_t read (void *buffer, size_t size)
+    {
+        const size_t n = std::min(size, m_rx.size() - m_rx_pos);
+
+        memcpy(buffer, m_rx.data() + m_rx_pos, n);
+        m_rx_pos += n;
+
+        if (m_rx_pos == m_rx.size())
+        {
+            m_rx.clear();
+            m_rx_pos = 0;
+        }
+
+        m_n_reads++;
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t write (const void *buffer, size_t size)
+    {
+        const char *data = static_cast<const char*>(buffer);
+
+        m_tx.append(data, size);
+        m_n_writes++;
+
+        if (m_responder)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                if (data[i] == '\r' || data[i] == '\x1a')
+                {
+                    this->feed(m_responder(m_pending));
+                    m_pending.clear();
+                }
+                else
+                {
+                    m_pending.push_back(data[i]);
+                }
+            }
+        }
+
+        return static_cast<ssize_t>(size);
+    }
+
+    int wait_for_data ([[maybe_unused]] size_t timeout_ms)
+    {
+        return m_rx_pos < m_rx.size() ? 1 : 0;
+    }
+
+
+
+    void feed (std::string_view bytes)
+    {
+        m_rx.append(bytes);
+    }
+
+    void set_responder (responder r)
+    {
+        m_responder = std::move(r);
+    }
+
+    // Everything written so far.
+    const std::string& written (void) const
+    {
+        return m_tx;
+    }
+
+    void clear_written (void)
+    {
+        m_tx.clear();
+    }
+
+    size_t get_read_count (void) const
+    {
+        return m_n_reads;
+    }
+
+    size_t get_write_count (void) const
+    {
+        return m_n_writes;
+    }
+
+private:
+    std::string m_rx;
+    size_t      m_rx_pos    = 0;
+    std::string m_tx;
+    std::string m_pending;
+    responder   m_responder;
+    size_t      m_n_reads   = 0;
+    size_t      m_n_writes  = 0;
+};
+
+static_assert(serial_device_type<mock_serial_device>);
@@ -4,7 +4,11 @@
 
 #include <fcntl.h>
 #ifndef _WIN32
+    #include <cerrno>
+    #include <cstdio>
+    #include <termios.h>
     #include <unistd.h>
+    #include <sys/stat.h>
 #endif
 
 
@@ -55,6 +59,12 @@ void windows_perror (const char *funcname)
 
 
 #ifdef _WIN32
+// Close here rather than in the base destructor, where close_handle() is no longer ours to call.
+win32_serial_device::~win32_serial_device (void)
+{
+    this->close();
+}
+
 ssize_t win32_serial_device::read (void *buffer, size_t size)
 {
     DBG("Reading (requesting %lu bytes)...\n", size);
@@ -137,6 +147,35 @@ bool win32_serial_device::close_handle (HANDLE handle)
     return CloseHandle(handle);
 }
 
+bool win32_serial_device::set_baud_rate (unsigned int rate)
+{
+    DCB dcb = {};
+    dcb.DCBlength = sizeof(dcb);
+
+    if (!GetCommState(this->get_handle(), &dcb))
+    {
+        windows_perror("GetCommState");
+        return false;
+    }
+
+    dcb.BaudRate = rate;
+    if (!SetCommState(this->get_handle(), &dcb))
+    {
+        windows_perror("SetCommState");
+        return false;
+    }
+
+    PurgeComm(this->get_handle(), PURGE_RXCLEAR);
+    return true;
+}
+
+unsigned int win32_serial_device::get_baud_rate (void)
+{
+    DCB dcb = {};
+    dcb.DCBlength = sizeof(dcb);
+    return GetCommState(this->get_handle(), &dcb) ? dcb.BaudRate : 0;
+}
+
 int win32_serial_device::wait_for_data (size_t timeout_ms)
 {
     return 1;
@@ -163,6 +202,12 @@ int win32_serial_device::wait_for_data (size_t timeout_ms)
     return status;
 }
 #else
+// Close here rather than in the base destructor, where close_handle() is no longer ours to call.
+posix_serial_device::~posix_serial_device (void)
+{
+    this->close();
+}
+
 ssize_t posix_serial_device::read (void *buffer, size_t size)
 {
     const ssize_t status = ::read(this->get_handle(), buffer, size);
@@ -190,24 +235,126 @@ int posix_serial_device::open_handle (const char *device)
         throw source_exception("invalid argument");
     }
 
-    const std::filesystem::path path(device);
-
-    if (!std::filesystem::exists(path))
+    // One open, then check what was opened: no stat() beforehand to race
+    // with. Not our controlling terminal, not inherited by children.
+    const int fd = ::open(device, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (-1 == fd)
     {
-        throw source_exception("does not exist");
+        if (ENOENT == errno)
+        {
+            throw source_exception("does not exist");
+        }
+
+        perror("open");
+        return INVALID_HANDLE;
     }
 
-    if (!std::filesystem::is_character_file(path))
+    struct stat st;
+    if (-1 == fstat(fd, &st) || !S_ISCHR(st.st_mode))
     {
+        ::close(fd);
         throw source_exception("not a serial device");
     }
 
-    return ::open(device, O_RDWR);
+    return fd;
 }
 
 bool posix_serial_device::close_handle (int fd)
 {
-    return ::close(fd);
+    return 0 == ::close(fd);
+}
+
+bool posix_serial_device::configure (void)
+{
+    termios tio;
+    if (-1 == tcgetattr(this->get_handle(), &tio))
+    {
+        // Not a tty (e.g. a FIFO in a test): nothing to set.
+        return true;
+    }
+
+    // No echo, no line editing, no CR/LF translation, 8N1. Hardware flow
+    // control is left as it was set up (stty crtscts).
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if (-1 == tcsetattr(this->get_handle(), TCSANOW, &tio))
+    {
+        perror("tcsetattr");
+        return false;
+    }
+
+    return true;
+}
+
+
+
+static constexpr struct
+{
+    unsigned int    rate;
+    speed_t         speed;
+} BAUD_RATES [] = {
+    {1200,    B1200},    {2400,    B2400},    {4800,    B4800},    {9600,    B9600},
+    {19200,   B19200},   {38400,   B38400},   {57600,   B57600},   {115200,  B115200},
+    {230400,  B230400},  {460800,  B460800},  {500000,  B500000},  {576000,  B576000},
+    {921600,  B921600},  {1000000, B1000000}, {1152000, B1152000}, {1500000, B1500000},
+    {2000000, B2000000}, {2500000, B2500000}, {3000000, B3000000}, {3500000, B3500000},
+    {4000000, B4000000},
+};
+
+bool posix_serial_device::set_baud_rate (unsigned int rate)
+{
+    for (const auto &entry : BAUD_RATES)
+    {
+        if (entry.rate != rate)
+        {
+            continue;
+        }
+
+        termios tio;
+        if (-1 == tcgetattr(this->get_handle(), &tio))
+        {
+            perror("tcgetattr");
+            return false;
+        }
+
+        cfsetispeed(&tio, entry.speed);
+        cfsetospeed(&tio, entry.speed);
+
+        // Lets queued output go out at the old rate first.
+        if (-1 == tcsetattr(this->get_handle(), TCSADRAIN, &tio))
+        {
+            perror("tcsetattr");
+            return false;
+        }
+
+        tcflush(this->get_handle(), TCIFLUSH);
+        return true;
+    }
+
+    return false;
+}
+
+unsigned int posix_serial_device::get_baud_rate (void)
+{
+    termios tio;
+    if (-1 == tcgetattr(this->get_handle(), &tio))
+    {
+        return 0;
+    }
+
+    const speed_t speed = cfgetospeed(&tio);
+    for (const auto &entry : BAUD_RATES)
+    {
+        if (entry.speed == speed)
+        {
+            return entry.rate;
+        }
+    }
+
+    return 0;
 }
 
 int posix_serial_device::wait_for_data (size_t timeout_ms)
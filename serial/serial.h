@@ -1,6 +1,7 @@
 #pragma once
 
 #include "basic_serial_device.h"
+#include "serial_device_type.h"
 
 #ifdef _WIN32
     #define NOMINMAX
@@ -10,28 +11,48 @@
 
 
 #ifdef _WIN32
-class win32_serial_device : public basic_serial_device<HANDLE, INVALID_HANDLE_VALUE>
+class win32_serial_device final : public basic_serial_device<HANDLE, INVALID_HANDLE_VALUE>
 {
 public:
+    ~win32_serial_device (void) override;
+
     ssize_t read (void *buffer, size_t size) override;
     ssize_t write (const void *buffer, size_t size) override;
     int wait_for_data (size_t timeout_ms) override;
 
+    // See posix_serial_device.
+    bool set_baud_rate (unsigned int rate);
+    unsigned int get_baud_rate (void);
+
 private:
     HANDLE open_handle (const char *device) override;
     bool close_handle (HANDLE handle) override;
 };
 #else
-class posix_serial_device : public basic_serial_device<int, -1>
+class posix_serial_device final : public basic_serial_device<int, -1>
 {
 public:
+    ~posix_serial_device (void) override;
+
     ssize_t read (void *buffer, size_t size) override;
     ssize_t write (const void *buffer, size_t size) override;
     int wait_for_data (size_t timeout_ms) override;
 
+    // Sets both directions and drops input received at the old rate. false
+    // if rate is not one of the standard ones (up to 4000000) or the
+    // driver refuses it; ptys and USB CDC ports accept any and ignore it.
+    bool set_baud_rate (unsigned int rate);
+
+    // 0 if unknown, e.g. not a tty.
+    unsigned int get_baud_rate (void);
+
 private:
     int open_handle (const char *device) override;
     bool close_handle (int handle) override;
+
+    // Raw mode, 8N1, non-blocking reads; keeps the rate, hardware flow
+    // control left as configured.
+    bool configure (void) override;
 };
 #endif
 
@@ -43,3 +64,5 @@ void windows_perror (const char *funcname);
 #else
 using serial_device = posix_serial_device;
 #endif
+
+static_assert(serial_device_type<serial_device>);
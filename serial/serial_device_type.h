@@ -0,0 +1,31 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+
+#ifdef _WIN32
+    using ssize_t = long;
+#else
+    #include <sys/types.h>
+#endif
+
+
+
+// What code driving a serial device needs from it. Templating on this
+// instead of going through basic_serial_device's virtuals lets the
+// compiler call (and inline) the I/O functions directly, and lets tests
+// substitute an in-memory device (see mock_serial_device.h).
+template<typename T>
+concept serial_device_type = requires (T &device, void *read_buffer, const void *write_buffer, size_t size, size_t timeout_ms)
+{
+    // <0: error, >=0: # bytes read
+    { device.read(read_buffer, size) }      -> std::convertible_to<ssize_t>;
+
+    // <0: error, >=0: # bytes written
+    { device.write(write_buffer, size) }    -> std::convertible_to<ssize_t>;
+
+    // <0: error, 0: timeout, >0: data available
+    { device.wait_for_data(timeout_ms) }    -> std::convertible_to<int>;
+
+    { device.is_open() }                    -> std::convertible_to<bool>;
+};
@@ -0,0 +1,490 @@
+#include "serial_io_ring.h"
+#include "../source_exception/source_exception.h"
+#include "../common.h"
+
+#ifndef _WIN32
+    #include <algorithm>
+    #include <cerrno>
+    #include <csignal>
+    #include <cstdio>
+    #include <cstring>
+    #include <atomic>
+    #include <unistd.h>
+    #include <sys/epoll.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <linux/io_uring.h>
+#endif
+
+
+
+#ifndef _WIN32
+// user_data of a submission: device index, and whether it is a write.
+static constexpr uint64_t _user_data (size_t index, bool is_write)
+{
+    return (static_cast<uint64_t>(index) << 1) | (is_write ? 1 : 0);
+}
+
+static uint32_t _load_acquire (const uint32_t *p)
+{
+    return std::atomic_ref<const uint32_t>(*p).load(std::memory_order_acquire);
+}
+
+static void _store_release (uint32_t *p, uint32_t value)
+{
+    std::atomic_ref<uint32_t>(*p).store(value, std::memory_order_release);
+}
+
+
+
+serial_io_ring::serial_io_ring (size_t max_devices, serial_io_backend preferred)
+    : m_buffers (max_devices * BUFFER_SIZE)
+    , m_max_devices (max_devices)
+{
+    m_devices.reserve(max_devices);
+
+    if (preferred == serial_io_backend::io_uring && this->setup_uring(max_devices))
+    {
+        m_backend = serial_io_backend::io_uring;
+        return;
+    }
+
+    m_backend = serial_io_backend::epoll;
+    m_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == m_fd)
+    {
+        perror("epoll_create1");
+        throw source_exception("Failed to create epoll instance");
+    }
+}
+
+serial_io_ring::~serial_io_ring (void)
+{
+    this->close_uring();
+}
+
+// Also closes an epoll instance. Closing an io_uring cancels the reads still outstanding.
+void serial_io_ring::close_uring (void)
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    if (m_sqes)
+    {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring && m_cq_ring != m_sq_ring)
+    {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if (m_sq_ring)
+    {
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+
+    m_sq_ring = m_cq_ring = m_sqes = nullptr;
+}
+
+bool serial_io_ring::setup_uring (size_t max_devices)
+{
+    // A read per device, a write per device, and some slack.
+    unsigned int entries = 8;
+    while (entries < 2 * max_devices + 8)
+    {
+        entries *= 2;
+    }
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (-1 == m_fd)
+    {
+        DBG("io_uring unavailable (%s), using epoll\n", strerror(errno));
+        return false;
+    }
+
+    // Timeouts on io_uring_enter() arrived in 5.11.
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        DBG("io_uring too old, using epoll\n");
+        this->close_uring();
+        return false;
+    }
+
+    m_current_pos = params.features & IORING_FEAT_RW_CUR_POS;
+
+
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED != m_sq_ring)
+    {
+        m_cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? m_sq_ring
+            : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        m_sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    }
+
+    if (MAP_FAILED == m_sq_ring || MAP_FAILED == m_cq_ring || MAP_FAILED == m_sqes)
+    {
+        perror("mmap");
+        m_sq_ring = MAP_FAILED == m_sq_ring ? nullptr : m_sq_ring;
+        m_cq_ring = MAP_FAILED == m_cq_ring ? nullptr : m_cq_ring;
+        m_sqes = MAP_FAILED == m_sqes ? nullptr : m_sqes;
+        this->close_uring();
+        return false;
+    }
+
+    char *sq = static_cast<char*>(m_sq_ring);
+    m_sq_head   = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    m_sq_tail   = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    m_sq_mask   = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    m_sq_array  = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+
+    char *cq = static_cast<char*>(m_cq_ring);
+    m_cq_head   = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    m_cq_tail   = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    m_cq_mask   = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    m_cqes      = cq + params.cq_off.cqes;
+
+
+
+    // Registered buffers spare the kernel mapping them on every read; without
+    // them (RLIMIT_MEMLOCK on older kernels) plain reads do the same job.
+    std::vector<iovec> iovecs(max_devices);
+    for (size_t i = 0; i < max_devices; i++)
+    {
+        iovecs[i] = {m_buffers.data() + i * BUFFER_SIZE, BUFFER_SIZE};
+    }
+
+    m_fixed_buffers = 0 == syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size());
+    DBG("io_uring with %u entries, %s buffers\n", m_sq_entries, m_fixed_buffers ? "registered" : "plain");
+
+    return true;
+}
+
+
+
+size_t serial_io_ring::add (int fd)
+{
+    if (m_devices.size() >= m_max_devices)
+    {
+        throw source_exception("Too many devices");
+    }
+
+    const size_t index = m_devices.size();
+    m_devices.emplace_back().fd = fd;
+
+    if (m_backend == serial_io_backend::io_uring)
+    {
+        this->arm_read(index);
+    }
+    else
+    {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = index;
+
+        m_n_syscalls++;
+        if (-1 == epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev))
+        {
+            perror("epoll_ctl");
+            throw source_exception("Failed to watch device");
+        }
+    }
+
+    return index;
+}
+
+void serial_io_ring::remove (size_t index)
+{
+    device &dev = m_devices[index];
+    if (-1 == dev.fd)
+    {
+        return;
+    }
+
+    if (m_backend == serial_io_backend::epoll)
+    {
+        m_n_syscalls++;
+        epoll_ctl(m_fd, EPOLL_CTL_DEL, dev.fd, nullptr);
+    }
+
+    // A read still in flight completes into a device that is no longer looked at.
+    dev.fd = -1;
+    dev.pending.clear();
+}
+
+void serial_io_ring::write (size_t index, const void *data, size_t size)
+{
+    device &dev = m_devices[index];
+    if (-1 == dev.fd)
+    {
+        return;
+    }
+
+    if (m_backend == serial_io_backend::io_uring)
+    {
+        dev.pending.append(static_cast<const char*>(data), size);
+        this->submit_write(index);
+        return;
+    }
+
+    const char *p = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        m_n_syscalls++;
+        const ssize_t n_written = ::write(dev.fd, p, size);
+        if (n_written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            perror("write");
+            throw source_exception("Failed to write to device");
+        }
+
+        p += n_written;
+        size -= n_written;
+    }
+}
+
+size_t serial_io_ring::wait (int timeout_ms, std::vector<serial_io_event> &events_dest)
+{
+    return m_backend == serial_io_backend::io_uring
+        ? this->wait_uring(timeout_ms, events_dest)
+        : this->wait_epoll(timeout_ms, events_dest);
+}
+
+
+
+void* serial_io_ring::next_sqe (void)
+{
+    const uint32_t tail = *m_sq_tail;
+
+    // Full: hand the queue to the kernel before adding more.
+    if (tail - _load_acquire(m_sq_head) >= m_sq_entries)
+    {
+        this->enter(m_to_submit, 0, -1);
+    }
+
+    const uint32_t index = tail & *m_sq_mask;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+
+    return sqe;
+}
+
+void serial_io_ring::commit_sqe (void)
+{
+    _store_release(m_sq_tail, *m_sq_tail + 1);
+    m_to_submit++;
+}
+
+int serial_io_ring::enter (unsigned int to_submit, unsigned int min_complete, int timeout_ms)
+{
+    __kernel_timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL};
+
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = timeout_ms < 0 ? 0 : reinterpret_cast<uint64_t>(&ts);
+
+    unsigned int flags = IORING_ENTER_EXT_ARG;
+    if (min_complete)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    m_n_syscalls++;
+    const int rv = syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+
+    // Whatever the outcome, what the kernel took off the queue is submitted.
+    m_to_submit = *m_sq_tail - _load_acquire(m_sq_head);
+
+    if (-1 == rv && ETIME != errno && EINTR != errno && EBUSY != errno)
+    {
+        perror("io_uring_enter");
+        throw source_exception("Failed to submit I/O");
+    }
+
+    return rv;
+}
+
+void serial_io_ring::arm_read (size_t index)
+{
+    device &dev = m_devices[index];
+
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(this->next_sqe());
+    sqe->opcode     = m_fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd         = dev.fd;
+    sqe->addr       = reinterpret_cast<uint64_t>(m_buffers.data() + index * BUFFER_SIZE);
+    sqe->len        = BUFFER_SIZE;
+    sqe->off        = m_current_pos ? static_cast<uint64_t>(-1) : 0;
+    sqe->buf_index  = static_cast<uint16_t>(index);
+    sqe->user_data  = _user_data(index, false);
+    this->commit_sqe();
+
+    dev.read_armed = true;
+}
+
+void serial_io_ring::submit_write (size_t index)
+{
+    device &dev = m_devices[index];
+
+    // One write in flight per device keeps the bytes in order.
+    if (!dev.writing.empty() || dev.pending.empty())
+    {
+        return;
+    }
+
+    dev.writing.swap(dev.pending);
+
+    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(this->next_sqe());
+    sqe->opcode     = IORING_OP_WRITE;
+    sqe->fd         = dev.fd;
+    sqe->addr       = reinterpret_cast<uint64_t>(dev.writing.data());
+    sqe->len        = static_cast<uint32_t>(dev.writing.size());
+    sqe->off        = m_current_pos ? static_cast<uint64_t>(-1) : 0;
+    sqe->user_data  = _user_data(index, true);
+    this->commit_sqe();
+}
+
+size_t serial_io_ring::wait_uring (int timeout_ms, std::vector<serial_io_event> &events_dest)
+{
+    // The buffers handed out by the last wait() are free again.
+    for (size_t i = 0; i < m_devices.size(); i++)
+    {
+        if (m_devices[i].fd >= 0 && !m_devices[i].read_armed)
+        {
+            this->arm_read(i);
+        }
+    }
+
+    // Submits every queued read and write and waits, in one system call.
+    if (*m_cq_head == _load_acquire(m_cq_tail))
+    {
+        this->enter(m_to_submit, 1, timeout_ms);
+    }
+    else if (m_to_submit)
+    {
+        this->enter(m_to_submit, 0, -1);
+    }
+
+
+
+    const size_t n_before = events_dest.size();
+    uint32_t head = *m_cq_head;
+    const uint32_t tail = _load_acquire(m_cq_tail);
+
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe &cqe = static_cast<const io_uring_cqe*>(m_cqes)[head & *m_cq_mask];
+        const size_t index = cqe.user_data >> 1;
+        device &dev = m_devices[index];
+
+        if (cqe.user_data & 1)
+        {
+            if (cqe.res < 0 || dev.fd < 0)
+            {
+                dev.writing.clear();
+                if (dev.fd >= 0)
+                {
+                    events_dest.push_back({index, nullptr, cqe.res});
+                }
+                continue;
+            }
+
+            // Short write: the rest goes ahead of anything queued since.
+            dev.writing.erase(0, cqe.res);
+            dev.pending.insert(0, dev.writing);
+            dev.writing.clear();
+            this->submit_write(index);
+        }
+        else
+        {
+            dev.read_armed = false;
+            if (dev.fd >= 0)
+            {
+                events_dest.push_back({index, m_buffers.data() + index * BUFFER_SIZE, cqe.res});
+            }
+        }
+    }
+
+    _store_release(m_cq_head, head);
+    return events_dest.size() - n_before;
+}
+
+
+
+size_t serial_io_ring::wait_epoll (int timeout_ms, std::vector<serial_io_event> &events_dest)
+{
+    epoll_event events [64];
+
+    m_n_syscalls++;
+    const int n = epoll_wait(m_fd, events, std::min<size_t>(64, std::max<size_t>(1, m_devices.size())), timeout_ms);
+    if (-1 == n)
+    {
+        if (EINTR == errno)
+        {
+            return 0;
+        }
+        perror("epoll_wait");
+        throw source_exception("Failed to wait for data");
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const size_t index = events[i].data.u64;
+        char *buffer = m_buffers.data() + index * BUFFER_SIZE;
+
+        m_n_syscalls++;
+        const ssize_t n_read = ::read(m_devices[index].fd, buffer, BUFFER_SIZE);
+        events_dest.push_back({index, buffer, n_read < 0 ? -errno : n_read});
+    }
+
+    return n;
+}
+#else
+serial_io_ring::serial_io_ring (size_t max_devices, serial_io_backend preferred)
+{
+    throw source_exception("Not supported on Windows");
+}
+
+serial_io_ring::~serial_io_ring (void)
+{}
+
+void serial_io_ring::close_uring (void)
+{}
+
+size_t serial_io_ring::add (int fd)
+{
+    return 0;
+}
+
+void serial_io_ring::remove (size_t index)
+{}
+
+void serial_io_ring::write (size_t index, const void *data, size_t size)
+{}
+
+size_t serial_io_ring::wait (int timeout_ms, std::vector<serial_io_event> &events_dest)
+{
+    return 0;
+}
+#endif
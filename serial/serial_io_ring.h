@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+    using ssize_t = long;
+#endif
+
+
+
+enum class serial_io_backend
+{
+    io_uring,
+    epoll,
+};
+
+// Data read from one device, or an error (size < 0). data points into the
+// ring's own buffer and stays valid until the next wait().
+struct serial_io_event
+{
+    size_t          index;
+    const char     *data;
+    ssize_t         size;
+};
+
+
+
+// Reads from many serial devices at once and batches their writes.
+//
+// With io_uring every device has a read outstanding on a registered buffer
+// and writes are queued as submissions, so a single io_uring_enter() both
+// sends all pending commands and collects all responses that arrived. Where
+// io_uring is unavailable (old kernels, seccomp filters) an epoll loop with
+// plain read()/write() takes its place.
+class serial_io_ring
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 1024;
+
+    explicit serial_io_ring (size_t max_devices, serial_io_backend preferred = serial_io_backend::io_uring);
+    ~serial_io_ring (void);
+
+    serial_io_ring (const serial_io_ring&) = delete;
+    serial_io_ring& operator= (const serial_io_ring&) = delete;
+
+    // Starts reading fd; returns the index its events carry.
+    size_t add (int fd);
+
+    // Stops reading the device, e.g. after it hung up.
+    void remove (size_t index);
+
+    // Queued until the next wait() with io_uring, written at once with epoll.
+    void write (size_t index, const void *data, size_t size);
+
+    // Waits up to timeout_ms for data and appends it to events_dest.
+    // Returns the number of events, 0 on timeout.
+    size_t wait (int timeout_ms, std::vector<serial_io_event> &events_dest);
+
+    serial_io_backend get_backend (void) const
+    {
+        return m_backend;
+    }
+
+    const char* get_backend_name (void) const
+    {
+        return m_backend == serial_io_backend::io_uring ? "io_uring" : "epoll";
+    }
+
+    // System calls made by add(), write() and wait() so far.
+    uint64_t get_syscalls (void) const
+    {
+        return m_n_syscalls;
+    }
+
+private:
+    struct device
+    {
+        int             fd          = -1;
+        std::string     pending;            // written once the write in flight completes
+        std::string     writing;            // in flight (io_uring)
+        bool            read_armed  = false;
+    };
+
+    bool setup_uring (size_t max_devices);
+    void close_uring (void);
+    void arm_read (size_t index);
+    void submit_write (size_t index);
+    size_t wait_uring (int timeout_ms, std::vector<serial_io_event> &events_dest);
+    size_t wait_epoll (int timeout_ms, std::vector<serial_io_event> &events_dest);
+
+    // Next free submission queue entry, flushing the queue if it is full.
+    // commit_sqe() queues it once filled in.
+    void* next_sqe (void);
+    void commit_sqe (void);
+    int enter (unsigned int to_submit, unsigned int min_complete, int timeout_ms);
+
+    serial_io_backend       m_backend;
+    std::vector<device>     m_devices;
+    std::vector<char>       m_buffers;
+    size_t                  m_max_devices;
+    uint64_t                m_n_syscalls    = 0;
+
+    int                     m_fd            = -1;   // io_uring or epoll
+
+    // io_uring rings, mapped from the kernel.
+    void                   *m_sq_ring       = nullptr;
+    size_t                  m_sq_ring_size  = 0;
+    void                   *m_cq_ring       = nullptr;
+    size_t                  m_cq_ring_size  = 0;
+    void                   *m_sqes          = nullptr;
+    size_t                  m_sqes_size     = 0;
+    unsigned int            m_sq_entries    = 0;
+    unsigned int            m_to_submit     = 0;
+    bool                    m_fixed_buffers = false;
+    bool                    m_current_pos   = false;
+
+    // Offsets into the rings, from io_uring_params.
+    uint32_t               *m_sq_head;
+    uint32_t               *m_sq_tail;
+    uint32_t               *m_sq_mask;
+    uint32_t               *m_sq_array;
+    uint32_t               *m_cq_head;
+    uint32_t               *m_cq_tail;
+    uint32_t               *m_cq_mask;
+    void                   *m_cqes;
+};
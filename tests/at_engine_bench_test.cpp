@@ -0,0 +1,122 @@
+#include "test.h"
+#include "test_devices.h"
+#include "../atctl/at_engine.h"
+#include "../serial/mock_serial_device.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+
+// Microbenchmarks of the engine alone: commands one by one, batched
+// without merging, and batched and merged. On mock_serial_device they
+// measure the engine's own cost per command, on paced_modem_device what
+// merging saves in round trips. Results go to stderr.
+
+using bench_clock = std::chrono::steady_clock;
+
+static const std::vector<std::string> STATUS_COMMANDS = {
+    "+CSQ", "+CREG?", "+CGREG?", "+CEREG?", "+CPAS", "+CGATT?", "+COPS?", "+CCLK?",
+};
+
+enum class bench_mode
+{
+    single,
+    batch,
+    merged,
+};
+
+struct bench_result
+{
+    double      seconds;
+    size_t      lines;
+    bool        ok;
+};
+
+template<serial_device_type DEVICE>
+static bench_result _run (DEVICE &device, bench_mode mode, size_t rounds)
+{
+    basic_at_engine<DEVICE> engine(device);
+    engine.set_max_line(mode == bench_mode::merged ? AT_DEFAULT_MAX_LINE : 0);
+
+    std::vector<std::string> lines;
+    std::vector<at_response> responses;
+    bool ok = true;
+
+    const bench_clock::time_point start = bench_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        if (mode == bench_mode::single)
+        {
+            for (const std::string &command : STATUS_COMMANDS)
+            {
+                ok = ok && at_final::ok == engine.transact(command, lines);
+            }
+            continue;
+        }
+
+        engine.transact_batch(STATUS_COMMANDS, responses);
+        for (const at_response &response : responses)
+        {
+            ok = ok && at_final::ok == response.result;
+        }
+    }
+    const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+
+    return {elapsed.count(), engine.get_round_trips(), ok};
+}
+
+static void _report (const char *device, const char *mode, const bench_result &result, size_t rounds)
+{
+    const size_t n = rounds * STATUS_COMMANDS.size();
+    fprintf(stderr, "    %-6s %-7s %9.0f ns/command, %zu command lines for %zu commands\n",
+            device, mode, result.seconds * 1e9 / n, result.lines, n);
+}
+
+
+
+TEST(bench_engine_on_mock_device)
+{
+    static constexpr size_t ROUNDS = 20000;
+
+    counting_modem modem;
+    mock_serial_device device;
+    device.set_responder([&] (std::string_view line) { return modem.answer(line); });
+
+    const bench_result single = _run(device, bench_mode::single, ROUNDS);
+    const bench_result batch = _run(device, bench_mode::batch, ROUNDS);
+    const bench_result merged = _run(device, bench_mode::merged, ROUNDS);
+
+    _report("mock", "single", single, ROUNDS);
+    _report("mock", "batch", batch, ROUNDS);
+    _report("mock", "merged", merged, ROUNDS);
+
+    CHECK(single.ok && batch.ok && merged.ok);
+    CHECK(single.lines == ROUNDS * STATUS_COMMANDS.size());
+    CHECK(batch.lines == single.lines);
+    CHECK(merged.lines == ROUNDS);
+}
+
+// Each command line costs the modem 1 ms, whatever it holds.
+TEST(bench_merging_saves_round_trips)
+{
+    static constexpr size_t ROUNDS = 20;
+
+    counting_modem modem;
+    paced_modem_device device([&] (std::string_view line) -> paced_modem_device::reply
+    {
+        return {1, modem.answer(line)};
+    });
+
+    const bench_result single = _run(device, bench_mode::single, ROUNDS);
+    const bench_result merged = _run(device, bench_mode::merged, ROUNDS);
+
+    _report("paced", "single", single, ROUNDS);
+    _report("paced", "merged", merged, ROUNDS);
+    fprintf(stderr, "    merging is %.1fx faster\n", single.seconds / merged.seconds);
+
+    CHECK(single.ok && merged.ok);
+    CHECK(merged.lines == ROUNDS);
+    CHECK(single.seconds > 3 * merged.seconds);
+}
@@ -0,0 +1,130 @@
+#include "test.h"
+#include "test_devices.h"
+#include "../atctl/at_engine.h"
+#include "../serial/mock_serial_device.h"
+
+#include <string>
+#include <vector>
+
+
+
+// +CPAS answers after cpas_ms, everything else at once; of merged lines
+// only +CSQ gets an information response.
+static paced_modem_device _slow_cpas_modem (size_t cpas_ms)
+{
+    return paced_modem_device([cpas_ms] (std::string_view line) -> paced_modem_device::reply
+    {
+        if (line == "AT+CPAS")
+        {
+            return {cpas_ms, "\r\n+CPAS: 0\r\n\r\nOK\r\n"};
+        }
+        if (line.find("+CSQ") != std::string_view::npos)
+        {
+            return {5, "\r\n+CSQ: 20,99\r\n\r\nOK\r\n"};
+        }
+        return {5, "\r\nOK\r\n"};
+    });
+}
+
+static const std::vector<std::string> CSQ_LINES = {"+CSQ: 20,99", "OK"};
+
+
+
+// The late reply arrives while the engine is still draining the line.
+TEST(engine_drops_reply_of_timed_out_command)
+{
+    paced_modem_device modem = _slow_cpas_modem(80);
+    basic_at_engine<paced_modem_device> engine(modem);
+    std::vector<std::string> lines;
+
+    CHECK(at_final::none == engine.transact("+CPAS", lines, 50));
+    CHECK(at_final::ok == engine.transact("+CSQ", lines, 1000));
+    CHECK(lines == CSQ_LINES);
+    CHECK(engine.get_abandoned() == 1);
+}
+
+// The late reply arrives after the next command was sent: it precedes that
+// command's echo.
+TEST(engine_skips_late_reply_up_to_own_echo)
+{
+    paced_modem_device modem = _slow_cpas_modem(400);
+    basic_at_engine<paced_modem_device> engine(modem);
+    std::vector<std::string> lines;
+
+    CHECK(at_final::none == engine.transact("+CPAS", lines, 50));
+    CHECK(at_final::ok == engine.transact("+CSQ", lines, 1000));
+    CHECK(lines == CSQ_LINES);
+
+    CHECK(at_final::ok == engine.transact("+CPAS", lines, 1000));
+    CHECK(lines.size() == 2 && lines[0] == "+CPAS: 0");
+}
+
+TEST(engine_stream_skips_late_reply)
+{
+    paced_modem_device modem = _slow_cpas_modem(400);
+    basic_at_engine<paced_modem_device> engine(modem);
+    std::vector<std::string> lines;
+
+    CHECK(at_final::none == engine.transact_stream("+CPAS", [&] (const std::string &line) { lines.push_back(line); }, [] () {}, 50));
+    lines.clear();
+
+    CHECK(at_final::ok == engine.transact_stream("+CSQ", [&] (const std::string &line) { lines.push_back(line); }, [] () {}, 1000));
+    CHECK(lines == CSQ_LINES);
+}
+
+TEST(engine_batch_after_timeout_gets_own_answers)
+{
+    paced_modem_device modem = _slow_cpas_modem(400);
+    basic_at_engine<paced_modem_device> engine(modem);
+    std::vector<at_response> responses;
+
+    engine.transact_batch({"+CPAS"}, responses, 50);
+    CHECK(responses[0].result == at_final::none);
+
+    engine.transact_batch({"+CSQ", "+CREG?"}, responses, 1000);
+    CHECK(responses[0].result == at_final::ok);
+    CHECK(responses[0].lines == CSQ_LINES);
+}
+
+
+
+TEST(batch_merges_only_known_repeatable_commands)
+{
+    mock_serial_device device;
+    counting_modem modem;
+    device.set_responder([&] (std::string_view line) { return modem.answer(line); });
+
+    basic_at_engine<mock_serial_device> engine(device);
+    std::vector<at_response> responses;
+
+    engine.transact_batch({"+CSQ", "+CREG?", "+XYZZY?", "+CFUN=1,1", "+CFUN?", "+CSQ"}, responses);
+
+    const std::vector<std::string> expected = {"AT+CSQ;+CREG?", "AT+XYZZY?", "AT+CFUN=1,1", "AT+CFUN?;+CSQ"};
+    CHECK(modem.lines == expected);
+    CHECK(responses[1].lines.size() == 2 && responses[1].lines[0] == "+CREG: 0,1");
+}
+
+// Only commands from the first that did not answer on are sent again.
+TEST(batch_retries_rejected_line_from_failing_command)
+{
+    mock_serial_device device;
+    counting_modem modem;
+    device.set_responder([&] (std::string_view line) { return modem.answer(line); });
+
+    basic_at_engine<mock_serial_device> engine(device);
+    std::vector<at_response> responses;
+
+    engine.transact_batch({"+CSQ", "+CMEE=1", "+CPMS?", "+CREG?"}, responses);
+
+    CHECK(modem.lines.front() == "AT+CSQ;+CMEE=1;+CPMS?;+CREG?");
+    CHECK(modem.runs["+CSQ"] == 1);
+    CHECK(modem.runs["+CMEE=1"] == 2);
+    CHECK(modem.runs["+CREG?"] == 1);
+
+    CHECK(responses[0].result == at_final::ok);
+    CHECK(responses[0].lines == CSQ_LINES);
+    CHECK(responses[1].result == at_final::ok);
+    CHECK(responses[2].result == at_final::error);
+    CHECK(responses[3].result == at_final::ok);
+    CHECK(responses[3].lines.size() == 2 && responses[3].lines[0] == "+CREG: 0,1");
+}
@@ -0,0 +1,83 @@
+#include "test.h"
+#include "test_devices.h"
+#include "../atctl/at_io_thread.h"
+#include "../serial/mock_serial_device.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+static constexpr size_t N_ROUNDS = 200;
+
+static const std::vector<std::string> LOAD_COMMANDS = {"+CSQ", "+CMEE=1", "+CPMS?", "+CREG?"};
+
+// Submits every round at once, so that requests of both threads queue up
+// together, then waits for all of them.
+static void _submit_rounds (basic_at_io_thread<mock_serial_device> &io, std::vector<at_request> &requests)
+{
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        requests[i].command = LOAD_COMMANDS[i % LOAD_COMMANDS.size()];
+        io.submit(requests[i]);
+    }
+
+    for (at_request &request : requests)
+    {
+        request.wait();
+    }
+}
+
+
+
+// Settings are never put on one line with another thread's commands, and
+// a failing query does not make them run again.
+TEST(io_thread_runs_settings_alone)
+{
+    mock_serial_device device;
+    counting_modem modem;
+    device.set_responder([&] (std::string_view line) { return modem.answer(line); });
+
+    basic_at_engine<mock_serial_device> engine(device);
+    engine.set_skip_settings(false);
+
+    std::vector<at_request> first (N_ROUNDS * LOAD_COMMANDS.size());
+    std::vector<at_request> second (N_ROUNDS * LOAD_COMMANDS.size());
+    {
+        basic_at_io_thread<mock_serial_device> io (engine);
+        std::thread other ([&] (void) { _submit_rounds(io, second); });
+        _submit_rounds(io, first);
+        other.join();
+    }
+
+    for (const std::string &line : modem.lines)
+    {
+        CHECK(line.find("+CMEE") == std::string::npos || line == "AT+CMEE=1");
+    }
+    CHECK(modem.runs["+CMEE=1"] == 2 * N_ROUNDS);
+
+    for (const std::vector<at_request> *requests : {&first, &second})
+    {
+        for (const at_request &request : *requests)
+        {
+            const std::vector<std::string> &lines = request.response.lines;
+
+            if (request.command == "+CPMS?")
+            {
+                CHECK(request.response.result == at_final::error);
+                continue;
+            }
+
+            CHECK(request.response.result == at_final::ok);
+            if (request.command == "+CMEE=1")
+            {
+                CHECK(lines.size() == 1);
+            }
+            else
+            {
+                CHECK(lines.size() == 2 && lines[0].starts_with(request.command.substr(0, request.command.find('?')) + ":"));
+            }
+        }
+    }
+}
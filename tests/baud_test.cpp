@@ -0,0 +1,158 @@
+#include "test.h"
+#include "test_devices.h"
+
+#ifndef _WIN32
+#include "../atctl/baud.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+
+
+// A modem on a pty that only understands the host at its own rate, which
+// AT+IPR changes. At a mismatched rate it answers with junk; at a rate in
+// bad, its ATI answers come back altered, as over a link that cannot
+// carry that rate.
+class pty_baud_modem
+{
+public:
+    pty_baud_modem (unsigned int rate, std::vector<unsigned int> bad)
+        : m_rate (rate)
+        , m_bad (std::move(bad))
+        , m_pty ([this] (std::string &input) { this->receive(input); })
+    {}
+
+    const char* path (void) const
+    {
+        return m_pty.path();
+    }
+
+    unsigned int rate (void) const
+    {
+        return m_rate;
+    }
+
+private:
+    static constexpr unsigned int RATES [] = {9600, 115200, 460800, 921600, 1000000, 3000000};
+
+    // What the host has set on its end.
+    unsigned int host_rate (void) const
+    {
+        static constexpr struct { speed_t speed; unsigned int rate; } SPEEDS [] = {
+            {B9600, 9600}, {B115200, 115200}, {B460800, 460800}, {B921600, 921600},
+            {B1000000, 1000000}, {B3000000, 3000000},
+        };
+
+        termios tio;
+        if (0 != tcgetattr(m_pty.master(), &tio))
+        {
+            return 0;
+        }
+        for (const auto &entry : SPEEDS)
+        {
+            if (entry.speed == cfgetospeed(&tio))
+            {
+                return entry.rate;
+            }
+        }
+        return 0;
+    }
+
+    void receive (std::string &input)
+    {
+        if (this->host_rate() != m_rate)
+        {
+            m_pty.send(std::string(std::max<size_t>(1, input.size() / 2), '\xA5'));
+            input.clear();
+            return;
+        }
+
+        std::string line;
+        while (pty_next_line(input, line))
+        {
+            if (!line.empty())
+            {
+                this->answer(line);
+            }
+        }
+    }
+
+    void answer (const std::string &line)
+    {
+        const bool bad = m_bad.end() != std::find(m_bad.begin(), m_bad.end(), m_rate);
+        std::string reply = line + "\r\r\n";
+        unsigned int new_rate = 0;
+
+        if (line == "ATI")
+        {
+            reply += bad ? "\r\nQuectel\r\nEG2\xB5\r\n" : "\r\nQuectel\r\nEG25\r\n";
+        }
+        else if (line == "AT+IPR=?")
+        {
+            reply += "\r\n+IPR: (9600,115200,460800,921600,1000000,3000000),()\r\n";
+        }
+        else if (line.starts_with("AT+IPR="))
+        {
+            new_rate = static_cast<unsigned int>(strtoul(line.c_str() + 7, nullptr, 10));
+            if (std::end(RATES) == std::find(std::begin(RATES), std::end(RATES), new_rate))
+            {
+                m_pty.send(reply + "\r\nERROR\r\n");
+                return;
+            }
+        }
+
+        m_pty.send(reply + "\r\nOK\r\n");
+        if (new_rate)
+        {
+            m_rate = new_rate;
+        }
+    }
+
+    std::atomic<unsigned int>   m_rate;
+    std::vector<unsigned int>   m_bad;
+    pty_modem                   m_pty;      // last: serves once the rest is set up
+};
+
+
+
+TEST(baud_detect_finds_modem_rate)
+{
+    pty_baud_modem modem (460800, {});
+    serial_device device;
+    CHECK(device.open(modem.path()));
+
+    at_engine engine(device);
+    CHECK(460800 == baud_detect(engine));
+    CHECK(460800 == device.get_baud_rate());
+}
+
+// 3000000 and 1000000 fail verification; each is undone with AT+IPR at
+// that rate and the next lower one is tried.
+TEST(baud_negotiate_falls_back_from_bad_rates)
+{
+    pty_baud_modem modem (115200, {3000000, 1000000});
+    serial_device device;
+    CHECK(device.open(modem.path()));
+    CHECK(device.set_baud_rate(115200));
+
+    at_engine engine(device);
+    CHECK(921600 == baud_negotiate(engine));
+    CHECK(921600 == modem.rate());
+    CHECK(921600 == device.get_baud_rate());
+}
+
+TEST(baud_negotiate_keeps_to_max_rate)
+{
+    pty_baud_modem modem (115200, {});
+    serial_device device;
+    CHECK(device.open(modem.path()));
+    CHECK(device.set_baud_rate(115200));
+
+    at_engine engine(device);
+    CHECK(460800 == baud_negotiate(engine, 500000));
+    CHECK(460800 == modem.rate());
+}
+#endif
@@ -0,0 +1,214 @@
+#include "test.h"
+#include "../atctl/chat_script.h"
+#include "../serial/mock_serial_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+
+
+// A modem whose SIM is ready only after not_ready queries, with an IMEI
+// and a data call to dial.
+struct chat_modem
+{
+    size_t                      not_ready   = 0;
+    std::vector<std::string>    lines;
+
+    std::string answer (std::string_view line)
+    {
+        lines.emplace_back(line);
+
+        if (line == "AT+CPIN?")
+        {
+            if (not_ready)
+            {
+                not_ready--;
+                return "\r\n+CPIN: SIM PIN\r\n\r\nOK\r\n";
+            }
+            return "\r\n+CPIN: READY\r\n\r\nOK\r\n";
+        }
+        if (line == "AT+CGSN")
+        {
+            return "\r\n867962041234567\r\n\r\nOK\r\n";
+        }
+        if (line == "ATD*99#")
+        {
+            return "\r\nCONNECT 150000000\r\n";
+        }
+        return "\r\nERROR\r\n";
+    }
+
+    size_t count (std::string_view line) const
+    {
+        return std::count(lines.begin(), lines.end(), line);
+    }
+};
+
+static bool _load (chat_script &script, const char *text)
+{
+    FILE *f = tmpfile();
+    if (!f)
+    {
+        return false;
+    }
+
+    fputs(text, f);
+    rewind(f);
+    const bool ok = script.load(f, "test.chat");
+    fclose(f);
+    return ok;
+}
+
+// Runs text against modem, with what print wrote in printed_dest.
+static bool _run (const char *text, chat_modem &modem, std::map<std::string, std::string> &vars, std::string &printed_dest)
+{
+    chat_script script;
+    if (!_load(script, text))
+    {
+        return false;
+    }
+
+    mock_serial_device device;
+    device.set_responder([&] (std::string_view line) { return modem.answer(line); });
+    basic_at_engine<mock_serial_device> engine(device);
+
+    FILE *out = tmpfile();
+    bool ok;
+    {
+        output_writer output(fileno(out));
+        ok = script.run(engine, vars, output);
+    }
+
+    char buffer [256];
+    rewind(out);
+    printed_dest.assign(buffer, fread(buffer, 1, sizeof(buffer), out));
+    fclose(out);
+
+    return ok;
+}
+
+
+
+TEST(chat_script_rejects_bad_scripts)
+{
+    static const char *const BAD [] = {
+        "frobnicate\n",
+        "goto nowhere\n",
+        "again:\nagain:\n",
+        "1st:\n",
+        "send\n",
+        "expect\n",
+        "expect \"(\"\n",
+        "expect \"unterminated\n",
+        "expect MAYBE\n",
+        "if OK\n",
+        "if OK goto\n",
+        "capture \"x\"\n",
+        "capture imei OK\n",
+        "retry start\nstart:\n",
+        "start:\nretry start 0\n",
+        "start:\nretry start 3 soon\n",
+        "timeout 0\n",
+        "sleep\n",
+        "done now\n",
+    };
+
+    for (const char *text : BAD)
+    {
+        chat_script script;
+        CHECK(!_load(script, text));
+    }
+
+    chat_script script;
+    CHECK(_load(script, "start:  # the top\n  send +CPIN?\n\nexpect NO CARRIER else start\ndone\n"));
+}
+
+// Outside quotes \# is a literal '#'; an unescaped one starts a comment.
+TEST(chat_script_keeps_escaped_hash)
+{
+    chat_modem modem;
+    std::map<std::string, std::string> vars;
+    std::string printed;
+
+    CHECK(_run("send D*99\\#   # dial the data call\nexpect \"^CONNECT\"\nprint \"#\" \\# 1\n", modem, vars, printed));
+    CHECK(modem.lines.size() == 1 && modem.lines[0] == "ATD*99#");
+    CHECK(printed == "\"#\" # 1\n");
+}
+
+// The SIM needs two retries: 20 then 40 ms of backoff before it is ready,
+// then the IMEI is captured and checked.
+TEST(chat_script_runs_retry_and_capture)
+{
+    static const char SCRIPT [] = R"(
+        start:
+            send +CPIN?
+            if "READY" goto ready
+            retry start 3 20
+            fail SIM not ready
+        ready:
+            send +CGSN
+            capture imei "^(\d{15})$" else no_imei
+            expect OK
+            print IMEI $imei on ${port}
+            done
+        no_imei:
+            fail no IMEI
+    )";
+
+    chat_modem modem;
+    modem.not_ready = 2;
+    std::map<std::string, std::string> vars = {{"port", "ttyUSB2"}};
+    std::string printed;
+
+    const auto start = std::chrono::steady_clock::now();
+    CHECK(_run(SCRIPT, modem, vars, printed));
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    CHECK(modem.count("AT+CPIN?") == 3);
+    CHECK(elapsed >= std::chrono::milliseconds(60));
+    CHECK(vars["imei"] == "867962041234567");
+    CHECK(printed == "IMEI 867962041234567 on ttyUSB2\n");
+}
+
+// Once retries run out, the statement after retry runs.
+TEST(chat_script_fails_after_last_retry)
+{
+    static const char SCRIPT [] = R"(
+        start:
+            send +CPIN?
+            expect "READY" else again
+            done
+        again:
+            retry start 2
+            fail SIM not ready
+    )";
+
+    chat_modem modem;
+    modem.not_ready = 10;
+    std::map<std::string, std::string> vars;
+    std::string printed;
+
+    CHECK(!_run(SCRIPT, modem, vars, printed));
+    CHECK(modem.count("AT+CPIN?") == 3);
+}
+
+// A failed expect without else ends the run; result codes match only the
+// last send's.
+TEST(chat_script_fails_on_unmatched_expect)
+{
+    chat_modem modem;
+    std::map<std::string, std::string> vars;
+    std::string printed;
+
+    CHECK(!_run("send +CPIN?\nexpect OK\nsend +COPS=0\nexpect OK\nprint unreachable\n", modem, vars, printed));
+    CHECK(modem.lines.size() == 2);
+    CHECK(printed.empty());
+
+    modem.lines.clear();
+    CHECK(_run("send +COPS=0\nif ERROR goto end\nsend +CGSN\nend:\n", modem, vars, printed));
+    CHECK(modem.lines.size() == 1);
+}
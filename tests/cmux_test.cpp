@@ -0,0 +1,90 @@
+#include "test.h"
+#include "../atctl/cmux.h"
+
+#include <string>
+#include <vector>
+
+
+
+// Feeds every byte of stream and returns the frames completed.
+static std::vector<cmux_frame> _decode (cmux_decoder &decoder, const std::string &stream)
+{
+    std::vector<cmux_frame> frames;
+    cmux_frame frame;
+
+    for (const char c : stream)
+    {
+        if (decoder.feed(static_cast<uint8_t>(c), frame))
+        {
+            frames.push_back(frame);
+        }
+    }
+
+    return frames;
+}
+
+static bool _same (const cmux_frame &frame, uint8_t dlci, uint8_t control, const std::string &data)
+{
+    return frame.dlci == dlci && frame.control == control && frame.data == data;
+}
+
+
+
+// Payloads with flag bytes in them, and one long enough for a two-byte
+// length field; junk between frames is skipped.
+TEST(cmux_round_trip)
+{
+    const std::string at = "AT+CSQ\r";
+    const std::string flags = std::string("\xF9\x00\xF9", 3);
+    const std::string large (300, 'x');
+
+    std::string stream = "noise";
+    cmux_encode_frame(1, CMUX_UIH, at.data(), at.size(), stream);
+    cmux_encode_frame(2, CMUX_UIH, flags.data(), flags.size(), stream, false);
+    stream.append("\xF9\xF9", 2);
+    cmux_encode_frame(3, CMUX_UIH, large.data(), large.size(), stream);
+    cmux_encode_frame(0, CMUX_SABM | CMUX_PF, nullptr, 0, stream);
+    cmux_encode_frame(4, CMUX_UI, at.data(), at.size(), stream);
+
+    cmux_decoder decoder;
+    const std::vector<cmux_frame> frames = _decode(decoder, stream);
+
+    CHECK(frames.size() == 5);
+    CHECK(_same(frames[0], 1, CMUX_UIH, at));
+    CHECK(_same(frames[1], 2, CMUX_UIH, flags));
+    CHECK(_same(frames[2], 3, CMUX_UIH, large));
+    CHECK(_same(frames[3], 0, CMUX_SABM, ""));
+    CHECK(_same(frames[4], 4, CMUX_UI, at));
+    CHECK(decoder.get_fcs_errors() == 0);
+}
+
+// A damaged header, or damaged data of a UI frame, fails the FCS; the
+// frame is dropped and the next one still decodes. UIH data is not covered.
+TEST(cmux_fcs_error)
+{
+    const std::string at = "AT+CSQ\r";
+
+    std::string bad_header;
+    cmux_encode_frame(1, CMUX_UIH, at.data(), at.size(), bad_header);
+    bad_header[1] ^= 0x04;
+
+    std::string bad_ui;
+    cmux_encode_frame(2, CMUX_UI, at.data(), at.size(), bad_ui);
+    bad_ui[5] ^= 0x01;
+
+    std::string bad_uih;
+    cmux_encode_frame(2, CMUX_UIH, at.data(), at.size(), bad_uih);
+    bad_uih[5] ^= 0x01;
+
+    std::string stream = bad_header + bad_ui;
+    cmux_encode_frame(1, CMUX_UIH, at.data(), at.size(), stream);
+    stream += bad_uih;
+
+    cmux_decoder decoder;
+    const std::vector<cmux_frame> frames = _decode(decoder, stream);
+
+    CHECK(decoder.get_fcs_errors() == 2);
+    CHECK(frames.size() == 2);
+    CHECK(_same(frames[0], 1, CMUX_UIH, at));
+    CHECK(frames[1].dlci == 2 && frames[1].data != at);
+}
@@ -0,0 +1,248 @@
+#include "test.h"
+
+#ifndef _WIN32
+#include "../gps/geofence.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+
+// Eight squares and a triangle on 0..16 x 0..16: with two cells per fence
+// the grid is 4 x 4 cells of 4 degrees, so 4, 8 and 12 are cell boundaries.
+static const char SQUARES [] =
+    "# id  corners as <lat>,<lon>\n"
+    "a      0,0   0,10  10,10 10,0\n"
+    "b      5,5   5,15  15,15 15,5\n"
+    "c      6,6   6,10  10,10 10,6      # inside a and b\n"
+    "e      8,8   8,12  12,12 12,8      # corner on a cell corner\n"
+    "tri    12,0  16,0  16,4\n"
+    "f      0,12  0,16  4,16  4,12\n"
+    "g      12,12 12,16 16,16 16,12\n"
+    "h      4,4   4,8   8,8   8,4       # exactly one cell\n";
+
+static bool _load (geofence_set &fences, const std::string &text)
+{
+    FILE *f = tmpfile();
+    if (!f)
+    {
+        return false;
+    }
+
+    fputs(text.c_str(), f);
+    rewind(f);
+    const bool ok = fences.load(f, "test.fences");
+    fclose(f);
+    return ok;
+}
+
+// What a tracker should report going from the fences in before to those
+// in after: every difference, in ascending fence order.
+static std::vector<std::pair<uint32_t, bool>> _differences (const std::vector<uint32_t> &before, const std::vector<uint32_t> &after)
+{
+    std::vector<std::pair<uint32_t, bool>> events;
+    for (const uint32_t fence : before)
+    {
+        if (!std::binary_search(after.begin(), after.end(), fence))
+        {
+            events.emplace_back(fence, false);
+        }
+    }
+    for (const uint32_t fence : after)
+    {
+        if (!std::binary_search(before.begin(), before.end(), fence))
+        {
+            events.emplace_back(fence, true);
+        }
+    }
+    std::sort(events.begin(), events.end());
+    return events;
+}
+
+// Random star-shaped polygons, heavily overlapping, with corners on
+// multiples of 1/1024 degree so they read back exactly.
+static std::string _random_fences (size_t n, std::vector<geo_point> &vertices_dest)
+{
+    std::mt19937 random(43);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::string text;
+    char point [64];
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const double lat = 48 + 2 * unit(random);
+        const double lon = 11 + 3 * unit(random);
+        const double radius = 0.02 + 0.3 * unit(random);
+        const size_t n_vertices = 6 + random() % 35;
+
+        std::vector<double> angles(n_vertices);
+        for (double &angle : angles)
+        {
+            angle = 2 * M_PI * unit(random);
+        }
+        std::sort(angles.begin(), angles.end());
+
+        text += "fence-" + std::to_string(i);
+        for (const double angle : angles)
+        {
+            const double r = radius * (0.3 + 0.7 * unit(random));
+            const geo_point p = {std::round((lat + r * std::sin(angle)) * 1024) / 1024, std::round((lon + r * std::cos(angle)) * 1024) / 1024};
+            snprintf(point, sizeof(point), " %.10f,%.10f", p.lat, p.lon);
+            text += point;
+            vertices_dest.push_back(p);
+        }
+        text += "\n";
+    }
+
+    return text;
+}
+
+
+
+TEST(geofence_rejects_bad_files)
+{
+    static const char *const BAD [] = {
+        "a 0,0 0,1\n",                  // two points
+        "a 0,0 0,1 1,x\n",
+        "a 0,0 0,1 91,1\n",
+        "a 0,0 0,1 1,181\n",
+        "a\"b 0,0 0,1 1,1\n",
+        "a 0,0 0,1 1,1 nan,1\n",
+        "a 0;0 0,1 1,1\n",
+    };
+
+    for (const char *text : BAD)
+    {
+        geofence_set fences;
+        CHECK(!_load(fences, text));
+        CHECK(fences.size() == 0);
+    }
+
+    geofence_set fences;
+    CHECK(_load(fences, SQUARES));
+    CHECK(fences.size() == 8);
+    CHECK(fences.get_id(4) == "tri");
+
+    uint32_t cols, rows;
+    double per_cell;
+    fences.get_grid_stats(cols, rows, per_cell);
+    CHECK(cols == 4 && rows == 4);
+}
+
+// The grid finds what testing every fence finds: for random fixes, fixes
+// on the fences' corners, and fixes exactly on the lines between cells.
+TEST(geofence_query_matches_linear)
+{
+    std::vector<geo_point> vertices;
+    geofence_set fences;
+    CHECK(_load(fences, _random_fences(500, vertices)));
+    CHECK(fences.size() == 500);
+
+    geo_box bounds;
+    for (const geo_point &p : vertices)
+    {
+        bounds.extend(p);
+    }
+
+    uint32_t cols, rows;
+    double per_cell;
+    fences.get_grid_stats(cols, rows, per_cell);
+    CHECK(cols > 4 && rows > 4 && per_cell > 2);
+
+    const double cell_lat = (bounds.max_lat - bounds.min_lat) / rows;
+    const double cell_lon = (bounds.max_lon - bounds.min_lon) / cols;
+
+    std::mt19937 random(43);
+    std::uniform_real_distribution<double> lat(bounds.min_lat - 0.1, bounds.max_lat + 0.1);
+    std::uniform_real_distribution<double> lon(bounds.min_lon - 0.1, bounds.max_lon + 0.1);
+
+    std::vector<geo_point> fixes = vertices;
+    for (size_t i = 0; i < 20000; i++)
+    {
+        fixes.push_back({lat(random), lon(random)});
+    }
+    for (uint32_t row = 0; row <= rows; row++)
+    {
+        for (uint32_t col = 0; col <= cols; col++)
+        {
+            const double boundary_lat = bounds.min_lat + row * cell_lat;
+            const double boundary_lon = bounds.min_lon + col * cell_lon;
+            fixes.push_back({boundary_lat, boundary_lon});
+            fixes.push_back({boundary_lat, lon(random)});
+            fixes.push_back({lat(random), boundary_lon});
+        }
+    }
+
+    std::vector<uint32_t> grid, linear;
+    size_t n_inside = 0;
+    for (const geo_point &p : fixes)
+    {
+        fences.query(p, grid);
+        fences.query_linear(p, linear);
+        CHECK(grid == linear);
+        CHECK(std::is_sorted(grid.begin(), grid.end()));
+        n_inside += grid.size();
+    }
+
+    // Overlapping: many fixes are in several fences at once.
+    CHECK(n_inside > fixes.size());
+}
+
+// Crossings come out in ascending fence order, exits and entries merged,
+// and agree with query_linear(), also for fixes on cell boundaries and
+// fence corners.
+TEST(geofence_tracker_orders_events)
+{
+    geofence_set fences;
+    CHECK(_load(fences, SQUARES));
+
+    enum : uint32_t { A, B, C, E, TRI, F, G, H };
+    using events = std::vector<std::pair<uint32_t, bool>>;
+
+    const struct
+    {
+        geo_point   fix;
+        events      expected;
+    } STEPS [] = {
+        {{-1, -1},      {}},
+        {{2, 2},        {{A, true}}},
+        {{7, 7},        {{B, true}, {C, true}, {H, true}}},
+        {{9, 9},        {{E, true}, {H, false}}},
+        {{12.5, 12.5},  {{A, false}, {C, false}, {E, false}, {G, true}}},
+        {{2, 2},        {{A, true}, {B, false}, {G, false}}},
+        {{15, 1},       {{A, false}, {TRI, true}}},
+        {{20, 20},      {{TRI, false}}},
+
+        // On the lines between cells, which are also fence edges. The
+        // even-odd rule counts a square's south and west edges in and its
+        // north and east ones out, with or without the grid.
+        {{8, 9},        {{A, true}, {B, true}, {C, true}, {E, true}}},
+        {{9, 8},        {}},
+        {{8, 8},        {}},                // e's lower corner, h's upper
+        {{4, 12},       {{A, false}, {B, false}, {C, false}, {E, false}}},
+        {{2, 12},       {{F, true}}},
+        {{16, 16},      {{F, false}}},      // g's corner, the grid's last
+    };
+
+    geofence_tracker tracker(fences);
+    std::vector<uint32_t> before, after;
+
+    for (const auto &step : STEPS)
+    {
+        events reported;
+        tracker.update(step.fix, [&](uint32_t fence, bool entered) { reported.emplace_back(fence, entered); });
+
+        fences.query_linear(step.fix, after);
+        CHECK(reported == _differences(before, after));
+        CHECK(tracker.get_inside() == after);
+        before = after;
+
+        CHECK(reported == step.expected);
+    }
+}
+#endif
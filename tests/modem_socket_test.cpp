@@ -0,0 +1,199 @@
+#include "test.h"
+#include "test_devices.h"
+
+#ifndef _WIN32
+#include "../atctl/modem_socket.h"
+#include "../source_exception/source_exception.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+
+
+// The Quectel TCP/IP stack of a modem on a pty, connected to an echo
+// server: what +QISEND delivers comes back, announced with +QIURC: "recv"
+// and fetched with +QIRD.
+class pty_qi_modem
+{
+public:
+    pty_qi_modem (void)
+        : m_pty ([this] (std::string &input) { this->receive(input); })
+    {}
+
+    const char* path (void) const
+    {
+        return m_pty.path();
+    }
+
+    size_t get_sends (void) const
+    {
+        return m_sends;
+    }
+
+    // An unsolicited line, e.g. a garbled URC.
+    void urc (const std::string &line)
+    {
+        m_pty.send("\r\n" + line + "\r\n");
+    }
+
+private:
+    void receive (std::string &input)
+    {
+        std::string line;
+
+        while (!input.empty())
+        {
+            if (m_send_left)
+            {
+                const size_t n = std::min(m_send_left, input.size());
+                m_payload.append(input, 0, n);
+                input.erase(0, n);
+                m_send_left -= n;
+
+                if (!m_send_left)
+                {
+                    this->deliver();
+                }
+                continue;
+            }
+
+            if (!pty_next_line(input, line))
+            {
+                return;
+            }
+            if (!line.empty())
+            {
+                this->answer(line);
+            }
+        }
+    }
+
+    void answer (const std::string &line)
+    {
+        std::string reply = line + "\r\r\n";
+
+        if (line == "AT+QIACT?")
+        {
+            reply += "\r\n+QIACT: 1,1,1,\"10.0.0.2\"\r\n";
+        }
+        else if (line.starts_with("AT+QIOPEN="))
+        {
+            m_rx.clear();
+            m_pty.send(reply + "\r\nOK\r\n\r\n+QIOPEN: 0,0\r\n");
+            return;
+        }
+        else if (line.starts_with("AT+QISEND="))
+        {
+            m_send_left = strtoul(line.c_str() + line.find(',') + 1, nullptr, 10);
+            m_sends++;
+            m_pty.send(reply + "\r\n> ");
+            return;
+        }
+        else if (line.starts_with("AT+QIRD="))
+        {
+            const size_t n = std::min<size_t>(m_rx.size(), strtoul(line.c_str() + line.find(',') + 1, nullptr, 10));
+            reply += "\r\n+QIRD: " + std::to_string(n) + "\r\n" + m_rx.substr(0, n) + "\r\n";
+            m_rx.erase(0, n);
+        }
+
+        m_pty.send(reply + "\r\nOK\r\n");
+    }
+
+    // The echo server answers at once.
+    void deliver (void)
+    {
+        m_pty.send("\r\nSEND OK\r\n");
+
+        if (m_rx.empty())
+        {
+            m_pty.send("\r\n+QIURC: \"recv\",0\r\n");
+        }
+        m_rx += m_payload;
+        m_payload.clear();
+    }
+
+    size_t                  m_send_left     = 0;
+    std::string             m_payload;
+    std::string             m_rx;
+    std::atomic<size_t>     m_sends         {0};
+    pty_modem               m_pty;      // last: serves once the rest is set up
+};
+
+
+
+// Writes are coalesced into full +QISEND chunks, and what comes back is
+// read in full.
+TEST(modem_socket_round_trip)
+{
+    pty_qi_modem modem;
+    serial_device device;
+    CHECK(device.open(modem.path()));
+
+    at_engine engine(device);
+    modem_socket socket(engine);
+    socket.connect("192.0.2.1", 7);
+    CHECK(socket.is_connected());
+
+    std::string sent;
+    for (size_t i = 0; sent.size() < 2 * QI_MAX_SEND + 100; i++)
+    {
+        const std::string message = "message " + std::to_string(i) + "\n";
+        socket.write(message.data(), message.size());
+        sent += message;
+    }
+    socket.flush();
+    CHECK(modem.get_sends() == 3);
+
+    const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (socket.received().size() < sent.size() && std::chrono::steady_clock::now() < give_up)
+    {
+        socket.poll(100);
+    }
+    CHECK(socket.received() == sent);
+
+    socket.close();
+    CHECK(!socket.is_connected());
+}
+
+TEST(modem_socket_rejects_quotes_in_host)
+{
+    pty_qi_modem modem;
+    serial_device device;
+    CHECK(device.open(modem.path()));
+
+    at_engine engine(device);
+    modem_socket socket(engine);
+
+    bool thrown = false;
+    try
+    {
+        socket.connect("example.org\",0,\"x", 7);
+    }
+    catch (const source_exception &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(!socket.is_connected());
+}
+
+// URCs without the connection id are ignored rather than thrown over.
+TEST(modem_socket_ignores_truncated_urc)
+{
+    pty_qi_modem modem;
+    serial_device device;
+    CHECK(device.open(modem.path()));
+
+    at_engine engine(device);
+    modem_socket socket(engine);
+    socket.connect("192.0.2.1", 7);
+
+    modem.urc("+QIURC: \"recv\"");
+    modem.urc("+QIURC: \"closed\",");
+    modem.urc("+QIURC: \"");
+    socket.poll(200);
+    CHECK(socket.is_connected());
+}
+#endif
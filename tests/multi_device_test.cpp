@@ -0,0 +1,252 @@
+#include "test.h"
+#include "test_devices.h"
+
+#ifndef _WIN32
+#include "../atctl/multi_device.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+
+// A modem on a pty that gives itself away: its IMEI and signal quality
+// carry its number.
+class numbered_modem
+{
+public:
+    explicit numbered_modem (size_t number)
+        : m_number  (number)
+        , m_pty     ([this] (std::string &input) { this->receive(input); })
+    {}
+
+    const char* path (void) const
+    {
+        return m_pty.path();
+    }
+
+    std::string imei (void) const
+    {
+        char imei [16];
+        snprintf(imei, sizeof(imei), "86796204%07zu", m_number);
+        return imei;
+    }
+
+private:
+    void receive (std::string &input)
+    {
+        std::string line;
+        while (pty_next_line(input, line))
+        {
+            if (line.empty())
+            {
+                continue;
+            }
+
+            std::string reply = line + "\r\r\n";
+            if (line == "AT+CGSN")
+            {
+                reply += "\r\n" + this->imei() + "\r\n";
+            }
+            else if (line == "AT+CSQ")
+            {
+                reply += "\r\n+CSQ: " + std::to_string(m_number) + ",99\r\n";
+            }
+            m_pty.send(reply + "\r\nOK\r\n");
+        }
+    }
+
+    size_t          m_number;
+    pty_modem       m_pty;      // last: serves once the rest is set up
+};
+
+// Runs commands on n modems; the jsonl output goes to written_dest.
+static size_t _run_multi (const std::vector<std::unique_ptr<numbered_modem>> &modems, const std::vector<std::string> &commands,
+                          serial_io_backend backend, multi_device_stats &stats_dest, std::string &written_dest)
+{
+    std::vector<std::string> paths;
+    for (const auto &modem : modems)
+    {
+        paths.emplace_back(modem->path());
+    }
+
+    FILE *out = tmpfile();
+    size_t n_failed;
+    {
+        output_writer output(fileno(out));
+        output.set_format(output_format::jsonl);
+        n_failed = send_at_commands_multi(paths, commands, backend, output, &stats_dest);
+    }
+
+    char buffer [4096];
+    size_t n;
+    written_dest.clear();
+    rewind(out);
+    while ((n = fread(buffer, 1, sizeof(buffer), out)) > 0)
+    {
+        written_dest.append(buffer, n);
+    }
+    fclose(out);
+
+    return n_failed;
+}
+
+static std::vector<std::unique_ptr<numbered_modem>> _modems (size_t n)
+{
+    std::vector<std::unique_ptr<numbered_modem>> modems;
+    for (size_t i = 0; i < n; i++)
+    {
+        modems.push_back(std::make_unique<numbered_modem>(i));
+    }
+    return modems;
+}
+
+// io_uring where the kernel has it; epoll is always there.
+static std::vector<serial_io_backend> _backends (void)
+{
+    std::vector<serial_io_backend> backends = {serial_io_backend::epoll};
+    if (serial_io_ring(1).get_backend() == serial_io_backend::io_uring)
+    {
+        backends.insert(backends.begin(), serial_io_backend::io_uring);
+    }
+    else
+    {
+        fprintf(stderr, "    io_uring unavailable, testing epoll only\n");
+    }
+    return backends;
+}
+
+static size_t _count (const std::string &haystack, const std::string &needle)
+{
+    size_t n = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1))
+    {
+        n++;
+    }
+    return n;
+}
+
+
+
+// Every response line is printed with the device it came from, once.
+TEST(multi_device_attributes_responses)
+{
+    static constexpr size_t N_MODEMS = 8;
+    const std::vector<std::string> commands = {"+CGSN", "+CSQ", "E1"};
+
+    const auto modems = _modems(N_MODEMS);
+    for (const serial_io_backend backend : _backends())
+    {
+        multi_device_stats stats;
+        std::string written;
+        CHECK(0 == _run_multi(modems, commands, backend, stats, written));
+        CHECK(stats.backend == backend);
+        CHECK(stats.commands == N_MODEMS * commands.size());
+        CHECK(_count(written, "\n") == N_MODEMS * (2 + 2 + 1));
+
+        for (size_t i = 0; i < N_MODEMS; i++)
+        {
+            const std::string device = std::string("{\"device\":\"") + modems[i]->path() + "\",";
+            CHECK(_count(written, device + "\"command\":\"+CGSN\",\"line\":\"" + modems[i]->imei() + "\"}\n") == 1);
+            CHECK(_count(written, device + "\"command\":\"+CSQ\",\"line\":\"+CSQ: " + std::to_string(i) + ",99\"}\n") == 1);
+            CHECK(_count(written, device + "\"command\":\"E1\",\"line\":\"OK\"}\n") == 1);
+            CHECK(_count(written, device) == 5);
+        }
+    }
+}
+
+// The run behind the numbers in the io_uring backend's commit: 32 modems,
+// 60 commands each. io_uring batches the writes and reads of all devices
+// into few io_uring_enter() calls; epoll needs a write and a read per
+// command on top of its waits.
+TEST(multi_device_syscalls_per_command)
+{
+    static constexpr size_t N_MODEMS = 32;
+    const std::vector<std::string> commands(60, "+CSQ");
+
+    const auto modems = _modems(N_MODEMS);
+    for (const serial_io_backend backend : _backends())
+    {
+        multi_device_stats stats;
+        std::string written;
+        CHECK(0 == _run_multi(modems, commands, backend, stats, written));
+        CHECK(stats.commands == N_MODEMS * commands.size());
+
+        const double per_command = static_cast<double>(stats.syscalls) / stats.commands;
+        fprintf(stderr, "    %-8s %.2f syscalls per command\n", backend == serial_io_backend::io_uring ? "io_uring" : "epoll", per_command);
+
+        if (backend == serial_io_backend::io_uring)
+        {
+            CHECK(per_command < 0.5);
+        }
+        else
+        {
+            CHECK(per_command >= 2 && per_command < 3);
+        }
+    }
+}
+
+// A write far larger than the socket buffer goes out in parts, in order,
+// ahead of what was queued after it.
+TEST(serial_io_ring_completes_short_writes)
+{
+    static constexpr size_t SIZE = 1 << 20;
+
+    for (const serial_io_backend backend : _backends())
+    {
+        int sv [2];
+        CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv));
+        const int sndbuf = 4096;
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+        std::string data(SIZE, '\0');
+        for (size_t i = 0; i < SIZE; i++)
+        {
+            data[i] = static_cast<char>('a' + (i * 7 + i / 251) % 26);
+        }
+        const std::string tail = "AT+CSQ\r";
+
+        // Read slowly at first, so that the writes fill the buffer.
+        std::string received;
+        std::atomic<size_t> n_received {0};
+        std::thread peer([&]
+        {
+            char buffer [3000];
+            ssize_t n;
+            while (received.size() < SIZE + tail.size() && (n = read(sv[1], buffer, sizeof(buffer))) > 0)
+            {
+                received.append(buffer, n);
+                n_received = received.size();
+                usleep(received.size() < 64 * 1024 ? 100 : 0);
+            }
+        });
+
+        {
+            serial_io_ring ring(1, backend);
+            const size_t index = ring.add(sv[0]);
+            ring.write(index, data.data(), data.size());
+            ring.write(index, tail.data(), tail.size());
+
+            std::vector<serial_io_event> events;
+            const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (n_received < SIZE + tail.size() && std::chrono::steady_clock::now() < give_up)
+            {
+                ring.wait(10, events);
+            }
+            shutdown(sv[1], SHUT_RDWR);
+            peer.join();
+        }
+
+        close(sv[0]);
+        close(sv[1]);
+        CHECK(received.size() == SIZE + tail.size());
+        CHECK(received == data + tail);
+    }
+}
+#endif
@@ -0,0 +1,87 @@
+#include "test.h"
+#include "../atctl/output.h"
+
+#include <cstdio>
+#include <string>
+
+
+
+// What an output_writer in format wrote for one response line.
+static std::string _format_line (output_format format, std::string_view command, std::string_view line)
+{
+    FILE *out = tmpfile();
+    if (!out)
+    {
+        return "";
+    }
+
+    {
+        output_writer output(fileno(out));
+        output.set_format(format);
+        output.set_device("/dev/ttyUSB2");
+        output.line(command, line);
+    }
+
+    std::string written;
+    char buffer [256];
+    size_t n;
+    rewind(out);
+    while ((n = fread(buffer, 1, sizeof(buffer), out)) > 0)
+    {
+        written.append(buffer, n);
+    }
+    fclose(out);
+
+    return written;
+}
+
+static std::string _jsonl (std::string_view line)
+{
+    return _format_line(output_format::jsonl, "+CSQ", line);
+}
+
+static std::string _csv (std::string_view line)
+{
+    return _format_line(output_format::csv, "+CSQ", line);
+}
+
+
+
+TEST(output_jsonl_escapes_strings)
+{
+    CHECK(_jsonl("+CSQ: 20,99") == "{\"device\":\"/dev/ttyUSB2\",\"command\":\"+CSQ\",\"line\":\"+CSQ: 20,99\"}\n");
+    CHECK(_jsonl("+COPS: 0,0,\"Tele\\2\"") == "{\"device\":\"/dev/ttyUSB2\",\"command\":\"+CSQ\",\"line\":\"+COPS: 0,0,\\\"Tele\\\\2\\\"\"}\n");
+    CHECK(_jsonl(std::string("a\tb\r\nc\x1b[0m\x01", 11)) == "{\"device\":\"/dev/ttyUSB2\",\"command\":\"+CSQ\",\"line\":\"a\\tb\\r\\nc\\u001b[0m\\u0001\"}\n");
+    CHECK(_jsonl(std::string("nul\0!", 5)) == "{\"device\":\"/dev/ttyUSB2\",\"command\":\"+CSQ\",\"line\":\"nul\\u0000!\"}\n");
+}
+
+// Well-formed UTF-8 is kept; other bytes are written as \u00XX.
+TEST(output_jsonl_replaces_invalid_utf8)
+{
+    const std::string prefix = "{\"device\":\"/dev/ttyUSB2\",\"command\":\"+CSQ\",\"line\":\"";
+
+    CHECK(_jsonl("Stra\xC3\x9F" "e \xE2\x82\xAC \xF0\x9F\x93\xB6") == prefix + "Stra\xC3\x9F" "e \xE2\x82\xAC \xF0\x9F\x93\xB6\"}\n");
+    CHECK(_jsonl("\xA5\xA5OK") == prefix + "\\u00a5\\u00a5OK\"}\n");
+    CHECK(_jsonl("cut \xE2\x82") == prefix + "cut \\u00e2\\u0082\"}\n");
+    CHECK(_jsonl("overlong \xC0\xAF") == prefix + "overlong \\u00c0\\u00af\"}\n");
+    CHECK(_jsonl("surrogate \xED\xA0\x80") == prefix + "surrogate \\u00ed\\u00a0\\u0080\"}\n");
+    CHECK(_jsonl("too big \xF4\x90\x80\x80") == prefix + "too big \\u00f4\\u0090\\u0080\\u0080\"}\n");
+}
+
+// Fields with commas, quotes or line breaks are quoted, quotes doubled.
+TEST(output_csv_quotes_fields)
+{
+    CHECK(_csv("OK") == "device,command,line\n/dev/ttyUSB2,+CSQ,OK\n");
+    CHECK(_csv("+CSQ: 20,99") == "device,command,line\n/dev/ttyUSB2,+CSQ,\"+CSQ: 20,99\"\n");
+    CHECK(_csv("+COPS: 0,0,\"Tele\\2\"") == "device,command,line\n/dev/ttyUSB2,+CSQ,\"+COPS: 0,0,\"\"Tele\\2\"\"\"\n");
+    CHECK(_csv("two\r\nlines") == "device,command,line\n/dev/ttyUSB2,+CSQ,\"two\r\nlines\"\n");
+    CHECK(_csv("tab\there") == "device,command,line\n/dev/ttyUSB2,+CSQ,tab\there\n");
+}
+
+// CSV has no escapes: bytes that are not UTF-8 become U+FFFD.
+TEST(output_csv_replaces_invalid_utf8)
+{
+    CHECK(_csv("\xE2\x82\xAC 5") == "device,command,line\n/dev/ttyUSB2,+CSQ,\xE2\x82\xAC 5\n");
+    CHECK(_csv("\xA5OK") == "device,command,line\n/dev/ttyUSB2,+CSQ,\xEF\xBF\xBDOK\n");
+    CHECK(_csv("\xA5,OK") == "device,command,line\n/dev/ttyUSB2,+CSQ,\"\xEF\xBF\xBD,OK\"\n");
+}
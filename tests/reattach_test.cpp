@@ -0,0 +1,129 @@
+#include "test.h"
+#include "test_devices.h"
+
+#ifndef _WIN32
+#include "../atctl/reattach.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+
+
+// Answers every command line with OK.
+struct ok_modem
+{
+    pty_modem   pty {[this] (std::string &input)
+    {
+        std::string line;
+        while (pty_next_line(input, line))
+        {
+            if (!line.empty())
+            {
+                pty.send(line + "\r\r\n\r\nOK\r\n");
+            }
+        }
+    }};
+};
+
+// A directory holding a "modem" link to the pty, standing in for a
+// /dev/serial/by-id entry that disappears while the modem resets.
+struct reattach_fixture
+{
+    std::string                 dir;
+    std::string                 link;
+    std::unique_ptr<ok_modem>   modem;
+
+    reattach_fixture (void)
+    {
+        char name [] = "/tmp/atctl_reattach.XXXXXX";
+        if (mkdtemp(name))
+        {
+            dir = name;
+            link = dir + "/modem";
+        }
+    }
+
+    ~reattach_fixture (void)
+    {
+        unlink(link.c_str());
+        rmdir(dir.c_str());
+    }
+
+    bool attach (void)
+    {
+        modem = std::make_unique<ok_modem>();
+        return 0 == symlink(modem->pty.path(), link.c_str());
+    }
+
+    void reset (void)
+    {
+        unlink(link.c_str());
+        modem.reset();
+    }
+};
+
+
+
+// The modem comes back 300 ms after it went away: the new link wakes the
+// watch well before the next probe would.
+TEST(reattach_follows_modem_reset)
+{
+    static constexpr size_t OUTAGE_MS = 300;
+
+    reattach_fixture fixture;
+    CHECK(fixture.attach());
+
+    serial_device device;
+    CHECK(device.open(fixture.link.c_str()));
+    device_watch watch(fixture.link.c_str());
+    CHECK(!watch.is_gone(device));
+
+    fixture.reset();
+    CHECK(watch.is_gone(device));
+    watch.lose(device);
+    CHECK(watch.is_lost());
+
+    bool attached = false;
+    std::thread boot ([&] (void)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(OUTAGE_MS));
+        attached = fixture.attach();
+    });
+
+    const bool back = reattach(device, watch, -1, 5000);
+    boot.join();
+
+    CHECK(attached && back);
+    CHECK(!watch.is_lost() && device.is_open());
+    CHECK(watch.get_reattach_count() == 1);
+    CHECK(watch.get_last_recovery_ms() >= OUTAGE_MS);
+    CHECK(watch.get_last_recovery_ms() < OUTAGE_MS + REATTACH_PROBE_MS);
+}
+
+TEST(reattach_stops_on_request)
+{
+    reattach_fixture fixture;
+    CHECK(fixture.attach());
+
+    serial_device device;
+    CHECK(device.open(fixture.link.c_str()));
+    device_watch watch(fixture.link.c_str());
+
+    fixture.reset();
+    watch.lose(device);
+
+    int stop [2];
+    CHECK(0 == pipe(stop));
+    CHECK(1 == write(stop[1], "x", 1));
+
+    CHECK(!reattach(device, watch, stop[0], 5000));
+    CHECK(watch.is_lost());
+
+    close(stop[0]);
+    close(stop[1]);
+}
+#endif
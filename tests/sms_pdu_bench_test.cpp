@@ -0,0 +1,333 @@
+#include "test.h"
+
+#ifndef _WIN32
+#include "../atctl/sms_pdu.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+
+// Decoding a synthetic AT+CMGL=4 dump: GSM 7-bit messages, some with
+// extension table characters, UCS2 ones with emoji, 2-4 part
+// concatenations and alphanumeric senders, in the proportions of a busy
+// SIM. Measures sms_decode_pdu() alone, the hex conversion on both paths,
+// and the reader writing jsonl to the null device. Results go to stderr.
+//
+// Decoding must stay above SMS_PDU_MIN_PDUS_PER_S, by default well below
+// what an -O2 build does on this mix (about 2.4 M PDUs/s).
+
+static constexpr size_t SMS_BENCH_MESSAGES = 100000;
+static constexpr size_t SMS_BENCH_REPEATS = 3;
+
+using bench_clock = std::chrono::steady_clock;
+
+// The PDUs, and the listing they came in.
+struct sms_dump
+{
+    std::vector<std::string>    pdus;
+    std::vector<std::string>    lines;
+    size_t                      messages    = 0;
+};
+
+static void _append_hex (const std::vector<uint8_t> &bytes, std::string &dest)
+{
+    static const char HEX [] = "0123456789ABCDEF";
+    for (const uint8_t b : bytes)
+    {
+        dest.push_back(HEX[b >> 4]);
+        dest.push_back(HEX[b & 0xf]);
+    }
+}
+
+// Digits as semi-octets, padded with F.
+static void _append_semi_octets (const std::string &digits, std::vector<uint8_t> &dest)
+{
+    for (size_t i = 0; i < digits.size(); i += 2)
+    {
+        const uint8_t lo = digits[i] - '0';
+        const uint8_t hi = (i + 1 < digits.size()) ? digits[i + 1] - '0' : 0xf;
+        dest.push_back(static_cast<uint8_t>((hi << 4) | lo));
+    }
+}
+
+// Septets packed after a header, with the fill bits that align them.
+// Returns the user data length in septets.
+static size_t _pack_septets (const std::vector<uint8_t> &header, const std::vector<uint8_t> &septets, std::vector<uint8_t> &dest)
+{
+    const size_t skip = header.empty() ? 0 : (header.size() * 8 + 6) / 7;
+    const size_t udl = skip + septets.size();
+    const size_t start = dest.size();
+
+    dest.insert(dest.end(), header.begin(), header.end());
+    dest.resize(start + (udl * 7 + 7) / 8, 0);
+
+    size_t bit = skip * 7;
+    for (const uint8_t s : septets)
+    {
+        dest[start + bit / 8] |= static_cast<uint8_t>(s << (bit % 8));
+        if (bit % 8 > 1)
+        {
+            dest[start + bit / 8 + 1] |= static_cast<uint8_t>(s >> (8 - bit % 8));
+        }
+        bit += 7;
+    }
+
+    return udl;
+}
+
+// Printable ASCII other than @ $ _ ` and the extension table characters
+// has the same code in the GSM default alphabet.
+static void _gsm7_septets (const std::string &text, std::vector<uint8_t> &dest)
+{
+    static constexpr struct { char c; uint8_t code; } EXTENSION [] = {
+        {'^', 0x14}, {'{', 0x28}, {'}', 0x29}, {'\\', 0x2f}, {'[', 0x3c}, {'~', 0x3d}, {']', 0x3e}, {'|', 0x40},
+    };
+
+    for (const char c : text)
+    {
+        const auto ext = std::find_if(std::begin(EXTENSION), std::end(EXTENSION), [c] (const auto &e) { return e.c == c; });
+        if (ext != std::end(EXTENSION))
+        {
+            dest.push_back(0x1b);
+            dest.push_back(ext->code);
+        }
+        else
+        {
+            dest.push_back(static_cast<uint8_t>(c));
+        }
+    }
+}
+
+class sms_dump_generator
+{
+public:
+    sms_dump generate (size_t n_messages)
+    {
+        sms_dump dump;
+
+        while (dump.messages < n_messages)
+        {
+            const unsigned int kind = m_random() % 100;
+            const std::string number = "49" + std::to_string(1500000000 + m_random() % 100000000);
+
+            if (kind < 60 || kind >= 95)
+            {
+                this->add(dump, kind >= 95 ? "ALERTS" : number, this->gsm7_text(3 + m_random() % 17, 160), false, {});
+            }
+            else if (kind < 75)
+            {
+                this->add(dump, number, this->ucs2_text(140), true, {});
+            }
+            else
+            {
+                const uint8_t ref = m_random() % 256;
+                const uint8_t parts = 2 + m_random() % 3;
+                for (uint8_t part = 1; part <= parts; part++)
+                {
+                    this->add(dump, number, this->gsm7_text(25, 153), false, {5, 0, 3, ref, parts, part});
+                }
+            }
+            dump.messages++;
+        }
+
+        return dump;
+    }
+
+private:
+    std::vector<uint8_t> gsm7_text (size_t n_words, size_t max_septets)
+    {
+        static const char *const WORDS [] = {
+            "hello", "meeting", "tomorrow", "at", "the", "office", "please", "call", "back", "when",
+            "you", "can", "thanks", "for", "update", "[ok]", "{x}", "~ok^", "price:", "12,50",
+        };
+
+        std::vector<uint8_t> septets;
+        for (size_t i = 0; i < n_words; i++)
+        {
+            std::vector<uint8_t> word;
+            _gsm7_septets(std::string(i ? " " : "") + WORDS[m_random() % std::size(WORDS)], word);
+            if (septets.size() + word.size() > max_septets)
+            {
+                break;
+            }
+            septets.insert(septets.end(), word.begin(), word.end());
+        }
+        return septets;
+    }
+
+    // Cyrillic, CJK, spaces and emoji as UTF-16 code units.
+    std::vector<uint8_t> ucs2_text (size_t max_octets)
+    {
+        static const std::vector<uint16_t> CHARS [] = {
+            {0x041f}, {0x0440}, {0x0438}, {0x0432}, {0x0435}, {0x0442}, {0x4f60}, {0x597d},
+            {0x0020}, {0x0068}, {0x00e9}, {0xd83d, 0xde00}, {0xd83d, 0xdc4d},
+        };
+
+        std::vector<uint8_t> octets;
+        const size_t n = 5 + m_random() % 55;
+        for (size_t i = 0; i < n; i++)
+        {
+            const std::vector<uint16_t> &c = CHARS[m_random() % std::size(CHARS)];
+            if (octets.size() + 2 * c.size() > max_octets)
+            {
+                break;
+            }
+            for (const uint16_t unit : c)
+            {
+                octets.push_back(static_cast<uint8_t>(unit >> 8));
+                octets.push_back(static_cast<uint8_t>(unit));
+            }
+        }
+        return octets;
+    }
+
+    // An SMS-DELIVER from number (digits, or an alphanumeric name), with
+    // text as septets or UCS2 octets.
+    void add (sms_dump &dump, const std::string &number, const std::vector<uint8_t> &text, bool ucs2, const std::vector<uint8_t> &header)
+    {
+        std::vector<uint8_t> pdu = {0x06, 0x91};
+        _append_semi_octets("4917202000", pdu);
+        const size_t tpdu_start = pdu.size();
+
+        pdu.push_back(header.empty() ? 0x04 : 0x44);
+        if (number[0] >= '0' && number[0] <= '9')
+        {
+            pdu.push_back(static_cast<uint8_t>(number.size()));
+            pdu.push_back(0x91);
+            _append_semi_octets(number, pdu);
+        }
+        else
+        {
+            std::vector<uint8_t> septets;
+            std::vector<uint8_t> packed;
+            _gsm7_septets(number, septets);
+            _pack_septets({}, septets, packed);
+            pdu.push_back(static_cast<uint8_t>(2 * packed.size()));
+            pdu.push_back(0xd0);
+            pdu.insert(pdu.end(), packed.begin(), packed.end());
+        }
+
+        pdu.push_back(0x00);
+        pdu.push_back(ucs2 ? 0x08 : 0x00);
+        pdu.insert(pdu.end(), {0x62, 0x01, 0x81, 0x41, 0x03, 0x50, 0x80});
+
+        if (ucs2)
+        {
+            pdu.push_back(static_cast<uint8_t>(text.size()));
+            pdu.insert(pdu.end(), text.begin(), text.end());
+        }
+        else
+        {
+            const size_t udl_pos = pdu.size();
+            pdu.push_back(0);
+            pdu[udl_pos] = static_cast<uint8_t>(_pack_septets(header, text, pdu));
+        }
+
+        std::string hex;
+        _append_hex(pdu, hex);
+        dump.lines.push_back("+CMGL: " + std::to_string(dump.pdus.size()) + ",1,," + std::to_string(pdu.size() - tpdu_start));
+        dump.lines.push_back(hex);
+        dump.pdus.push_back(std::move(hex));
+    }
+
+    std::mt19937    m_random    {48};
+};
+
+static double _best_seconds (const std::vector<double> &runs)
+{
+    return *std::min_element(runs.begin(), runs.end());
+}
+
+
+
+TEST(bench_sms_pdu_decode)
+{
+    const sms_dump dump = sms_dump_generator().generate(SMS_BENCH_MESSAGES);
+    const size_t n = dump.pdus.size();
+    sms_pdu pdu;
+
+
+
+    std::vector<double> decode;
+    size_t decoded = 0;
+    for (size_t r = 0; r < SMS_BENCH_REPEATS; r++)
+    {
+        decoded = 0;
+        const bench_clock::time_point start = bench_clock::now();
+        for (const std::string &hex : dump.pdus)
+        {
+            decoded += sms_decode_pdu(hex, pdu);
+        }
+        decode.push_back(std::chrono::duration<double>(bench_clock::now() - start).count());
+    }
+    CHECK(decoded == n);
+
+    uint8_t bytes [SMS_PDU_MAX];
+    std::vector<double> hex_paths [2];
+    for (size_t r = 0; r < SMS_BENCH_REPEATS; r++)
+    {
+        for (const bool table : {false, true})
+        {
+            size_t converted = 0;
+            const bench_clock::time_point start = bench_clock::now();
+            for (const std::string &hex : dump.pdus)
+            {
+                converted += table ? sms_hex_decode_table(hex.data(), hex.size() / 2, bytes)
+                                   : sms_hex_decode(hex.data(), hex.size() / 2, bytes);
+            }
+            hex_paths[table].push_back(std::chrono::duration<double>(bench_clock::now() - start).count());
+            CHECK(converted == n);
+        }
+    }
+
+    // The whole listing through the reader, as --decode-sms does.
+    const int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    CHECK(-1 != null_fd);
+
+    std::vector<double> read;
+    uint64_t messages = 0;
+    uint64_t failed = 0;
+    for (size_t r = 0; r < SMS_BENCH_REPEATS; r++)
+    {
+        output_writer output(null_fd);
+        output.set_format(output_format::jsonl);
+        sms_pdu_reader reader(output);
+
+        const bench_clock::time_point start = bench_clock::now();
+        for (const std::string &line : dump.lines)
+        {
+            reader.line("+CMGL", line);
+        }
+        reader.finish();
+        output.flush();
+        read.push_back(std::chrono::duration<double>(bench_clock::now() - start).count());
+
+        messages = reader.get_messages();
+        failed = reader.get_failed();
+    }
+    close(null_fd);
+    CHECK(messages == dump.messages && failed == 0);
+
+
+
+    const char *min = getenv("SMS_PDU_MIN_PDUS_PER_S");
+    const double min_rate = (min && *min) ? strtod(min, nullptr) : 200000;
+    const double rate = n / _best_seconds(decode);
+
+    fprintf(stderr, "    %zu PDUs for %zu messages\n", n, dump.messages);
+    fprintf(stderr, "    decode       %6.0f ns/PDU, %.2f M PDUs/s (min %.2f M)\n", _best_seconds(decode) * 1e9 / n, rate / 1e6, min_rate / 1e6);
+    fprintf(stderr, "    hex          %6.0f ns/PDU, table only %.0f ns/PDU\n",
+            _best_seconds(hex_paths[0]) * 1e9 / n, _best_seconds(hex_paths[1]) * 1e9 / n);
+    fprintf(stderr, "    jsonl        %6.0f ns/PDU, %.2f M PDUs/s\n", _best_seconds(read) * 1e9 / n, n / _best_seconds(read) / 1e6);
+
+    CHECK(rate >= min_rate);
+}
+#endif
@@ -0,0 +1,212 @@
+#include "test.h"
+#include "../atctl/sms_pdu.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+
+// Reference PDUs, encoded independently of the decoder. All come from the
+// SMSC +4917202000 except the SUBMIT, stored on the SIM without one.
+
+// "Price: €5 [ok]": '€', '[' and ']' are in the extension table.
+static const char GSM7_DELIVER [] = "06919471020200040D91947116325476F80000620181410350801150797A5CD68136E51A68C37BAF373E";
+
+// "Hi 😀 Привет": the emoji is a surrogate pair. Zone -05:00.
+static const char UCS2_DELIVER [] = "06919471020200040D91947116325476F800086210203040500A18004800690020D83DDE000020041F04400438043204350442";
+
+// "Paket {x}" from "DHL".
+static const char ALPHANUMERIC_DELIVER [] = "069194710202000406D04424130000620181410350800BD0F0BA4C076D50F84D0A";
+
+// "On my way~" to +4915112345678, relative validity period.
+static const char GSM7_SUBMIT [] = "0011000D91945111325476F80000A70B4F37A89D07DDC3F94D0F";
+
+// "part one, part two, part three", 8-bit reference 0x42.
+static const char *const CONCAT8 [] = {
+    "06919471020200440D91947116325476F800006201814103508011050003420301E061391DF476975920",
+    "06919471020200440D91947116325476F800006201814103508011050003420302E061391D44BFBF5920",
+    "06919471020200440D91947116325476F800006201814103508011050003420303E061391D4447CBCB65",
+};
+
+// "Teil eins – Teil zwei – Teil drei ✓" in UCS2, 16-bit reference 0x1234.
+static const char *const CONCAT16 [] = {
+    "06919471020200440D91947116325476F80008620181410350801F06080412340301005400650069006C002000650069006E0073002020130020",
+    "06919471020200440D91947116325476F80008620181410350801F06080412340302005400650069006C0020007A007700650069002020130020",
+    "06919471020200440D91947116325476F80008620181410350801D06080412340303005400650069006C0020006400720065006900202713",
+};
+
+static const std::string RECORD_START = "{\"index\":\"";
+static const std::string RECORD_FROM = "\",\"status\":\"read\",\"smsc\":\"+4917202000\",\"number\":\"+4917612345678\","
+                                       "\"time\":\"2026-10-18T14:30:05+02:00\",\"parts\":\"3\",\"text\":\"";
+
+// Runs a +CMGL listing of (index, pdu) through an sms_pdu_reader and
+// returns its jsonl output.
+static std::string _read_listing (const std::vector<std::pair<int, const char*>> &listing, bool finish)
+{
+    FILE *out = tmpfile();
+    if (!out)
+    {
+        return "";
+    }
+
+    {
+        output_writer output(fileno(out));
+        output.set_format(output_format::jsonl);
+        sms_pdu_reader reader(output);
+
+        for (const auto &[index, pdu] : listing)
+        {
+            const std::string header = "+CMGL: " + std::to_string(index) + ",1,," + std::to_string(strlen(pdu) / 2);
+            reader.line("+CMGL", header);
+            reader.line("+CMGL", pdu);
+        }
+        if (finish)
+        {
+            reader.finish();
+        }
+    }
+
+    std::string written;
+    char buffer [1024];
+    size_t n;
+    rewind(out);
+    while ((n = fread(buffer, 1, sizeof(buffer), out)) > 0)
+    {
+        written.append(buffer, n);
+    }
+    fclose(out);
+
+    return written;
+}
+
+
+
+TEST(sms_pdu_decodes_gsm7_deliver)
+{
+    sms_pdu pdu;
+    CHECK(sms_decode_pdu(GSM7_DELIVER, pdu));
+    CHECK(!pdu.submit && pdu.alphabet == sms_alphabet::gsm7);
+    CHECK(pdu.smsc == "+4917202000");
+    CHECK(pdu.number == "+4917612345678");
+    CHECK(pdu.time == "2026-10-18T14:30:05+02:00");
+    CHECK(pdu.text == "Price: \xE2\x82\xAC" "5 [ok]");
+    CHECK(pdu.parts == 0);
+}
+
+TEST(sms_pdu_decodes_ucs2_deliver)
+{
+    sms_pdu pdu;
+    CHECK(sms_decode_pdu(UCS2_DELIVER, pdu));
+    CHECK(pdu.alphabet == sms_alphabet::ucs2);
+    CHECK(pdu.time == "2026-01-02T03:04:05-05:00");
+    CHECK(pdu.text == "Hi \xF0\x9F\x98\x80 \xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82");
+}
+
+TEST(sms_pdu_decodes_alphanumeric_sender)
+{
+    sms_pdu pdu;
+    CHECK(sms_decode_pdu(ALPHANUMERIC_DELIVER, pdu));
+    CHECK(pdu.number == "DHL");
+    CHECK(pdu.text == "Paket {x}");
+}
+
+TEST(sms_pdu_decodes_submit)
+{
+    sms_pdu pdu;
+    CHECK(sms_decode_pdu(GSM7_SUBMIT, pdu));
+    CHECK(pdu.submit);
+    CHECK(pdu.smsc.empty() && pdu.time.empty());
+    CHECK(pdu.number == "+4915112345678");
+    CHECK(pdu.text == "On my way~");
+}
+
+// Parts of two messages, interleaved and out of order: each is printed
+// once its last part arrives, with the indices in the order seen.
+TEST(sms_pdu_joins_parts_out_of_order)
+{
+    const std::string written = _read_listing({
+        {3, CONCAT8[2]}, {5, CONCAT16[1]}, {1, CONCAT8[0]},
+        {6, CONCAT16[2]}, {2, CONCAT8[1]}, {4, CONCAT16[0]},
+    }, false);
+
+    CHECK(written == RECORD_START + "3,1,2" + RECORD_FROM + "part one, part two, part three\"}\n"
+                   + RECORD_START + "5,6,4" + RECORD_FROM + "Teil eins \xE2\x80\x93 Teil zwei \xE2\x80\x93 Teil drei \xE2\x9C\x93\"}\n");
+}
+
+TEST(sms_pdu_flushes_incomplete_message)
+{
+    CHECK(_read_listing({{1, CONCAT8[0]}, {3, CONCAT8[2]}}, false).empty());
+    CHECK(_read_listing({{1, CONCAT8[0]}, {3, CONCAT8[2]}}, true) == RECORD_START + "1,3" + RECORD_FROM + "part one, ...part three\"}\n");
+}
+
+// Truncated, odd-length, non-hex and unsupported PDUs fail without reading
+// past their end; the reader passes them on as plain lines.
+TEST(sms_pdu_rejects_malformed_input)
+{
+    const std::string good = GSM7_DELIVER;
+    sms_pdu pdu;
+
+    for (size_t n = 0; n < good.size(); n += 2)
+    {
+        CHECK(!sms_decode_pdu(std::string_view(good).substr(0, n), pdu));
+    }
+    CHECK(!sms_decode_pdu(std::string_view(good).substr(0, good.size() - 1), pdu));
+    CHECK(!sms_decode_pdu(good + "0", pdu));
+
+    for (size_t i = 0; i < good.size(); i++)
+    {
+        for (const char c : {'G', 'g', ' ', '/', ':', '@', '`', '\0', '\xC3'})
+        {
+            std::string bad = good;
+            bad[i] = c;
+            CHECK(!sms_decode_pdu(bad, pdu));
+        }
+    }
+
+    // A status report (TP-MTI 2), and user data longer than the PDU.
+    CHECK(!sms_decode_pdu("00020D91947116325476F80000620181410350801150797A5CD68136E51A68C37BAF373E", pdu));
+    CHECK(!sms_decode_pdu("06919471020200040D91947116325476F80000620181410350809950797A5CD68136E51A68C37BAF373E", pdu));
+    CHECK(!sms_decode_pdu(std::string(2 * (SMS_PDU_MAX + 1), '0'), pdu));
+
+    const std::string written = _read_listing({{1, "0691947102020004ZZ"}}, true);
+    CHECK(written == "{\"device\":\"\",\"command\":\"+CMGL\",\"line\":\"0691947102020004ZZ\"}\n");
+}
+
+// Every length, both cases, and a bad digit at every position: the SSE2
+// path must agree with the table.
+TEST(sms_pdu_hex_paths_agree)
+{
+    static const char DIGITS [] = "0123456789abcdefABCDEF";
+    std::mt19937 random(48);
+
+    for (size_t n_bytes = 0; n_bytes <= 64; n_bytes++)
+    {
+        for (size_t round = 0; round < 20; round++)
+        {
+            std::string hex;
+            for (size_t i = 0; i < 2 * n_bytes; i++)
+            {
+                hex.push_back(DIGITS[random() % (sizeof(DIGITS) - 1)]);
+            }
+
+            uint8_t fast [64];
+            uint8_t table [64];
+            CHECK(sms_hex_decode(hex.data(), n_bytes, fast));
+            CHECK(sms_hex_decode_table(hex.data(), n_bytes, table));
+            CHECK(0 == memcmp(fast, table, n_bytes));
+
+            if (n_bytes)
+            {
+                hex[random() % hex.size()] = static_cast<char>(random() % 256);
+                const bool valid = std::string::npos == hex.find_first_not_of(DIGITS);
+                CHECK(valid == sms_hex_decode(hex.data(), n_bytes, fast));
+                CHECK(valid == sms_hex_decode_table(hex.data(), n_bytes, table));
+                CHECK(!valid || 0 == memcmp(fast, table, n_bytes));
+            }
+        }
+    }
+}
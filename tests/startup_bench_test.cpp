@@ -0,0 +1,164 @@
+#include "test.h"
+
+#ifndef _WIN32
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+
+
+// Cold start of a one-shot "atctl <tty> +CSQ": from spawn to the command's
+// first byte on the tty, and to exit after the reply. The test is the
+// modem, on a pty it answers as soon as the command line is complete.
+//
+// Runs only if ATCTL_BIN names the binary to measure. The medians must
+// stay below ATCTL_FIRST_BYTE_MAX_US and ATCTL_EXIT_MAX_US, by default
+// well above what a static Release build takes (about 1.2 and 1.3 ms).
+
+static constexpr size_t STARTUP_WARMUP = 10;
+static constexpr size_t STARTUP_RUNS = 200;
+static constexpr int STARTUP_TIMEOUT_MS = 2000;
+
+using startup_clock = std::chrono::steady_clock;
+
+static double _env_us (const char *name, double fallback)
+{
+    const char *value = getenv(name);
+    return (value && *value) ? strtod(value, nullptr) : fallback;
+}
+
+static double _median (std::vector<double> &values)
+{
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0 : values[values.size() / 2];
+}
+
+static double _us_since (startup_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(startup_clock::now() - start).count();
+}
+
+// One run: false if atctl did not write a command line in time or failed.
+static bool _spawn_once (const char *binary, int master, const char *tty, double &first_byte_us, double &exit_us)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char *const argv [] = {const_cast<char*>(binary), const_cast<char*>(tty), const_cast<char*>("+CSQ"), nullptr};
+
+    const startup_clock::time_point start = startup_clock::now();
+    pid_t pid;
+    const int spawned = posix_spawn(&pid, binary, &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (0 != spawned)
+    {
+        errno = spawned;
+        perror(binary);
+        return false;
+    }
+
+    std::string received;
+    bool first = true;
+    while (received.find('\r') == std::string::npos)
+    {
+        pollfd pfd = {master, POLLIN, 0};
+        if (poll(&pfd, 1, STARTUP_TIMEOUT_MS) <= 0)
+        {
+            break;
+        }
+
+        char buffer [256];
+        const ssize_t n_read = read(master, buffer, sizeof(buffer));
+        if (n_read <= 0)
+        {
+            break;
+        }
+
+        if (first)
+        {
+            first_byte_us = _us_since(start);
+            first = false;
+        }
+        received.append(buffer, n_read);
+    }
+
+    static const char REPLY [] = "\r\n+CSQ: 20,99\r\n\r\nOK\r\n";
+    const bool answered = !first && sizeof(REPLY) - 1 == write(master, REPLY, sizeof(REPLY) - 1);
+
+    int status;
+    waitpid(pid, &status, 0);
+    exit_us = _us_since(start);
+
+    return answered && WIFEXITED(status) && EXIT_SUCCESS == WEXITSTATUS(status);
+}
+
+
+
+TEST(bench_startup_to_first_byte)
+{
+    const char *binary = getenv("ATCTL_BIN");
+    if (!binary || !*binary)
+    {
+        fprintf(stderr, "    skipped: set ATCTL_BIN to the atctl binary to measure\n");
+        return;
+    }
+
+    const int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    CHECK(-1 != master && 0 == grantpt(master) && 0 == unlockpt(master));
+    const std::string tty = ptsname(master);
+
+    // Held open, and raw, so that the line discipline neither echoes nor
+    // translates between runs.
+    const int slave = open(tty.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    termios tio;
+    CHECK(-1 != slave && 0 == tcgetattr(slave, &tio));
+    cfmakeraw(&tio);
+    CHECK(0 == tcsetattr(slave, TCSANOW, &tio));
+
+    std::vector<double> first_byte;
+    std::vector<double> exit;
+    bool ok = true;
+
+    for (size_t i = 0; i < STARTUP_WARMUP + STARTUP_RUNS && ok; i++)
+    {
+        double first_byte_us = 0;
+        double exit_us = 0;
+        ok = _spawn_once(binary, master, tty.c_str(), first_byte_us, exit_us);
+
+        if (i >= STARTUP_WARMUP)
+        {
+            first_byte.push_back(first_byte_us);
+            exit.push_back(exit_us);
+        }
+    }
+
+    close(slave);
+    close(master);
+    CHECK(ok);
+
+    const double first_byte_max = _env_us("ATCTL_FIRST_BYTE_MAX_US", 5000);
+    const double exit_max = _env_us("ATCTL_EXIT_MAX_US", 6000);
+    const double first_byte_median = _median(first_byte);
+    const double exit_median = _median(exit);
+
+    fprintf(stderr, "    first byte: median %.0f us (max %.0f), exit: median %.0f us (max %.0f)\n",
+            first_byte_median, first_byte_max, exit_median, exit_max);
+
+    CHECK(first_byte_median <= first_byte_max);
+    CHECK(exit_median <= exit_max);
+}
+#endif
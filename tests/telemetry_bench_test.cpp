@@ -0,0 +1,187 @@
+#include "test.h"
+
+#ifndef _WIN32
+#include "../atctl/telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+
+// Recording 10 M lines of synthetic --monitor output: per one second tick
+// +CSQ, +CREG, the Quectel serving cell and three neighbours, each with its
+// OK, with RSRP on a random walk and an occasional handover. Lines are
+// generated a batch at a time outside the timing. Then serving.rsrp is
+// scanned in full and for a range. Results go to stderr.
+//
+// Recording must stay above TELEMETRY_MIN_LINES_PER_S and below
+// TELEMETRY_MAX_BYTES_PER_ROW, by default with room to spare over what an
+// -O2 build does (about 7 M lines/s at 7.4 bytes per row).
+
+static constexpr size_t TELEMETRY_BENCH_LINES = 10000000;
+static constexpr size_t TELEMETRY_BENCH_BATCH = 100000;     // lines; whole ticks
+
+using bench_clock = std::chrono::steady_clock;
+
+class monitor_generator
+{
+public:
+    // Appends the lines of one tick.
+    void tick (std::vector<std::string> &lines_dest, std::vector<double> &times_dest)
+    {
+        char line [200];
+
+        m_time += 1 + (m_random() % 2000) / 1e6;
+        m_rsrp = std::clamp(m_rsrp + static_cast<int>(m_random() % 5) - 2, -140, -44);
+        if (0 == m_random() % 500)
+        {
+            m_cell = 0x1000000 + m_random() % 0x1000000;
+            m_pcid = m_random() % 504;
+            m_earfcn = EARFCNS[m_random() % std::size(EARFCNS)];
+            m_tac = 0x1816 + m_random() % 3;
+        }
+        const int rssi = std::clamp((m_rsrp + 140) / 3, 0, 31);
+
+        snprintf(line, sizeof(line), "+CSQ: %d,99", rssi);
+        this->add(line, lines_dest, times_dest);
+        snprintf(line, sizeof(line), "+CREG: 2,1,\"%X\",\"%X\",7", m_tac, m_cell);
+        this->add(line, lines_dest, times_dest);
+        snprintf(line, sizeof(line), "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",262,01,%X,%d,%d,3,5,5,%X,%d,%d,%d,%d,-,-,%d",
+                 m_cell, m_pcid, m_earfcn, m_tac, m_rsrp, -12 + static_cast<int>(m_random() % 5), m_rsrp + 30,
+                 static_cast<int>(m_random() % 21), 37 + static_cast<int>(m_random() % 7));
+        this->add(line, lines_dest, times_dest);
+
+        for (int k = 0; k < 3; k++)
+        {
+            snprintf(line, sizeof(line), "+QENG: \"neighbourcell %s\",\"LTE\",%d,%d,%d,%d,%d,%d,30,7,62,6,44",
+                     k < 2 ? "intra" : "inter", k < 2 ? m_earfcn : 6300, (m_pcid + 7 * (k + 1)) % 504,
+                     -15 + static_cast<int>(m_random() % 7), m_rsrp - 5 * (k + 1) + static_cast<int>(m_random() % 5) - 2,
+                     m_rsrp + 25, -5 + static_cast<int>(m_random() % 16));
+            lines_dest.emplace_back(line);
+            times_dest.push_back(m_time);
+        }
+        lines_dest.emplace_back("OK");
+        times_dest.push_back(m_time);
+    }
+
+    static constexpr size_t LINES_PER_TICK = 10;
+
+private:
+    void add (const char *line, std::vector<std::string> &lines_dest, std::vector<double> &times_dest)
+    {
+        lines_dest.emplace_back(line);
+        lines_dest.emplace_back("OK");
+        times_dest.push_back(m_time);
+        times_dest.push_back(m_time);
+    }
+
+    static constexpr int EARFCNS [] = {1300, 3050, 6300};
+
+    std::mt19937    m_random    {45};
+    double          m_time      = 1760000000.0;
+    int             m_rsrp      = -95;
+    unsigned int    m_cell      = 0x1a2d001;
+    unsigned int    m_tac       = 0x1816;
+    int             m_pcid      = 369;
+    int             m_earfcn    = 1300;
+};
+
+static double _env (const char *name, double fallback)
+{
+    const char *value = getenv(name);
+    return (value && *value) ? strtod(value, nullptr) : fallback;
+}
+
+
+
+TEST(bench_telemetry_record)
+{
+    char path [] = "/tmp/atctl_telemetry_bench.XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(-1 != fd);
+    close(fd);
+
+    monitor_generator generator;
+    std::vector<std::string> lines;
+    std::vector<double> times;
+    lines.reserve(TELEMETRY_BENCH_BATCH);
+    times.reserve(TELEMETRY_BENCH_BATCH);
+
+    telemetry_writer writer;
+    bool ok = writer.open(path);
+    size_t added = 0;
+    double record = 0;
+
+    for (size_t n = 0; ok && n < TELEMETRY_BENCH_LINES; n += lines.size())
+    {
+        lines.clear();
+        times.clear();
+        while (lines.size() + monitor_generator::LINES_PER_TICK <= TELEMETRY_BENCH_BATCH)
+        {
+            generator.tick(lines, times);
+        }
+
+        const bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            added += writer.add(times[i], lines[i]);
+        }
+        record += std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    const bench_clock::time_point start = bench_clock::now();
+    ok = writer.close() && ok;
+    record += std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    struct stat st;
+    ok = 0 == stat(path, &st) && ok;
+
+
+
+    telemetry_scan_result full, range;
+    const bench_clock::time_point scan_start = bench_clock::now();
+    ok = telemetry_scan_column(path, "serving.rsrp", INT64_MIN, INT64_MAX, false, full) && ok;
+    const double scan = std::chrono::duration<double>(bench_clock::now() - scan_start).count();
+
+    const bench_clock::time_point range_start = bench_clock::now();
+    ok = telemetry_scan_column(path, "serving.rsrp", -100, -90, true, range) && ok;
+    const double scan_range = std::chrono::duration<double>(bench_clock::now() - range_start).count();
+
+    telemetry_scan_result range_decoded;
+    ok = telemetry_scan_column(path, "serving.rsrp", -100, -90, false, range_decoded) && ok;
+
+    unlink(path);
+    CHECK(ok);
+
+    // Six rows per ten lines; every tick has a serving cell row.
+    CHECK(added == TELEMETRY_BENCH_LINES / 10 * 6);
+    CHECK(writer.get_rows() == added);
+    CHECK(full.rows == TELEMETRY_BENCH_LINES / 10 && full.values == full.rows);
+    CHECK(range.within == range_decoded.within);
+
+
+
+    const double min_rate = _env("TELEMETRY_MIN_LINES_PER_S", 1000000);
+    const double max_bytes = _env("TELEMETRY_MAX_BYTES_PER_ROW", 8);
+    const double rate = TELEMETRY_BENCH_LINES / record;
+    const double bytes_per_row = static_cast<double>(st.st_size) / added;
+
+    fprintf(stderr, "    %zu lines, %zu rows, %.1f MB\n", TELEMETRY_BENCH_LINES, added, st.st_size / 1e6);
+    fprintf(stderr, "    record       %6.0f ns/line, %.2f M lines/s (min %.2f M), %.2f bytes/row (max %.2f)\n",
+            record * 1e9 / TELEMETRY_BENCH_LINES, rate / 1e6, min_rate / 1e6, bytes_per_row, max_bytes);
+    fprintf(stderr, "    scan         %6.2f ms for %" PRIu64 " rsrp values, %.0f M values/s\n", scan * 1e3, full.values, full.values / scan / 1e6);
+    fprintf(stderr, "    scan range   %6.2f ms, %" PRIu64 " in -100..-90; %" PRIu64 " of %" PRIu64 " blocks decoded, %" PRIu64 " skipped, %" PRIu64 " whole\n",
+            scan_range * 1e3, range.within, range.decoded, range.blocks, range.skipped, range.whole);
+
+    CHECK(rate >= min_rate);
+    CHECK(bytes_per_row <= max_bytes);
+}
+#endif
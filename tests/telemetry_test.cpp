@@ -0,0 +1,397 @@
+#include "test.h"
+
+#ifndef _WIN32
+#include "../atctl/telemetry.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+
+static constexpr int64_t LIMIT = INT64_C(1) << 62;
+
+// A temporary telemetry file, removed afterwards.
+struct telemetry_file
+{
+    std::string     path;
+
+    telemetry_file (void)
+    {
+        char name [] = "/tmp/atctl_telemetry.XXXXXX";
+        const int fd = mkstemp(name);
+        if (-1 != fd)
+        {
+            ::close(fd);
+            path = name;
+        }
+    }
+
+    ~telemetry_file (void)
+    {
+        unlink(path.c_str());
+    }
+
+    std::vector<uint8_t> read (void) const
+    {
+        std::vector<uint8_t> bytes;
+        FILE *f = fopen(path.c_str(), "rb");
+        if (f)
+        {
+            uint8_t buffer [4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+            {
+                bytes.insert(bytes.end(), buffer, buffer + n);
+            }
+            fclose(f);
+        }
+        return bytes;
+    }
+
+    long size (void) const
+    {
+        return static_cast<long>(this->read().size());
+    }
+};
+
+// The header a writer puts in front of the first block.
+static constexpr size_t HEADER_SIZE = sizeof(TELEMETRY_MAGIC) + 1;
+
+// A block's directory as a writer lays it out, for the csq table (time,
+// rssi, ber) unless the test changes it.
+struct block_spec
+{
+    uint64_t    table       = 0;
+    uint64_t    rows        = 2;
+    uint64_t    columns     = 3;
+    struct column
+    {
+        uint64_t    bytes;
+        uint64_t    nulls;
+        int64_t     min;
+        int64_t     max;
+    };
+    std::vector<column> directory = {{4, 0, 1000, 2000}, {0, 0, 20, 20}, {0, 2, 0, 0}};
+    std::vector<uint8_t> values = {0xd1, 0x0f, 0xd1, 0x0f};    // +1000, +1000
+
+    std::vector<uint8_t> encode (void) const
+    {
+        std::vector<uint8_t> bytes;
+        telemetry_put_varint(bytes, table);
+        telemetry_put_varint(bytes, rows);
+        telemetry_put_varint(bytes, columns);
+        for (const column &c : directory)
+        {
+            telemetry_put_varint(bytes, c.bytes);
+            telemetry_put_varint(bytes, c.nulls);
+            telemetry_put_varint(bytes, telemetry_zigzag(c.min));
+            telemetry_put_varint(bytes, telemetry_zigzag(c.max));
+        }
+        bytes.insert(bytes.end(), values.begin(), values.end());
+        return bytes;
+    }
+};
+
+static bool _read_block (const std::vector<uint8_t> &bytes, telemetry_block &block_dest)
+{
+    const uint8_t *p = bytes.data();
+    return telemetry_read_block(p, bytes.data() + bytes.size(), block_dest) && p == bytes.data() + bytes.size();
+}
+
+static std::string _serving_line (int rsrp)
+{
+    char line [200];
+    if (rsrp)
+    {
+        snprintf(line, sizeof(line), "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",262,01,1A2D001,369,1300,3,5,5,1816,%d,-10,%d,12,-,-,40", rsrp, rsrp + 30);
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",262,01,1A2D001,369,1300,3,5,5,1816,-,-10,-,12,-,-,40");
+    }
+    return line;
+}
+
+
+
+// Every length of varint, the ends of the range a value may take and the
+// largest delta between two of them.
+TEST(telemetry_varint_round_trip)
+{
+    std::vector<uint64_t> unsigned_values = {0, 1, 127, 128, 16383, 16384, UINT32_MAX, UINT64_MAX - 1, UINT64_MAX};
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        unsigned_values.push_back(UINT64_C(1) << shift);
+        unsigned_values.push_back((UINT64_C(1) << shift) - 1);
+    }
+
+    for (const uint64_t value : unsigned_values)
+    {
+        std::vector<uint8_t> bytes;
+        telemetry_put_varint(bytes, value);
+        CHECK(bytes.size() <= 10);
+
+        const uint8_t *p = bytes.data();
+        uint64_t read;
+        CHECK(telemetry_get_varint(p, bytes.data() + bytes.size(), read));
+        CHECK(read == value && p == bytes.data() + bytes.size());
+
+        // Every truncation fails without reading past the end.
+        for (size_t n = 0; n < bytes.size(); n++)
+        {
+            p = bytes.data();
+            CHECK(!telemetry_get_varint(p, bytes.data() + n, read));
+            CHECK(p == bytes.data() + n);
+        }
+    }
+
+    const int64_t signed_values [] = {
+        0, 1, -1, 63, -64, 64, -65, LIMIT - 1, -(LIMIT - 1), LIMIT, -LIMIT, INT64_MAX, INT64_MIN,
+        2 * (LIMIT - 1), -2 * (LIMIT - 1),
+    };
+    for (const int64_t value : signed_values)
+    {
+        CHECK(telemetry_unzigzag(telemetry_zigzag(value)) == value);
+    }
+    CHECK(telemetry_zigzag(0) == 0 && telemetry_zigzag(-1) == 1 && telemetry_zigzag(1) == 2);
+    CHECK(telemetry_zigzag(INT64_MIN) == UINT64_MAX);
+
+    // A delta between two stored values still fits in zigzag + 1.
+    CHECK(telemetry_zigzag(2 * (LIMIT - 1)) + 1 > telemetry_zigzag(2 * (LIMIT - 1)));
+    CHECK(telemetry_zigzag(-2 * (LIMIT - 1)) + 1 > telemetry_zigzag(-2 * (LIMIT - 1)));
+
+    // Over ten bytes.
+    const std::vector<uint8_t> overlong(11, 0x80);
+    const uint8_t *p = overlong.data();
+    uint64_t read;
+    CHECK(!telemetry_get_varint(p, overlong.data() + overlong.size(), read));
+}
+
+// Values at +-(2^62 - 1) are stored and come back; beyond that they are null.
+TEST(telemetry_stores_limit_values)
+{
+    telemetry_file file;
+    {
+        telemetry_writer writer;
+        CHECK(writer.open(file.path.c_str()));
+        CHECK(writer.add(1, "+CSQ: " + std::to_string(LIMIT - 1) + "," + std::to_string(-(LIMIT - 1))));
+        CHECK(writer.add(2, "+CSQ: " + std::to_string(-(LIMIT - 1)) + "," + std::to_string(LIMIT - 1)));
+        CHECK(writer.add(3, "+CSQ: " + std::to_string(LIMIT) + "," + std::to_string(-LIMIT)));
+        CHECK(writer.close());
+    }
+
+    telemetry_scan_result rssi, ber;
+    CHECK(telemetry_scan_column(file.path.c_str(), "csq.rssi", INT64_MIN, INT64_MAX, false, rssi));
+    CHECK(telemetry_scan_column(file.path.c_str(), "csq.ber", INT64_MIN, INT64_MAX, false, ber));
+    CHECK(rssi.rows == 3 && rssi.values == 2 && rssi.min == -(LIMIT - 1) && rssi.max == LIMIT - 1);
+    CHECK(ber.rows == 3 && ber.values == 2 && ber.min == -(LIMIT - 1) && ber.max == LIMIT - 1);
+}
+
+// A column that is all null, or one value throughout, takes no bytes and
+// still reads back in full.
+TEST(telemetry_elides_null_and_constant_columns)
+{
+    static constexpr size_t ROWS = 100;
+
+    telemetry_file file;
+    {
+        telemetry_writer writer;
+        CHECK(writer.open(file.path.c_str()));
+        for (size_t i = 0; i < ROWS; i++)
+        {
+            CHECK(writer.add(1760000000.0 + i, "+CSQ: 20,99"));
+            CHECK(writer.add(1760000000.0 + i, "+CREG: 0,1"));
+        }
+        CHECK(writer.close());
+        CHECK(writer.get_rows() == 2 * ROWS);
+    }
+
+    const std::vector<uint8_t> bytes = file.read();
+    CHECK(bytes.size() > HEADER_SIZE);
+
+    const uint8_t *p = bytes.data() + HEADER_SIZE;
+    const uint8_t *end = bytes.data() + bytes.size();
+    telemetry_block csq, creg;
+    CHECK(telemetry_read_block(p, end, csq));
+    CHECK(telemetry_read_block(p, end, creg));
+    CHECK(p == end);
+
+    CHECK(csq.table == 0 && csq.rows == ROWS && csq.columns.size() == 3);
+    CHECK(csq.columns[0].bytes == 6 + 2 * (ROWS - 1));      // the first time, then steps of 1000 ms
+    CHECK(csq.columns[1].bytes == 0 && csq.columns[1].nulls == 0 && csq.columns[1].min == 20 && csq.columns[1].max == 20);
+    CHECK(csq.columns[2].bytes == 0 && csq.columns[2].nulls == 0 && csq.columns[2].min == 99 && csq.columns[2].max == 99);
+
+    CHECK(creg.table == 1 && creg.rows == ROWS && creg.columns.size() == 6);
+    for (size_t c = 1; c < 3; c++)
+    {
+        CHECK(creg.columns[c].bytes == 0 && creg.columns[c].nulls == 0);
+    }
+    for (size_t c = 3; c < 6; c++)
+    {
+        CHECK(creg.columns[c].bytes == 0 && creg.columns[c].nulls == ROWS);
+    }
+
+    telemetry_scan_result rssi, lac;
+    CHECK(telemetry_scan_column(file.path.c_str(), "csq.rssi", INT64_MIN, INT64_MAX, false, rssi));
+    CHECK(rssi.values == ROWS && rssi.decoded == 1 && rssi.sum == 20.0 * ROWS && rssi.within == ROWS);
+    CHECK(telemetry_scan_column(file.path.c_str(), "creg.lac", INT64_MIN, INT64_MAX, false, lac));
+    CHECK(lac.rows == ROWS && lac.values == 0 && lac.within == 0);
+}
+
+// Directories that do not add up are not blocks.
+TEST(telemetry_read_block_rejects_corrupt_directory)
+{
+    telemetry_block block;
+    const block_spec good;
+    CHECK(_read_block(good.encode(), block));
+    CHECK(block.rows == 2 && block.columns[0].min == 1000 && block.columns[1].min == 20 && block.columns[2].nulls == 2);
+
+    const std::vector<uint8_t> bytes = good.encode();
+    for (size_t n = 0; n < bytes.size(); n++)
+    {
+        const std::vector<uint8_t> torn(bytes.begin(), bytes.begin() + n);
+        CHECK(!_read_block(torn, block));
+    }
+
+    std::vector<block_spec> bad(11, good);
+    bad[0].table = 5;                               // no such table
+    bad[1].rows = 0;
+    bad[2].columns = 2;                             // csq has three
+    bad[3].table = 1;                               // creg has six
+    bad[4].directory[2].nulls = 3;                  // more nulls than rows
+    bad[5].directory[1].min = 19;                   // elided but not constant
+    bad[6].directory[1].nulls = 1;                  // elided, neither null nor constant
+    bad[7].directory[0].bytes = 1;                  // fewer bytes than rows
+    bad[8].directory[0].bytes = 21;                 // more than ten per row
+    bad[9].directory[0].bytes = 5;                  // past the end
+    bad[10].values.clear();
+
+    for (const block_spec &spec : bad)
+    {
+        const std::vector<uint8_t> corrupt = spec.encode();
+        const uint8_t *p = corrupt.data();
+        CHECK(!telemetry_read_block(p, corrupt.data() + corrupt.size(), block));
+    }
+
+    // A directory varint that runs on.
+    std::vector<uint8_t> overlong = {0};
+    overlong.insert(overlong.end(), 11, 0x80);
+    overlong.push_back(0x01);
+    CHECK(!_read_block(overlong, block));
+}
+
+// A writer that died mid-block left part of one behind: the next one cuts
+// it off before appending, so the new rows are not hidden behind it.
+TEST(telemetry_open_truncates_torn_block)
+{
+    telemetry_file file;
+    long intact;
+    {
+        telemetry_writer writer;
+        CHECK(writer.open(file.path.c_str()));
+        for (int i = 0; i < 10; i++)
+        {
+            CHECK(writer.add(1000 + i, "+CSQ: " + std::to_string(10 + i) + ",99"));
+        }
+        CHECK(writer.flush());
+        intact = file.size();
+
+        for (int i = 10; i < 20; i++)
+        {
+            CHECK(writer.add(1000 + i, "+CSQ: " + std::to_string(10 + i) + ",99"));
+        }
+        CHECK(writer.close());
+    }
+    const long full = file.size();
+    CHECK(intact > static_cast<long>(HEADER_SIZE) && full > intact);
+
+    // Torn just after the first block, halfway and one byte short.
+    for (const long size : {intact + 1, (intact + full) / 2, full - 1})
+    {
+        CHECK(0 == truncate(file.path.c_str(), size));
+
+        telemetry_scan_result before;
+        CHECK(telemetry_scan_column(file.path.c_str(), "csq.rssi", INT64_MIN, INT64_MAX, false, before));
+        CHECK(before.rows == 10);
+
+        telemetry_writer writer;
+        CHECK(writer.open(file.path.c_str()));
+        CHECK(file.size() == intact);
+        CHECK(writer.add(2000, "+CSQ: 31,99"));
+        CHECK(writer.close());
+
+        telemetry_scan_result after;
+        CHECK(telemetry_scan_column(file.path.c_str(), "csq.rssi", INT64_MIN, INT64_MAX, false, after));
+        CHECK(after.rows == 11 && after.max == 31 && after.sum == 145 + 31);
+
+        CHECK(0 == truncate(file.path.c_str(), intact));
+    }
+}
+
+// Skipping and taking blocks whole by their min/max gives the counts a
+// full decode does, over several blocks of a random walk with nulls.
+TEST(telemetry_scan_skipping_matches_full_decode)
+{
+    static constexpr size_t ROWS = 5 * TELEMETRY_BLOCK_ROWS + 123;
+
+    telemetry_file file;
+    std::vector<int> rsrp;
+    {
+        std::mt19937 random(45);
+        int value = -95;
+
+        telemetry_writer writer;
+        CHECK(writer.open(file.path.c_str()));
+        for (size_t i = 0; i < ROWS; i++)
+        {
+            value = std::clamp(value + static_cast<int>(random() % 5) - 2, -140, -44);
+            if (i / TELEMETRY_BLOCK_ROWS == 2)
+            {
+                value = std::max(value, -80);           // a block clear of -100..-90
+            }
+            const bool null = 0 == random() % 50;
+            rsrp.push_back(null ? 0 : value);
+            CHECK(writer.add(1760000000.0 + i, _serving_line(rsrp.back())));
+        }
+        CHECK(writer.close());
+    }
+
+    const int64_t RANGES [][2] = {
+        {-140, -44}, {-100, -90}, {-80, -44}, {-200, -150}, {-95, -95}, {INT64_MIN, INT64_MAX}, {-44, 0},
+    };
+
+    uint64_t skipped = 0, whole = 0;
+    for (const auto &range : RANGES)
+    {
+        uint64_t expected = 0;
+        for (const int value : rsrp)
+        {
+            expected += value && value >= range[0] && value <= range[1];
+        }
+
+        telemetry_scan_result full, skipping;
+        CHECK(telemetry_scan_column(file.path.c_str(), "serving.rsrp", range[0], range[1], false, full));
+        CHECK(telemetry_scan_column(file.path.c_str(), "serving.rsrp", range[0], range[1], true, skipping));
+
+        CHECK(full.within == expected && skipping.within == expected);
+        CHECK(full.rows == ROWS && skipping.rows == ROWS);
+        CHECK(full.values == skipping.values && full.min == skipping.min && full.max == skipping.max);
+        CHECK(full.decoded == full.blocks && full.skipped == 0 && full.whole == 0);
+        CHECK(skipping.decoded + skipping.skipped + skipping.whole == skipping.blocks);
+        CHECK(skipping.bytes_decoded <= full.bytes_decoded);
+
+        skipped += skipping.skipped;
+        whole += skipping.whole;
+    }
+    CHECK(skipped > 0 && whole > 0);
+
+    telemetry_scan_result unknown;
+    CHECK(!telemetry_scan_column(file.path.c_str(), "serving.nope", 0, 0, false, unknown));
+}
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdio>
+
+
+
+// Self-registering test cases:
+//
+//   TEST(engine_drops_late_reply)
+//   {
+//       CHECK(lines.size() == 2);
+//   }
+//
+// A failed CHECK reports itself and ends the test. tests.cpp runs every
+// test, or those whose name contains an argument, and exits non-zero if
+// any failed.
+struct test_case
+{
+    const char     *name;
+    void          (*body) (void);
+};
+
+bool test_register (const char *name, void (*body) (void));
+void test_fail (const char *file, int line, const char *expr);
+
+#define TEST(name)                                                              \
+    static void test_##name (void);                                             \
+    [[maybe_unused]] static const bool test_##name##_registered =               \
+        test_register(#name, test_##name);                                      \
+    static void test_##name (void)
+
+#define CHECK(expr)                                                             \
+    do                                                                          \
+    {                                                                           \
+        if (!(expr))                                                            \
+        {                                                                       \
+            test_fail(__FILE__, __LINE__, #expr);                               \
+            return;                                                             \
+        }                                                                       \
+    } while (0)
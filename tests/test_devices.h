@@ -0,0 +1,300 @@
+#pragma once
+
+#include "../serial/serial_device_type.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <termios.h>
+    #include <unistd.h>
+#endif
+
+
+
+// A modem that takes its time, unlike mock_serial_device: each command
+// line written is echoed and answered once the one before it is through,
+// after the delay its responder asks for. wait_for_data() sleeps until
+// something is due or the timeout passes, as on a tty. Characters before
+// "AT" are dropped, as modems do, so an abort character leaves no trace.
+class paced_modem_device
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    struct reply
+    {
+        size_t          delay_ms;
+        std::string     text;       // what follows the echo, e.g. "\r\n+CSQ: 20,99\r\n\r\nOK\r\n"
+    };
+
+    using responder = std::function<reply (std::string_view line)>;
+
+    explicit paced_modem_device (responder r)
+        : m_responder (std::move(r))
+    {}
+
+    constexpr bool is_open (void) const
+    {
+        return true;
+    }
+
+    ssize_t read (void *buffer, size_t size)
+    {
+        this->release();
+
+        const size_t n = std::min(size, m_rx.size());
+        memcpy(buffer, m_rx.data(), n);
+        m_rx.erase(0, n);
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t write (const void *buffer, size_t size)
+    {
+        const char *data = static_cast<const char*>(buffer);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (data[i] != '\r')
+            {
+                m_line.push_back(data[i]);
+                continue;
+            }
+
+            const size_t at = m_line.find("AT");
+            if (at != std::string::npos)
+            {
+                this->answer(m_line.substr(at));
+            }
+            m_line.clear();
+        }
+
+        return static_cast<ssize_t>(size);
+    }
+
+    int wait_for_data (size_t timeout_ms)
+    {
+        this->release();
+        if (!m_rx.empty())
+        {
+            return 1;
+        }
+
+        const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+        if (m_pending.empty() || m_pending.front().due > deadline)
+        {
+            std::this_thread::sleep_until(deadline);
+            return 0;
+        }
+
+        std::this_thread::sleep_until(m_pending.front().due);
+        this->release();
+        return 1;
+    }
+
+    void set_echo (bool echo)
+    {
+        m_echo = echo;
+    }
+
+private:
+    struct pending
+    {
+        clock::time_point   due;
+        std::string         bytes;
+    };
+
+    void answer (const std::string &line)
+    {
+        const clock::time_point start = std::max(clock::now(), m_busy_until);
+        const reply r = m_responder(line);
+
+        if (m_echo)
+        {
+            m_pending.push_back({start, line + "\r\r\n"});
+        }
+        m_busy_until = start + std::chrono::milliseconds(r.delay_ms);
+        m_pending.push_back({m_busy_until, r.text});
+    }
+
+    void release (void)
+    {
+        const clock::time_point now = clock::now();
+        while (!m_pending.empty() && m_pending.front().due <= now)
+        {
+            m_rx.append(m_pending.front().bytes);
+            m_pending.pop_front();
+        }
+    }
+
+    responder               m_responder;
+    std::deque<pending>     m_pending;          // in order of time due
+    std::string             m_rx;
+    std::string             m_line;
+    clock::time_point       m_busy_until;
+    bool                    m_echo          = true;
+};
+
+static_assert(serial_device_type<paced_modem_device>);
+
+
+
+// A responder for mock_serial_device that runs the commands of a line in
+// order and stops at the first that fails, as V.250 modems do. +CPMS
+// fails, +CSQ and +CREG? answer, everything else is OK. Lines written and
+// commands run are recorded.
+struct counting_modem
+{
+    std::map<std::string, size_t, std::less<>>  runs;
+    std::vector<std::string>                    lines;
+
+    std::string answer (std::string_view line)
+    {
+        lines.emplace_back(line);
+        line.remove_prefix(2);
+
+        std::string reply;
+        while (!line.empty())
+        {
+            const std::string_view command = line.substr(0, line.find(';'));
+            line.remove_prefix(std::min(line.size(), command.size() + 1));
+            runs[std::string(command)]++;
+
+            if (command.starts_with("+CPMS"))
+            {
+                return reply + "\r\nERROR\r\n";
+            }
+            if (command == "+CSQ")
+            {
+                reply += "\r\n+CSQ: 20,99\r\n";
+            }
+            else if (command == "+CREG?")
+            {
+                reply += "\r\n+CREG: 0,1\r\n";
+            }
+        }
+
+        return reply + "\r\nOK\r\n";
+    }
+};
+
+
+
+#ifndef _WIN32
+// A modem on a pty, for code that runs on a real serial_device. The
+// handler is called on the modem's own thread with everything received and
+// not yet consumed; it erases what it has handled and answers with send().
+// The slave end is raw and kept open, so it can be opened by path.
+class pty_modem
+{
+public:
+    using handler = std::function<void (std::string &input)>;
+
+    explicit pty_modem (handler h)
+        : m_handler (std::move(h))
+    {
+        m_master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (-1 == m_master || 0 != grantpt(m_master) || 0 != unlockpt(m_master))
+        {
+            return;
+        }
+        m_path = ptsname(m_master);
+
+        m_slave = open(m_path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        termios tio;
+        if (-1 != m_slave && 0 == tcgetattr(m_slave, &tio))
+        {
+            cfmakeraw(&tio);
+            cfsetispeed(&tio, B115200);
+            cfsetospeed(&tio, B115200);
+            tcsetattr(m_slave, TCSANOW, &tio);
+        }
+
+        m_thread = std::thread(&pty_modem::serve, this);
+    }
+
+    ~pty_modem (void)
+    {
+        m_stop = true;
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+        close(m_slave);
+        close(m_master);
+    }
+
+    pty_modem (const pty_modem&) = delete;
+    pty_modem& operator= (const pty_modem&) = delete;
+
+    const char* path (void) const
+    {
+        return m_path.c_str();
+    }
+
+    // The host's settings, e.g. its baud rate, are visible here.
+    int master (void) const
+    {
+        return m_master;
+    }
+
+    void send (std::string_view data)
+    {
+        if (static_cast<ssize_t>(data.size()) != write(m_master, data.data(), data.size()))
+        {
+            perror("pty_modem");
+        }
+    }
+
+private:
+    void serve (void)
+    {
+        while (!m_stop)
+        {
+            pollfd pfd = {m_master, POLLIN, 0};
+            char buffer [4096];
+            ssize_t n_read;
+
+            if (poll(&pfd, 1, 20) > 0 && (n_read = read(m_master, buffer, sizeof(buffer))) > 0)
+            {
+                m_input.append(buffer, n_read);
+                m_handler(m_input);
+            }
+        }
+    }
+
+    handler                 m_handler;
+    int                     m_master    = -1;
+    int                     m_slave     = -1;
+    std::string             m_path;
+    std::string             m_input;
+    std::atomic<bool>       m_stop      {false};
+    std::thread             m_thread;
+};
+
+// Takes the next command line (up to "\r", from "AT" on, "" if there is
+// none) off input. false: no complete line yet.
+static inline bool pty_next_line (std::string &input, std::string &line_dest)
+{
+    const size_t cr = input.find('\r');
+    if (cr == std::string::npos)
+    {
+        return false;
+    }
+
+    const size_t at = input.find("AT");
+    line_dest.assign(at < cr ? input.substr(at, cr - at) : std::string());
+    input.erase(0, cr + 1);
+    return true;
+}
+#endif
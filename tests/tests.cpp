@@ -0,0 +1,69 @@
+#include "test.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+
+
+static std::vector<test_case>& _tests (void)
+{
+    static std::vector<test_case> tests;
+    return tests;
+}
+
+static bool s_failed = false;
+
+bool test_register (const char *name, void (*body) (void))
+{
+    _tests().push_back({name, body});
+    return true;
+}
+
+void test_fail (const char *file, int line, const char *expr)
+{
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expr);
+    s_failed = true;
+}
+
+static bool _selected (const char *name, int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strstr(name, argv[i]))
+        {
+            return true;
+        }
+    }
+
+    return argc < 2;
+}
+
+
+
+int main (int argc, char *argv[])
+{
+    size_t run = 0;
+    size_t failed = 0;
+
+    for (const test_case &test : _tests())
+    {
+        if (!_selected(test.name, argc, argv))
+        {
+            continue;
+        }
+
+        s_failed = false;
+        test.body();
+        run++;
+
+        if (s_failed)
+        {
+            failed++;
+        }
+        fprintf(stderr, "%-40s %s\n", test.name, s_failed ? "FAILED" : "ok");
+    }
+
+    fprintf(stderr, "\n%zu tests, %zu failed\n", run, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}